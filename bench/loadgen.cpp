@@ -0,0 +1,221 @@
+// Load generator for --listen mode: each connection runs on its own thread
+// and keeps --depth requests in flight (pipelining), replacing every '?'
+// in --query with a random key. Prints throughput and latency percentiles.
+// Without --connect it serves an in-process Server on a temporary Unix
+// socket, so the numbers need nothing else running.
+#include "protocol.hpp"
+#include "server.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace db;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+  std::string address;
+  size_t connections{4};
+  size_t depth{16};
+  size_t rows{100000};
+  size_t workers{std::max(1u, std::thread::hardware_concurrency())};
+  double seconds{2.0};
+  std::string query{"SELECT v FROM loadgen WHERE id = ?"};
+  bool binary{false};
+};
+
+struct ThreadResult {
+  std::vector<uint32_t> micros;
+  uint64_t errors{0};
+};
+
+// Creates and fills table loadgen unless it already exists.
+void setup(const Options &opts) {
+  Client c(opts.address);
+  if (c.query("CREATE TABLE loadgen (id int, v str)").status ==
+      ResponseStatus::ERROR)
+    return;
+  constexpr size_t kPerInsert = 1000;
+  size_t statements = 0;
+  for (size_t base = 0; base < opts.rows; base += kPerInsert) {
+    std::string sql = "INSERT INTO loadgen (id, v) VALUES ";
+    for (size_t i = base; i < std::min(opts.rows, base + kPerInsert); ++i) {
+      if (i != base)
+        sql += ", ";
+      sql += "(" + std::to_string(i) + ", \"value" + std::to_string(i) +
+             "\")";
+    }
+    c.send(sql);
+    ++statements;
+  }
+  c.send("CREATE INDEX loadgen_id ON loadgen (id)");
+  ++statements;
+  for (size_t i = 0; i < statements; ++i) {
+    Response r = c.receive();
+    if (r.status == ResponseStatus::ERROR)
+      throw DBError("Setup failed: " + r.body);
+  }
+}
+
+std::string instantiate(const std::string &tmpl, uint64_t &state,
+                        size_t rows) {
+  std::string sql;
+  for (char ch : tmpl) {
+    if (ch != '?') {
+      sql += ch;
+      continue;
+    }
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    sql += std::to_string((state >> 33) % rows);
+  }
+  return sql;
+}
+
+void drive(const Options &opts, size_t index, const std::atomic<bool> &stop,
+           ThreadResult &out) {
+  Client c(opts.address);
+  ResultFormat fmt = opts.binary ? ResultFormat::BINARY : ResultFormat::CSV;
+  uint64_t state = index * 7919 + 1;
+  // send times of the requests in flight, oldest first
+  std::deque<Clock::time_point> sent;
+  for (size_t i = 0; i < opts.depth; ++i) {
+    c.send(instantiate(opts.query, state, opts.rows), fmt);
+    sent.push_back(Clock::now());
+  }
+  while (!sent.empty()) {
+    Response r = c.receive();
+    auto now = Clock::now();
+    out.micros.push_back(static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(now -
+                                                              sent.front())
+            .count()));
+    sent.pop_front();
+    if (r.status == ResponseStatus::ERROR)
+      ++out.errors;
+    if (!stop.load(std::memory_order_relaxed)) {
+      c.send(instantiate(opts.query, state, opts.rows), fmt);
+      sent.push_back(Clock::now());
+    }
+  }
+}
+
+uint32_t percentile(const std::vector<uint32_t> &sorted, double p) {
+  if (sorted.empty())
+    return 0;
+  size_t at = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+  return sorted[at];
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    try {
+      if (arg == "--connect" && i + 1 < argc)
+        opts.address = argv[++i];
+      else if (arg == "--connections" && i + 1 < argc)
+        opts.connections = std::stoul(argv[++i]);
+      else if (arg == "--depth" && i + 1 < argc)
+        opts.depth = std::stoul(argv[++i]);
+      else if (arg == "--rows" && i + 1 < argc)
+        opts.rows = std::stoul(argv[++i]);
+      else if (arg == "--workers" && i + 1 < argc)
+        opts.workers = std::stoul(argv[++i]);
+      else if (arg == "--seconds" && i + 1 < argc)
+        opts.seconds = std::stod(argv[++i]);
+      else if (arg == "--query" && i + 1 < argc)
+        opts.query = argv[++i];
+      else if (arg == "--binary")
+        opts.binary = true;
+      else {
+        std::cerr << "Unknown argument: " << arg << "\n";
+        return 2;
+      }
+    } catch (const std::exception &) {
+      std::cerr << "Invalid value for " << arg << ": " << argv[i] << "\n";
+      return 2;
+    }
+  }
+  if (opts.connections == 0 || opts.depth == 0 || opts.rows == 0) {
+    std::cerr << "--connections, --depth and --rows must be positive\n";
+    return 2;
+  }
+
+  // the in-process server, when there is no --connect
+  Database db;
+  std::unique_ptr<Server> server;
+  std::thread loop;
+  try {
+    if (opts.address.empty()) {
+      opts.address = std::string(P_tmpdir) + "/inmemdb_loadgen_" +
+                     std::to_string(::getpid()) + ".sock";
+      ServerOptions so;
+      so.workers = opts.workers;
+      server = std::make_unique<Server>(db, opts.address, so);
+      loop = std::thread([&] { server->run(); });
+    }
+    setup(opts);
+  } catch (const DBError &e) {
+    std::cerr << e.what() << "\n";
+    if (server) {
+      server->stop();
+      loop.join();
+    }
+    return 1;
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> failed{0};
+  std::vector<ThreadResult> results(opts.connections);
+  std::vector<std::thread> threads;
+  auto t0 = Clock::now();
+  for (size_t i = 0; i < opts.connections; ++i) {
+    threads.emplace_back([&, i] {
+      try {
+        drive(opts, i, stop, results[i]);
+      } catch (const DBError &e) {
+        std::cerr << e.what() << "\n";
+        ++failed;
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::duration<double>(opts.seconds));
+  stop.store(true);
+  for (auto &t : threads)
+    t.join();
+  double secs =
+      std::chrono::duration<double>(Clock::now() - t0).count();
+  if (server) {
+    server->stop();
+    loop.join();
+  }
+
+  std::vector<uint32_t> all;
+  uint64_t errors = 0;
+  for (auto &r : results) {
+    all.insert(all.end(), r.micros.begin(), r.micros.end());
+    errors += r.errors;
+  }
+  std::sort(all.begin(), all.end());
+  std::printf("%zu connections x depth %zu, %s results, %.1f s\n",
+              opts.connections, opts.depth, opts.binary ? "binary" : "CSV",
+              secs);
+  std::printf("%12s %10s %10s %10s %8s\n", "requests/s", "p50 us", "p99 us",
+              "p999 us", "errors");
+  std::printf("%12.0f %10u %10u %10u %8llu\n",
+              static_cast<double>(all.size()) / secs, percentile(all, 0.5),
+              percentile(all, 0.99), percentile(all, 0.999),
+              static_cast<unsigned long long>(errors));
+  return failed.load() == 0 ? 0 : 1;
+}
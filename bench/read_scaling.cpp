@@ -0,0 +1,156 @@
+// Read-throughput stress test: N reader threads run SELECTs against one
+// table for a fixed time, for N = 1, 2, 4, ... up to --max-threads, while
+// an optional writer keeps inserting into the same table. Prints queries
+// per second and the speedup over one reader for each step.
+#include "database.hpp"
+#include "parallel.hpp"
+#include "prepared.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace db;
+
+namespace {
+
+struct Options {
+  size_t rows{1 << 20};
+  size_t max_threads{std::max(1u, std::thread::hardware_concurrency())};
+  double seconds{1.0};
+  bool writer{false};
+  // "point": indexed equality lookups; "scan": full-column filter
+  std::string query{"point"};
+};
+
+struct StepResult {
+  double qps{0};
+  uint64_t writes{0};
+};
+
+void load(Database &db, size_t rows) {
+  db.create_table("t", {{"id", Type::INT}, {"name", Type::STR}});
+  Table &t = db.table("t");
+  IntColumn ids;
+  StrColumn names;
+  for (size_t i = 0; i < rows; ++i) {
+    ids.push_back(static_cast<int64_t>(i));
+    names.push_back("name" + std::to_string(i));
+  }
+  std::vector<ColumnData> block;
+  block.emplace_back(std::move(ids));
+  block.emplace_back(std::move(names));
+  t.append(block);
+  db.create_index("by_id", "t", "id", IndexKind::HASH);
+}
+
+StepResult run_step(Database &db, const Options &opts, size_t readers) {
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> queries{0};
+  std::atomic<uint64_t> writes{0};
+  std::vector<std::thread> threads;
+  // every thread runs the one cached plan
+  auto select = db.prepare(opts.query == "point"
+                               ? "SELECT name FROM t WHERE id = ?"
+                               : "SELECT id FROM t WHERE id < ?");
+  auto insert = db.prepare("INSERT INTO t (id, name) VALUES (?, \"written\")");
+  for (size_t r = 0; r < readers; ++r) {
+    threads.emplace_back([&, r] {
+      ResultCollector sink;
+      uint64_t n = 0;
+      uint64_t key = r * 7919;
+      while (!stop.load(std::memory_order_relaxed)) {
+        key = (key * 6364136223846793005ULL + 1442695040888963407ULL);
+        long long v = opts.query == "point"
+                          ? static_cast<long long>((key >> 33) % opts.rows)
+                          : 10;
+        sink.result = QueryResult{};
+        select->execute({Value::make_int(v)}, sink);
+        ++n;
+      }
+      queries.fetch_add(n);
+    });
+  }
+  if (opts.writer) {
+    threads.emplace_back([&] {
+      uint64_t n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        insert->execute({Value::make_int(-1 - static_cast<long long>(n))});
+        ++n;
+      }
+      writes.fetch_add(n);
+    });
+  }
+  auto t0 = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(opts.seconds));
+  stop.store(true);
+  for (auto &th : threads)
+    th.join();
+  double secs = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - t0)
+                    .count();
+  return StepResult{queries.load() / secs, writes.load()};
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    try {
+      if (arg == "--rows" && i + 1 < argc)
+        opts.rows = std::stoul(argv[++i]);
+      else if (arg == "--max-threads" && i + 1 < argc)
+        opts.max_threads = std::stoul(argv[++i]);
+      else if (arg == "--seconds" && i + 1 < argc)
+        opts.seconds = std::stod(argv[++i]);
+      else if (arg == "--query" && i + 1 < argc)
+        opts.query = argv[++i];
+      else if (arg == "--writer")
+        opts.writer = true;
+      else {
+        std::cerr << "Unknown argument: " << arg << "\n";
+        return 2;
+      }
+    } catch (const std::exception &) {
+      std::cerr << "Invalid value for " << arg << ": " << argv[i] << "\n";
+      return 2;
+    }
+  }
+  if (opts.query != "point" && opts.query != "scan") {
+    std::cerr << "--query must be point or scan\n";
+    return 2;
+  }
+  if (opts.rows == 0 || opts.max_threads == 0) {
+    std::cerr << "--rows and --max-threads must be positive\n";
+    return 2;
+  }
+  // one core per query: throughput should scale with readers, not morsels
+  ParallelOptions par = parallel_options();
+  par.threads = 1;
+  set_parallel_options(par);
+
+  Database db;
+  load(db, opts.rows);
+  std::printf("%zu rows, %s queries%s, %.1f s per step, %u cores\n",
+              opts.rows, opts.query.c_str(),
+              opts.writer ? ", one concurrent writer" : "", opts.seconds,
+              std::thread::hardware_concurrency());
+  std::printf("%8s %14s %8s %10s\n", "readers", "queries/s", "speedup",
+              "writes");
+  double base = 0;
+  for (size_t n = 1; n <= opts.max_threads; n *= 2) {
+    StepResult r = run_step(db, opts, n);
+    if (n == 1)
+      base = r.qps;
+    std::printf("%8zu %14.0f %7.2fx %10llu\n", n, r.qps,
+                base > 0 ? r.qps / base : 0.0,
+                static_cast<unsigned long long>(r.writes));
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "storage.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+namespace db {
+
+enum class AggFunc { COUNT, SUM, MIN, MAX, AVG };
+
+const char *agg_func_name(AggFunc f);
+
+// COUNT, SUM, MIN and MAX of INT values at once; AVG is sum / count. SUM
+// wraps around on overflow like other INT arithmetic would. Partials of
+// disjoint row sets merge.
+struct IntAggregate {
+  int64_t count{0};
+  int64_t sum{0};
+  int64_t min{std::numeric_limits<int64_t>::max()};
+  int64_t max{std::numeric_limits<int64_t>::min()};
+
+  void add(int64_t v) {
+    ++count;
+    sum = static_cast<int64_t>(static_cast<uint64_t>(sum) +
+                               static_cast<uint64_t>(v));
+    min = std::min(min, v);
+    max = std::max(max, v);
+  }
+  void merge(const IntAggregate &o) {
+    count += o.count;
+    sum = static_cast<int64_t>(static_cast<uint64_t>(sum) +
+                               static_cast<uint64_t>(o.sum));
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+  }
+};
+
+// MIN and MAX of STR values, viewing the table's string storage.
+struct StrAggregate {
+  int64_t count{0};
+  std::string_view min;
+  std::string_view max;
+
+  void add(std::string_view s) {
+    if (count++ == 0) {
+      min = max = s;
+      return;
+    }
+    if (s < min)
+      min = s;
+    else if (s > max)
+      max = s;
+  }
+  void merge(const StrAggregate &o) {
+    if (o.count == 0)
+      return;
+    if (count == 0) {
+      *this = o;
+      return;
+    }
+    count += o.count;
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+  }
+};
+
+// Folds values[0, n) into acc.
+void aggregate_ints(const int64_t *values, size_t n, IntAggregate &acc);
+// Folds values[rows[i] - base] for i in [0, n), for rows filtered out of
+// one contiguous run starting at position base.
+void aggregate_ints(const int64_t *values, size_t base, const size_t *rows,
+                    size_t n, IntAggregate &acc);
+
+} // namespace db
@@ -0,0 +1,258 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace db {
+
+// In-memory B+tree of (key, row) entries. Entries are unique because the row
+// position breaks ties between equal keys, which lets erase() find the exact
+// entry of a row. Leaves are chained left to right for range scans.
+template <typename K> class BPlusTree {
+public:
+  using Entry = std::pair<K, size_t>;
+
+  // one end of a key range; a null key means unbounded
+  struct Bound {
+    const K *key;
+    bool inclusive;
+  };
+
+  void insert(K key, size_t row) {
+    Entry e{std::move(key), row};
+    if (!root)
+      root = std::make_unique<Node>(true);
+    auto split = insert_rec(*root, std::move(e));
+    if (split.second) {
+      auto new_root = std::make_unique<Node>(false);
+      new_root->keys.push_back(std::move(split.first));
+      new_root->children.push_back(std::move(root));
+      new_root->children.push_back(std::move(split.second));
+      root = std::move(new_root);
+    }
+    ++count;
+  }
+
+  bool erase(const K &key, size_t row) {
+    if (!root || !erase_rec(*root, Entry{key, row}))
+      return false;
+    if (!root->leaf && root->children.size() == 1)
+      root = std::move(root->children.front());
+    --count;
+    return true;
+  }
+
+  void clear() {
+    root.reset();
+    count = 0;
+  }
+
+  size_t size() const { return count; }
+  // heap held by the nodes and by string keys too long to store inline
+  size_t memory_bytes() const { return root ? node_bytes(*root) : 0; }
+
+  // Calls f(key, row) for every entry within [lo, hi] in key order.
+  template <typename F> void scan(Bound lo, Bound hi, F &&f) const {
+    if (!root)
+      return;
+    const Node *n = root.get();
+    while (!n->leaf) {
+      size_t i = 0;
+      if (lo.key) {
+        // first child that can hold an entry with key >= lo
+        i = std::lower_bound(n->keys.begin(), n->keys.end(), *lo.key,
+                             [](const Entry &e, const K &k) {
+                               return e.first < k;
+                             }) -
+            n->keys.begin();
+      }
+      n = n->children[i].get();
+    }
+    for (; n; n = n->next) {
+      for (const Entry &e : n->entries) {
+        if (lo.key && (e.first < *lo.key ||
+                       (!lo.inclusive && !(*lo.key < e.first))))
+          continue;
+        if (hi.key && (*hi.key < e.first ||
+                       (!hi.inclusive && !(e.first < *hi.key))))
+          return;
+        f(e.first, e.second);
+      }
+    }
+  }
+
+private:
+  static constexpr size_t kMaxEntries = 64;
+  static constexpr size_t kMinEntries = kMaxEntries / 4;
+
+  struct Node {
+    // room for one entry past a full node, so inserts only allocate when
+    // a node splits
+    explicit Node(bool is_leaf) : leaf(is_leaf) {
+      if (leaf) {
+        entries.reserve(kMaxEntries + 1);
+      } else {
+        keys.reserve(kMaxEntries);
+        children.reserve(kMaxEntries + 1);
+      }
+    }
+    bool leaf;
+    // leaf: sorted entries, chained through next
+    std::vector<Entry> entries;
+    Node *next{nullptr};
+    // inner: keys[i] is the smallest entry below children[i + 1]
+    std::vector<Entry> keys;
+    std::vector<std::unique_ptr<Node>> children;
+
+    size_t fill() const { return leaf ? entries.size() : children.size(); }
+  };
+
+  std::unique_ptr<Node> root;
+  size_t count{0};
+
+  static size_t key_bytes(const K &k) {
+    if constexpr (std::is_same_v<K, std::string>) {
+      const char *p = k.data();
+      bool inline_key = p >= reinterpret_cast<const char *>(&k) &&
+                        p < reinterpret_cast<const char *>(&k + 1);
+      return inline_key ? 0 : k.capacity() + 1;
+    } else {
+      return 0;
+    }
+  }
+  static size_t node_bytes(const Node &n) {
+    size_t total = sizeof(Node) +
+                   (n.entries.capacity() + n.keys.capacity()) * sizeof(Entry) +
+                   n.children.capacity() * sizeof(n.children[0]);
+    for (const Entry &e : n.entries)
+      total += key_bytes(e.first);
+    for (const Entry &e : n.keys)
+      total += key_bytes(e.first);
+    for (const auto &c : n.children)
+      total += node_bytes(*c);
+    return total;
+  }
+
+  static size_t child_slot(const Node &n, const Entry &e) {
+    return std::upper_bound(n.keys.begin(), n.keys.end(), e) - n.keys.begin();
+  }
+
+  // Returns the separator and new right sibling when n had to split.
+  static std::pair<Entry, std::unique_ptr<Node>> insert_rec(Node &n,
+                                                            Entry &&e) {
+    if (n.leaf) {
+      auto at = std::lower_bound(n.entries.begin(), n.entries.end(), e);
+      n.entries.insert(at, std::move(e));
+      if (n.entries.size() <= kMaxEntries)
+        return {};
+      auto right = std::make_unique<Node>(true);
+      size_t mid = n.entries.size() / 2;
+      right->entries.assign(std::make_move_iterator(n.entries.begin() + mid),
+                            std::make_move_iterator(n.entries.end()));
+      n.entries.resize(mid);
+      right->next = n.next;
+      n.next = right.get();
+      return {right->entries.front(), std::move(right)};
+    }
+    size_t i = child_slot(n, e);
+    auto split = insert_rec(*n.children[i], std::move(e));
+    if (!split.second)
+      return {};
+    n.keys.insert(n.keys.begin() + i, std::move(split.first));
+    n.children.insert(n.children.begin() + i + 1, std::move(split.second));
+    if (n.children.size() <= kMaxEntries)
+      return {};
+    auto right = std::make_unique<Node>(false);
+    size_t mid = n.keys.size() / 2;
+    Entry sep = std::move(n.keys[mid]);
+    right->keys.assign(std::make_move_iterator(n.keys.begin() + mid + 1),
+                       std::make_move_iterator(n.keys.end()));
+    right->children.assign(
+        std::make_move_iterator(n.children.begin() + mid + 1),
+        std::make_move_iterator(n.children.end()));
+    n.keys.resize(mid);
+    n.children.resize(mid + 1);
+    return {std::move(sep), std::move(right)};
+  }
+
+  static bool erase_rec(Node &n, const Entry &e) {
+    if (n.leaf) {
+      auto it = std::lower_bound(n.entries.begin(), n.entries.end(), e);
+      if (it == n.entries.end() || *it != e)
+        return false;
+      n.entries.erase(it);
+      return true;
+    }
+    size_t i = child_slot(n, e);
+    if (!erase_rec(*n.children[i], e))
+      return false;
+    if (n.children[i]->fill() < kMinEntries)
+      rebalance(n, i);
+    return true;
+  }
+
+  // Refill the underfull child i of n from a sibling, or merge it into one.
+  static void rebalance(Node &n, size_t i) {
+    if (n.children.size() < 2)
+      return;
+    size_t l = i > 0 ? i - 1 : i;
+    Node &left = *n.children[l];
+    Node &right = *n.children[l + 1];
+    if (left.fill() + right.fill() <= kMaxEntries) {
+      merge(n, l);
+      return;
+    }
+    if (left.leaf) {
+      if (left.entries.size() < right.entries.size()) {
+        left.entries.push_back(std::move(right.entries.front()));
+        right.entries.erase(right.entries.begin());
+      } else {
+        right.entries.insert(right.entries.begin(),
+                             std::move(left.entries.back()));
+        left.entries.pop_back();
+      }
+      n.keys[l] = right.entries.front();
+    } else if (left.children.size() < right.children.size()) {
+      left.keys.push_back(std::move(n.keys[l]));
+      left.children.push_back(std::move(right.children.front()));
+      n.keys[l] = std::move(right.keys.front());
+      right.keys.erase(right.keys.begin());
+      right.children.erase(right.children.begin());
+    } else {
+      right.keys.insert(right.keys.begin(), std::move(n.keys[l]));
+      right.children.insert(right.children.begin(),
+                            std::move(left.children.back()));
+      n.keys[l] = std::move(left.keys.back());
+      left.keys.pop_back();
+      left.children.pop_back();
+    }
+  }
+
+  // Fold children[l + 1] of n into children[l].
+  static void merge(Node &n, size_t l) {
+    Node &left = *n.children[l];
+    Node &right = *n.children[l + 1];
+    if (left.leaf) {
+      left.entries.insert(left.entries.end(),
+                          std::make_move_iterator(right.entries.begin()),
+                          std::make_move_iterator(right.entries.end()));
+      left.next = right.next;
+    } else {
+      left.keys.push_back(std::move(n.keys[l]));
+      left.keys.insert(left.keys.end(),
+                       std::make_move_iterator(right.keys.begin()),
+                       std::make_move_iterator(right.keys.end()));
+      left.children.insert(left.children.end(),
+                           std::make_move_iterator(right.children.begin()),
+                           std::make_move_iterator(right.children.end()));
+    }
+    n.keys.erase(n.keys.begin() + l);
+    n.children.erase(n.children.begin() + l + 1);
+  }
+};
+
+} // namespace db
@@ -0,0 +1,64 @@
+#pragma once
+#include "errors.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace db {
+
+// Appends fixed-width integers (host byte order) and length-prefixed strings
+// to a byte string; used by the on-disk formats.
+class ByteWriter {
+public:
+  std::string out;
+
+  void u8(uint8_t v) { out.push_back(static_cast<char>(v)); }
+  void u32(uint32_t v) { raw(&v, 4); }
+  void u64(uint64_t v) { raw(&v, 8); }
+  void i64(int64_t v) { raw(&v, 8); }
+  void str(std::string_view s) {
+    u32(static_cast<uint32_t>(s.size()));
+    out.append(s.data(), s.size());
+  }
+  void raw(const void *p, size_t n) {
+    out.append(static_cast<const char *>(p), n);
+  }
+};
+
+// Reads what ByteWriter wrote, throwing DBError(what) when the input runs
+// out.
+class ByteReader {
+public:
+  ByteReader(std::string_view in, const char *what) : in(in), what(what) {}
+
+  uint8_t u8() { return static_cast<uint8_t>(*take(1)); }
+  uint32_t u32() { return read<uint32_t>(); }
+  uint64_t u64() { return read<uint64_t>(); }
+  int64_t i64() { return read<int64_t>(); }
+  std::string_view str() {
+    uint32_t n = u32();
+    return {take(n), n};
+  }
+  const char *take(size_t n) {
+    if (in.size() - pos < n)
+      throw DBError(what);
+    const char *at = in.data() + pos;
+    pos += n;
+    return at;
+  }
+  bool done() const { return pos == in.size(); }
+
+private:
+  std::string_view in;
+  const char *what;
+  size_t pos{0};
+
+  template <typename T> T read() {
+    T v;
+    std::memcpy(&v, take(sizeof(T)), sizeof(T));
+    return v;
+  }
+};
+
+} // namespace db
@@ -0,0 +1,54 @@
+#pragma once
+#include "database.hpp"
+#include "wal.hpp"
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+
+namespace db {
+
+struct CheckpointReport {
+  std::string path;
+  bool ok{false};
+  std::string error;
+  // last log entry the snapshot contains
+  uint64_t wal_lsn{0};
+  // time the caller was stalled in fork()
+  double fork_seconds{0};
+  // time from fork until the child had written the snapshot
+  double seconds{0};
+  // memory the child ended up not sharing with the parent (Private_Dirty),
+  // i.e. the copy-on-write cost of the checkpoint
+  uint64_t cow_bytes{0};
+};
+
+// Background snapshots: the process forks and the child writes the
+// copy-on-write image of the database while the parent keeps executing.
+// Once a child is reaped successfully, by which time the snapshot and its
+// directory entry are durable, the parent drops the log records the
+// snapshot covers. One checkpoint runs at a time; any thread may start or
+// poll it.
+class Checkpointer {
+public:
+  Checkpointer() = default;
+  ~Checkpointer();
+  Checkpointer(const Checkpointer &) = delete;
+  Checkpointer &operator=(const Checkpointer &) = delete;
+
+  void start(Database &db, const std::string &path);
+  bool running() const;
+  // Reaps a finished child without blocking, or blocks until it finishes
+  // when wait is set. Returns its report once.
+  std::optional<CheckpointReport> poll(bool wait = false);
+
+private:
+  mutable std::mutex mu;
+  pid_t child{-1};
+  int pipe_fd{-1};
+  WriteAheadLog *log{nullptr};
+  WalMark mark;
+  CheckpointReport report;
+};
+
+} // namespace db
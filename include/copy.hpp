@@ -0,0 +1,18 @@
+#pragma once
+#include "database.hpp"
+#include <string>
+
+namespace db {
+
+// Bulk-loads a CSV file, in the format the CSV output mode writes, into t.
+// The header row names the columns, in any order; table columns it leaves
+// out get their default value. Empty lines are skipped, except that with a
+// single STR field each is a row holding "". The file is memory-mapped and
+// cut into chunks on row boundaries that are parsed in parallel straight
+// into column buffers. Nothing is appended unless the whole file parses.
+// Returns the number of rows loaded. chunk_bytes 0 picks a size from the
+// file size and the thread count.
+size_t copy_from_csv(Table &t, const std::string &path,
+                     size_t chunk_bytes = 0);
+
+} // namespace db
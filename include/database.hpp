@@ -1,17 +1,23 @@
 #pragma once
+#include "aggregate.hpp"
 #include "errors.hpp"
+#include "index.hpp"
 #include "output.hpp"
+#include "storage.hpp"
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <variant>
 #include <vector>
 
 namespace db {
 
-enum class Type { INT, STR };
-
 struct Column {
   std::string name;
   Type type;
@@ -64,57 +70,397 @@ struct Value {
   }
 };
 
-struct Row {
-  std::vector<Value> cells;
+// What a WHERE node tests: a comparison with one literal, membership in a
+// list, or the AND, OR or NOT of other nodes.
+enum class CondKind { CMP, IN, AND, OR, NOT };
+
+// A WHERE condition whose columns have been resolved to positions in one
+// table; literals are borrowed from the Condition or plan it came from.
+struct ColumnCondition {
+  size_t column;
+  CmpOp op;
+  const Value *literal;
+  CondKind kind{CondKind::CMP};
+  // operands of AND and OR; NOT has one
+  std::vector<ColumnCondition> children{};
+  // the IN list
+  const std::vector<Value> *values{nullptr};
+};
+
+// An aggregate whose column has been resolved to a position in one table;
+// the column is kStar for COUNT(*).
+struct ColumnAggregate {
+  static constexpr size_t kStar = static_cast<size_t>(-1);
+  AggFunc func;
+  size_t column;
+};
+
+// ORDER BY, LIMIT and OFFSET with the ORDER BY column resolved to a
+// position in one table; kNone marks a clause that is absent.
+struct ColumnOrdering {
+  static constexpr size_t kNone = static_cast<size_t>(-1);
+  size_t column{kNone};
+  bool descending{false};
+  size_t limit{kNone};
+  size_t offset{0};
+};
+
+// A GROUP BY resolved against one table: the key column, the aggregates,
+// and for each result column the aggregate it shows, or kKey for the key.
+struct GroupPlan {
+  static constexpr size_t kKey = static_cast<size_t>(-1);
+  size_t key;
+  std::vector<ColumnAggregate> aggs;
+  std::vector<size_t> layout;
 };
 
+// A WHERE operand of a join that names columns of both sides, checked on
+// each joined pair. Its tests are comparisons and IN lists on one side
+// each (0 for the FROM table, 1 for the joined one).
+struct JoinFilter {
+  CondKind kind{CondKind::CMP};
+  size_t side{0};
+  ColumnCondition test{};
+  std::vector<JoinFilter> children{};
+};
+
+// SELECT ... FROM a JOIN b ON a.x = b.y resolved against both tables, side
+// 0 being a and side 1 b: the key of each side, each result column's side
+// and position, the WHERE conjuncts pushed down to each side, and those
+// left to check on the joined pairs.
+struct JoinPlan {
+  size_t key[2];
+  std::vector<std::pair<size_t, size_t>> columns;
+  std::vector<std::string> headers;
+  std::optional<ColumnCondition> where[2];
+  std::vector<JoinFilter> residual;
+};
+
+class PreparedStatement;
+// Plans by PREPARE name, as seen by one client.
+using PreparedNames =
+    std::unordered_map<std::string, std::shared_ptr<PreparedStatement>>;
+class WriteAheadLog;
+class Checkpointer;
+
+// Writers of a table serialize on its WriteLock, which every mutator takes.
+// Every change is committed as a new read-only view (see snapshot()), which
+// is what SELECTs read, so queries never wait for writers or for each other.
 class Table {
 public:
-  Table() = default;
+  Table() : Table("", {}) {}
   Table(std::string name, std::vector<Column> cols);
 
-  const std::string &get_name() const { return name; }
-  const std::vector<Column> &get_columns() const { return columns; }
+  const std::string &get_name() const { return schema->name; }
+  const std::vector<Column> &get_columns() const { return schema->columns; }
+  const std::vector<std::unique_ptr<Index>> &get_indexes() const;
 
   size_t col_index(const std::string &col) const;
-  const Column &col_at(size_t idx) const { return columns.at(idx); }
+  const Column &col_at(size_t idx) const { return schema->columns.at(idx); }
+
+  // live rows, deleted ones excluded
+  size_t row_count() const { return nrows - deleted.count(); }
+  // Row positions in use, deleted rows included: positions run from 0 to
+  // slot_count() and only change when the table is compacted.
+  size_t slot_count() const { return nrows; }
+  bool is_deleted(size_t row) const { return deleted.test(row); }
+  // positions of the deleted rows, ascending
+  std::vector<size_t> deleted_rows() const { return deleted.positions(); }
+  const ColumnData &column_data(size_t idx) const { return data.at(idx); }
+  Value cell(size_t row, size_t col) const;
+
+  void create_index(const std::string &index_name, const std::string &col,
+                    IndexKind kind);
+  bool has_index(const std::string &index_name) const;
 
   void insert_row(const std::vector<std::optional<Value>> &row_values);
+  // Same, with a null entry for each column that takes its default. The
+  // values are copied straight into the column storage.
+  void insert_row(const std::vector<const Value *> &row_values);
+  // Appends a block of rows given column by column, one entry per table
+  // column in table order, all of the same length.
+  void append(const std::vector<ColumnData> &block);
+  // Replaces all rows with the given columns (one per table column, in
+  // order, nrows each) and rebuilds the indexes.
+  void restore(std::vector<ColumnData> cols, size_t rows);
+  // Marks the matching rows deleted; see vacuum().
   size_t delete_where(const std::optional<struct Condition> &cond);
   size_t update_where(const std::vector<std::pair<std::string, Value>> &sets,
                       const std::optional<struct Condition> &cond);
   QueryResult select_where(const std::vector<std::string> &out_cols, bool star,
                            const std::optional<struct Condition> &cond) const;
+  // Streams the matching rows to sink in bounded batches instead of
+  // materializing them.
+  void scan_where(const std::vector<std::string> &out_cols, bool star,
+                  const std::optional<struct Condition> &cond,
+                  RowSink &sink) const;
 
-private:
-  std::string name;
-  std::vector<Column> columns;
-  std::unordered_map<std::string, size_t> name2idx;
-  std::vector<Row> rows;
+  // Streams the single row of aggregates over the matching rows. Over no
+  // rows, COUNT and SUM give 0 and the others an empty STR cell.
+  void aggregate_where(const std::vector<struct Aggregate> &aggs,
+                       const std::optional<struct Condition> &cond,
+                       RowSink &sink) const;
 
-  bool row_matches(const Row &r,
-                   const std::optional<struct Condition> &cond) const;
+  // Name resolution, done once by prepared plans.
+  ColumnCondition resolve(const struct Condition &cond) const;
+  std::optional<ColumnCondition>
+  resolve(const std::optional<struct Condition> &cond) const;
   std::vector<size_t> build_projection(const std::vector<std::string> &out_cols,
                                        bool star) const;
+  // Also checks that SUM and AVG are given INT columns.
+  std::vector<ColumnAggregate>
+  resolve(const std::vector<struct Aggregate> &aggs) const;
+  ColumnOrdering resolve(const struct Ordering &order) const;
+  // A SELECT list grouped by key; its plain columns may only name key.
+  GroupPlan resolve_group(const std::string &key,
+                          const std::vector<std::string> &out_cols,
+                          const std::vector<struct Aggregate> &aggs) const;
+  // This table JOIN other: names may be qualified as `table.column` and
+  // must otherwise belong to one of the two tables only.
+  JoinPlan resolve_join(const Table &other, const struct Join &join,
+                        const std::vector<std::string> &out_cols, bool star,
+                        const std::optional<struct Condition> &cond) const;
+  // Same as the *_where calls, on already resolved columns.
+  size_t delete_rows(const std::optional<ColumnCondition> &cond);
+  size_t update_rows(const std::vector<std::pair<size_t, const Value *>> &sets,
+                     const std::optional<ColumnCondition> &cond);
+  // Sorted on order.column, if set: by a bounded top-k heap under a
+  // LIMIT, else by a parallel sort. Without ORDER BY, a LIMIT ends the scan
+  // once enough rows have matched.
+  void scan_rows(const std::vector<size_t> &proj,
+                 const std::optional<ColumnCondition> &cond, RowSink &sink,
+                 const ColumnOrdering &order = ColumnOrdering()) const;
+  void aggregate_rows(const std::vector<ColumnAggregate> &aggs,
+                      const std::optional<ColumnCondition> &cond,
+                      RowSink &sink) const;
+  // Streams one row per group of matching rows, in no particular order.
+  void group_rows(const GroupPlan &plan,
+                  const std::optional<ColumnCondition> &cond,
+                  RowSink &sink) const;
+  // Streams the rows of this table joined with other's: each side is
+  // filtered first, the smaller is loaded into a hash table on its key, and
+  // the larger probes it, morsels in parallel, until the sink is done.
+  void join_rows(const Table &other, const JoinPlan &plan,
+                 RowSink &sink) const;
+
+  // DELETE only marks rows, so it costs O(matches). The space is reclaimed
+  // by compaction, which moves the surviving rows together, rebuilds the
+  // indexes and trims the storage. A DELETE compacts once at least one
+  // position in kCompactFraction is deleted, which keeps the copying
+  // proportional to the rows deleted. vacuum() compacts now and returns
+  // the number of rows it removed.
+  static constexpr size_t kCompactFraction = 4;
+  size_t vacuum();
+
+  // Memory held by the rows and indexes. Writer only, like the other
+  // accessors.
+  MemoryUsage memory_usage() const;
+
+  // The table as of its last commit: a read-only Table sharing this one's
+  // storage, which later changes copy rather than overwrite. Any thread may
+  // take and read views; the writer never waits for them. Only the writer
+  // may call the other accessors on the table itself.
+  std::shared_ptr<const Table> snapshot() const;
+  // commit timestamp of the view, from the global commit clock
+  uint64_t version() const { return ts; }
+
+  // Exclusive hold on the table's writer lock. A thread that already
+  // holds it takes it again for free, so mutators can nest.
+  class WriteLock {
+  public:
+    explicit WriteLock(Table &t) {
+      if (t.writer.load(std::memory_order_relaxed) ==
+          std::this_thread::get_id())
+        return;
+      lk = std::unique_lock<std::shared_mutex>(t.write_mu);
+      t.writer.store(std::this_thread::get_id(), std::memory_order_relaxed);
+      owner = &t;
+    }
+    ~WriteLock() {
+      if (owner)
+        owner->writer.store(std::thread::id(), std::memory_order_relaxed);
+    }
+    WriteLock(const WriteLock &) = delete;
+    WriteLock &operator=(const WriteLock &) = delete;
+
+  private:
+    std::unique_lock<std::shared_mutex> lk;
+    Table *owner{nullptr};
+  };
+
+  // Holds the write lock and defers commits while alive: the changes made
+  // meanwhile become visible at once when the outermost Batch ends. Wrap a
+  // statement in one so that logging it stays in order with applying it.
+  class Batch {
+  public:
+    explicit Batch(Table &t) : lk(t), t(t) { ++t.batch_depth; }
+    ~Batch() { t.end_batch(); }
+    Batch(const Batch &) = delete;
+    Batch &operator=(const Batch &) = delete;
+
+  private:
+    WriteLock lk;
+    Table &t;
+  };
+
+private:
+  struct Schema {
+    std::string name;
+    std::vector<Column> columns;
+    std::unordered_map<std::string, size_t> name2idx;
+  };
+  struct IndexSet;
+  class IndexWriteLock;
+  class ViewPool;
+
+  std::shared_ptr<const Schema> schema;
+  // column-major storage, one entry per column
+  std::vector<ColumnData> data;
+  // positions 0..nrows, deleted ones marked in `deleted`
+  size_t nrows{0};
+  RowBitmap deleted;
+  // shared with the views, which only use it while `layout` matches
+  std::shared_ptr<IndexSet> ixs;
+
+  // views: the commit they show and the index layout at that point
+  bool is_view{false};
+  uint64_t ts{0};
+  uint64_t layout{0};
+  // tables: the latest view, replaced atomically on commit, and dropped
+  // views kept for reuse
+  std::shared_ptr<const Table> published;
+  std::shared_ptr<ViewPool> views;
+  int batch_depth{0};
+  bool dirty{false};
+  // held exclusively by writers, shared by Database::WriteBarrier
+  std::shared_mutex write_mu;
+  std::atomic<std::thread::id> writer{};
+
+  friend class Database;
+
+  Table(const Table &live, uint64_t commit_ts);
+  // turns a view into one of live as of commit_ts
+  void show(const Table &live, uint64_t commit_ts);
+  void commit();
+  void end_batch();
+  size_t compact();
+  // rows satisfying cond per an index, if one can answer it or one of its
+  // AND operands
+  bool index_lookup(const std::optional<ColumnCondition> &cond,
+                    std::vector<size_t> &out) const;
+
+  // positions of the rows satisfying cond, in ascending order
+  std::vector<size_t>
+  matching_rows(const std::optional<ColumnCondition> &cond) const;
+  // index able to answer a comparison or IN list, if any
+  const Index *index_for(const ColumnCondition &cond) const;
+  // cond or the operand of it that an index answers, with that index
+  const ColumnCondition *index_probe(const ColumnCondition &cond,
+                                     const Index *&ix) const;
+  void project_rows(const size_t *rows, size_t n,
+                    const std::vector<size_t> &proj, QueryResult &qr) const;
+  std::string aggregate_header(const ColumnAggregate &a) const;
+  Type aggregate_type(const ColumnAggregate &a) const;
+  // positions of the matching rows in the order's order, past its offset
+  // and up to its limit
+  template <typename Key>
+  std::vector<size_t> ordered_rows(const std::optional<ColumnCondition> &cond,
+                                   const ColumnOrdering &order) const;
+  template <typename Key>
+  void join_rows_by(const Table &other, const JoinPlan &plan,
+                    RowSink &sink) const;
+  template <typename Key>
+  void group_rows_by(const GroupPlan &plan,
+                     const std::optional<ColumnCondition> &cond,
+                     RowSink &sink) const;
 };
 
+// Safe for concurrent use. Table lookups read an immutable catalog without
+// locking; CREATE TABLE and CREATE INDEX take the catalog lock and publish
+// a new catalog. Tables are never dropped, so references stay valid.
 class Database {
 public:
+  Database();
+  Database(const Database &) = delete;
+  Database &operator=(const Database &) = delete;
+
+  // Both record the change in the attached log, if any, before other
+  // statements can use it.
   void create_table(const std::string &name, const std::vector<Column> &cols);
+  void create_index(const std::string &name, const std::string &table,
+                    const std::string &column, IndexKind kind);
   Table &table(const std::string &name);
   const Table &table(const std::string &name) const;
+  // every table, in creation order
+  std::vector<const Table *> get_tables() const;
+  // Memory held by each table, in creation order. Takes a WriteBarrier.
+  std::vector<std::pair<std::string, MemoryUsage>> memory_usage();
+
+  // Holds off DDL and the writers of every table while alive, so the
+  // tables (and the log) show no statement half-applied. Views of the
+  // tables can still be read. Must not be taken by a thread that holds a
+  // table's WriteLock.
+  class WriteBarrier {
+  public:
+    explicit WriteBarrier(Database &db);
+    WriteBarrier(const WriteBarrier &) = delete;
+    WriteBarrier &operator=(const WriteBarrier &) = delete;
+
+  private:
+    std::unique_lock<std::mutex> ddl;
+    std::vector<std::shared_lock<std::shared_mutex>> writers;
+  };
+
+  // Plan for sql, parsed on first use and then served from a cache keyed by
+  // the statement text. '?' placeholders take their values per execution.
+  std::shared_ptr<PreparedStatement> prepare(const std::string &sql);
+  // Named plans for PREPARE/EXECUTE when the caller keeps none of its own
+  // (see execute); a new PREPARE replaces an old one.
+  void prepare_as(const std::string &name, const std::string &sql);
+  std::shared_ptr<PreparedStatement> prepared(const std::string &name);
+
+  // Log that mutations are recorded in, if any; not owned. Attach it
+  // before other threads use the database.
+  void attach_wal(WriteAheadLog *log) { wal_log = log; }
+  WriteAheadLog *wal() const { return wal_log; }
+
+  // Background snapshots started by CHECKPOINT.
+  Checkpointer &checkpointer();
 
 private:
-  std::unordered_map<std::string, Table> tables;
+  using Catalog = std::unordered_map<std::string, Table *>;
+
+  // serializes DDL; lookups go through `catalog` instead
+  std::mutex catalog_mu;
+  std::vector<std::unique_ptr<Table>> tables;
+  // Every catalog version lives as long as the database, so a lookup can
+  // never read a map that is being freed.
+  std::vector<std::unique_ptr<const Catalog>> catalogs;
+  std::atomic<const Catalog *> catalog;
+
+  WriteAheadLog *wal_log{nullptr};
+  std::once_flag checkpoints_once;
+  std::shared_ptr<Checkpointer> checkpoints;
+  std::mutex plans_mu;
+  std::unordered_map<std::string, std::shared_ptr<PreparedStatement>> plans;
+  PreparedNames named;
+
+  Table *find(const std::string &name) const;
 };
 
-// WHERE condition: simple binary comparison
+// WHERE condition: `column op literal`, `column IN (values)`, or the AND,
+// OR or NOT of child conditions. BETWEEN is parsed as the AND of two
+// comparisons.
 struct Condition {
-  enum class Op { EQ, NEQ, LT, GT, LE, GE };
+  using Op = CmpOp;
+  using Kind = CondKind;
   std::string column;
-  Op op;
-  Value literal;
-  bool matches(const Table &t, const Row &r) const;
+  Op op{Op::EQ};
+  Value literal{};
+  Kind kind{Kind::CMP};
+  std::vector<Condition> children{};
+  std::vector<Value> values{};
+  bool matches(const Table &t, size_t row) const;
 };
 
 // --- Statements (parsed) ---
@@ -122,6 +468,12 @@ struct StmtCreate {
   std::string name;
   std::vector<Column> columns;
 };
+struct StmtCreateIndex {
+  std::string name;
+  std::string table;
+  std::string column;
+  IndexKind kind{IndexKind::HASH};
+};
 struct StmtInsert {
   std::string table;
   std::vector<std::string> columns;
@@ -136,17 +488,83 @@ struct StmtUpdate {
   std::vector<std::pair<std::string, Value>> sets;
   std::optional<Condition> where;
 };
+// An aggregate in a SELECT list; the column is empty for COUNT(*).
+struct Aggregate {
+  AggFunc func;
+  std::string column;
+  // place in the SELECT list, counting plain columns too
+  size_t position{0};
+};
+// ORDER BY column, which is empty without one, then LIMIT and OFFSET.
+struct Ordering {
+  std::string column;
+  bool descending{false};
+  std::optional<size_t> limit;
+  size_t offset{0};
+};
+// JOIN table ON left = right, where left and right name a column of each
+// table.
+struct Join {
+  std::string table;
+  std::string left;
+  std::string right;
+};
 struct StmtSelect {
   std::string table;
   std::vector<std::string> columns;
   bool star{false};
   std::optional<Condition> where;
+  // set instead of columns for a SELECT list of aggregates; with GROUP BY
+  // the list may also name the grouping column
+  std::vector<Aggregate> aggregates;
+  // empty without GROUP BY
+  std::string group_by;
+  Ordering order;
+  std::optional<Join> join;
+};
+
+struct StmtCopy {
+  std::string table;
+  std::string path;
+};
+struct StmtSave {
+  std::string path;
+};
+struct StmtCheckpoint {
+  std::string path;
+};
+struct StmtVacuum {
+  // empty for every table
+  std::string table;
+};
+struct StmtPrepare {
+  std::string name;
+  std::string sql;
+};
+struct StmtExecute {
+  std::string name;
+  std::vector<Value> params;
 };
 
 using Statement =
-    std::variant<StmtCreate, StmtInsert, StmtDelete, StmtUpdate, StmtSelect>;
+    std::variant<StmtCreate, StmtCreateIndex, StmtInsert, StmtDelete,
+                 StmtUpdate, StmtSelect, StmtCopy, StmtSave, StmtPrepare,
+                 StmtExecute, StmtCheckpoint, StmtVacuum>;
 
 // --- Execution helpers ---
 std::optional<QueryResult> execute(Database &db, const Statement &stmt);
+// Streams a SELECT's rows to sink; returns whether stmt produced a result.
+// PREPARE and EXECUTE use `names` if given, so that clients sharing a
+// database do not see each other's names, and the database's own otherwise.
+bool execute(Database &db, const Statement &stmt, RowSink &sink,
+             PreparedNames *names = nullptr);
+// Records rows appended to t since row `from` in db's write-ahead log, if
+// it has one, and returns the LSN to make durable (0 for none).
+uint64_t log_appended(Database &db, const Table &t, size_t from);
+// Waits until db's write-ahead log holds every record up to lsn durably;
+// call it after releasing the statement's locks, which also publishes its
+// changes to readers before they are durable. Does nothing without a log
+// or for lsn 0.
+void make_durable(Database &db, uint64_t lsn);
 
 } // namespace db
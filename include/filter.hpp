@@ -0,0 +1,29 @@
+#pragma once
+#include "storage.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace db {
+
+// Instruction sets the INT filter kernels are built for, weakest first.
+enum class SimdLevel { SCALAR, SSE42, AVX2 };
+
+// Sets bit i of `bits` (LSB first, 64 rows per word) when `values[i] op lit`
+// holds, for i in [0, n). Bits past n in the last word are cleared.
+using FilterKernel = void (*)(const int64_t *values, size_t n, int64_t lit,
+                              uint64_t *bits);
+
+// best level the running CPU supports (detected once)
+SimdLevel detect_simd_level();
+bool simd_level_supported(SimdLevel level);
+
+FilterKernel filter_kernel(CmpOp op, SimdLevel level);
+inline FilterKernel filter_kernel(CmpOp op) {
+  return filter_kernel(op, detect_simd_level());
+}
+
+// Append base + i for every bit i set in the first n bits of `bits`.
+void append_selection(const uint64_t *bits, size_t n, size_t base,
+                      std::vector<size_t> &out);
+
+} // namespace db
@@ -0,0 +1,138 @@
+#pragma once
+#include "aggregate.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace db {
+
+inline uint64_t group_hash(int64_t k) {
+  // murmur3's finaliser: every key bit reaches the high bits that pick
+  // the partition and the low bits that pick the slot
+  uint64_t h = static_cast<uint64_t>(k);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+inline uint64_t group_hash(std::string_view k) {
+  return group_hash(static_cast<int64_t>(std::hash<std::string_view>{}(k)));
+}
+
+// The groups of a GROUP BY and their running aggregates. Keys live in an
+// open-addressing table with linear probing; each slot holds a group
+// number and 32 bits of its hash, so most probes that miss never touch the
+// keys. STR keys view the table's string storage, so probing one copies
+// nothing. Aggregates are stored per group, `ints` and `strs` of them, in
+// flat arrays. With none, the table just numbers keys, as the build side
+// of a hash join does.
+template <typename Key> class GroupTable {
+public:
+  static constexpr size_t kNone = static_cast<size_t>(-1);
+
+  GroupTable(size_t ints, size_t strs) : nints(ints), nstrs(strs) {}
+
+  size_t size() const { return keys.size(); }
+  const Key &key(size_t g) const { return keys[g]; }
+  int64_t rows(size_t g) const { return counts[g]; }
+  IntAggregate &int_at(size_t g, size_t c) { return int_states[g * nints + c]; }
+  StrAggregate &str_at(size_t g, size_t c) { return str_states[g * nstrs + c]; }
+  const IntAggregate &int_at(size_t g, size_t c) const {
+    return int_states[g * nints + c];
+  }
+  const StrAggregate &str_at(size_t g, size_t c) const {
+    return str_states[g * nstrs + c];
+  }
+
+  // The group of key, added empty if it is new. Counts one row for it.
+  size_t add_row(const Key &k, uint64_t hash) {
+    size_t g = find_or_add(k, hash);
+    ++counts[g];
+    return g;
+  }
+
+  // The group of key, or kNone if it has none.
+  size_t find(const Key &k, uint64_t hash) const {
+    if (slots.empty())
+      return kNone;
+    size_t mask = slots.size() - 1;
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const Slot &s = slots[i];
+      if (s.group == 0)
+        return kNone;
+      if (s.tag == tag && keys[s.group - 1] == k)
+        return s.group - 1;
+    }
+  }
+
+  // Adds o's groups and their aggregates to this table's.
+  void merge(const GroupTable &o) {
+    for (size_t h = 0; h < o.size(); ++h) {
+      size_t g = find_or_add(o.keys[h], o.hashes[h]);
+      counts[g] += o.counts[h];
+      for (size_t c = 0; c < nints; ++c)
+        int_at(g, c).merge(o.int_at(h, c));
+      for (size_t c = 0; c < nstrs; ++c)
+        str_at(g, c).merge(o.str_at(h, c));
+    }
+  }
+
+private:
+  struct Slot {
+    // group number + 1; 0 marks a free slot
+    uint32_t group;
+    uint32_t tag;
+  };
+  size_t nints;
+  size_t nstrs;
+  std::vector<Slot> slots;
+  std::vector<Key> keys;
+  std::vector<uint64_t> hashes;
+  std::vector<int64_t> counts;
+  std::vector<IntAggregate> int_states;
+  std::vector<StrAggregate> str_states;
+
+  size_t find_or_add(const Key &k, uint64_t hash) {
+    // at most half full, so probe runs stay short
+    if (2 * (keys.size() + 1) > slots.size())
+      grow();
+    size_t mask = slots.size() - 1;
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      Slot &s = slots[i];
+      if (s.group == 0) {
+        s = Slot{static_cast<uint32_t>(keys.size() + 1), tag};
+        keys.push_back(k);
+        hashes.push_back(hash);
+        counts.push_back(0);
+        int_states.resize(int_states.size() + nints);
+        str_states.resize(str_states.size() + nstrs);
+        return keys.size() - 1;
+      }
+      if (s.tag == tag && keys[s.group - 1] == k)
+        return s.group - 1;
+    }
+  }
+
+  void grow() {
+    std::vector<Slot> bigger(slots.empty() ? 16 : slots.size() * 2,
+                             Slot{0, 0});
+    size_t mask = bigger.size() - 1;
+    for (size_t g = 0; g < keys.size(); ++g) {
+      size_t i = hashes[g] & mask;
+      while (bigger[i].group != 0)
+        i = (i + 1) & mask;
+      bigger[i] = Slot{static_cast<uint32_t>(g + 1),
+                       static_cast<uint32_t>(hashes[g] >> 32)};
+    }
+    slots.swap(bigger);
+  }
+};
+
+} // namespace db
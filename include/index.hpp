@@ -0,0 +1,98 @@
+#pragma once
+#include "btree.hpp"
+#include "memory.hpp"
+#include "storage.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace db {
+
+struct Value;
+
+enum class IndexKind { HASH, BTREE };
+
+// Secondary index over one column. Entries map a key to row positions; the
+// key is always read from the column storage so callers never build a Value.
+class Index {
+public:
+  Index(std::string name, size_t column)
+      : name(std::move(name)), column(column) {}
+  virtual ~Index() = default;
+
+  const std::string &get_name() const { return name; }
+  size_t get_column() const { return column; }
+
+  virtual IndexKind kind() const = 0;
+  virtual void insert(const ColumnData &col, size_t row) = 0;
+  virtual void erase(const ColumnData &col, size_t row) = 0;
+  virtual void clear() = 0;
+  // whether lookup() can answer `column op key`
+  virtual bool supports(CmpOp op) const = 0;
+  // append the rows satisfying `column op key`; ordered indexes produce them
+  // in key order, hash indexes in no particular order
+  virtual void lookup(CmpOp op, const Value &key,
+                      std::vector<size_t> &out) const = 0;
+  // heap held by the entries
+  virtual size_t memory_bytes() const = 0;
+
+  void rebuild(const ColumnData &col, size_t nrows);
+
+private:
+  std::string name;
+  size_t column;
+};
+
+class HashIndex : public Index {
+public:
+  HashIndex(std::string name, size_t column) : Index(std::move(name), column) {}
+
+  IndexKind kind() const override { return IndexKind::HASH; }
+  void insert(const ColumnData &col, size_t row) override;
+  void erase(const ColumnData &col, size_t row) override;
+  void clear() override;
+  bool supports(CmpOp op) const override { return op == CmpOp::EQ; }
+  void lookup(CmpOp op, const Value &key,
+              std::vector<size_t> &out) const override;
+  size_t memory_bytes() const override { return heap.bytes(); }
+
+private:
+  using Rows = std::pmr::vector<size_t>;
+
+  void add(Rows &rows, size_t row);
+  template <typename Map, typename Key>
+  void remove(Map &m, const Key &key, size_t row);
+
+  // Entries and string keys come from pools the index owns, so an insert
+  // rarely reaches malloc and an erased entry's memory is reused.
+  CountingResource heap;
+  std::pmr::unsynchronized_pool_resource pool{&heap};
+  // each key maps to its rows, and slot[row] is the row's place among them,
+  // so erasing one row of a key many rows share takes constant time
+  std::pmr::unordered_map<int64_t, Rows> ints{&pool};
+  std::pmr::unordered_map<std::pmr::string, Rows> strs{&pool};
+  std::pmr::vector<size_t> slot{&pool};
+};
+
+class BTreeIndex : public Index {
+public:
+  BTreeIndex(std::string name, size_t column)
+      : Index(std::move(name), column) {}
+
+  IndexKind kind() const override { return IndexKind::BTREE; }
+  void insert(const ColumnData &col, size_t row) override;
+  void erase(const ColumnData &col, size_t row) override;
+  void clear() override;
+  bool supports(CmpOp op) const override { return op != CmpOp::NEQ; }
+  void lookup(CmpOp op, const Value &key,
+              std::vector<size_t> &out) const override;
+  size_t memory_bytes() const override {
+    return ints.memory_bytes() + strs.memory_bytes();
+  }
+
+private:
+  BPlusTree<int64_t> ints;
+  BPlusTree<std::string> strs;
+};
+
+} // namespace db
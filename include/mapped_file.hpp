@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+namespace db {
+
+// Read-only memory map of a whole file, unmapped on destruction. An empty
+// file maps to a null data() with size() 0. sequential hints the kernel to
+// read ahead for a single front-to-back pass.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path, bool sequential = false);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return ptr; }
+  size_t size() const { return len; }
+
+private:
+  const char *ptr{nullptr};
+  size_t len{0};
+};
+
+// Fsyncs the directory holding path, so a file just renamed to path stays
+// there across a crash.
+void sync_parent_dir(const std::string &path);
+
+} // namespace db
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+
+namespace db {
+
+// Bytes held by a table, by what they store. Storage shared with views is
+// counted once, in the table; storage still borrowed from a snapshot
+// mapping is file-backed rather than heap, so it is counted apart.
+struct MemoryUsage {
+  // INT values, string offsets and lengths, the deletion bitmap
+  size_t columns{0};
+  // string bytes, including those of overwritten and deleted strings
+  size_t strings{0};
+  size_t indexes{0};
+  size_t mapped{0};
+
+  size_t heap() const { return columns + strings + indexes; }
+  MemoryUsage &operator+=(const MemoryUsage &o) {
+    columns += o.columns;
+    strings += o.strings;
+    indexes += o.indexes;
+    mapped += o.mapped;
+    return *this;
+  }
+};
+
+// Takes memory from the heap and keeps count of what it holds. Not
+// thread-safe, like the pool resources it feeds.
+class CountingResource : public std::pmr::memory_resource {
+public:
+  size_t bytes() const { return held; }
+
+private:
+  size_t held{0};
+
+  void *do_allocate(size_t n, size_t align) override {
+    void *p = std::pmr::new_delete_resource()->allocate(n, align);
+    held += n;
+    return p;
+  }
+  void do_deallocate(void *p, size_t n, size_t align) override {
+    std::pmr::new_delete_resource()->deallocate(p, n, align);
+    held -= n;
+  }
+  bool do_is_equal(const memory_resource &o) const noexcept override {
+    return this == &o;
+  }
+};
+
+} // namespace db
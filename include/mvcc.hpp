@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+
+namespace db {
+
+// Global commit clock: each commit to any table takes the next timestamp,
+// so the versions of all tables are ordered with respect to each other.
+uint64_t next_commit_ts();
+uint64_t last_commit_ts();
+
+// Runs free_fn on a background thread. Table versions whose destruction
+// would release large column storage are freed this way, so neither the
+// reader dropping them nor the writer replacing them pays for it.
+void reclaim_later(std::function<void()> free_fn);
+// Blocks until everything handed to reclaim_later so far has run.
+void reclaim_wait();
+
+} // namespace db
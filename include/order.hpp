@@ -0,0 +1,72 @@
+#pragma once
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace db {
+
+// The k least items under cmp among those pushed, kept in a heap whose top
+// is the worst of them, so an item that cannot make the cut costs a single
+// comparison.
+template <typename T, typename Cmp> class TopK {
+public:
+  TopK(size_t k, Cmp cmp) : k(k), cmp(cmp) {}
+
+  void push(const T &x) {
+    if (heap.size() < k) {
+      heap.push_back(x);
+      std::push_heap(heap.begin(), heap.end(), cmp);
+    } else if (k > 0 && cmp(x, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), cmp);
+      heap.back() = x;
+      std::push_heap(heap.begin(), heap.end(), cmp);
+    }
+  }
+  void merge(const TopK &o) {
+    for (const T &x : o.heap)
+      push(x);
+  }
+  // the items, least first; leaves this empty
+  std::vector<T> take_sorted() {
+    std::sort_heap(heap.begin(), heap.end(), cmp);
+    return std::move(heap);
+  }
+
+private:
+  size_t k;
+  Cmp cmp;
+  std::vector<T> heap;
+};
+
+// std::sort, spread over the shared pool for large inputs: one run per
+// thread is sorted in parallel, then neighbouring runs are merged pairwise,
+// the merges of each round in parallel too.
+template <typename T, typename Cmp>
+void parallel_sort(std::vector<T> &v, Cmp cmp) {
+  const auto &opts = parallel_options();
+  if (!use_parallel_scan(v.size())) {
+    std::sort(v.begin(), v.end(), cmp);
+    return;
+  }
+  size_t runs = opts.threads;
+  std::vector<size_t> bounds(runs + 1);
+  for (size_t r = 0; r <= runs; ++r)
+    bounds[r] = v.size() * r / runs;
+  parallel_tasks(runs, [&](size_t r) {
+    std::sort(v.begin() + bounds[r], v.begin() + bounds[r + 1], cmp);
+  });
+  for (size_t width = 1; width < runs; width *= 2) {
+    size_t pairs = (runs + 2 * width - 1) / (2 * width);
+    parallel_tasks(pairs, [&](size_t p) {
+      size_t lo = p * 2 * width;
+      size_t mid = std::min(lo + width, runs);
+      size_t hi = std::min(lo + 2 * width, runs);
+      if (mid < hi)
+        std::inplace_merge(v.begin() + bounds[lo], v.begin() + bounds[mid],
+                           v.begin() + bounds[hi], cmp);
+    });
+  }
+}
+
+} // namespace db
@@ -1,16 +1,111 @@
 #pragma once
+#include "storage.hpp"
+#include <iosfwd>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace db {
 
+// One column of a typed result: INT cells stay integers and STR cells are
+// views. Formatting happens only when output is written.
+struct ResultColumn {
+  Type type{Type::STR};
+  std::vector<int64_t> ints;
+  std::vector<std::string_view> strs;
+  // blocks the views point into once the column owns its bytes; copies of
+  // the column share them
+  std::vector<std::shared_ptr<const char[]>> arena;
+
+  size_t size() const { return type == Type::INT ? ints.size() : strs.size(); }
+};
+
 struct QueryResult {
   std::vector<std::string> headers;
+  // Engine results fill `columns`, one per header. In batches handed to a
+  // RowSink the string views point into table storage and are only valid
+  // during write(); a ResultCollector copies them into the result's arena.
+  std::vector<ResultColumn> columns;
+  // Results built from text instead; used when `columns` is empty.
   std::vector<std::vector<std::string>> rows;
+
+  bool typed() const { return !columns.empty(); }
+  size_t row_count() const;
+  // Text of one cell; formatting helpers avoid this allocation.
+  std::string cell(size_t row, size_t col) const;
+  // Keeps only rows [from, from + count), or those of them that exist.
+  void slice(size_t from, size_t count);
 };
 
 enum class OutputMode { ASCII, CSV };
 
+// Consumer of a streamed result: begin() once with the headers, then write()
+// for each batch of rows (batch headers are empty), then end(). Once done()
+// is true the sink wants no more rows, and a producer may skip the rest of
+// its work; end() is still called.
+class RowSink {
+public:
+  virtual ~RowSink() = default;
+  virtual void begin(const std::vector<std::string> &headers) = 0;
+  virtual void write(QueryResult &&batch) = 0;
+  virtual void end() {}
+  virtual bool done() const { return false; }
+};
+
+// Materializes the whole result, e.g. for ASCII output which needs every
+// row to size its columns. The result owns its strings, so it stays valid
+// after the tables it was read from change.
+class ResultCollector : public RowSink {
+public:
+  void begin(const std::vector<std::string> &headers) override;
+  void write(QueryResult &&batch) override;
+
+  QueryResult result;
+};
+
+// Passes rows [offset, offset + limit) of a result on to another sink.
+class LimitSink : public RowSink {
+public:
+  LimitSink(RowSink &out, size_t limit, size_t offset)
+      : out(out), left(limit), skip(offset) {}
+  void begin(const std::vector<std::string> &headers) override;
+  void write(QueryResult &&batch) override;
+  void end() override;
+  // once the limit is reached
+  bool done() const override;
+
+private:
+  RowSink &out;
+  size_t left;
+  size_t skip;
+};
+
+// Writes CSV as batches arrive, so memory stays bounded by the batch size.
+class CsvWriter : public RowSink {
+public:
+  explicit CsvWriter(std::ostream &out) : out(out) {}
+  void begin(const std::vector<std::string> &headers) override;
+  void write(QueryResult &&batch) override;
+  void end() override;
+
+private:
+  std::ostream &out;
+};
+
+// Appends CSV to a string as batches arrive, e.g. straight into a
+// response buffer.
+class CsvStringWriter : public RowSink {
+public:
+  explicit CsvStringWriter(std::string &out) : out(out) {}
+  void begin(const std::vector<std::string> &headers) override;
+  void write(QueryResult &&batch) override;
+  void end() override {}
+
+private:
+  std::string &out;
+};
+
 std::string to_csv(const QueryResult &r);
 std::string to_ascii(const QueryResult &r);
 
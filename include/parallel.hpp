@@ -0,0 +1,64 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace db {
+
+// Fixed set of worker threads draining a FIFO of tasks.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t workers);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return threads.size(); }
+  void submit(std::function<void()> task);
+
+private:
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mu;
+  std::condition_variable cv;
+  bool stopping{false};
+
+  void worker_loop();
+};
+
+struct ParallelOptions {
+  // threads working on one scan, counting the caller; 1 disables parallelism
+  size_t threads{1};
+  // tables with fewer rows than this are always scanned serially
+  size_t min_rows{1 << 16};
+  // rows handed to a worker at a time
+  size_t morsel_rows{1 << 14};
+};
+
+const ParallelOptions &parallel_options();
+// Not safe to call while scans are running; meant for start-up.
+void set_parallel_options(const ParallelOptions &opts);
+
+bool use_parallel_scan(size_t rows);
+
+// Splits [0, n) into morsels of parallel_options().morsel_rows rows and calls
+// fn(morsel, begin, end) for each, spreading them over the shared pool; the
+// caller works too. Returns when every morsel is done and rethrows the first
+// exception a morsel raised.
+void parallel_morsels(size_t n,
+                      const std::function<void(size_t, size_t, size_t)> &fn);
+
+// Runs fn(task) for every task in [0, n) on the shared pool, with the same
+// participation and exception rules as parallel_morsels.
+void parallel_tasks(size_t n, const std::function<void(size_t)> &fn);
+
+inline size_t morsel_count(size_t n) {
+  size_t m = parallel_options().morsel_rows;
+  return (n + m - 1) / m;
+}
+
+} // namespace db
@@ -1,6 +1,8 @@
 #pragma once
 #include "database.hpp"
+#include <istream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace db {
@@ -8,7 +10,46 @@ namespace db {
 // split input by semicolons outside of quotes
 std::vector<std::string> split_statements(const std::string &input);
 
+// Splits input that arrives in pieces. Only the statement in progress is
+// buffered; each completed statement is trimmed and appended to out.
+class StatementSplitter {
+public:
+  void feed(std::string_view chunk, std::vector<std::string> &out);
+
+private:
+  std::string cur;
+  bool in_string{false};
+};
+
+// Reads a file descriptor or stream in fixed-size chunks and hands out each
+// statement as soon as its terminating ';' has been read, so memory stays
+// bounded by the chunk plus the longest statement. As with
+// split_statements, a trailing statement without ';' is ignored.
+class StatementReader {
+public:
+  explicit StatementReader(int fd, size_t chunk_size = 1 << 16);
+  explicit StatementReader(std::istream &in, size_t chunk_size = 1 << 16);
+
+  // Stores the next statement in stmt; false once the input is exhausted.
+  bool next(std::string &stmt);
+
+private:
+  int fd{-1};
+  std::istream *in{nullptr};
+  std::vector<char> buf;
+  StatementSplitter splitter;
+  std::vector<std::string> ready;
+  size_t ready_pos{0};
+  bool done{false};
+
+  size_t fill();
+};
+
 // parse a single statement (without trailing semicolon)
-Statement parse_statement(const std::string &stmt);
+Statement parse_statement(std::string_view stmt);
+// Also accepts '?' wherever a literal may appear. The positions of the
+// placeholders among the statement's literals, counted in parse order, are
+// appended to params; each placeholder parses as INT 0.
+Statement parse_statement(std::string_view stmt, std::vector<size_t> &params);
 
 } // namespace db
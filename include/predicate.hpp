@@ -0,0 +1,83 @@
+#pragma once
+#include "database.hpp"
+#include "filter.hpp"
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace db {
+
+// A Condition compiled against one table: columns are resolved once and
+// each comparison is specialised for the column type and operator, so
+// evaluating it per row involves no name lookup, no type dispatch and no
+// allocation. IN lists become hash sets; STR ones view the condition's
+// literals, which must outlive this. Valid until the table's storage is
+// next modified.
+//
+// The operands of AND and OR are reordered by estimated cost and
+// selectivity: AND runs first the operand that rejects the most rows per
+// unit of work, OR the one that accepts the most, and each later operand
+// only sees the rows whose outcome is still open.
+class BoundCondition {
+public:
+  BoundCondition(const Table &t, const ColumnCondition &c);
+  BoundCondition(const Table &t, const Condition &c)
+      : BoundCondition(t, t.resolve(c)) {}
+
+  // the column a comparison or IN list tests
+  size_t column() const { return col; }
+  bool matches(size_t row) const;
+  // append the positions in [begin, end) that satisfy the condition
+  void select(size_t begin, size_t end, std::vector<size_t> &out) const;
+  // keep the rows of rows[from, end) that satisfy the condition; they must
+  // ascend
+  void refine(std::vector<size_t> &rows, size_t from) const;
+  // estimated fraction of rows that pass, and work per row tested
+  double selectivity() const { return sel; }
+  double cost() const { return per_row; }
+
+private:
+  using MatchFn = bool (*)(const BoundCondition &, size_t);
+  using SelectFn = void (*)(const BoundCondition &, size_t, size_t,
+                            std::vector<size_t> &);
+
+  CondKind kind{CondKind::CMP};
+  size_t col{0};
+  const IntColumn *ints{nullptr};
+  const StrColumn *strs{nullptr};
+  int64_t int_lit{0};
+  std::string str_lit;
+  std::unordered_set<int64_t> int_set;
+  std::unordered_set<std::string_view> str_set;
+  MatchFn match_fn{nullptr};
+  SelectFn select_fn{nullptr};
+  FilterKernel int_kernel{nullptr};
+  std::vector<BoundCondition> children;
+  double sel{1};
+  double per_row{0};
+
+  void bind_leaf(const Table &t, const ColumnCondition &c);
+  void bind_in(const Table &t, const ColumnCondition &c);
+  void order_children();
+  template <typename Cmp> void bind();
+  template <typename Cmp>
+  static bool match_int(const BoundCondition &b, size_t row);
+  template <typename Cmp>
+  static bool match_str(const BoundCondition &b, size_t row);
+  static bool match_int_in(const BoundCondition &b, size_t row);
+  static bool match_str_in(const BoundCondition &b, size_t row);
+  static void select_int(const BoundCondition &b, size_t begin, size_t end,
+                         std::vector<size_t> &out);
+  template <typename Cmp>
+  static void select_str(const BoundCondition &b, size_t begin, size_t end,
+                         std::vector<size_t> &out);
+  static void select_int_in(const BoundCondition &b, size_t begin, size_t end,
+                            std::vector<size_t> &out);
+  static void select_str_in(const BoundCondition &b, size_t begin, size_t end,
+                            std::vector<size_t> &out);
+  void select_any(std::vector<size_t> &rows, size_t from,
+                  std::vector<size_t> undecided, size_t first) const;
+};
+
+} // namespace db
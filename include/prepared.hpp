@@ -0,0 +1,68 @@
+#pragma once
+#include "database.hpp"
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace db {
+
+// A statement parsed once, with '?' placeholders standing in for literals.
+// The table, column positions, projection or aggregates, join plan and
+// WHERE column are resolved on the first execution and reused, so running
+// it again skips the tokenizer, the parser and every name lookup. Obtain
+// one through Database::prepare.
+// Executions never modify the plan: each binds its parameters to its own
+// copy of the conditions and assignments, so threads may run one statement
+// at the same time.
+class PreparedStatement {
+public:
+  PreparedStatement(Database &db, std::string_view sql);
+  PreparedStatement(const PreparedStatement &) = delete;
+  PreparedStatement &operator=(const PreparedStatement &) = delete;
+
+  size_t param_count() const { return slots.size(); }
+  // Runs with params bound to the placeholders in order.
+  std::optional<QueryResult> execute(const std::vector<Value> &params = {});
+  // Streams a SELECT's rows to sink; returns whether it produced a result.
+  bool execute(const std::vector<Value> &params, RowSink &sink);
+
+private:
+  // one execution's parameters, and the IN lists rebuilt to hold them
+  struct Args {
+    const std::vector<Value> &params;
+    std::list<std::vector<Value>> lists{};
+  };
+
+  Database &db;
+  Statement stmt;
+  // literals of stmt that are placeholders, in parameter order, and their
+  // positions among all of its literals
+  std::vector<const Value *> slots;
+  std::vector<size_t> ordinals;
+  // everything below is set once by bind() and only read afterwards
+  std::once_flag bound;
+  Table *table{nullptr};
+  // INSERT target columns or SELECT projection
+  std::vector<size_t> cols;
+  std::vector<ColumnAggregate> aggs;
+  std::optional<GroupPlan> group;
+  // the joined table of a SELECT ... JOIN
+  const Table *join_table{nullptr};
+  std::optional<JoinPlan> join;
+  std::vector<std::pair<size_t, const Value *>> sets;
+  std::optional<ColumnCondition> where;
+  ColumnOrdering order;
+  // one full row per INSERT tuple, pointing into stmt
+  std::vector<std::vector<const Value *>> rows;
+
+  void bind();
+  const Value *arg(const Value *literal, const Args &args) const;
+  void bind_args(ColumnCondition &c, Args &args) const;
+  void bind_args(JoinFilter &f, Args &args) const;
+  std::optional<ColumnCondition> bound_where(Args &args) const;
+  Statement with_params(const std::vector<Value> &params) const;
+};
+
+} // namespace db
@@ -0,0 +1,101 @@
+#pragma once
+#include "output.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace db {
+
+// Wire protocol of the --listen server. Every message is a frame: a u32
+// payload length followed by the payload (integers are little-endian).
+//
+// Request payload: u8 ResultFormat, then the text of one SQL statement.
+// Response payload: u8 ResponseStatus, then for
+//   OK     nothing: the statement produced no result;
+//   ROWS   the result, as CSV text or in the binary layout below;
+//   ERROR  the error message.
+// A ROWS response may be split over several frames: each but the last has
+// status MORE and carries the next part of the result, and the bodies
+// concatenate to the whole. An ERROR frame may also end a response after
+// MORE frames, whose parts are then void.
+// Responses come back in request order, so a client may send any number
+// of requests before reading the first response (pipelining).
+//
+// Binary results: u32 column count and each column's name (u32 length +
+// bytes); then batches, each a u32 row count followed, per column, by a u8
+// Type and the cells (INT: raw i64s; STR: u32 length + bytes each). A
+// batch of zero rows ends the result.
+enum class ResultFormat : uint8_t { CSV = 0, BINARY = 1 };
+enum class ResponseStatus : uint8_t { OK = 0, ROWS = 1, ERROR = 2, MORE = 3 };
+
+// frames larger than this are rejected as malformed
+constexpr size_t kMaxFrame = size_t{64} << 20;
+
+// Appends a frame header whose length end_frame() fills in once the
+// payload has been appended after it. Returns the header's position.
+size_t begin_frame(std::string &out);
+// Throws DBError, leaving out as it is, if the payload exceeds kMaxFrame.
+void end_frame(std::string &out, size_t at);
+void append_frame(std::string &out, std::string_view payload);
+// Finds the frame starting at pos in buf: on success stores its payload,
+// advances pos past it and returns true; returns false if buf does not hold
+// the whole frame yet. Throws DBError for frames above kMaxFrame.
+bool next_frame(std::string_view buf, size_t &pos, std::string_view &payload);
+
+// Encodes rows as they are produced, in the binary layout above.
+class BinaryResultWriter : public RowSink {
+public:
+  explicit BinaryResultWriter(std::string &out) : out(out) {}
+  void begin(const std::vector<std::string> &headers) override;
+  void write(QueryResult &&batch) override;
+  void end() override;
+
+private:
+  std::string &out;
+  size_t ncols{0};
+};
+
+// Decodes a binary result into text rows.
+QueryResult decode_binary_result(std::string_view body);
+
+struct Response {
+  ResponseStatus status{ResponseStatus::OK};
+  std::string body;
+};
+
+// Blocking client. Requests are buffered by send() and written when the
+// buffer fills or a response is awaited, so sending several before
+// receiving pipelines them. Addresses are as for Server.
+class Client {
+public:
+  explicit Client(const std::string &address);
+  ~Client();
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+
+  void send(std::string_view sql, ResultFormat format = ResultFormat::CSV);
+  void flush();
+  // Next response, in request order, its frames joined; throws DBError if
+  // the connection closes first.
+  Response receive();
+  // send() then receive()
+  Response query(std::string_view sql,
+                 ResultFormat format = ResultFormat::CSV);
+
+private:
+  int fd{-1};
+  std::string out;
+  std::string in;
+  size_t in_pos{0};
+
+  // payload of the next frame, valid until the next call
+  std::string_view next_payload();
+};
+
+// Socket helpers shared by Server and Client. An address made of digits
+// only is a TCP port on 127.0.0.1 (0 picks a free one); anything else is
+// the path of a Unix socket. Both throw DBError.
+int listen_on(const std::string &address);
+int connect_to(const std::string &address);
+
+} // namespace db
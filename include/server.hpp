@@ -0,0 +1,103 @@
+#pragma once
+#include "database.hpp"
+#include "parallel.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace db {
+
+struct ServerOptions {
+  // threads executing statements
+  size_t workers{std::max(1u, std::thread::hardware_concurrency())};
+  // a connection is not read from while this many response bytes wait,
+  // and a statement streaming a result pauses until they drain
+  size_t max_pending_output{size_t{8} << 20};
+  // A paused statement fails with ERROR once its connection has written
+  // nothing for this long, and so do the rest of its batch's results, so
+  // a client that stops reading holds a worker for no longer than this.
+  std::chrono::milliseconds output_timeout{1000};
+  // if set, called on the event-loop thread at least every 100 ms
+  std::function<void()> tick;
+};
+
+// Serves the protocol in protocol.hpp from one epoll event loop. The loop
+// only moves bytes: each connection's complete requests are handed to a
+// worker as one batch and executed in order, so a pipelining client gets
+// its statements run back to back, while different connections run in
+// parallel on the workers. Large results are handed to the loop in parts
+// as they are produced (see protocol.hpp), so neither side holds a whole
+// result at once.
+class Server {
+public:
+  // Binds and listens on address (see listen_on); throws DBError.
+  Server(Database &db, const std::string &address, ServerOptions opts = {});
+  ~Server();
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  // Serves connections until stop() is called.
+  void run();
+  // Makes run() return; safe from any thread and from signal handlers.
+  void stop();
+  // the bound TCP port, or 0 for Unix sockets
+  int port() const { return tcp_port; }
+
+private:
+  struct Connection;
+  struct Completion {
+    uint64_t id;
+    std::string out;
+    // more output of the same batch follows
+    bool partial{false};
+  };
+  // Output a connection's running batch has handed over and that is not
+  // yet written, which the batch waits on before producing more.
+  struct Backlog {
+    std::mutex mu;
+    std::condition_variable cv;
+    size_t unsent{0};
+    // nothing more will be written: the peer is gone or the server stops
+    bool closed{false};
+  };
+
+  Database &db;
+  ServerOptions opts;
+  std::string address;
+  int tcp_port{0};
+  int listen_fd{-1};
+  int epoll_fd{-1};
+  // written by workers and stop() to wake the loop
+  int wake_fd{-1};
+  std::unordered_map<uint64_t, std::unique_ptr<Connection>> conns;
+  uint64_t next_id{0};
+
+  std::mutex done_mu;
+  std::vector<Completion> done;
+  std::atomic<bool> stopping{false};
+  std::unique_ptr<ThreadPool> workers;
+
+  void accept_all();
+  void on_ready(uint64_t id, uint32_t events);
+  void on_wake();
+  void read_input(Connection &c);
+  void write_output(Connection &c);
+  void dispatch(Connection &c);
+  // hands a batch's output to the loop
+  void complete(Completion &&d);
+  // tells c's running batch how much output is still unsent, if any
+  void report_backlog(Connection &c, bool closed = false);
+  // updates c's epoll interest, or closes it once it is finished
+  void settle(Connection &c);
+  void close_connection(uint64_t id);
+};
+
+} // namespace db
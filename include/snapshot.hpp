@@ -0,0 +1,28 @@
+#pragma once
+#include "database.hpp"
+#include <string>
+
+namespace db {
+
+// Binary snapshot of a whole database: every table's schema, column buffers
+// and index definitions, in a versioned layout with CRC-32C checksums over
+// the header, the catalog and each buffer. The file is written under a
+// temporary name and renamed into place, so readers never see a torn file.
+// wal_lsn records the last log entry whose effects the snapshot contains.
+// The tables themselves are read, so their writers must be held off with a
+// Database::WriteBarrier (or db be a forked copy of a process holding one).
+void save_snapshot(const Database &db, const std::string &path,
+                   uint64_t wal_lsn = 0);
+
+// Adds the snapshot's tables to db. The file is memory-mapped and column
+// buffers are served straight from the mapping until first modified, so
+// loading reads only the catalog, plus every row of each indexed column to
+// rebuild its index. The header and catalog are always verified; column
+// contents, string offsets and lengths included, are trusted unless
+// verify_data is set, which checks every column checksum and that every
+// string lies within its column's bytes, and so touches all the data.
+// Returns the snapshot's wal_lsn.
+uint64_t load_snapshot(Database &db, const std::string &path,
+                       bool verify_data = false);
+
+} // namespace db
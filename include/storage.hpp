@@ -0,0 +1,482 @@
+#pragma once
+#include "memory.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace db {
+
+enum class Type { INT, STR };
+
+// Comparison operators shared by WHERE conditions and indexes.
+enum class CmpOp { EQ, NEQ, LT, GT, LE, GE };
+
+// Column values stored in fixed-size chunks behind a shared chunk
+// directory. A view shares the directory, so taking one copies no values;
+// a later write copies the directory and the one chunk it lands in while a
+// view still holds them. Appends go into the tail chunk past every view's
+// end. Chunks may also be borrowed from read-only memory (a snapshot
+// mapping) kept alive by a shared handle; they are copied on first write.
+template <typename T> class ColumnBuffer {
+public:
+  static constexpr size_t kChunkShift = 12;
+  static constexpr size_t kChunk = size_t{1} << kChunkShift;
+
+  ColumnBuffer() = default;
+  // copies are deep, so two writers never append into the same chunk
+  ColumnBuffer(const ColumnBuffer &o) { append(o); }
+  ColumnBuffer &operator=(const ColumnBuffer &o) {
+    if (this != &o) {
+      dir.reset();
+      n = 0;
+      append(o);
+    }
+    return *this;
+  }
+  ColumnBuffer(ColumnBuffer &&) = default;
+  ColumnBuffer &operator=(ColumnBuffer &&) = default;
+
+  size_t size() const { return n; }
+  const T &operator[](size_t i) const {
+    return (*dir)[i >> kChunkShift].p.get()[i & (kChunk - 1)];
+  }
+  // Calls f(values, count, first) over contiguous runs covering
+  // [begin, end). Runs never cross a multiple of kChunk.
+  template <typename F> void runs(size_t begin, size_t end, F &&f) const {
+    while (begin < end) {
+      size_t off = begin & (kChunk - 1);
+      size_t count = std::min(end - begin, kChunk - off);
+      f((*dir)[begin >> kChunkShift].p.get() + off, count, begin);
+      begin += count;
+    }
+  }
+
+  void push_back(const T &v) {
+    size_t room;
+    *tail(1, room) = v;
+    ++n;
+  }
+  void append(const T *p, size_t count) {
+    while (count > 0) {
+      size_t room;
+      T *dst = tail(count, room);
+      size_t k = std::min(count, room);
+      std::copy(p, p + k, dst);
+      p += k;
+      count -= k;
+      n += k;
+    }
+  }
+  void append(const ColumnBuffer &o) {
+    o.runs(0, o.size(), [&](const T *p, size_t count, size_t) {
+      append(p, count);
+    });
+  }
+  void set(size_t i, const T &v) {
+    writable_chunk(i >> kChunkShift)[i & (kChunk - 1)] = v;
+  }
+  // Stable removal of the given (ascending, unique) positions.
+  void erase(const std::vector<size_t> &sorted) {
+    if (sorted.empty())
+      return;
+    ColumnBuffer out;
+    size_t k = 0;
+    runs(0, n, [&](const T *p, size_t count, size_t first) {
+      size_t i = 0;
+      while (i < count) {
+        size_t stop = k < sorted.size() ? sorted[k] - first : count;
+        stop = std::min(stop, count);
+        out.append(p + i, stop - i);
+        i = stop;
+        if (i < count) {
+          ++k;
+          ++i;
+        }
+      }
+    });
+    *this = std::move(out);
+  }
+  void borrow(const T *p, size_t count,
+              const std::shared_ptr<const void> &keep) {
+    dir.reset();
+    n = count;
+    if (!count)
+      return;
+    dir = std::make_shared<std::vector<Chunk>>();
+    for (size_t off = 0; off < count; off += kChunk)
+      dir->push_back(Chunk{std::shared_ptr<const T>(keep, p + off), kChunk,
+                           false});
+  }
+  // read-only view of the current values that stays valid whatever happens
+  // to this buffer afterwards
+  ColumnBuffer view() const {
+    ColumnBuffer v;
+    v.dir = dir;
+    v.n = n;
+    return v;
+  }
+  // whether destroying this buffer may free storage
+  bool frees_storage() const { return dir && dir.use_count() == 1; }
+  // Trims the last chunk to the values it holds; views keep the old one.
+  void shrink_to_fit() {
+    if (n == 0) {
+      dir.reset();
+      return;
+    }
+    auto &d = own_dir();
+    d.resize(((n - 1) >> kChunkShift) + 1);
+    d.shrink_to_fit();
+    size_t used = n - ((d.size() - 1) << kChunkShift);
+    if (d.back().owned && d.back().cap > used)
+      copy_chunk(d.size() - 1, used, used);
+  }
+  // heap held by the owned chunks and the directory
+  size_t heap_bytes() const {
+    if (!dir)
+      return 0;
+    size_t total = dir->capacity() * sizeof(Chunk);
+    for (const Chunk &c : *dir) {
+      if (c.owned)
+        total += c.cap * sizeof(T);
+    }
+    return total;
+  }
+  // bytes of the values still served from borrowed memory
+  size_t mapped_bytes() const {
+    size_t total = 0;
+    for (size_t c = 0; dir && c < dir->size(); ++c) {
+      if (!(*dir)[c].owned)
+        total += std::min(kChunk, n - (c << kChunkShift)) * sizeof(T);
+    }
+    return total;
+  }
+
+private:
+  struct Chunk {
+    std::shared_ptr<const T> p;
+    size_t cap;
+    // false for borrowed memory, which is never written
+    bool owned;
+  };
+  std::shared_ptr<std::vector<Chunk>> dir;
+  size_t n{0};
+
+  // Views only ever take references on the writer's thread, so a count of
+  // one cannot go back up; the fence orders our writes after the reads of
+  // the view that dropped the last other reference.
+  template <typename P> static bool unique(const std::shared_ptr<P> &p) {
+    if (p.use_count() > 1)
+      return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+  }
+  // cache-line aligned, like the snapshot buffers scans also run over
+  static std::shared_ptr<const T> allocate(size_t cap) {
+    constexpr std::align_val_t align{64};
+    void *p = ::operator new(cap * sizeof(T), align);
+    return std::shared_ptr<const T>(static_cast<const T *>(p),
+                                    [](const T *q) {
+                                      ::operator delete(
+                                          const_cast<T *>(q), align);
+                                    });
+  }
+  static T *mut(const Chunk &c) { return const_cast<T *>(c.p.get()); }
+
+  std::vector<Chunk> &own_dir() {
+    if (!dir)
+      dir = std::make_shared<std::vector<Chunk>>();
+    else if (!unique(dir))
+      dir = std::make_shared<std::vector<Chunk>>(*dir);
+    return *dir;
+  }
+  // replaces chunk c with an owned copy of its first `used` values
+  T *copy_chunk(size_t c, size_t used, size_t cap) {
+    auto &d = own_dir();
+    auto fresh = allocate(cap);
+    std::copy(d[c].p.get(), d[c].p.get() + used,
+              const_cast<T *>(fresh.get()));
+    d[c] = Chunk{std::move(fresh), cap, true};
+    return mut(d[c]);
+  }
+  T *writable_chunk(size_t c) {
+    // copy the directory first: a shared one exposes all its chunks
+    auto &d = own_dir();
+    if (d[c].owned && unique(d[c].p))
+      return mut(d[c]);
+    size_t used = std::min(kChunk, n - (c << kChunkShift));
+    return copy_chunk(c, used, d[c].cap);
+  }
+  // where the value at position n goes, with room for `room` values
+  T *tail(size_t want, size_t &room) {
+    size_t c = n >> kChunkShift;
+    size_t off = n & (kChunk - 1);
+    if (!dir || c == dir->size()) {
+      // the first chunk starts small, so tiny tables stay tiny
+      size_t cap = c ? kChunk : std::min(kChunk, std::max<size_t>(16, want));
+      auto &d = own_dir();
+      d.push_back(Chunk{allocate(cap), cap, true});
+      room = cap;
+      return mut(d.back());
+    }
+    const Chunk &ch = (*dir)[c];
+    if (ch.owned && off < ch.cap) {
+      // past the end of every view, so no copy is needed
+      room = ch.cap - off;
+      return mut(ch) + off;
+    }
+    size_t cap = ch.owned ? std::min(kChunk, std::max(ch.cap * 2, off + want))
+                          : kChunk;
+    room = cap - off;
+    return copy_chunk(c, off, cap) + off;
+  }
+};
+
+// Contiguous bytes, owned or borrowed like a ColumnBuffer but never
+// chunked, so every string stays in one piece.
+class ByteBuffer {
+public:
+  ByteBuffer() = default;
+  ByteBuffer(const ByteBuffer &o) { *this = o; }
+  ByteBuffer &operator=(const ByteBuffer &o) {
+    if (this == &o)
+      return *this;
+    if (o.borrowed) {
+      borrow(o.borrowed, o.borrowed_n, o.backing);
+    } else {
+      borrow(nullptr, 0, nullptr);
+      if (o.vec)
+        vec = std::make_shared<std::vector<char>>(*o.vec);
+    }
+    return *this;
+  }
+  ByteBuffer(ByteBuffer &&) = default;
+  ByteBuffer &operator=(ByteBuffer &&) = default;
+
+  size_t size() const {
+    return borrowed ? borrowed_n : vec ? vec->size() : 0;
+  }
+  const char *data() const {
+    return borrowed ? borrowed : vec ? vec->data() : nullptr;
+  }
+
+  // Appends s and returns its offset. Bytes a view can see never move.
+  size_t append(std::string_view s) {
+    size_t at = size();
+    auto &v = grow(s.size());
+    v.insert(v.end(), s.begin(), s.end());
+    return at;
+  }
+  void append(const ByteBuffer &o) { append({o.data(), o.size()}); }
+  // whether bytes can be overwritten in place
+  bool writable() const { return !borrowed && vec && unique(); }
+  // for writable buffers only
+  char *mutable_data() { return vec->data(); }
+
+  void borrow(const char *p, size_t n, std::shared_ptr<const void> keep) {
+    vec.reset();
+    borrowed = n ? p : nullptr;
+    borrowed_n = n;
+    backing = n ? std::move(keep) : nullptr;
+  }
+  void assign(std::vector<char> &&v) {
+    borrow(nullptr, 0, nullptr);
+    vec = std::make_shared<std::vector<char>>(std::move(v));
+  }
+  ByteBuffer view() const {
+    ByteBuffer v;
+    if (borrowed)
+      v.borrow(borrowed, borrowed_n, backing);
+    else if (vec)
+      v.borrow(vec->data(), vec->size(), vec);
+    return v;
+  }
+  bool frees_storage() const {
+    return borrowed ? backing.use_count() == 1 : vec.use_count() == 1;
+  }
+  void shrink_to_fit() {
+    if (!vec || vec->capacity() == vec->size())
+      return;
+    if (unique())
+      vec->shrink_to_fit();
+    else
+      vec = std::make_shared<std::vector<char>>(*vec);
+  }
+  size_t heap_bytes() const { return vec ? vec->capacity() : 0; }
+  size_t mapped_bytes() const { return borrowed_n; }
+
+private:
+  std::shared_ptr<std::vector<char>> vec;
+  const char *borrowed{nullptr};
+  size_t borrowed_n{0};
+  std::shared_ptr<const void> backing;
+
+  // see ColumnBuffer::unique
+  bool unique() const {
+    if (vec.use_count() > 1)
+      return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+  }
+  // owned storage with room for `extra` more bytes without moving any
+  std::vector<char> &grow(size_t extra) {
+    if (!vec || borrowed) {
+      auto copy = std::make_shared<std::vector<char>>();
+      copy->reserve(size() + extra);
+      copy->assign(data(), data() + size());
+      borrow(nullptr, 0, nullptr);
+      vec = std::move(copy);
+    }
+    size_t need = vec->size() + extra;
+    if (need > vec->capacity()) {
+      size_t cap = std::max(need, vec->capacity() * 2);
+      if (!unique()) {
+        auto bigger = std::make_shared<std::vector<char>>();
+        bigger->reserve(cap);
+        bigger->assign(vec->begin(), vec->end());
+        vec = std::move(bigger);
+      } else {
+        vec->reserve(cap);
+      }
+    }
+    return *vec;
+  }
+};
+
+// INT column: chunked array of values.
+class IntColumn {
+public:
+  size_t size() const { return values.size(); }
+  int64_t get(size_t row) const { return values[row]; }
+  const ColumnBuffer<int64_t> &buffer() const { return values; }
+
+  void push_back(int64_t v) { values.push_back(v); }
+  void set(size_t row, int64_t v) { values.set(row, v); }
+  void append(const IntColumn &other) { values.append(other.values); }
+  void erase_rows(const std::vector<size_t> &sorted_rows) {
+    values.erase(sorted_rows);
+  }
+  void shrink_to_fit() { values.shrink_to_fit(); }
+
+  // Serves the values from p until the column is first modified.
+  void borrow(const int64_t *p, size_t n, std::shared_ptr<const void> keep) {
+    values.borrow(p, n, keep);
+  }
+  // read-only copy of the current values, sharing their storage
+  IntColumn view() const {
+    IntColumn v;
+    v.values = values.view();
+    return v;
+  }
+  bool frees_storage() const { return values.frees_storage(); }
+  void add_usage(MemoryUsage &m) const {
+    m.columns += values.heap_bytes();
+    m.mapped += values.mapped_bytes();
+  }
+
+private:
+  ColumnBuffer<int64_t> values;
+};
+
+// STR column: string bytes packed back-to-back in one buffer, addressed by a
+// per-row offset and length. Overwrites append to the buffer, so it is
+// compacted once the dead bytes outgrow the live ones.
+class StrColumn {
+public:
+  size_t size() const { return offsets.size(); }
+  std::string_view get(size_t row) const {
+    return {bytes.data() + offsets[row], lengths[row]};
+  }
+
+  void push_back(std::string_view s);
+  void set(size_t row, std::string_view s);
+  // appends other's live strings; its dead bytes are not copied
+  void append(const StrColumn &other);
+  void erase_rows(const std::vector<size_t> &sorted_rows);
+  // Packs the bytes of overwritten and erased strings away and releases
+  // spare capacity.
+  void shrink_to_fit();
+
+  // Raw buffers, for writing snapshots. Only packed columns (no dead
+  // bytes) can be written as they are.
+  bool packed() const { return dead_bytes == 0; }
+  const ColumnBuffer<uint64_t> &offset_buffer() const { return offsets; }
+  const ColumnBuffer<uint32_t> &length_buffer() const { return lengths; }
+  const char *byte_data() const { return bytes.data(); }
+  size_t byte_count() const { return bytes.size(); }
+  // Serves n strings from the given buffers until first modified.
+  void borrow(const uint64_t *offs, const uint32_t *lens, size_t n,
+              const char *data, size_t nbytes,
+              const std::shared_ptr<const void> &keep);
+  // read-only copy of the current strings, sharing their storage
+  StrColumn view() const;
+  bool frees_storage() const {
+    return offsets.frees_storage() || lengths.frees_storage() ||
+           bytes.frees_storage();
+  }
+  void add_usage(MemoryUsage &m) const {
+    m.columns += offsets.heap_bytes() + lengths.heap_bytes();
+    m.strings += bytes.heap_bytes();
+    m.mapped += offsets.mapped_bytes() + lengths.mapped_bytes() +
+                bytes.mapped_bytes();
+  }
+
+private:
+  ColumnBuffer<uint64_t> offsets;
+  ColumnBuffer<uint32_t> lengths;
+  ByteBuffer bytes;
+  size_t dead_bytes{0};
+
+  void maybe_compact();
+  void pack();
+};
+
+using ColumnData = std::variant<IntColumn, StrColumn>;
+
+// One bit per row position, shared with views and copied on write like a
+// ColumnBuffer. Positions past the last stored word read as clear, so an
+// empty bitmap costs nothing.
+class RowBitmap {
+public:
+  size_t count() const { return ones; }
+  bool test(size_t pos) const {
+    size_t w = pos >> 6;
+    return w < words.size() && ((words[w] >> (pos & 63)) & 1);
+  }
+  // Returns false if the bit was already set.
+  bool set(size_t pos) {
+    size_t w = pos >> 6;
+    while (words.size() <= w)
+      words.push_back(0);
+    uint64_t bit = uint64_t{1} << (pos & 63);
+    uint64_t cur = words[w];
+    if (cur & bit)
+      return false;
+    words.set(w, cur | bit);
+    ++ones;
+    return true;
+  }
+  // the set positions, ascending
+  std::vector<size_t> positions() const;
+  // Removes the set positions from rows[from, end), keeping the order.
+  void remove_set(std::vector<size_t> &rows, size_t from = 0) const;
+
+  RowBitmap view() const {
+    RowBitmap v;
+    v.words = words.view();
+    v.ones = ones;
+    return v;
+  }
+  bool frees_storage() const { return words.frees_storage(); }
+  void add_usage(MemoryUsage &m) const { m.columns += words.heap_bytes(); }
+
+private:
+  ColumnBuffer<uint64_t> words;
+  size_t ones{0};
+};
+
+} // namespace db
@@ -1,7 +1,5 @@
 #pragma once
-#include <optional>
-#include <string>
-#include <vector>
+#include <string_view>
 
 namespace db {
 
@@ -21,24 +19,83 @@ enum class TokType {
   GT,
   LE,
   GE,
+  PARAM,
   END
 };
 
+// Reserved words, recognised once by the tokenizer so the parser compares
+// enums rather than strings. Keywords are case-sensitive (uppercase).
+enum class Keyword {
+  NONE,
+  AND,
+  AS,
+  ASC,
+  BETWEEN,
+  BTREE,
+  BY,
+  CHECKPOINT,
+  COPY,
+  CREATE,
+  DELETE,
+  DESC,
+  EXECUTE,
+  FROM,
+  GROUP,
+  HASH,
+  IN,
+  INDEX,
+  INSERT,
+  INTO,
+  JOIN,
+  LIMIT,
+  NOT,
+  OFFSET,
+  ON,
+  OR,
+  ORDER,
+  PREPARE,
+  SAVE,
+  SELECT,
+  SET,
+  TABLE,
+  UPDATE,
+  USING,
+  VACUUM,
+  VALUES,
+  WHERE
+};
+
+Keyword keyword_of(std::string_view word);
+const char *keyword_name(Keyword kw);
+
+// ASCII whitespace as the tokenizer skips it; cheaper than the locale-aware
+// std::isspace on per-character paths.
+inline bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+// A token's text views the tokenizer's input (for strings, the part between
+// the quotes), so the input must outlive its tokens.
 struct Token {
   TokType type;
-  std::string text;
+  std::string_view text;
+  Keyword kw{Keyword::NONE};
 };
 
 class Tokenizer {
 public:
-  explicit Tokenizer(const std::string &s);
-  Token peek() const;
+  explicit Tokenizer(std::string_view s);
+  const Token &peek();
   Token next();
-  bool eof() const;
+  bool eof() { return peek().type == TokType::END; }
+  // input after the last token taken with next(); nothing may be peeked
+  std::string_view rest() const { return input.substr(i); }
 
 private:
-  const std::string &input;
+  std::string_view input;
   size_t i;
+  Token ahead{TokType::END, {}};
+  bool has_ahead{false};
+
+  Token scan();
   void skip_ws();
   Token scan_string();
   Token scan_ident_or_number();
@@ -0,0 +1,113 @@
+#pragma once
+#include "database.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace db {
+
+// A position in the log: every record up to lsn lies before byte offset.
+struct WalMark {
+  uint64_t lsn{0};
+  uint64_t offset{0};
+};
+
+struct WalOptions {
+  // make the log durable once this many records are waiting...
+  size_t group_size{256};
+  // ...and at least this often while any are
+  std::chrono::milliseconds group_interval{10};
+  // Let statements return before their records are durable, leaving them
+  // to the triggers above; a crash may then lose acknowledged changes.
+  bool async_commit{false};
+};
+
+// Append-only log of logical mutations, replayed on top of a snapshot at
+// startup. Records are buffered and made durable in groups: one write and
+// fsync covers everything appended since the previous one. A statement
+// waits in commit() until its records are durable; the first waiter
+// writes the group while those arriving meanwhile wait for it and then
+// share the next sync. The wait comes after the statement has released its
+// table and published its changes, so that writers of the same table can
+// join the group: other readers may see, and act on, changes a crash still
+// loses. Only the statement's own acknowledgement implies durability. With
+// async_commit nobody waits, and groups are
+// written once group_size records are pending or by a background flusher
+// every group_interval, so a crash loses at most the last open group.
+//
+// Each record is framed as {u32 payload size, u32 CRC-32C of the payload,
+// u64 LSN} followed by the payload, whose first byte is the record kind.
+class WriteAheadLog {
+public:
+  // Opens or creates the log. A torn or corrupt tail left by a crash is cut
+  // off; new records continue after the last intact one.
+  explicit WriteAheadLog(std::string path, WalOptions opts = {});
+  ~WriteAheadLog();
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  // Re-applies the records with an LSN above `after` (the snapshot's) to
+  // db, which must not have this log attached yet. New records are numbered
+  // past both. Returns the number of records applied.
+  size_t replay(Database &db, uint64_t after);
+
+  // Each returns the LSN of the last record it appended; pass it to
+  // commit() once the statement has released its locks.
+  uint64_t log_create_table(const std::string &name,
+                            const std::vector<Column> &cols);
+  uint64_t log_create_index(const StmtCreateIndex &s);
+  // rows [begin, end) of t, as appended by INSERT or COPY; returns 0 if
+  // there are none
+  uint64_t log_rows(const Table &t, size_t begin, size_t end);
+  uint64_t log_update(const StmtUpdate &s);
+  uint64_t log_delete(const StmtDelete &s);
+
+  // Returns once every record up to lsn is durable, joining the group
+  // being synced or leading the next one. Returns at once with
+  // async_commit, and throws the log's error if it has failed.
+  void commit(uint64_t lsn);
+
+  // Writes and fsyncs everything appended so far. A failed write or sync
+  // is cut off the file and kept pending, and the log stays failed: this
+  // and every later append or flush throws the same error.
+  void flush();
+  uint64_t last_lsn() const;
+  uint64_t durable_lsn() const;
+
+  // Flushes and returns the current end of the log.
+  WalMark mark();
+  // Drops every record before m (covered by a checkpoint) by rewriting the
+  // rest to a new file that atomically replaces the log. Returns once the
+  // replacement, directory entry included, is durable.
+  void truncate_to(const WalMark &m);
+
+private:
+  std::string path;
+  WalOptions opts;
+  int fd{-1};
+
+  mutable std::mutex mu;
+  std::condition_variable cv;
+  std::string pending;
+  size_t pending_records{0};
+  uint64_t last{0};
+  uint64_t durable{0};
+  // a group is being written; commit() waits on `synced` for it
+  bool syncing{false};
+  std::condition_variable synced;
+  bool stopping{false};
+  // the first write or sync failure; set, it fails every append and flush
+  std::string error;
+  // serializes writers of the file; guards fd and size
+  std::mutex io_mu;
+  uint64_t size{0};
+  std::thread flusher;
+
+  uint64_t append(const std::string &payload);
+  void flush_locked();
+  void flush_loop();
+};
+
+} // namespace db
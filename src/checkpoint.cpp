@@ -0,0 +1,144 @@
+#include "checkpoint.hpp"
+#include "snapshot.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace db {
+
+namespace {
+
+// What the child sends back through the pipe.
+struct ChildResult {
+  int ok;
+  double seconds;
+  uint64_t private_dirty;
+  char error[256];
+};
+
+double since(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+// Private_Dirty of this process in bytes, from smaps_rollup; 0 when the
+// kernel does not provide it.
+uint64_t private_dirty_bytes() {
+  std::FILE *f = std::fopen("/proc/self/smaps_rollup", "r");
+  if (!f)
+    return 0;
+  char line[256];
+  unsigned long long kb = 0;
+  while (std::fgets(line, sizeof(line), f)) {
+    if (std::sscanf(line, "Private_Dirty: %llu kB", &kb) == 1)
+      break;
+  }
+  std::fclose(f);
+  return static_cast<uint64_t>(kb) * 1024;
+}
+
+[[noreturn]] void run_child(const Database &db, const std::string &path,
+                            uint64_t lsn, int out,
+                            std::chrono::steady_clock::time_point t0) {
+  ChildResult res{};
+  try {
+    save_snapshot(db, path, lsn);
+    res.ok = 1;
+  } catch (const std::exception &e) {
+    std::snprintf(res.error, sizeof(res.error), "%s", e.what());
+  }
+  res.seconds = since(t0);
+  res.private_dirty = private_dirty_bytes();
+  ssize_t w = ::write(out, &res, sizeof(res));
+  // no destructors or atexit handlers: they belong to the parent
+  ::_exit(w == static_cast<ssize_t>(sizeof(res)) ? 0 : 1);
+}
+
+} // namespace
+
+Checkpointer::~Checkpointer() {
+  if (running())
+    poll(true);
+}
+
+bool Checkpointer::running() const {
+  std::lock_guard<std::mutex> lk(mu);
+  return child > 0;
+}
+
+void Checkpointer::start(Database &db, const std::string &path) {
+  std::lock_guard<std::mutex> lk(mu);
+  if (child > 0)
+    throw DBError("A checkpoint is already running");
+  // the child's image must not catch a statement half-applied or applied
+  // but not yet logged; the barrier is held only until fork returns
+  Database::WriteBarrier quiet(db);
+  log = db.wal();
+  mark = log ? log->mark() : WalMark{};
+  int fds[2];
+  if (::pipe2(fds, O_CLOEXEC) != 0)
+    throw DBError(std::string("Cannot start checkpoint: ") +
+                  std::strerror(errno));
+  auto t0 = std::chrono::steady_clock::now();
+  pid_t pid = ::fork();
+  if (pid < 0) {
+    int err = errno;
+    ::close(fds[0]);
+    ::close(fds[1]);
+    throw DBError(std::string("Cannot start checkpoint: ") +
+                  std::strerror(err));
+  }
+  if (pid == 0) {
+    ::close(fds[0]);
+    run_child(db, path, mark.lsn, fds[1], t0);
+  }
+  ::close(fds[1]);
+  child = pid;
+  pipe_fd = fds[0];
+  report = CheckpointReport{};
+  report.path = path;
+  report.wal_lsn = mark.lsn;
+  report.fork_seconds = since(t0);
+}
+
+std::optional<CheckpointReport> Checkpointer::poll(bool wait) {
+  std::lock_guard<std::mutex> lk(mu);
+  if (child <= 0)
+    return std::nullopt;
+  int status = 0;
+  pid_t r;
+  do {
+    r = ::waitpid(child, &status, wait ? 0 : WNOHANG);
+  } while (r < 0 && errno == EINTR);
+  if (r == 0)
+    return std::nullopt;
+  child = -1;
+
+  ChildResult res{};
+  ssize_t n = ::read(pipe_fd, &res, sizeof(res));
+  ::close(pipe_fd);
+  pipe_fd = -1;
+  if (n != static_cast<ssize_t>(sizeof(res))) {
+    report.error = "checkpoint process died";
+    return report;
+  }
+  report.seconds = res.seconds;
+  report.cow_bytes = res.private_dirty;
+  report.ok = res.ok != 0;
+  report.error = res.error;
+  if (report.ok && log) {
+    try {
+      log->truncate_to(mark);
+    } catch (const DBError &e) {
+      report.ok = false;
+      report.error = std::string("snapshot written, but ") + e.what();
+    }
+  }
+  return report;
+}
+
+} // namespace db
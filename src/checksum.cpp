@@ -0,0 +1,56 @@
+#include "checksum.hpp"
+#include "filter.hpp"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define INMEMDB_X86_64 1
+#endif
+
+namespace db {
+
+static uint32_t crc32c_table(const unsigned char *p, size_t n, uint32_t crc) {
+  static const auto table = [] {
+    struct {
+      uint32_t v[256];
+    } t;
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+        c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+      t.v[i] = c;
+    }
+    return t;
+  }();
+  for (size_t i = 0; i < n; ++i)
+    crc = table.v[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+#ifdef INMEMDB_X86_64
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_sse42(const unsigned char *p, size_t n, uint32_t crc) {
+  uint64_t c = crc;
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    c = _mm_crc32_u64(c, word);
+  }
+  uint32_t c32 = static_cast<uint32_t>(c);
+  for (; n > 0; --n, ++p)
+    c32 = _mm_crc32_u8(c32, *p);
+  return c32;
+}
+#endif
+
+uint32_t crc32c(const void *data, size_t n, uint32_t crc) {
+  const auto *p = static_cast<const unsigned char *>(data);
+  crc = ~crc;
+#ifdef INMEMDB_X86_64
+  if (simd_level_supported(SimdLevel::SSE42))
+    return ~crc32c_sse42(p, n, crc);
+#endif
+  return ~crc32c_table(p, n, crc);
+}
+
+} // namespace db
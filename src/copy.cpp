@@ -0,0 +1,223 @@
+#include "copy.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace db {
+
+namespace {
+
+// Cursor over one chunk of CSV text. Quoted fields may hold commas,
+// newlines and doubled quotes.
+struct CsvCursor {
+  const char *p;
+  const char *end;
+  std::string scratch;
+
+  // Reads one field; the view stays valid until the next call.
+  std::string_view field() {
+    if (p < end && *p == '"') {
+      scratch.clear();
+      ++p;
+      while (true) {
+        const char *q = static_cast<const char *>(
+            std::memchr(p, '"', static_cast<size_t>(end - p)));
+        if (!q)
+          throw DBError("Unterminated quoted field");
+        scratch.append(p, q);
+        p = q + 1;
+        if (p < end && *p == '"') {
+          scratch.push_back('"');
+          ++p;
+        } else {
+          return scratch;
+        }
+      }
+    }
+    const char *start = p;
+    while (p < end && *p != ',' && *p != '\n')
+      ++p;
+    const char *stop = p;
+    if (stop > start && stop[-1] == '\r' && (p == end || *p == '\n'))
+      --stop;
+    return {start, static_cast<size_t>(stop - start)};
+  }
+
+  // Consumes the separator after a field; last says whether the row should
+  // end there.
+  void separator(bool last) {
+    if (p < end && *p == '\r' && last)
+      ++p;
+    if (p == end && last)
+      return;
+    if (p < end && *p == (last ? '\n' : ',')) {
+      ++p;
+      return;
+    }
+    throw DBError(last ? "Too many fields in row" : "Too few fields in row");
+  }
+
+  bool blank_line() {
+    if (p < end && *p == '\r' && p + 1 < end && p[1] == '\n') {
+      p += 2;
+      return true;
+    }
+    if (p < end && *p == '\n') {
+      ++p;
+      return true;
+    }
+    return false;
+  }
+};
+
+struct Chunk {
+  const char *begin;
+  const char *end;
+  std::vector<ColumnData> cols;
+};
+
+} // namespace
+
+// Start of the first row after target, tracking whether p..target ends
+// inside quotes. Doubled quotes toggle twice, so parity is all it takes.
+static const char *next_row(const char *p, const char *target,
+                            const char *end, bool &in_quotes) {
+  while (const void *q =
+             std::memchr(p, '"', static_cast<size_t>(target - p))) {
+    in_quotes = !in_quotes;
+    p = static_cast<const char *>(q) + 1;
+  }
+  p = target;
+  while (p < end) {
+    char c = *p++;
+    if (c == '"')
+      in_quotes = !in_quotes;
+    else if (c == '\n' && !in_quotes)
+      break;
+  }
+  return p;
+}
+
+static size_t line_of(const char *file, const char *at) {
+  return 1 + static_cast<size_t>(std::count(file, at, '\n'));
+}
+
+static void parse_chunk(Chunk &chunk, const Table &t,
+                        const std::vector<size_t> &targets,
+                        const char *file) {
+  const auto &columns = t.get_columns();
+  chunk.cols.reserve(columns.size());
+  for (const auto &c : columns) {
+    if (c.type == Type::INT)
+      chunk.cols.emplace_back(IntColumn{});
+    else
+      chunk.cols.emplace_back(StrColumn{});
+  }
+  std::vector<bool> given(columns.size(), false);
+  for (size_t col : targets)
+    given[col] = true;
+
+  // An empty line is a row holding "" when that is the only field, as the
+  // CSV writer puts it; otherwise it can be no row and is skipped.
+  bool skip_blank = targets.size() > 1 ||
+                    columns[targets.front()].type == Type::INT;
+  CsvCursor cur{chunk.begin, chunk.end, {}};
+  size_t rows = 0;
+  const char *row_start = cur.p;
+  try {
+    while (cur.p < cur.end) {
+      row_start = cur.p;
+      if (skip_blank && cur.blank_line())
+        continue;
+      for (size_t f = 0; f < targets.size(); ++f) {
+        std::string_view v = cur.field();
+        size_t col = targets[f];
+        if (auto *ic = std::get_if<IntColumn>(&chunk.cols[col])) {
+          int64_t x = 0;
+          auto res = std::from_chars(v.data(), v.data() + v.size(), x);
+          if (v.empty() || res.ec != std::errc() ||
+              res.ptr != v.data() + v.size())
+            throw DBError("Invalid integer for column " + columns[col].name +
+                          ": " + std::string(v));
+          ic->push_back(x);
+        } else {
+          std::get<StrColumn>(chunk.cols[col]).push_back(v);
+        }
+        cur.separator(f + 1 == targets.size());
+      }
+      ++rows;
+    }
+  } catch (const DBError &e) {
+    throw DBError(std::string(e.what()) + " on line " +
+                  std::to_string(line_of(file, row_start)));
+  }
+  for (size_t col = 0; col < columns.size(); ++col) {
+    if (given[col])
+      continue;
+    for (size_t r = 0; r < rows; ++r) {
+      if (auto *ic = std::get_if<IntColumn>(&chunk.cols[col]))
+        ic->push_back(0);
+      else
+        std::get<StrColumn>(chunk.cols[col]).push_back("");
+    }
+  }
+}
+
+size_t copy_from_csv(Table &t, const std::string &path, size_t chunk_bytes) {
+  MappedFile file(path, true);
+  const char *begin = file.data();
+  const char *end = begin + file.size();
+  if (begin == end)
+    throw DBError("Missing CSV header in " + path);
+
+  // header: the table column each field goes to
+  CsvCursor head{begin, end, {}};
+  std::vector<size_t> targets;
+  std::vector<bool> seen(t.get_columns().size(), false);
+  while (true) {
+    size_t col = t.col_index(std::string(head.field()));
+    if (seen[col])
+      throw DBError("Duplicate column in CSV header: " + t.col_at(col).name);
+    seen[col] = true;
+    targets.push_back(col);
+    if (head.p < end && *head.p == ',') {
+      ++head.p;
+      continue;
+    }
+    head.separator(true);
+    break;
+  }
+
+  const char *body = head.p;
+  if (chunk_bytes == 0) {
+    // a few chunks per thread for balance, but big enough to amortize
+    size_t per = static_cast<size_t>(end - body) /
+                 (parallel_options().threads * 4);
+    chunk_bytes = std::max<size_t>(per, 1 << 20);
+  }
+  std::vector<Chunk> chunks;
+  bool in_quotes = false;
+  for (const char *p = body; p < end;) {
+    const char *target =
+        static_cast<size_t>(end - p) > chunk_bytes ? p + chunk_bytes : end;
+    const char *next =
+        target == end ? end : next_row(p, target, end, in_quotes);
+    chunks.push_back({p, next, {}});
+    p = next;
+  }
+
+  parallel_tasks(chunks.size(), [&](size_t k) {
+    parse_chunk(chunks[k], t, targets, begin);
+  });
+
+  // everything parsed; append in file order, committed as one change
+  Table::Batch batch(t);
+  size_t before = t.row_count();
+  for (const auto &c : chunks)
+    t.append(c.cols);
+  return t.row_count() - before;
+}
+
+} // namespace db
@@ -1,47 +1,594 @@
 #include "database.hpp"
+#include "checkpoint.hpp"
+#include "copy.hpp"
+#include "group.hpp"
+#include "mvcc.hpp"
+#include "order.hpp"
+#include "parallel.hpp"
+#include "predicate.hpp"
+#include "prepared.hpp"
+#include "snapshot.hpp"
+#include "wal.hpp"
 #include <algorithm>
+#include <exception>
 #include <iomanip>
+#include <shared_mutex>
+#include <type_traits>
 
 namespace db {
 
+struct Table::IndexSet {
+  std::shared_mutex mu;
+  // set while the writer wants the lock, so a stream of probing views
+  // cannot starve it
+  std::atomic<bool> writing{false};
+  std::vector<std::unique_ptr<Index>> list;
+  // bumped whenever indexed rows move or change their keys
+  uint64_t layout{0};
+};
+
+// Held by the writer while it changes the indexes; a null set locks
+// nothing.
+class Table::IndexWriteLock {
+public:
+  explicit IndexWriteLock(IndexSet *s) : s(s) {
+    if (!s)
+      return;
+    s->writing.store(true);
+    s->mu.lock();
+  }
+  ~IndexWriteLock() {
+    if (!s)
+      return;
+    s->mu.unlock();
+    s->writing.store(false);
+  }
+  IndexWriteLock(const IndexWriteLock &) = delete;
+  IndexWriteLock &operator=(const IndexWriteLock &) = delete;
+
+private:
+  IndexSet *s;
+};
+
+// Dropped views wait here for later commits to show, along with the memory
+// of their shared_ptr control blocks, so publishing a commit does not
+// allocate once the table is warm. Views come back from any thread.
+class Table::ViewPool : public std::enable_shared_from_this<ViewPool> {
+public:
+  // more than readers hold at once, unless they hold on to old versions
+  static constexpr size_t kKeep = 8;
+
+  ViewPool() = default;
+  ViewPool(const ViewPool &) = delete;
+  ViewPool &operator=(const ViewPool &) = delete;
+  ~ViewPool() {
+    for (Table *view : tables)
+      delete view;
+    for (void *block : blocks)
+      ::operator delete(block);
+  }
+
+  // Hands out control blocks. Each holds the pool, which thus outlives
+  // every view that returns to it.
+  template <typename T> struct BlockAllocator {
+    using value_type = T;
+    std::shared_ptr<ViewPool> pool;
+
+    explicit BlockAllocator(std::shared_ptr<ViewPool> p)
+        : pool(std::move(p)) {}
+    template <typename U>
+    BlockAllocator(const BlockAllocator<U> &o) : pool(o.pool) {}
+    T *allocate(size_t n) {
+      return static_cast<T *>(pool->allocate(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t n) { pool->deallocate(p, n * sizeof(T)); }
+    template <typename U> bool operator==(const BlockAllocator<U> &o) const {
+      return pool == o.pool;
+    }
+    template <typename U> bool operator!=(const BlockAllocator<U> &o) const {
+      return pool != o.pool;
+    }
+  };
+
+  // The deleter of published views. Runs wherever the last reference to a
+  // view goes away; if that releases column storage the table has since
+  // replaced, the freeing is left to the background reclaimer.
+  struct Recycle {
+    ViewPool *pool;
+    void operator()(const Table *view) const { pool->drop(view); }
+  };
+
+  // a spare view, if any
+  Table *take() {
+    std::lock_guard<std::mutex> lk(mu);
+    if (tables.empty())
+      return nullptr;
+    Table *view = tables.back();
+    tables.pop_back();
+    return view;
+  }
+
+private:
+  std::mutex mu;
+  std::vector<Table *> tables;
+  std::vector<void *> blocks;
+  // every control block is of the one type, so of one size
+  size_t block_size{0};
+
+  void drop(const Table *view) {
+    auto *v = const_cast<Table *>(view);
+    bool frees = v->deleted.frees_storage();
+    for (const auto &d : v->data)
+      frees = frees || std::visit(
+                           [](const auto &col) { return col.frees_storage(); },
+                           d);
+    if (frees)
+      reclaim_later([pool = shared_from_this(), v] { pool->recycle(v); });
+    else
+      recycle(v);
+  }
+  void recycle(Table *view) {
+    // clear() keeps the capacity for the next columns shown
+    view->data.clear();
+    view->deleted = RowBitmap();
+    view->schema.reset();
+    view->ixs.reset();
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      if (tables.size() < kKeep) {
+        tables.push_back(view);
+        return;
+      }
+    }
+    delete view;
+  }
+  void *allocate(size_t n) {
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      if (!block_size)
+        block_size = n;
+      if (n == block_size && !blocks.empty()) {
+        void *block = blocks.back();
+        blocks.pop_back();
+        return block;
+      }
+    }
+    return ::operator new(n);
+  }
+  void deallocate(void *p, size_t n) {
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      if (n == block_size && blocks.size() < kKeep) {
+        blocks.push_back(p);
+        return;
+      }
+    }
+    ::operator delete(p);
+  }
+};
+
 Table::Table(std::string n, std::vector<Column> cols)
-    : name(std::move(n)), columns(std::move(cols)) {
-  for (size_t idx = 0; idx < columns.size(); ++idx) {
-    name2idx.emplace(columns[idx].name, idx);
+    : ixs(std::make_shared<IndexSet>()), views(std::make_shared<ViewPool>()) {
+  auto sc = std::make_shared<Schema>();
+  sc->name = std::move(n);
+  sc->columns = std::move(cols);
+  data.reserve(sc->columns.size());
+  for (size_t idx = 0; idx < sc->columns.size(); ++idx) {
+    sc->name2idx.emplace(sc->columns[idx].name, idx);
+    if (sc->columns[idx].type == Type::INT)
+      data.emplace_back(IntColumn{});
+    else
+      data.emplace_back(StrColumn{});
   }
+  schema = std::move(sc);
+  commit();
+}
+
+Table::Table(const Table &live, uint64_t commit_ts) { show(live, commit_ts); }
+
+// A view: same schema and indexes, columns that borrow the live storage.
+void Table::show(const Table &live, uint64_t commit_ts) {
+  schema = live.schema;
+  nrows = live.nrows;
+  deleted = live.deleted.view();
+  ixs = live.ixs;
+  is_view = true;
+  ts = commit_ts;
+  layout = live.ixs->layout;
+  data.clear();
+  data.reserve(live.data.size());
+  for (const auto &d : live.data)
+    data.push_back(std::visit(
+        [](const auto &col) -> ColumnData { return col.view(); }, d));
+}
+
+void Table::commit() {
+  if (batch_depth > 0) {
+    dirty = true;
+    return;
+  }
+  dirty = false;
+  uint64_t now = next_commit_ts();
+  Table *view = views->take();
+  if (view)
+    view->show(*this, now);
+  else
+    view = new Table(*this, now);
+  std::shared_ptr<const Table> published_view(
+      view, ViewPool::Recycle{views.get()},
+      ViewPool::BlockAllocator<Table>(views));
+  std::atomic_store(&published, std::move(published_view));
+}
+
+void Table::end_batch() {
+  if (--batch_depth == 0 && dirty)
+    commit();
+}
+
+std::shared_ptr<const Table> Table::snapshot() const {
+  return std::atomic_load(&published);
+}
+
+const std::vector<std::unique_ptr<Index>> &Table::get_indexes() const {
+  return ixs->list;
 }
 
 size_t Table::col_index(const std::string &col) const {
-  auto it = name2idx.find(col);
-  if (it == name2idx.end())
+  auto it = schema->name2idx.find(col);
+  if (it == schema->name2idx.end())
     throw DBError("Unknown column: " + col);
   return it->second;
 }
 
+void Table::create_index(const std::string &index_name,
+                         const std::string &col, IndexKind kind) {
+  WriteLock wl(*this);
+  size_t idx = col_index(col);
+  std::unique_ptr<Index> ix;
+  if (kind == IndexKind::BTREE)
+    ix = std::make_unique<BTreeIndex>(index_name, idx);
+  else
+    ix = std::make_unique<HashIndex>(index_name, idx);
+  ix->rebuild(data[idx], nrows);
+  // rows have not moved, so views keep using the indexes, this one too
+  IndexWriteLock lk(ixs.get());
+  ixs->list.push_back(std::move(ix));
+}
+
+bool Table::has_index(const std::string &index_name) const {
+  for (const auto &ix : ixs->list) {
+    if (ix->get_name() == index_name)
+      return true;
+  }
+  return false;
+}
+
+// cond with each column name mapped to a position by column_of.
+template <typename F>
+static ColumnCondition resolve_condition(const Condition &cond,
+                                         const F &column_of) {
+  ColumnCondition c{0, cond.op, &cond.literal};
+  c.kind = cond.kind;
+  if (cond.kind == CondKind::CMP || cond.kind == CondKind::IN)
+    c.column = column_of(cond.column);
+  if (cond.kind == CondKind::IN)
+    c.values = &cond.values;
+  c.children.reserve(cond.children.size());
+  for (const auto &child : cond.children)
+    c.children.push_back(resolve_condition(child, column_of));
+  return c;
+}
+
+ColumnCondition Table::resolve(const Condition &cond) const {
+  return resolve_condition(
+      cond, [&](const std::string &col) { return col_index(col); });
+}
+
+std::optional<ColumnCondition>
+Table::resolve(const std::optional<Condition> &cond) const {
+  if (!cond)
+    return std::nullopt;
+  return resolve(*cond);
+}
+
+ColumnOrdering Table::resolve(const Ordering &order) const {
+  ColumnOrdering o;
+  if (!order.column.empty())
+    o.column = col_index(order.column);
+  o.descending = order.descending;
+  o.limit = order.limit.value_or(ColumnOrdering::kNone);
+  o.offset = order.offset;
+  return o;
+}
+
+const Index *Table::index_for(const ColumnCondition &cond) const {
+  if (cond.kind != CondKind::CMP && cond.kind != CondKind::IN)
+    return nullptr;
+  size_t col = cond.column;
+  // a mistyped literal takes the scan path, which reports the mismatch
+  Type type = schema->columns[col].type;
+  if (cond.kind == CondKind::CMP && cond.literal->type != type)
+    return nullptr;
+  if (cond.kind == CondKind::IN) {
+    for (const Value &v : *cond.values) {
+      if (v.type != type)
+        return nullptr;
+    }
+  }
+  // an IN list is probed one equality at a time
+  CmpOp op = cond.kind == CondKind::IN ? CmpOp::EQ : cond.op;
+  const Index *found = nullptr;
+  for (const auto &ix : ixs->list) {
+    if (ix->get_column() != col || !ix->supports(op))
+      continue;
+    // hash probes beat tree walks for equality
+    if (!found || ix->kind() == IndexKind::HASH)
+      found = ix.get();
+  }
+  return found;
+}
+
+const ColumnCondition *Table::index_probe(const ColumnCondition &cond,
+                                          const Index *&ix) const {
+  if ((ix = index_for(cond)))
+    return &cond;
+  if (cond.kind != CondKind::AND)
+    return nullptr;
+  // the parser flattens nested ANDs, so one level holds every conjunct;
+  // equalities narrow the rows the most
+  const ColumnCondition *best = nullptr;
+  auto exact = [](const ColumnCondition &c) {
+    return c.kind == CondKind::IN || c.op == CmpOp::EQ;
+  };
+  for (const auto &child : cond.children) {
+    const Index *found = index_for(child);
+    if (found && (!best || (exact(child) && !exact(*best)))) {
+      best = &child;
+      ix = found;
+    }
+  }
+  return best;
+}
+
+// Append the rows an index holds for a comparison or IN list.
+static void probe(const Index &ix, const ColumnCondition &c,
+                  std::vector<size_t> &out) {
+  if (c.kind == CondKind::CMP) {
+    ix.lookup(c.op, *c.literal, out);
+    return;
+  }
+  for (const Value &v : *c.values)
+    ix.lookup(CmpOp::EQ, v, out);
+}
+
+// Sort rows an index produced; an IN list naming a key twice finds its
+// rows twice.
+static void sort_rows(const ColumnCondition &c, std::vector<size_t> &rows) {
+  std::sort(rows.begin(), rows.end());
+  if (c.kind == CondKind::IN)
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+}
+
+bool Table::index_lookup(const std::optional<ColumnCondition> &cond,
+                         std::vector<size_t> &out) const {
+  if (!cond)
+    return false;
+  const Index *ix = nullptr;
+  const ColumnCondition *part = nullptr;
+  if (!is_view) {
+    part = index_probe(*cond, ix);
+    if (!part)
+      return false;
+    probe(*ix, *part, out);
+    // deleted rows keep their entries until compaction
+    deleted.remove_set(out);
+    sort_rows(*part, out);
+  } else {
+    // never wait for the writer: while it holds the indexes, or once rows
+    // this view holds have moved, scanning the view is the answer
+    if (ixs->writing.load())
+      return false;
+    std::shared_lock<std::shared_mutex> lk(ixs->mu, std::try_to_lock);
+    if (!lk.owns_lock() || ixs->layout != layout)
+      return false;
+    part = index_probe(*cond, ix);
+    if (!part)
+      return false;
+    probe(*ix, *part, out);
+    lk.unlock();
+    // drop rows appended after the view was taken or deleted before it
+    out.erase(std::remove_if(out.begin(), out.end(),
+                             [&](size_t row) {
+                               return row >= nrows || deleted.test(row);
+                             }),
+              out.end());
+    sort_rows(*part, out);
+  }
+  // the other conjuncts are checked on the rows the index found
+  if (part != &*cond)
+    BoundCondition(*this, *cond).refine(out, 0);
+  return true;
+}
+
+Value Table::cell(size_t row, size_t col) const {
+  if (schema->columns[col].type == Type::INT)
+    return Value::make_int(std::get<IntColumn>(data[col]).get(row));
+  return Value::make_str(std::string(std::get<StrColumn>(data[col]).get(row)));
+}
+
+// Store v into column data d, either appending or overwriting row.
+static void store_value(ColumnData &d, const Value &v) {
+  if (auto *ic = std::get_if<IntColumn>(&d))
+    ic->push_back(v.i);
+  else
+    std::get<StrColumn>(d).push_back(v.s);
+}
+
+static void store_default(ColumnData &d) {
+  if (auto *ic = std::get_if<IntColumn>(&d))
+    ic->push_back(0);
+  else
+    std::get<StrColumn>(d).push_back({});
+}
+
+static void store_value(ColumnData &d, size_t row, const Value &v) {
+  if (auto *ic = std::get_if<IntColumn>(&d))
+    ic->set(row, v.i);
+  else
+    std::get<StrColumn>(d).set(row, v.s);
+}
+
 void Table::insert_row(const std::vector<std::optional<Value>> &row_values) {
+  std::vector<const Value *> row;
+  row.reserve(row_values.size());
+  for (const auto &v : row_values)
+    row.push_back(v ? &*v : nullptr);
+  insert_row(row);
+}
+
+void Table::insert_row(const std::vector<const Value *> &row_values) {
+  WriteLock wl(*this);
+  const auto &columns = schema->columns;
   if (row_values.size() != columns.size())
     throw DBError("Internal error: wrong row size");
-  Row r;
-  r.cells.reserve(columns.size());
+  // validate the whole row first so a failed insert leaves no partial row
   for (size_t i = 0; i < columns.size(); ++i) {
-    if (row_values[i].has_value()) {
-      const Value &v = *row_values[i];
-      if (v.type != columns[i].type)
-        throw TypeError("Type mismatch on insert into column " +
-                        columns[i].name);
-      r.cells.push_back(v);
-    } else {
-      r.cells.push_back(Value::default_of(columns[i].type));
+    if (row_values[i] && row_values[i]->type != columns[i].type)
+      throw TypeError("Type mismatch on insert into column " +
+                      columns[i].name);
+  }
+  for (size_t i = 0; i < columns.size(); ++i) {
+    if (row_values[i])
+      store_value(data[i], *row_values[i]);
+    else
+      store_default(data[i]);
+  }
+  if (!ixs->list.empty()) {
+    IndexWriteLock lk(ixs.get());
+    for (auto &ix : ixs->list)
+      ix->insert(data[ix->get_column()], nrows);
+  }
+  ++nrows;
+  commit();
+}
+
+void Table::append(const std::vector<ColumnData> &block) {
+  WriteLock wl(*this);
+  const auto &columns = schema->columns;
+  if (block.size() != columns.size())
+    throw DBError("Internal error: wrong block width");
+  size_t n = 0;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    bool is_int = std::holds_alternative<IntColumn>(block[i]);
+    if (is_int != (columns[i].type == Type::INT))
+      throw TypeError("Type mismatch on append to column " + columns[i].name);
+    size_t len = std::visit([](const auto &c) { return c.size(); }, block[i]);
+    if (i > 0 && len != n)
+      throw DBError("Internal error: ragged block");
+    n = len;
+  }
+  for (size_t i = 0; i < columns.size(); ++i) {
+    if (auto *ic = std::get_if<IntColumn>(&data[i]))
+      ic->append(std::get<IntColumn>(block[i]));
+    else
+      std::get<StrColumn>(data[i]).append(std::get<StrColumn>(block[i]));
+  }
+  if (!ixs->list.empty()) {
+    IndexWriteLock lk(ixs.get());
+    for (auto &ix : ixs->list) {
+      for (size_t row = nrows; row < nrows + n; ++row)
+        ix->insert(data[ix->get_column()], row);
     }
   }
-  rows.push_back(std::move(r));
+  nrows += n;
+  commit();
 }
 
-bool Table::row_matches(const Row &r,
-                        const std::optional<Condition> &cond) const {
-  if (!cond)
-    return true;
-  return cond->matches(*this, r);
+void Table::restore(std::vector<ColumnData> cols, size_t rows) {
+  WriteLock wl(*this);
+  const auto &columns = schema->columns;
+  if (cols.size() != columns.size())
+    throw DBError("Internal error: wrong column count");
+  for (size_t i = 0; i < columns.size(); ++i) {
+    bool is_int = std::holds_alternative<IntColumn>(cols[i]);
+    size_t len = std::visit([](const auto &c) { return c.size(); }, cols[i]);
+    if (is_int != (columns[i].type == Type::INT) || len != rows)
+      throw DBError("Internal error: column does not match " +
+                    columns[i].name);
+  }
+  data = std::move(cols);
+  nrows = rows;
+  deleted = RowBitmap();
+  {
+    IndexWriteLock lk(ixs.get());
+    ++ixs->layout;
+    for (auto &ix : ixs->list)
+      ix->rebuild(data[ix->get_column()], nrows);
+  }
+  commit();
+}
+
+std::vector<size_t>
+Table::matching_rows(const std::optional<ColumnCondition> &cond) const {
+  std::vector<size_t> out;
+  if (index_lookup(cond, out))
+    return out;
+  if (!cond) {
+    out.reserve(row_count());
+    for (size_t row = 0; row < nrows; ++row) {
+      if (!deleted.test(row))
+        out.push_back(row);
+    }
+    return out;
+  }
+  BoundCondition bound(*this, *cond);
+  if (!use_parallel_scan(nrows)) {
+    bound.select(0, nrows, out);
+    deleted.remove_set(out);
+    return out;
+  }
+  std::vector<std::vector<size_t>> parts(morsel_count(nrows));
+  parallel_morsels(nrows, [&](size_t m, size_t begin, size_t end) {
+    bound.select(begin, end, parts[m]);
+    deleted.remove_set(parts[m]);
+  });
+  size_t total = 0;
+  for (const auto &p : parts)
+    total += p.size();
+  out.reserve(total);
+  for (const auto &p : parts)
+    out.insert(out.end(), p.begin(), p.end());
+  return out;
+}
+
+// Append the cells of d at rows[0, n) to out.
+static void gather(const ColumnData &d, const size_t *rows, size_t n,
+                   ResultColumn &out) {
+  if (auto *ic = std::get_if<IntColumn>(&d)) {
+    size_t base = out.ints.size();
+    out.ints.resize(base + n);
+    for (size_t i = 0; i < n; ++i)
+      out.ints[base + i] = ic->get(rows[i]);
+  } else {
+    const auto &sc = std::get<StrColumn>(d);
+    size_t base = out.strs.size();
+    out.strs.resize(base + n);
+    for (size_t i = 0; i < n; ++i)
+      out.strs[base + i] = sc.get(rows[i]);
+  }
+}
+
+void Table::project_rows(const size_t *rows, size_t n,
+                         const std::vector<size_t> &proj,
+                         QueryResult &qr) const {
+  if (qr.columns.empty()) {
+    qr.columns.resize(proj.size());
+    for (size_t k = 0; k < proj.size(); ++k)
+      qr.columns[k].type = schema->columns[proj[k]].type;
+  }
+  // gather column by column; cells are formatted only on output
+  for (size_t k = 0; k < proj.size(); ++k)
+    gather(data[proj[k]], rows, n, qr.columns[k]);
 }
 
 std::vector<size_t>
@@ -49,8 +596,8 @@ Table::build_projection(const std::vector<std::string> &out_cols,
                         bool star) const {
   std::vector<size_t> proj;
   if (star) {
-    proj.resize(columns.size());
-    for (size_t i = 0; i < columns.size(); ++i)
+    proj.resize(schema->columns.size());
+    for (size_t i = 0; i < proj.size(); ++i)
       proj[i] = i;
   } else {
     proj.reserve(out_cols.size());
@@ -63,103 +610,1156 @@ Table::build_projection(const std::vector<std::string> &out_cols,
 QueryResult Table::select_where(const std::vector<std::string> &out_cols,
                                 bool star,
                                 const std::optional<Condition> &cond) const {
-  auto proj = build_projection(out_cols, star);
-  QueryResult qr;
-  qr.headers.reserve(proj.size());
+  ResultCollector collector;
+  scan_where(out_cols, star, cond, collector);
+  return std::move(collector.result);
+}
+
+void Table::scan_where(const std::vector<std::string> &out_cols, bool star,
+                       const std::optional<Condition> &cond,
+                       RowSink &sink) const {
+  scan_rows(build_projection(out_cols, star), resolve(cond), sink);
+}
+
+// Append the live rows of [begin, end) that satisfy bound (all when null).
+static void select_range(const BoundCondition *bound,
+                         const RowBitmap &deleted, size_t begin, size_t end,
+                         std::vector<size_t> &sel) {
+  size_t from = sel.size();
+  if (bound) {
+    bound->select(begin, end, sel);
+    deleted.remove_set(sel, from);
+    return;
+  }
+  for (size_t row = begin; row < end; ++row) {
+    if (!deleted.test(row))
+      sel.push_back(row);
+  }
+}
+
+// Drop rows of sel before the first of `skip` more rows and after the first
+// `left`, counting both down.
+static void take_rows(std::vector<size_t> &sel, size_t &skip, size_t &left) {
+  size_t drop = std::min(skip, sel.size());
+  sel.erase(sel.begin(), sel.begin() + static_cast<std::ptrdiff_t>(drop));
+  skip -= drop;
+  if (sel.size() > left)
+    sel.resize(left);
+  left -= sel.size();
+}
+
+namespace {
+// ORDER BY order on (key, row); ties keep row order either way.
+template <typename Key> struct OrderCmp {
+  bool descending;
+  bool operator()(const std::pair<Key, size_t> &a,
+                  const std::pair<Key, size_t> &b) const {
+    if (a.first != b.first)
+      return descending ? b.first < a.first : a.first < b.first;
+    return a.second < b.second;
+  }
+};
+} // namespace
+
+template <typename Key>
+std::vector<size_t>
+Table::ordered_rows(const std::optional<ColumnCondition> &cond,
+                    const ColumnOrdering &order) const {
+  using Entry = std::pair<Key, size_t>;
+  using KeyColumn =
+      std::conditional_t<std::is_same_v<Key, int64_t>, IntColumn, StrColumn>;
+  const auto &keys = std::get<KeyColumn>(data[order.column]);
+  OrderCmp<Key> cmp{order.descending};
+  std::vector<Entry> sorted;
+  if (order.limit != ColumnOrdering::kNone) {
+    // only the first offset + limit rows are ever written, so each morsel
+    // keeps its best in a heap that size and the heaps are merged
+    size_t k = order.limit > ColumnOrdering::kNone - order.offset
+                   ? ColumnOrdering::kNone
+                   : order.offset + order.limit;
+    TopK<Entry, OrderCmp<Key>> top(k, cmp);
+    std::vector<size_t> rows;
+    bool indexed = index_lookup(cond, rows);
+    std::optional<BoundCondition> bound;
+    if (cond && !indexed)
+      bound.emplace(*this, *cond);
+    const BoundCondition *b = bound ? &*bound : nullptr;
+    auto push_range = [&](TopK<Entry, OrderCmp<Key>> &into, size_t begin,
+                          size_t end) {
+      std::vector<size_t> sel;
+      select_range(b, deleted, begin, end, sel);
+      for (size_t row : sel)
+        into.push(Entry{keys.get(row), row});
+    };
+    if (indexed) {
+      for (size_t row : rows)
+        top.push(Entry{keys.get(row), row});
+    } else if (!use_parallel_scan(nrows)) {
+      constexpr size_t kBlockRows = 1024;
+      for (size_t begin = 0; begin < nrows; begin += kBlockRows)
+        push_range(top, begin, std::min(nrows, begin + kBlockRows));
+    } else {
+      std::vector<TopK<Entry, OrderCmp<Key>>> parts(morsel_count(nrows), top);
+      parallel_morsels(nrows, [&](size_t m, size_t begin, size_t end) {
+        push_range(parts[m], begin, end);
+      });
+      for (const auto &p : parts)
+        top.merge(p);
+    }
+    sorted = top.take_sorted();
+  } else {
+    std::vector<size_t> rows = matching_rows(cond);
+    sorted.reserve(rows.size());
+    for (size_t row : rows)
+      sorted.push_back(Entry{keys.get(row), row});
+    parallel_sort(sorted, cmp);
+  }
+  std::vector<size_t> out;
+  size_t from = std::min(order.offset, sorted.size());
+  out.reserve(std::min(sorted.size() - from, order.limit));
+  for (size_t i = from; i < sorted.size() && out.size() < order.limit; ++i)
+    out.push_back(sorted[i].second);
+  return out;
+}
+
+void Table::scan_rows(const std::vector<size_t> &proj,
+                      const std::optional<ColumnCondition> &cond,
+                      RowSink &sink, const ColumnOrdering &order) const {
+  // readers, the writer included, see the last commit
+  if (!is_view) {
+    snapshot()->scan_rows(proj, cond, sink, order);
+    return;
+  }
+  constexpr size_t kBatchRows = 1024;
+  std::vector<std::string> headers;
+  headers.reserve(proj.size());
   for (size_t idx : proj)
-    qr.headers.push_back(columns[idx].name);
-  for (const auto &row : rows) {
-    if (!row_matches(row, cond))
+    headers.push_back(schema->columns[idx].name);
+  auto write_rows = [&](const std::vector<size_t> &rows) {
+    for (size_t k = 0; k < rows.size(); k += kBatchRows) {
+      QueryResult batch;
+      project_rows(rows.data() + k, std::min(kBatchRows, rows.size() - k),
+                   proj, batch);
+      sink.write(std::move(batch));
+    }
+  };
+  if (order.column != ColumnOrdering::kNone) {
+    std::vector<size_t> rows =
+        schema->columns[order.column].type == Type::INT
+            ? ordered_rows<int64_t>(cond, order)
+            : ordered_rows<std::string_view>(cond, order);
+    sink.begin(headers);
+    write_rows(rows);
+    sink.end();
+    return;
+  }
+
+  std::vector<size_t> rows;
+  bool indexed = index_lookup(cond, rows);
+  std::optional<BoundCondition> bound;
+  if (cond && !indexed)
+    bound.emplace(*this, *cond);
+  // a LIMIT stops the scan once it has its rows
+  size_t skip = order.offset;
+  size_t left = order.limit;
+  sink.begin(headers);
+
+  if (indexed) {
+    take_rows(rows, skip, left);
+    write_rows(rows);
+  } else if (use_parallel_scan(nrows)) {
+    // morsel-driven: a window of morsels is filtered and projected in
+    // parallel, one fragment per morsel, and the fragments are streamed out
+    // in row order before the next window starts
+    const auto &opts = parallel_options();
+    size_t window = opts.morsel_rows * opts.threads * 2;
+    for (size_t w = 0; w < nrows && left > 0; w += window) {
+      size_t wn = std::min(window, nrows - w);
+      std::vector<QueryResult> parts(morsel_count(wn));
+      parallel_morsels(wn, [&](size_t m, size_t begin, size_t end) {
+        std::vector<size_t> sel;
+        select_range(bound ? &*bound : nullptr, deleted, w + begin, w + end,
+                     sel);
+        project_rows(sel.data(), sel.size(), proj, parts[m]);
+      });
+      for (auto &p : parts) {
+        size_t n = p.row_count();
+        if (skip >= n) {
+          skip -= n;
+          continue;
+        }
+        if (left == 0)
+          break;
+        p.slice(skip, left);
+        skip = 0;
+        left -= p.row_count();
+        sink.write(std::move(p));
+      }
+    }
+  } else {
+    std::vector<size_t> sel;
+    for (size_t begin = 0; begin < nrows && left > 0; begin += kBatchRows) {
+      sel.clear();
+      select_range(bound ? &*bound : nullptr, deleted, begin,
+                   std::min(nrows, begin + kBatchRows), sel);
+      take_rows(sel, skip, left);
+      if (sel.empty())
+        continue;
+      QueryResult batch;
+      project_rows(sel.data(), sel.size(), proj, batch);
+      sink.write(std::move(batch));
+    }
+  }
+  sink.end();
+}
+
+void Table::aggregate_where(const std::vector<Aggregate> &aggs,
+                            const std::optional<Condition> &cond,
+                            RowSink &sink) const {
+  aggregate_rows(resolve(aggs), resolve(cond), sink);
+}
+
+std::vector<ColumnAggregate>
+Table::resolve(const std::vector<Aggregate> &aggs) const {
+  std::vector<ColumnAggregate> out;
+  out.reserve(aggs.size());
+  for (const auto &a : aggs) {
+    if (a.column.empty()) {
+      out.push_back({a.func, ColumnAggregate::kStar});
+      continue;
+    }
+    size_t col = col_index(a.column);
+    if ((a.func == AggFunc::SUM || a.func == AggFunc::AVG) &&
+        schema->columns[col].type != Type::INT)
+      throw TypeError(std::string(agg_func_name(a.func)) +
+                      " needs an INT column: " + a.column);
+    out.push_back({a.func, col});
+  }
+  return out;
+}
+
+std::string Table::aggregate_header(const ColumnAggregate &a) const {
+  bool star = a.column == ColumnAggregate::kStar;
+  return std::string(agg_func_name(a.func)) + "(" +
+         (star ? "*" : schema->columns[a.column].name) + ")";
+}
+
+Type Table::aggregate_type(const ColumnAggregate &a) const {
+  if (a.func == AggFunc::MIN || a.func == AggFunc::MAX)
+    return schema->columns[a.column].type;
+  return Type::INT;
+}
+
+// Appends the value of one aggregate over `rows` rows to c, whose type is
+// the aggregate's. Only MIN and MAX of STR columns read sa.
+static void append_aggregate(ResultColumn &c, AggFunc f, int64_t rows,
+                             const IntAggregate &ia, const StrAggregate &sa) {
+  switch (f) {
+  case AggFunc::COUNT:
+    c.ints.push_back(rows);
+    return;
+  case AggFunc::SUM:
+    c.ints.push_back(ia.sum);
+    return;
+  case AggFunc::AVG:
+    c.ints.push_back(ia.sum / ia.count);
+    return;
+  case AggFunc::MIN:
+    if (c.type == Type::STR)
+      c.strs.push_back(sa.min);
+    else
+      c.ints.push_back(ia.min);
+    return;
+  case AggFunc::MAX:
+    if (c.type == Type::STR)
+      c.strs.push_back(sa.max);
+    else
+      c.ints.push_back(ia.max);
+    return;
+  }
+}
+
+namespace {
+// Running aggregates of the distinct columns a SELECT list aggregates,
+// folded a block of rows at a time. A block never crosses a storage chunk,
+// so each INT column is one contiguous run the kernels can stream over.
+struct AggregateFold {
+  const Table &t;
+  const std::vector<size_t> &cols;
+  int64_t rows{0};
+  std::vector<IntAggregate> ints;
+  std::vector<StrAggregate> strs;
+
+  AggregateFold(const Table &t, const std::vector<size_t> &cols)
+      : t(t), cols(cols), ints(cols.size()), strs(cols.size()) {}
+
+  // positions [begin, begin + n) when sel is null, else sel[0, n), all
+  // within begin's chunk
+  void add(size_t begin, const size_t *sel, size_t n) {
+    rows += static_cast<int64_t>(n);
+    for (size_t k = 0; k < cols.size(); ++k) {
+      const ColumnData &d = t.column_data(cols[k]);
+      if (auto *ic = std::get_if<IntColumn>(&d)) {
+        const int64_t *v = &ic->buffer()[begin];
+        if (sel)
+          aggregate_ints(v, begin, sel, n, ints[k]);
+        else
+          aggregate_ints(v, n, ints[k]);
+        continue;
+      }
+      const auto &sc = std::get<StrColumn>(d);
+      for (size_t i = 0; i < n; ++i)
+        strs[k].add(sc.get(sel ? sel[i] : begin + i));
+    }
+  }
+  void merge(const AggregateFold &o) {
+    rows += o.rows;
+    for (size_t k = 0; k < cols.size(); ++k) {
+      ints[k].merge(o.ints[k]);
+      strs[k].merge(o.strs[k]);
+    }
+  }
+};
+} // namespace
+
+static constexpr size_t kAggBlock = ColumnBuffer<int64_t>::kChunk;
+
+// Folds the live rows of [begin, end) satisfying bound (all when null).
+static void fold_range(const BoundCondition *bound, const RowBitmap &deleted,
+                       size_t begin, size_t end, AggregateFold &fold) {
+  std::vector<size_t> sel;
+  while (begin < end) {
+    size_t stop = std::min(end, (begin / kAggBlock + 1) * kAggBlock);
+    if (!bound && deleted.count() == 0) {
+      fold.add(begin, nullptr, stop - begin);
+    } else {
+      sel.clear();
+      select_range(bound, deleted, begin, stop, sel);
+      if (sel.size() == stop - begin)
+        fold.add(begin, nullptr, sel.size());
+      else if (!sel.empty())
+        fold.add(begin, sel.data(), sel.size());
+    }
+    begin = stop;
+  }
+}
+
+void Table::aggregate_rows(const std::vector<ColumnAggregate> &aggs,
+                           const std::optional<ColumnCondition> &cond,
+                           RowSink &sink) const {
+  if (!is_view) {
+    snapshot()->aggregate_rows(aggs, cond, sink);
+    return;
+  }
+  // each column is folded once, however many aggregates it feeds
+  std::vector<size_t> cols;
+  std::vector<size_t> slot(aggs.size(), 0);
+  for (size_t k = 0; k < aggs.size(); ++k) {
+    if (aggs[k].column == ColumnAggregate::kStar)
+      continue;
+    auto it = std::find(cols.begin(), cols.end(), aggs[k].column);
+    slot[k] = static_cast<size_t>(it - cols.begin());
+    if (it == cols.end())
+      cols.push_back(aggs[k].column);
+  }
+
+  AggregateFold fold(*this, cols);
+  std::vector<size_t> rows;
+  if (index_lookup(cond, rows)) {
+    // the matches of one chunk at a time
+    for (size_t i = 0; i < rows.size();) {
+      size_t begin = rows[i] / kAggBlock * kAggBlock;
+      size_t j = i;
+      while (j < rows.size() && rows[j] < begin + kAggBlock)
+        ++j;
+      fold.add(begin, rows.data() + i, j - i);
+      i = j;
+    }
+  } else {
+    std::optional<BoundCondition> bound;
+    if (cond)
+      bound.emplace(*this, *cond);
+    const BoundCondition *b = bound ? &*bound : nullptr;
+    if (use_parallel_scan(nrows)) {
+      std::vector<AggregateFold> parts(morsel_count(nrows), fold);
+      parallel_morsels(nrows, [&](size_t m, size_t begin, size_t end) {
+        fold_range(b, deleted, begin, end, parts[m]);
+      });
+      for (const auto &p : parts)
+        fold.merge(p);
+    } else {
+      fold_range(b, deleted, 0, nrows, fold);
+    }
+  }
+
+  std::vector<std::string> headers;
+  QueryResult out;
+  out.columns.resize(aggs.size());
+  for (size_t k = 0; k < aggs.size(); ++k) {
+    const ColumnAggregate &a = aggs[k];
+    headers.push_back(aggregate_header(a));
+    ResultColumn &c = out.columns[k];
+    c.type = aggregate_type(a);
+    if (fold.rows == 0 && a.func != AggFunc::COUNT && a.func != AggFunc::SUM) {
+      // no value to show, and no NULL to show instead
+      c.type = Type::STR;
+      c.strs.emplace_back();
+      continue;
+    }
+    append_aggregate(c, a.func, fold.rows, fold.ints[slot[k]],
+                     fold.strs[slot[k]]);
+  }
+  sink.begin(headers);
+  sink.write(std::move(out));
+  sink.end();
+}
+
+GroupPlan Table::resolve_group(const std::string &key,
+                               const std::vector<std::string> &out_cols,
+                               const std::vector<Aggregate> &aggs) const {
+  GroupPlan plan{col_index(key), resolve(aggs), {}};
+  plan.layout.assign(out_cols.size() + aggs.size(), GroupPlan::kKey);
+  for (size_t k = 0; k < aggs.size(); ++k)
+    plan.layout.at(aggs[k].position) = k;
+  for (const auto &c : out_cols) {
+    if (c != key)
+      throw DBError("Column " + c + " must appear in GROUP BY");
+  }
+  return plan;
+}
+
+namespace {
+// Groups rows by the key column and folds the aggregated columns per
+// group, into `parts` tables picked by hash so that partials built on
+// different threads merge partition by partition. Rows are taken a block
+// at a time: the keys are probed first, then each column is folded into
+// the groups found, one column at a time.
+template <typename Key> struct GroupFold {
+  const ColumnData &keys;
+  std::vector<const IntColumn *> ints;
+  std::vector<const StrColumn *> strs;
+  std::vector<GroupTable<Key>> parts;
+  // per row of the block: its partition and group there
+  std::vector<uint32_t> part_of;
+  std::vector<uint32_t> group_of;
+
+  GroupFold(const Table &t, size_t key, const std::vector<size_t> &int_cols,
+            const std::vector<size_t> &str_cols, size_t nparts)
+      : keys(t.column_data(key)) {
+    for (size_t c : int_cols)
+      ints.push_back(&std::get<IntColumn>(t.column_data(c)));
+    for (size_t c : str_cols)
+      strs.push_back(&std::get<StrColumn>(t.column_data(c)));
+    parts.assign(nparts, GroupTable<Key>(ints.size(), strs.size()));
+  }
+
+  Key key_at(size_t row) const {
+    if constexpr (std::is_same_v<Key, int64_t>)
+      return std::get<IntColumn>(keys).get(row);
+    else
+      return std::get<StrColumn>(keys).get(row);
+  }
+
+  void add(const size_t *rows, size_t n) {
+    part_of.resize(n);
+    group_of.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      Key k = key_at(rows[i]);
+      uint64_t h = group_hash(k);
+      // the top hash bits, scaled to the partition count
+      size_t p = static_cast<size_t>(((h >> 32) * parts.size()) >> 32);
+      part_of[i] = static_cast<uint32_t>(p);
+      group_of[i] = static_cast<uint32_t>(parts[p].add_row(k, h));
+    }
+    for (size_t c = 0; c < ints.size(); ++c) {
+      for (size_t i = 0; i < n; ++i)
+        parts[part_of[i]].int_at(group_of[i], c).add(ints[c]->get(rows[i]));
+    }
+    for (size_t c = 0; c < strs.size(); ++c) {
+      for (size_t i = 0; i < n; ++i)
+        parts[part_of[i]].str_at(group_of[i], c).add(strs[c]->get(rows[i]));
+    }
+  }
+};
+} // namespace
+
+namespace {
+// A JoinFilter bound to the two sides of a join.
+class PairFilter {
+public:
+  PairFilter(const Table *const sides[2], const JoinFilter &f)
+      : kind(f.kind), side(f.side) {
+    if (kind == CondKind::CMP || kind == CondKind::IN) {
+      test.emplace(*sides[side], f.test);
+      return;
+    }
+    children.reserve(f.children.size());
+    for (const auto &child : f.children)
+      children.emplace_back(sides, child);
+  }
+
+  // whether the pair of rows[0] on side 0 and rows[1] on side 1 passes
+  bool matches(const size_t rows[2]) const {
+    switch (kind) {
+    case CondKind::CMP:
+    case CondKind::IN:
+      return test->matches(rows[side]);
+    case CondKind::AND:
+      for (const auto &c : children) {
+        if (!c.matches(rows))
+          return false;
+      }
+      return true;
+    case CondKind::OR:
+      for (const auto &c : children) {
+        if (c.matches(rows))
+          return true;
+      }
+      return false;
+    case CondKind::NOT:
+      break;
+    }
+    return !children[0].matches(rows);
+  }
+
+private:
+  CondKind kind;
+  size_t side;
+  std::optional<BoundCondition> test;
+  std::vector<PairFilter> children;
+};
+
+// Bit s is set when cond names a column of side s.
+template <typename F>
+unsigned condition_sides(const Condition &cond, const F &locate) {
+  if (cond.kind == CondKind::CMP || cond.kind == CondKind::IN)
+    return 1u << locate(cond.column).first;
+  unsigned sides = 0;
+  for (const auto &child : cond.children)
+    sides |= condition_sides(child, locate);
+  return sides;
+}
+
+template <typename F>
+JoinFilter resolve_filter(const Condition &cond, const F &locate) {
+  JoinFilter f;
+  f.kind = cond.kind;
+  if (cond.kind == CondKind::CMP || cond.kind == CondKind::IN) {
+    auto [side, col] = locate(cond.column);
+    f.side = side;
+    f.test = resolve_condition(cond, [col = col](const std::string &) {
+      return col;
+    });
+    return f;
+  }
+  for (const auto &child : cond.children)
+    f.children.push_back(resolve_filter(child, locate));
+  return f;
+}
+} // namespace
+
+JoinPlan Table::resolve_join(const Table &other, const Join &join,
+                             const std::vector<std::string> &out_cols,
+                             bool star,
+                             const std::optional<Condition> &cond) const {
+  // without aliases the two sides could not be told apart
+  if (get_name() == other.get_name())
+    throw DBError("Cannot join table " + get_name() + " with itself");
+  const Table *sides[2] = {this, &other};
+  // (side, position) of a column named `table.column` or `column`
+  auto locate = [&](const std::string &name) {
+    size_t dot = name.find('.');
+    if (dot != std::string::npos) {
+      std::string table = name.substr(0, dot);
+      for (size_t side = 0; side < 2; ++side) {
+        if (sides[side]->get_name() == table)
+          return std::make_pair(side,
+                                sides[side]->col_index(name.substr(dot + 1)));
+      }
+      throw DBError("Unknown table in column: " + name);
+    }
+    auto in0 = schema->name2idx.find(name);
+    auto in1 = other.schema->name2idx.find(name);
+    bool at0 = in0 != schema->name2idx.end();
+    bool at1 = in1 != other.schema->name2idx.end();
+    if (at0 && at1)
+      throw DBError("Ambiguous column: " + name);
+    if (at0)
+      return std::make_pair(size_t{0}, in0->second);
+    if (at1)
+      return std::make_pair(size_t{1}, in1->second);
+    throw DBError("Unknown column: " + name);
+  };
+
+  JoinPlan plan;
+  auto left = locate(join.left);
+  auto right = locate(join.right);
+  if (left.first == right.first)
+    throw DBError("JOIN ON must compare a column of each table");
+  plan.key[left.first] = left.second;
+  plan.key[right.first] = right.second;
+  if (col_at(plan.key[0]).type != other.col_at(plan.key[1]).type)
+    throw TypeError("Type mismatch in JOIN ON");
+
+  if (star) {
+    for (size_t side = 0; side < 2; ++side) {
+      const auto &cols = sides[side]->get_columns();
+      for (size_t col = 0; col < cols.size(); ++col) {
+        plan.columns.emplace_back(side, col);
+        plan.headers.push_back(sides[side]->get_name() + "." + cols[col].name);
+      }
+    }
+  } else {
+    for (const auto &name : out_cols) {
+      plan.columns.push_back(locate(name));
+      plan.headers.push_back(name);
+    }
+  }
+
+  if (!cond)
+    return plan;
+  // each conjunct naming one side filters that side before the join
+  std::vector<const Condition *> conjuncts;
+  if (cond->kind == CondKind::AND) {
+    for (const auto &child : cond->children)
+      conjuncts.push_back(&child);
+  } else {
+    conjuncts.push_back(&*cond);
+  }
+  std::vector<ColumnCondition> pushed[2];
+  for (const Condition *c : conjuncts) {
+    unsigned named = condition_sides(*c, locate);
+    if (named == 3) {
+      plan.residual.push_back(resolve_filter(*c, locate));
+      continue;
+    }
+    size_t side = named == 1 ? 0 : 1;
+    pushed[side].push_back(resolve_condition(
+        *c, [&](const std::string &name) { return locate(name).second; }));
+  }
+  for (size_t side = 0; side < 2; ++side) {
+    if (pushed[side].size() == 1) {
+      plan.where[side] = std::move(pushed[side][0]);
+    } else if (!pushed[side].empty()) {
+      ColumnCondition all{0, CmpOp::EQ, nullptr};
+      all.kind = CondKind::AND;
+      all.children = std::move(pushed[side]);
+      plan.where[side] = std::move(all);
+    }
+  }
+  return plan;
+}
+
+void Table::join_rows(const Table &other, const JoinPlan &plan,
+                      RowSink &sink) const {
+  // both sides are read as of their last commit
+  if (!is_view) {
+    snapshot()->join_rows(other, plan, sink);
+    return;
+  }
+  if (!other.is_view) {
+    join_rows(*other.snapshot(), plan, sink);
+    return;
+  }
+  sink.begin(plan.headers);
+  if (schema->columns[plan.key[0]].type == Type::INT)
+    join_rows_by<int64_t>(other, plan, sink);
+  else
+    join_rows_by<std::string_view>(other, plan, sink);
+  sink.end();
+}
+
+template <typename Key>
+void Table::join_rows_by(const Table &other, const JoinPlan &plan,
+                         RowSink &sink) const {
+  using KeyColumn =
+      std::conditional_t<std::is_same_v<Key, int64_t>, IntColumn, StrColumn>;
+  constexpr size_t kBatchRows = 1024;
+  // e.g. under LIMIT 0
+  if (sink.done())
+    return;
+  const Table *sides[2] = {this, &other};
+  std::vector<size_t> rows[2] = {matching_rows(plan.where[0]),
+                                 other.matching_rows(plan.where[1])};
+  size_t build = rows[1].size() < rows[0].size() ? 1 : 0;
+  size_t probe = 1 - build;
+  const auto &build_keys =
+      std::get<KeyColumn>(sides[build]->data[plan.key[build]]);
+  const auto &probe_keys =
+      std::get<KeyColumn>(sides[probe]->data[plan.key[probe]]);
+
+  // number the build side's keys, then lay its rows out key by key: the
+  // rows of key g are matches[first[g], first[g + 1]), ascending
+  GroupTable<Key> keys(0, 0);
+  const std::vector<size_t> &built = rows[build];
+  std::vector<uint32_t> key_of(built.size());
+  for (size_t i = 0; i < built.size(); ++i) {
+    Key k = build_keys.get(built[i]);
+    key_of[i] = static_cast<uint32_t>(keys.add_row(k, group_hash(k)));
+  }
+  std::vector<size_t> first(keys.size() + 1, 0);
+  for (size_t g = 0; g < keys.size(); ++g)
+    first[g + 1] = first[g] + static_cast<size_t>(keys.rows(g));
+  std::vector<size_t> matches(built.size());
+  {
+    std::vector<size_t> next(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < built.size(); ++i)
+      matches[next[key_of[i]]++] = built[i];
+  }
+
+  std::vector<PairFilter> filters;
+  for (const auto &f : plan.residual)
+    filters.emplace_back(sides, f);
+  const std::vector<size_t> &probing = rows[probe];
+  // joins probe rows [begin, end) into out
+  auto probe_range = [&](size_t begin, size_t end, QueryResult &out) {
+    std::vector<size_t> paired[2];
+    size_t pair[2];
+    for (size_t i = begin; i < end; ++i) {
+      pair[probe] = probing[i];
+      Key k = probe_keys.get(pair[probe]);
+      size_t g = keys.find(k, group_hash(k));
+      if (g == GroupTable<Key>::kNone)
+        continue;
+      for (size_t j = first[g]; j < first[g + 1]; ++j) {
+        pair[build] = matches[j];
+        bool pass = true;
+        for (size_t f = 0; f < filters.size() && pass; ++f)
+          pass = filters[f].matches(pair);
+        if (!pass)
+          continue;
+        paired[0].push_back(pair[0]);
+        paired[1].push_back(pair[1]);
+      }
+    }
+    size_t n = paired[0].size();
+    if (n == 0)
+      return;
+    out.columns.resize(plan.columns.size());
+    for (size_t c = 0; c < plan.columns.size(); ++c) {
+      auto [side, col] = plan.columns[c];
+      out.columns[c].type = sides[side]->schema->columns[col].type;
+      gather(sides[side]->data[col], paired[side].data(), n, out.columns[c]);
+    }
+  };
+
+  // as a LIMIT in scan_rows, a sink that is done stops the probe
+  size_t nprobe = probing.size();
+  if (!use_parallel_scan(nprobe)) {
+    for (size_t begin = 0; begin < nprobe && !sink.done();
+         begin += kBatchRows) {
+      QueryResult batch;
+      probe_range(begin, std::min(nprobe, begin + kBatchRows), batch);
+      if (batch.row_count() > 0)
+        sink.write(std::move(batch));
+    }
+    return;
+  }
+  // as in scan_rows: a window of morsels is probed in parallel and the
+  // fragments are streamed out in order before the next window starts
+  const auto &opts = parallel_options();
+  size_t window = opts.morsel_rows * opts.threads * 2;
+  for (size_t w = 0; w < nprobe && !sink.done(); w += window) {
+    size_t wn = std::min(window, nprobe - w);
+    std::vector<QueryResult> parts(morsel_count(wn));
+    parallel_morsels(wn, [&](size_t m, size_t begin, size_t end) {
+      probe_range(w + begin, w + end, parts[m]);
+    });
+    for (auto &p : parts) {
+      if (sink.done())
+        break;
+      if (p.row_count() > 0)
+        sink.write(std::move(p));
+    }
+  }
+}
+
+void Table::group_rows(const GroupPlan &plan,
+                       const std::optional<ColumnCondition> &cond,
+                       RowSink &sink) const {
+  if (!is_view) {
+    snapshot()->group_rows(plan, cond, sink);
+    return;
+  }
+  if (schema->columns[plan.key].type == Type::INT)
+    group_rows_by<int64_t>(plan, cond, sink);
+  else
+    group_rows_by<std::string_view>(plan, cond, sink);
+}
+
+template <typename Key>
+void Table::group_rows_by(const GroupPlan &plan,
+                          const std::optional<ColumnCondition> &cond,
+                          RowSink &sink) const {
+  constexpr size_t kBlockRows = 1024;
+  // each column is folded once, however many aggregates it feeds; slot[k]
+  // is aggregate k's place among the INT or the STR columns
+  std::vector<size_t> int_cols;
+  std::vector<size_t> str_cols;
+  std::vector<size_t> slot(plan.aggs.size(), 0);
+  for (size_t k = 0; k < plan.aggs.size(); ++k) {
+    size_t col = plan.aggs[k].column;
+    if (col == ColumnAggregate::kStar)
       continue;
-    std::vector<std::string> out;
-    out.reserve(proj.size());
-    for (size_t idx : proj)
-      out.push_back(row.cells[idx].to_string());
-    qr.rows.push_back(std::move(out));
+    auto &list = schema->columns[col].type == Type::INT ? int_cols : str_cols;
+    auto it = std::find(list.begin(), list.end(), col);
+    slot[k] = static_cast<size_t>(it - list.begin());
+    if (it == list.end())
+      list.push_back(col);
   }
-  return qr;
+
+  std::vector<size_t> rows;
+  bool indexed = index_lookup(cond, rows);
+  std::optional<BoundCondition> bound;
+  if (cond && !indexed)
+    bound.emplace(*this, *cond);
+  const BoundCondition *b = bound ? &*bound : nullptr;
+  const auto &opts = parallel_options();
+  bool parallel = !indexed && use_parallel_scan(nrows);
+  size_t nparts = parallel ? opts.threads * 4 : 1;
+  GroupFold<Key> fold(*this, plan.key, int_cols, str_cols, nparts);
+
+  if (indexed) {
+    for (size_t k = 0; k < rows.size(); k += kBlockRows)
+      fold.add(rows.data() + k, std::min(kBlockRows, rows.size() - k));
+  } else if (!parallel) {
+    for (size_t begin = 0; begin < nrows; begin += kBlockRows) {
+      rows.clear();
+      select_range(b, deleted, begin, std::min(nrows, begin + kBlockRows),
+                   rows);
+      fold.add(rows.data(), rows.size());
+    }
+  } else {
+    // one pre-aggregating fold per thread, fed morsels as they come
+    std::vector<GroupFold<Key>> locals(opts.threads, fold);
+    std::atomic<size_t> next{0};
+    size_t morsels = morsel_count(nrows);
+    parallel_tasks(locals.size(), [&](size_t task) {
+      std::vector<size_t> sel;
+      for (size_t m; (m = next.fetch_add(1)) < morsels;) {
+        size_t end = std::min(nrows, (m + 1) * opts.morsel_rows);
+        for (size_t begin = m * opts.morsel_rows; begin < end;
+             begin += kBlockRows) {
+          sel.clear();
+          select_range(b, deleted, begin, std::min(end, begin + kBlockRows),
+                       sel);
+          locals[task].add(sel.data(), sel.size());
+        }
+      }
+    });
+    // then each partition is merged across the threads on its own
+    parallel_tasks(nparts, [&](size_t p) {
+      fold.parts[p] = std::move(locals[0].parts[p]);
+      for (size_t t = 1; t < locals.size(); ++t)
+        fold.parts[p].merge(locals[t].parts[p]);
+    });
+  }
+
+  std::vector<std::string> headers;
+  for (size_t item : plan.layout) {
+    headers.push_back(item == GroupPlan::kKey
+                          ? schema->columns[plan.key].name
+                          : aggregate_header(plan.aggs[item]));
+  }
+  sink.begin(headers);
+  for (const GroupTable<Key> &part : fold.parts) {
+    for (size_t g0 = 0; g0 < part.size(); g0 += kBlockRows) {
+      size_t g1 = std::min(part.size(), g0 + kBlockRows);
+      QueryResult batch;
+      batch.columns.resize(plan.layout.size());
+      for (size_t c = 0; c < plan.layout.size(); ++c) {
+        ResultColumn &out = batch.columns[c];
+        size_t item = plan.layout[c];
+        if (item == GroupPlan::kKey) {
+          out.type = schema->columns[plan.key].type;
+          for (size_t g = g0; g < g1; ++g) {
+            if constexpr (std::is_same_v<Key, int64_t>)
+              out.ints.push_back(part.key(g));
+            else
+              out.strs.push_back(part.key(g));
+          }
+          continue;
+        }
+        const ColumnAggregate &a = plan.aggs[item];
+        out.type = aggregate_type(a);
+        bool star = a.column == ColumnAggregate::kStar;
+        bool is_int = !star && schema->columns[a.column].type == Type::INT;
+        // COUNT(*) reads neither
+        const IntAggregate no_ints;
+        const StrAggregate no_strs;
+        for (size_t g = g0; g < g1; ++g) {
+          const IntAggregate &ia =
+              !star && is_int ? part.int_at(g, slot[item]) : no_ints;
+          const StrAggregate &sa =
+              !star && !is_int ? part.str_at(g, slot[item]) : no_strs;
+          append_aggregate(out, a.func, part.rows(g), ia, sa);
+        }
+      }
+      sink.write(std::move(batch));
+    }
+  }
+  sink.end();
 }
 
 size_t Table::delete_where(const std::optional<Condition> &cond) {
-  size_t before = rows.size();
-  rows.erase(std::remove_if(rows.begin(), rows.end(),
-                            [&](const Row &r) { return row_matches(r, cond); }),
-             rows.end());
-  return before - rows.size();
+  return delete_rows(resolve(cond));
+}
+
+size_t Table::delete_rows(const std::optional<ColumnCondition> &cond) {
+  WriteLock wl(*this);
+  std::vector<size_t> dead = matching_rows(cond);
+  if (dead.empty())
+    return 0;
+  // no row moves, so the indexes (and views using them) stay valid
+  for (size_t row : dead)
+    deleted.set(row);
+  if (deleted.count() * kCompactFraction >= nrows)
+    compact();
+  commit();
+  return dead.size();
+}
+
+size_t Table::vacuum() {
+  WriteLock wl(*this);
+  size_t removed = compact();
+  commit();
+  return removed;
+}
+
+MemoryUsage Table::memory_usage() const {
+  MemoryUsage m;
+  for (const auto &d : data)
+    std::visit([&](const auto &col) { col.add_usage(m); }, d);
+  deleted.add_usage(m);
+  for (const auto &ix : ixs->list)
+    m.indexes += ix->memory_bytes();
+  return m;
+}
+
+size_t Table::compact() {
+  std::vector<size_t> dead = deleted.positions();
+  for (auto &d : data) {
+    std::visit(
+        [&](auto &col) {
+          col.erase_rows(dead);
+          col.shrink_to_fit();
+        },
+        d);
+  }
+  if (dead.empty())
+    return 0;
+  nrows -= dead.size();
+  deleted = RowBitmap();
+  // surviving rows have moved, so positions held by the indexes are stale
+  {
+    IndexWriteLock lk(ixs.get());
+    ++ixs->layout;
+    for (auto &ix : ixs->list)
+      ix->rebuild(data[ix->get_column()], nrows);
+  }
+  return dead.size();
 }
 
 size_t
 Table::update_where(const std::vector<std::pair<std::string, Value>> &sets,
                     const std::optional<Condition> &cond) {
-  std::vector<size_t> idxs;
-  idxs.reserve(sets.size());
-  for (const auto &p : sets) {
-    idxs.push_back(col_index(p.first));
-  }
-  size_t count = 0;
-  for (auto &r : rows) {
-    if (!row_matches(r, cond))
-      continue;
-    for (size_t k = 0; k < sets.size(); ++k) {
-      const auto &v = sets[k].second;
-      size_t idx = idxs[k];
-      if (v.type != columns[idx].type)
-        throw TypeError("Type mismatch in UPDATE for column " +
-                        columns[idx].name);
-      r.cells[idx] = v;
+  std::vector<std::pair<size_t, const Value *>> resolved;
+  resolved.reserve(sets.size());
+  for (const auto &p : sets)
+    resolved.emplace_back(col_index(p.first), &p.second);
+  return update_rows(resolved, resolve(cond));
+}
+
+size_t
+Table::update_rows(const std::vector<std::pair<size_t, const Value *>> &sets,
+                   const std::optional<ColumnCondition> &cond) {
+  WriteLock wl(*this);
+  const auto &columns = schema->columns;
+  // indexes that must follow each assignment
+  std::vector<std::vector<Index *>> touched(sets.size());
+  bool rekeys = false;
+  for (size_t k = 0; k < sets.size(); ++k) {
+    for (auto &ix : ixs->list) {
+      if (ix->get_column() == sets[k].first) {
+        touched[k].push_back(ix.get());
+        rekeys = true;
+      }
     }
-    ++count;
   }
-  return count;
+  std::vector<size_t> rows = matching_rows(cond);
+  if (rows.empty())
+    return 0;
+  // check every assignment before the first write so a bad one cannot
+  // leave a half-updated row behind
+  for (const auto &set : sets) {
+    if (set.second->type != columns[set.first].type)
+      throw TypeError("Type mismatch in UPDATE for column " +
+                      columns[set.first].name);
+  }
+  {
+    IndexWriteLock lk(rekeys ? ixs.get() : nullptr);
+    if (rekeys)
+      ++ixs->layout;
+    for (size_t row : rows) {
+      for (size_t k = 0; k < sets.size(); ++k) {
+        ColumnData &d = data[sets[k].first];
+        for (Index *ix : touched[k])
+          ix->erase(d, row);
+        store_value(d, row, *sets[k].second);
+        for (Index *ix : touched[k])
+          ix->insert(d, row);
+      }
+    }
+  }
+  commit();
+  return rows.size();
+}
+
+Database::Database() : catalog(nullptr) {
+  catalogs.push_back(std::make_unique<Catalog>());
+  catalog.store(catalogs.back().get());
 }
 
 void Database::create_table(const std::string &n,
                             const std::vector<Column> &cols) {
-  if (tables.count(n))
-    throw DBError("Table already exists: " + n);
-  tables.emplace(n, Table{n, cols});
+  uint64_t lsn = 0;
+  {
+    std::lock_guard<std::mutex> lk(catalog_mu);
+    const Catalog &cur = *catalog.load();
+    if (cur.count(n))
+      throw DBError("Table already exists: " + n);
+    tables.push_back(std::make_unique<Table>(n, cols));
+    auto next = std::make_unique<Catalog>(cur);
+    next->emplace(n, tables.back().get());
+    catalogs.push_back(std::move(next));
+    if (wal_log)
+      lsn = wal_log->log_create_table(n, cols);
+    catalog.store(catalogs.back().get());
+  }
+  make_durable(*this, lsn);
 }
 
-Table &Database::table(const std::string &n) {
-  auto it = tables.find(n);
-  if (it == tables.end())
-    throw DBError("Unknown table: " + n);
-  return it->second;
+void Database::create_index(const std::string &n, const std::string &tbl,
+                            const std::string &column, IndexKind kind) {
+  uint64_t lsn = 0;
+  {
+    std::lock_guard<std::mutex> lk(catalog_mu);
+    // index lists only change under the catalog lock
+    for (const auto &t : tables) {
+      if (t->has_index(n))
+        throw DBError("Index already exists: " + n);
+    }
+    table(tbl).create_index(n, column, kind);
+    if (wal_log)
+      lsn = wal_log->log_create_index(StmtCreateIndex{n, tbl, column, kind});
+  }
+  make_durable(*this, lsn);
 }
 
-const Table &Database::table(const std::string &n) const {
-  auto it = tables.find(n);
-  if (it == tables.end())
+Table *Database::find(const std::string &n) const {
+  const Catalog &cur = *catalog.load(std::memory_order_acquire);
+  auto it = cur.find(n);
+  if (it == cur.end())
     throw DBError("Unknown table: " + n);
   return it->second;
 }
 
-bool Condition::matches(const Table &t, const Row &r) const {
-  size_t idx = t.col_index(column);
-  const Value &v = r.cells[idx];
-  int cmp = v.compare(literal);
-  switch (op) {
-  case Op::EQ:
-    return cmp == 0;
-  case Op::NEQ:
-    return cmp != 0;
-  case Op::LT:
-    return cmp < 0;
-  case Op::GT:
-    return cmp > 0;
-  case Op::LE:
-    return cmp <= 0;
-  case Op::GE:
-    return cmp >= 0;
+Table &Database::table(const std::string &n) { return *find(n); }
+
+const Table &Database::table(const std::string &n) const { return *find(n); }
+
+std::vector<const Table *> Database::get_tables() const {
+  std::vector<const Table *> out;
+  for (const auto &entry : *catalog.load(std::memory_order_acquire))
+    out.push_back(entry.second);
+  return out;
+}
+
+Database::WriteBarrier::WriteBarrier(Database &db) : ddl(db.catalog_mu) {
+  writers.reserve(db.tables.size());
+  for (const auto &t : db.tables)
+    writers.emplace_back(t->write_mu);
+}
+
+std::vector<std::pair<std::string, MemoryUsage>> Database::memory_usage() {
+  WriteBarrier barrier(*this);
+  std::vector<std::pair<std::string, MemoryUsage>> out;
+  for (const auto &t : tables)
+    out.emplace_back(t->get_name(), t->memory_usage());
+  return out;
+}
+
+std::shared_ptr<PreparedStatement> Database::prepare(const std::string &sql) {
+  // plans stay alive while callers hold them, so dropping the whole cache
+  // when it fills up is safe and keeps its size bounded
+  constexpr size_t kMaxPlans = 1024;
+  {
+    std::lock_guard<std::mutex> lk(plans_mu);
+    auto it = plans.find(sql);
+    if (it != plans.end())
+      return it->second;
   }
-  return false;
+  // parse outside the lock; if two threads race, both plans work
+  auto plan = std::make_shared<PreparedStatement>(*this, sql);
+  std::lock_guard<std::mutex> lk(plans_mu);
+  if (plans.size() >= kMaxPlans)
+    plans.clear();
+  return plans.emplace(sql, plan).first->second;
 }
 
-std::optional<QueryResult> execute(Database &db, const Statement &stmt) {
+void Database::prepare_as(const std::string &n, const std::string &sql) {
+  auto plan = prepare(sql);
+  std::lock_guard<std::mutex> lk(plans_mu);
+  named[n] = std::move(plan);
+}
+
+static std::shared_ptr<PreparedStatement>
+find_named(const PreparedNames &names, const std::string &n) {
+  auto it = names.find(n);
+  if (it == names.end())
+    throw DBError("Unknown prepared statement: " + n);
+  return it->second;
+}
+
+std::shared_ptr<PreparedStatement> Database::prepared(const std::string &n) {
+  std::lock_guard<std::mutex> lk(plans_mu);
+  return find_named(named, n);
+}
+
+Checkpointer &Database::checkpointer() {
+  std::call_once(checkpoints_once,
+                 [this] { checkpoints = std::make_shared<Checkpointer>(); });
+  return *checkpoints;
+}
+
+bool Condition::matches(const Table &t, size_t row) const {
+  return BoundCondition(t, t.resolve(*this)).matches(row);
+}
+
+// Also called when an INSERT fails part way, so the log holds exactly the
+// rows that were applied.
+uint64_t log_appended(Database &db, const Table &t, size_t from) {
+  if (WriteAheadLog *log = db.wal())
+    return log->log_rows(t, from, t.slot_count());
+  return 0;
+}
+
+void make_durable(Database &db, uint64_t lsn) {
+  if (WriteAheadLog *log = db.wal(); log && lsn > 0)
+    log->commit(lsn);
+}
+
+bool execute(Database &db, const Statement &stmt, RowSink &sink,
+             PreparedNames *names) {
+  WriteAheadLog *log = db.wal();
   if (std::holds_alternative<StmtCreate>(stmt)) {
     const auto &s = std::get<StmtCreate>(stmt);
     db.create_table(s.name, s.columns);
-    return std::nullopt;
+    return false;
+  } else if (std::holds_alternative<StmtCreateIndex>(stmt)) {
+    const auto &s = std::get<StmtCreateIndex>(stmt);
+    db.create_index(s.name, s.table, s.column, s.kind);
+    return false;
   } else if (std::holds_alternative<StmtInsert>(stmt)) {
     const auto &s = std::get<StmtInsert>(stmt);
     auto &t = db.table(s.table);
@@ -168,34 +1768,129 @@ std::optional<QueryResult> execute(Database &db, const Statement &stmt) {
     idxs.reserve(s.columns.size());
     for (const auto &c : s.columns)
       idxs.push_back(t.col_index(c));
-    for (const auto &tup : s.values) {
-      if (tup.size() != s.columns.size())
-        throw DBError("INSERT values tuple length mismatch");
-      std::vector<std::optional<Value>> row_vals(t.get_columns().size());
-      // set provided columns
-      for (size_t k = 0; k < tup.size(); ++k) {
-        size_t idx = idxs[k];
-        row_vals[idx] = tup[k];
+    uint64_t lsn;
+    // rows before a failing tuple stay applied, so they are made durable
+    // before the error is reported
+    std::exception_ptr failed;
+    {
+      // readers see the statement's rows all at once, and concurrent
+      // writers cannot log theirs in between
+      Table::Batch batch(t);
+      size_t before = t.slot_count();
+      std::vector<const Value *> row(t.get_columns().size(), nullptr);
+      try {
+        for (const auto &tup : s.values) {
+          if (tup.size() != s.columns.size())
+            throw DBError("INSERT values tuple length mismatch");
+          // the rest stay null and take their defaults
+          for (size_t k = 0; k < tup.size(); ++k)
+            row[idxs[k]] = &tup[k];
+          t.insert_row(row);
+        }
+      } catch (...) {
+        failed = std::current_exception();
       }
-      // remainings default in insert_row
-      t.insert_row(row_vals);
+      lsn = log_appended(db, t, before);
     }
-    return std::nullopt;
+    // waited for once the table is free, so other writers join the sync
+    make_durable(db, lsn);
+    if (failed)
+      std::rethrow_exception(failed);
+    return false;
   } else if (std::holds_alternative<StmtDelete>(stmt)) {
     const auto &s = std::get<StmtDelete>(stmt);
     auto &t = db.table(s.table);
-    t.delete_where(s.where);
-    return std::nullopt;
+    uint64_t lsn = 0;
+    {
+      Table::Batch batch(t);
+      if (t.delete_where(s.where) > 0 && log)
+        lsn = log->log_delete(s);
+    }
+    make_durable(db, lsn);
+    return false;
   } else if (std::holds_alternative<StmtUpdate>(stmt)) {
     const auto &s = std::get<StmtUpdate>(stmt);
     auto &t = db.table(s.table);
-    t.update_where(s.sets, s.where);
-    return std::nullopt;
+    uint64_t lsn = 0;
+    {
+      Table::Batch batch(t);
+      if (t.update_where(s.sets, s.where) > 0 && log)
+        lsn = log->log_update(s);
+    }
+    make_durable(db, lsn);
+    return false;
+  } else if (std::holds_alternative<StmtCopy>(stmt)) {
+    const auto &s = std::get<StmtCopy>(stmt);
+    auto &t = db.table(s.table);
+    uint64_t lsn;
+    {
+      Table::Batch batch(t);
+      size_t before = t.slot_count();
+      copy_from_csv(t, s.path);
+      lsn = log_appended(db, t, before);
+    }
+    make_durable(db, lsn);
+    return false;
+  } else if (std::holds_alternative<StmtSave>(stmt)) {
+    Database::WriteBarrier quiet(db);
+    save_snapshot(db, std::get<StmtSave>(stmt).path,
+                  log ? log->last_lsn() : 0);
+    return false;
+  } else if (std::holds_alternative<StmtCheckpoint>(stmt)) {
+    db.checkpointer().start(db, std::get<StmtCheckpoint>(stmt).path);
+    return false;
+  } else if (std::holds_alternative<StmtVacuum>(stmt)) {
+    // compaction moves rows but changes no contents, so it is not logged
+    const auto &s = std::get<StmtVacuum>(stmt);
+    if (!s.table.empty()) {
+      db.table(s.table).vacuum();
+      return false;
+    }
+    for (const Table *t : db.get_tables())
+      db.table(t->get_name()).vacuum();
+    return false;
+  } else if (std::holds_alternative<StmtPrepare>(stmt)) {
+    const auto &s = std::get<StmtPrepare>(stmt);
+    if (names)
+      (*names)[s.name] = db.prepare(s.sql);
+    else
+      db.prepare_as(s.name, s.sql);
+    return false;
+  } else if (std::holds_alternative<StmtExecute>(stmt)) {
+    const auto &s = std::get<StmtExecute>(stmt);
+    auto plan = names ? find_named(*names, s.name) : db.prepared(s.name);
+    return plan->execute(s.params, sink);
   } else {
     const auto &s = std::get<StmtSelect>(stmt);
     const auto &t = db.table(s.table);
-    return t.select_where(s.columns, s.star, s.where);
+    ColumnOrdering order = t.resolve(s.order);
+    if (s.join) {
+      const auto &other = db.table(s.join->table);
+      LimitSink limited(sink, order.limit, order.offset);
+      t.join_rows(other,
+                  t.resolve_join(other, *s.join, s.columns, s.star, s.where),
+                  limited);
+    } else if (!s.group_by.empty() || !s.aggregates.empty()) {
+      // their rows are few, so LIMIT and OFFSET apply as they stream out
+      LimitSink limited(sink, order.limit, order.offset);
+      if (!s.group_by.empty())
+        t.group_rows(t.resolve_group(s.group_by, s.columns, s.aggregates),
+                     t.resolve(s.where), limited);
+      else
+        t.aggregate_where(s.aggregates, s.where, limited);
+    } else {
+      t.scan_rows(t.build_projection(s.columns, s.star), t.resolve(s.where),
+                  sink, order);
+    }
+    return true;
   }
 }
 
+std::optional<QueryResult> execute(Database &db, const Statement &stmt) {
+  ResultCollector collector;
+  if (!execute(db, stmt, collector))
+    return std::nullopt;
+  return std::move(collector.result);
+}
+
 } // namespace db
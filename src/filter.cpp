@@ -0,0 +1,182 @@
+#include "filter.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INMEMDB_X86 1
+#endif
+
+namespace db {
+
+template <CmpOp Op> static inline bool compare(int64_t v, int64_t lit) {
+  if constexpr (Op == CmpOp::EQ)
+    return v == lit;
+  else if constexpr (Op == CmpOp::NEQ)
+    return v != lit;
+  else if constexpr (Op == CmpOp::LT)
+    return v < lit;
+  else if constexpr (Op == CmpOp::GT)
+    return v > lit;
+  else if constexpr (Op == CmpOp::LE)
+    return v <= lit;
+  else
+    return v >= lit;
+}
+
+template <CmpOp Op>
+static void filter_scalar(const int64_t *values, size_t n, int64_t lit,
+                          uint64_t *bits) {
+  for (size_t w = 0; w * 64 < n; ++w) {
+    const int64_t *v = values + w * 64;
+    size_t lim = n - w * 64 < 64 ? n - w * 64 : 64;
+    uint64_t word = 0;
+    for (size_t j = 0; j < lim; ++j)
+      word |= static_cast<uint64_t>(compare<Op>(v[j], lit)) << j;
+    bits[w] = word;
+  }
+}
+
+#ifdef INMEMDB_X86
+
+// The vector kernels fill whole 64-row words and leave the remainder to the
+// scalar kernel. Only EQ and GT exist as instructions; the other operators
+// swap operands and/or invert the lane mask.
+
+template <CmpOp Op>
+__attribute__((target("sse4.2"))) static inline unsigned
+sse42_mask(__m128i v, __m128i lit) {
+  __m128i m;
+  if constexpr (Op == CmpOp::EQ || Op == CmpOp::NEQ)
+    m = _mm_cmpeq_epi64(v, lit);
+  else if constexpr (Op == CmpOp::GT || Op == CmpOp::LE)
+    m = _mm_cmpgt_epi64(v, lit);
+  else
+    m = _mm_cmpgt_epi64(lit, v);
+  unsigned bits = static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(m)));
+  if constexpr (Op == CmpOp::NEQ || Op == CmpOp::LE || Op == CmpOp::GE)
+    bits ^= 0x3u;
+  return bits;
+}
+
+template <CmpOp Op>
+__attribute__((target("sse4.2"))) static void
+filter_sse42(const int64_t *values, size_t n, int64_t lit, uint64_t *bits) {
+  const __m128i l = _mm_set1_epi64x(lit);
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    uint64_t word = 0;
+    for (size_t j = 0; j < 64; j += 2) {
+      __m128i v =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i + j));
+      word |= static_cast<uint64_t>(sse42_mask<Op>(v, l)) << j;
+    }
+    bits[i / 64] = word;
+  }
+  if (i < n)
+    filter_scalar<Op>(values + i, n - i, lit, bits + i / 64);
+}
+
+template <CmpOp Op>
+__attribute__((target("avx2"))) static inline unsigned avx2_mask(__m256i v,
+                                                                 __m256i lit) {
+  __m256i m;
+  if constexpr (Op == CmpOp::EQ || Op == CmpOp::NEQ)
+    m = _mm256_cmpeq_epi64(v, lit);
+  else if constexpr (Op == CmpOp::GT || Op == CmpOp::LE)
+    m = _mm256_cmpgt_epi64(v, lit);
+  else
+    m = _mm256_cmpgt_epi64(lit, v);
+  unsigned bits =
+      static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+  if constexpr (Op == CmpOp::NEQ || Op == CmpOp::LE || Op == CmpOp::GE)
+    bits ^= 0xFu;
+  return bits;
+}
+
+template <CmpOp Op>
+__attribute__((target("avx2"))) static void
+filter_avx2(const int64_t *values, size_t n, int64_t lit, uint64_t *bits) {
+  const __m256i l = _mm256_set1_epi64x(lit);
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    uint64_t word = 0;
+    for (size_t j = 0; j < 64; j += 4) {
+      __m256i v = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(values + i + j));
+      word |= static_cast<uint64_t>(avx2_mask<Op>(v, l)) << j;
+    }
+    bits[i / 64] = word;
+  }
+  if (i < n)
+    filter_scalar<Op>(values + i, n - i, lit, bits + i / 64);
+}
+
+#endif
+
+SimdLevel detect_simd_level() {
+  static const SimdLevel level = [] {
+#ifdef INMEMDB_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+      return SimdLevel::SSE42;
+#endif
+    return SimdLevel::SCALAR;
+  }();
+  return level;
+}
+
+bool simd_level_supported(SimdLevel level) {
+  return static_cast<int>(level) <= static_cast<int>(detect_simd_level());
+}
+
+template <CmpOp Op> static FilterKernel kernel_for(SimdLevel level) {
+#ifdef INMEMDB_X86
+  if (level == SimdLevel::AVX2)
+    return &filter_avx2<Op>;
+  if (level == SimdLevel::SSE42)
+    return &filter_sse42<Op>;
+#else
+  (void)level;
+#endif
+  return &filter_scalar<Op>;
+}
+
+FilterKernel filter_kernel(CmpOp op, SimdLevel level) {
+  if (!simd_level_supported(level))
+    level = detect_simd_level();
+  switch (op) {
+  case CmpOp::EQ:
+    return kernel_for<CmpOp::EQ>(level);
+  case CmpOp::NEQ:
+    return kernel_for<CmpOp::NEQ>(level);
+  case CmpOp::LT:
+    return kernel_for<CmpOp::LT>(level);
+  case CmpOp::GT:
+    return kernel_for<CmpOp::GT>(level);
+  case CmpOp::LE:
+    return kernel_for<CmpOp::LE>(level);
+  case CmpOp::GE:
+    break;
+  }
+  return kernel_for<CmpOp::GE>(level);
+}
+
+void append_selection(const uint64_t *bits, size_t n, size_t base,
+                      std::vector<size_t> &out) {
+  size_t words = (n + 63) / 64;
+  size_t hits = 0;
+  for (size_t w = 0; w < words; ++w)
+    hits += static_cast<size_t>(__builtin_popcountll(bits[w]));
+  size_t pos = out.size();
+  out.resize(pos + hits);
+  for (size_t w = 0; w < words; ++w) {
+    uint64_t word = bits[w];
+    while (word) {
+      out[pos++] = base + w * 64 + static_cast<size_t>(__builtin_ctzll(word));
+      word &= word - 1;
+    }
+  }
+}
+
+} // namespace db
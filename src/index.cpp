@@ -0,0 +1,152 @@
+#include "index.hpp"
+#include "database.hpp"
+#include <tuple>
+
+namespace db {
+
+void Index::rebuild(const ColumnData &col, size_t nrows) {
+  clear();
+  for (size_t row = 0; row < nrows; ++row)
+    insert(col, row);
+}
+
+// Calls f with s as a key of the string map. Keys that fit in a stack
+// buffer are built there, so probes do not allocate.
+template <typename F> static void with_key(std::string_view s, F &&f) {
+  char buf[256];
+  std::pmr::monotonic_buffer_resource stack(buf, sizeof(buf));
+  f(std::pmr::string(s, &stack));
+}
+
+void HashIndex::add(Rows &rows, size_t row) {
+  if (row >= slot.size())
+    slot.resize(row + 1);
+  slot[row] = rows.size();
+  rows.push_back(row);
+}
+
+// Take `row` out of the rows of its key, moving the last of them into its
+// place; a key left without rows is dropped.
+template <typename Map, typename Key>
+void HashIndex::remove(Map &m, const Key &key, size_t row) {
+  auto it = m.find(key);
+  if (it == m.end() || row >= slot.size())
+    return;
+  Rows &rows = it->second;
+  size_t at = slot[row];
+  if (at >= rows.size() || rows[at] != row)
+    return;
+  rows[at] = rows.back();
+  slot[rows[at]] = at;
+  rows.pop_back();
+  if (rows.empty())
+    m.erase(it);
+}
+
+void HashIndex::insert(const ColumnData &col, size_t row) {
+  if (auto *ic = std::get_if<IntColumn>(&col)) {
+    add(ints[ic->get(row)], row);
+    return;
+  }
+  std::string_view s = std::get<StrColumn>(col).get(row);
+  with_key(s, [&](const std::pmr::string &key) {
+    auto it = strs.find(key);
+    if (it == strs.end())
+      it = strs.emplace(std::piecewise_construct, std::forward_as_tuple(s),
+                        std::forward_as_tuple())
+               .first;
+    add(it->second, row);
+  });
+}
+
+void HashIndex::erase(const ColumnData &col, size_t row) {
+  if (auto *ic = std::get_if<IntColumn>(&col))
+    remove(ints, ic->get(row), row);
+  else
+    with_key(std::get<StrColumn>(col).get(row),
+             [&](const std::pmr::string &key) { remove(strs, key, row); });
+}
+
+void HashIndex::clear() {
+  // drop the maps whole, bucket arrays too, so the pool can hand all its
+  // memory back
+  ints = decltype(ints)(&pool);
+  strs = decltype(strs)(&pool);
+  slot = decltype(slot)(&pool);
+  pool.release();
+}
+
+void HashIndex::lookup(CmpOp op, const Value &key,
+                       std::vector<size_t> &out) const {
+  if (op != CmpOp::EQ)
+    throw DBError("Hash index " + get_name() + " only supports '='");
+  const Rows *rows = nullptr;
+  if (key.type == Type::INT) {
+    auto it = ints.find(key.i);
+    rows = it == ints.end() ? nullptr : &it->second;
+  } else {
+    with_key(key.s, [&](const std::pmr::string &k) {
+      auto it = strs.find(k);
+      rows = it == strs.end() ? nullptr : &it->second;
+    });
+  }
+  if (rows)
+    out.insert(out.end(), rows->begin(), rows->end());
+}
+
+void BTreeIndex::insert(const ColumnData &col, size_t row) {
+  if (auto *ic = std::get_if<IntColumn>(&col))
+    ints.insert(ic->get(row), row);
+  else
+    strs.insert(std::string(std::get<StrColumn>(col).get(row)), row);
+}
+
+void BTreeIndex::erase(const ColumnData &col, size_t row) {
+  if (auto *ic = std::get_if<IntColumn>(&col))
+    ints.erase(ic->get(row), row);
+  else
+    strs.erase(std::string(std::get<StrColumn>(col).get(row)), row);
+}
+
+void BTreeIndex::clear() {
+  ints.clear();
+  strs.clear();
+}
+
+template <typename K>
+static void range_lookup(const BPlusTree<K> &tree, CmpOp op, const K &key,
+                         std::vector<size_t> &out) {
+  using Bound = typename BPlusTree<K>::Bound;
+  Bound lo{nullptr, false};
+  Bound hi{nullptr, false};
+  switch (op) {
+  case CmpOp::EQ:
+    lo = hi = Bound{&key, true};
+    break;
+  case CmpOp::LT:
+    hi = Bound{&key, false};
+    break;
+  case CmpOp::LE:
+    hi = Bound{&key, true};
+    break;
+  case CmpOp::GT:
+    lo = Bound{&key, false};
+    break;
+  case CmpOp::GE:
+    lo = Bound{&key, true};
+    break;
+  case CmpOp::NEQ:
+    throw DBError("Ordered index cannot answer '!='");
+  }
+  tree.scan(lo, hi, [&](const K &, size_t row) { out.push_back(row); });
+}
+
+void BTreeIndex::lookup(CmpOp op, const Value &key,
+                        std::vector<size_t> &out) const {
+  if (key.type == Type::INT)
+    range_lookup(ints, op, static_cast<int64_t>(key.i), out);
+  else
+    range_lookup(strs, op, key.s, out);
+}
+
+} // namespace db
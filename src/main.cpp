@@ -1,59 +1,179 @@
+#include "checkpoint.hpp"
 #include "database.hpp"
 #include "output.hpp"
+#include "parallel.hpp"
 #include "parser.hpp"
+#include "server.hpp"
+#include "snapshot.hpp"
+#include "wal.hpp"
+#include <csignal>
 #include <cstdio>
 #include <iostream>
-#include <sstream>
+#include <memory>
 #include <string>
 #include <unistd.h>
 
 using namespace db;
 
+static void report_checkpoint(const CheckpointReport &r) {
+  if (!r.ok) {
+    std::cerr << "Checkpoint to " << r.path << " failed: " << r.error << "\n";
+    return;
+  }
+  std::cerr << "Checkpoint to " << r.path << " finished in " << r.seconds
+            << " s (fork " << r.fork_seconds * 1000 << " ms, copy-on-write "
+            << r.cow_bytes / (1024.0 * 1024.0) << " MB)\n";
+}
+
+static Server *running_server = nullptr;
+
+static void stop_server(int) {
+  if (running_server)
+    running_server->stop();
+}
+
 int main(int argc, char **argv) {
   OutputMode mode = OutputMode::ASCII;
+  ParallelOptions par = parallel_options();
+  std::string load_path;
+  bool verify_load = false;
+  std::string wal_path;
+  WalOptions wal_opts;
+  std::string listen_address;
+  ServerOptions server_opts;
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
     if (arg == "--csv")
       mode = OutputMode::CSV;
     else if (arg == "--ascii")
       mode = OutputMode::ASCII;
-    else {
+    else if (arg == "--threads" && i + 1 < argc) {
+      try {
+        par.threads = std::stoul(argv[++i]);
+      } catch (const std::exception &) {
+        std::cerr << "Invalid thread count: " << argv[i] << "\n";
+        return 2;
+      }
+    } else if (arg == "--workers" && i + 1 < argc) {
+      try {
+        server_opts.workers = std::stoul(argv[++i]);
+      } catch (const std::exception &) {
+        std::cerr << "Invalid worker count: " << argv[i] << "\n";
+        return 2;
+      }
+    } else if (arg == "--listen" && i + 1 < argc) {
+      listen_address = argv[++i];
+    } else if (arg == "--load" && i + 1 < argc) {
+      load_path = argv[++i];
+    } else if (arg == "--verify") {
+      verify_load = true;
+    } else if (arg == "--wal" && i + 1 < argc) {
+      wal_path = argv[++i];
+    } else if (arg == "--wal-async") {
+      wal_opts.async_commit = true;
+    } else if ((arg == "--wal-group-size" || arg == "--wal-group-ms") &&
+               i + 1 < argc) {
+      try {
+        size_t v = std::stoul(argv[++i]);
+        if (arg == "--wal-group-size")
+          wal_opts.group_size = v;
+        else
+          wal_opts.group_interval = std::chrono::milliseconds(v);
+      } catch (const std::exception &) {
+        std::cerr << "Invalid value for " << arg << ": " << argv[i] << "\n";
+        return 2;
+      }
+    } else {
       std::cerr << "Unknown argument: " << arg << "\n";
       return 2;
     }
   }
 
-  if (isatty(fileno(stdin))) {
+  set_parallel_options(par);
+
+  if (listen_address.empty() && isatty(fileno(stdin))) {
     std::cerr << "Enter SQL statements (end with Ctrl+D):" << std::endl;
   }
 
-  std::ostringstream buf;
-  buf << std::cin.rdbuf();
-  std::string input = buf.str();
-
+  // the log outlives the database that points at it
+  std::unique_ptr<WriteAheadLog> wal;
   Database db;
-  auto stmts = split_statements(input);
+  try {
+    uint64_t lsn = 0;
+    if (!load_path.empty())
+      lsn = load_snapshot(db, load_path, verify_load);
+    if (!wal_path.empty()) {
+      wal = std::make_unique<WriteAheadLog>(wal_path, wal_opts);
+      wal->replay(db, lsn);
+      db.attach_wal(wal.get());
+    }
+  } catch (const DBError &e) {
+    std::cerr << "Load error: " << e.what() << "\n";
+    return 1;
+  }
 
-  for (size_t idx = 0; idx < stmts.size(); ++idx) {
+  if (!listen_address.empty()) {
+    server_opts.tick = [&db] {
+      if (auto r = db.checkpointer().poll())
+        report_checkpoint(*r);
+    };
     try {
-      Statement s = parse_statement(stmts[idx]);
-      auto res = execute(db, s);
-      if (res.has_value()) {
-        if (mode == OutputMode::CSV)
-          std::cout << to_csv(*res);
-        else
-          std::cout << to_ascii(*res);
+      Server server(db, listen_address, server_opts);
+      running_server = &server;
+      std::signal(SIGINT, stop_server);
+      std::signal(SIGTERM, stop_server);
+      std::cerr << "Listening on " << listen_address << std::endl;
+      server.run();
+      running_server = nullptr;
+    } catch (const DBError &e) {
+      running_server = nullptr;
+      std::cerr << "Server error: " << e.what() << "\n";
+      return 1;
+    }
+    if (auto r = db.checkpointer().poll(true))
+      report_checkpoint(*r);
+    return 0;
+  }
+
+  // statements run as soon as their ';' arrives; stdin is never held whole
+  StatementReader reader(fileno(stdin));
+  std::string sql;
+  size_t idx = 0;
+
+  while (true) {
+    try {
+      if (!reader.next(sql))
+        break;
+    } catch (const DBError &e) {
+      std::cerr << e.what() << "\n";
+      return 1;
+    }
+    ++idx;
+    try {
+      Statement s = parse_statement(sql);
+      if (mode == OutputMode::CSV) {
+        // rows go straight to stdout as they are produced
+        CsvWriter out(std::cout);
+        execute(db, s, out);
+      } else {
+        auto res = execute(db, s);
+        if (res.has_value())
+          std::cout << to_ascii(*res) << std::flush;
       }
     } catch (const ParseError &e) {
-      std::cerr << "Parse error in statement " << (idx + 1) << ": " << e.what()
+      std::cerr << "Parse error in statement " << idx << ": " << e.what()
                 << "\n";
     } catch (const DBError &e) {
-      std::cerr << "Execution error in statement " << (idx + 1) << ": "
-                << e.what() << "\n";
+      std::cerr << "Execution error in statement " << idx << ": " << e.what()
+                << "\n";
     } catch (const std::exception &e) {
-      std::cerr << "Unexpected error in statement " << (idx + 1) << ": "
+      std::cerr << "Unexpected error in statement " << idx << ": "
                 << e.what() << "\n";
     }
+    if (auto r = db.checkpointer().poll())
+      report_checkpoint(*r);
   }
+  if (auto r = db.checkpointer().poll(true))
+    report_checkpoint(*r);
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "mapped_file.hpp"
+#include "errors.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace db {
+
+static DBError file_error(const std::string &path) {
+  return DBError("Cannot read " + path + ": " + std::strerror(errno));
+}
+
+MappedFile::MappedFile(const std::string &path, bool sequential) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw file_error(path);
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    DBError err = file_error(path);
+    ::close(fd);
+    throw err;
+  }
+  len = static_cast<size_t>(st.st_size);
+  if (len > 0) {
+    void *p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      DBError err = file_error(path);
+      ::close(fd);
+      throw err;
+    }
+    if (sequential)
+      ::madvise(p, len, MADV_SEQUENTIAL);
+    ptr = static_cast<const char *>(p);
+  }
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (ptr)
+    ::munmap(const_cast<char *>(ptr), len);
+}
+
+void sync_parent_dir(const std::string &path) {
+  size_t slash = path.rfind('/');
+  std::string dir = ".";
+  if (slash == 0)
+    dir = "/";
+  else if (slash != std::string::npos)
+    dir = path.substr(0, slash);
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0 || ::fsync(fd) != 0) {
+    DBError err("Cannot sync directory " + dir + ": " + std::strerror(errno));
+    if (fd >= 0)
+      ::close(fd);
+    throw err;
+  }
+  ::close(fd);
+}
+
+} // namespace db
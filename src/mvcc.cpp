@@ -0,0 +1,110 @@
+#include "mvcc.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace db {
+
+static std::atomic<uint64_t> g_clock{0};
+
+uint64_t next_commit_ts() { return g_clock.fetch_add(1) + 1; }
+uint64_t last_commit_ts() { return g_clock.load(); }
+
+namespace {
+
+// Producers push onto a lock-free stack, so handing work over never blocks;
+// the mutex only serves the sleeping collector and reclaim_wait().
+class Reclaimer {
+public:
+  ~Reclaimer() {
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      stopping = true;
+    }
+    cv.notify_all();
+    if (worker.joinable())
+      worker.join();
+    run(head.exchange(nullptr));
+  }
+
+  void push(std::function<void()> fn) {
+    std::call_once(started,
+                   [this] { worker = std::thread([this] { loop(); }); });
+    auto *n = new Node{std::move(fn), head.load()};
+    while (!head.compare_exchange_weak(n->next, n)) {
+    }
+    submitted.fetch_add(1);
+    cv.notify_one();
+  }
+
+  void wait() {
+    uint64_t target = submitted.load();
+    std::unique_lock<std::mutex> lk(mu);
+    cv.notify_all();
+    idle.wait(lk, [&] { return completed.load() >= target; });
+  }
+
+private:
+  struct Node {
+    std::function<void()> fn;
+    Node *next;
+  };
+
+  std::atomic<Node *> head{nullptr};
+  std::atomic<uint64_t> submitted{0};
+  std::atomic<uint64_t> completed{0};
+  std::once_flag started;
+  std::thread worker;
+  std::mutex mu;
+  std::condition_variable cv;
+  std::condition_variable idle;
+  bool stopping{false};
+
+  void loop() {
+    std::unique_lock<std::mutex> lk(mu);
+    while (!stopping) {
+      // a notify can slip in between the check and the wait; the timeout
+      // bounds how long such work waits
+      cv.wait_for(lk, std::chrono::milliseconds(50), [this] {
+        return stopping || head.load() != nullptr;
+      });
+      Node *list = head.exchange(nullptr);
+      if (!list)
+        continue;
+      lk.unlock();
+      size_t n = run(list);
+      lk.lock();
+      completed.fetch_add(n);
+      idle.notify_all();
+    }
+  }
+
+  static size_t run(Node *list) {
+    size_t n = 0;
+    while (list) {
+      Node *next = list->next;
+      list->fn();
+      delete list;
+      list = next;
+      ++n;
+    }
+    return n;
+  }
+};
+
+Reclaimer &reclaimer() {
+  static Reclaimer r;
+  return r;
+}
+
+} // namespace
+
+void reclaim_later(std::function<void()> free_fn) {
+  reclaimer().push(std::move(free_fn));
+}
+
+void reclaim_wait() { reclaimer().wait(); }
+
+} // namespace db
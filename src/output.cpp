@@ -1,53 +1,203 @@
 #include "output.hpp"
 #include <algorithm>
+#include <charconv>
 #include <iomanip>
 #include <sstream>
 
 namespace db {
 
-static std::string csv_escape(const std::string &v) {
-  bool needs = v.find_first_of(",\"\n") != std::string::npos;
-  if (!needs)
-    return v;
-  std::string out = "\"";
-  for (char c : v) {
-    if (c == '"')
-      out += "\"\"";
+size_t QueryResult::row_count() const {
+  return typed() ? columns.front().size() : rows.size();
+}
+
+// Large enough for any int64_t in decimal.
+using IntBuf = char[24];
+
+// Text of a cell without allocating: integers are formatted into buf, strings
+// are viewed where they live.
+static std::string_view cell_text(const QueryResult &r, size_t row,
+                                  size_t col, IntBuf &buf) {
+  if (!r.typed())
+    return r.rows[row][col];
+  const ResultColumn &c = r.columns[col];
+  if (c.type == Type::STR)
+    return c.strs[row];
+  auto res = std::to_chars(buf, buf + sizeof(IntBuf), c.ints[row]);
+  return {buf, static_cast<size_t>(res.ptr - buf)};
+}
+
+std::string QueryResult::cell(size_t row, size_t col) const {
+  IntBuf buf;
+  return std::string(cell_text(*this, row, col, buf));
+}
+
+void QueryResult::slice(size_t from, size_t count) {
+  size_t n = row_count();
+  from = std::min(from, n);
+  count = std::min(count, n - from);
+  auto keep = [&](auto &v) {
+    v.erase(v.begin(), v.begin() + static_cast<std::ptrdiff_t>(from));
+    v.resize(count);
+  };
+  if (!typed()) {
+    keep(rows);
+    return;
+  }
+  for (ResultColumn &c : columns) {
+    if (c.type == Type::INT)
+      keep(c.ints);
     else
-      out += c;
+      keep(c.strs);
   }
-  out += "\"";
-  return out;
 }
 
-std::string to_csv(const QueryResult &r) {
-  std::ostringstream oss;
-  // header
-  for (size_t i = 0; i < r.headers.size(); ++i) {
+// CSV goes to a stream or is appended to a string.
+static void put(std::ostream &out, std::string_view s) { out << s; }
+static void put(std::string &out, std::string_view s) { out.append(s); }
+
+template <typename Out>
+static void write_csv_field(Out &out, std::string_view v) {
+  bool needs = v.find_first_of(",\"\n") != std::string_view::npos;
+  if (!needs) {
+    put(out, v);
+    return;
+  }
+  put(out, "\"");
+  for (size_t at = 0;;) {
+    size_t quote = v.find('"', at);
+    put(out, v.substr(at, quote - at));
+    if (quote == std::string_view::npos)
+      break;
+    put(out, "\"\"");
+    at = quote + 1;
+  }
+  put(out, "\"");
+}
+
+template <typename Out>
+static void write_csv_headers(Out &out,
+                              const std::vector<std::string> &headers) {
+  for (size_t i = 0; i < headers.size(); ++i) {
     if (i)
-      oss << ",";
-    oss << csv_escape(r.headers[i]);
+      put(out, ",");
+    write_csv_field(out, headers[i]);
   }
-  oss << "\n";
-  // rows
-  for (const auto &row : r.rows) {
-    for (size_t i = 0; i < row.size(); ++i) {
-      if (i)
-        oss << ",";
-      oss << csv_escape(row[i]);
+  put(out, "\n");
+}
+
+template <typename Out>
+static void write_csv_rows(Out &out, const QueryResult &r) {
+  size_t ncols = r.typed() ? r.columns.size() : 0;
+  IntBuf buf;
+  for (size_t row = 0; row < r.row_count(); ++row) {
+    if (!r.typed())
+      ncols = r.rows[row].size();
+    for (size_t col = 0; col < ncols; ++col) {
+      if (col)
+        put(out, ",");
+      write_csv_field(out, cell_text(r, row, col, buf));
     }
-    oss << "\n";
+    put(out, "\n");
   }
-  return oss.str();
+}
+
+void ResultCollector::begin(const std::vector<std::string> &headers) {
+  result.headers = headers;
+}
+
+// Copy the bytes of c.strs[from, end) into one block of c's arena and
+// point the views there.
+static void own_strings(ResultColumn &c, size_t from) {
+  size_t bytes = 0;
+  for (size_t i = from; i < c.strs.size(); ++i)
+    bytes += c.strs[i].size();
+  if (bytes == 0)
+    return;
+  std::shared_ptr<char[]> block(new char[bytes]);
+  char *dst = block.get();
+  for (size_t i = from; i < c.strs.size(); ++i) {
+    std::string_view v = c.strs[i];
+    std::copy(v.begin(), v.end(), dst);
+    c.strs[i] = std::string_view(dst, v.size());
+    dst += v.size();
+  }
+  c.arena.push_back(std::move(block));
+}
+
+void ResultCollector::write(QueryResult &&batch) {
+  if (result.row_count() == 0) {
+    result.columns = std::move(batch.columns);
+    result.rows = std::move(batch.rows);
+    for (ResultColumn &c : result.columns)
+      own_strings(c, 0);
+    return;
+  }
+  for (size_t c = 0; c < batch.columns.size(); ++c) {
+    ResultColumn &dst = result.columns[c];
+    ResultColumn &src = batch.columns[c];
+    size_t from = dst.strs.size();
+    dst.ints.insert(dst.ints.end(), src.ints.begin(), src.ints.end());
+    dst.strs.insert(dst.strs.end(), src.strs.begin(), src.strs.end());
+    own_strings(dst, from);
+  }
+  for (auto &row : batch.rows)
+    result.rows.push_back(std::move(row));
+}
+
+void LimitSink::begin(const std::vector<std::string> &headers) {
+  out.begin(headers);
+}
+
+void LimitSink::write(QueryResult &&batch) {
+  size_t n = batch.row_count();
+  if (skip >= n) {
+    skip -= n;
+    return;
+  }
+  if (left == 0)
+    return;
+  batch.slice(skip, left);
+  skip = 0;
+  left -= batch.row_count();
+  out.write(std::move(batch));
+}
+
+void LimitSink::end() { out.end(); }
+
+bool LimitSink::done() const { return left == 0 || out.done(); }
+
+void CsvWriter::begin(const std::vector<std::string> &headers) {
+  write_csv_headers(out, headers);
+}
+
+void CsvWriter::write(QueryResult &&batch) { write_csv_rows(out, batch); }
+
+void CsvWriter::end() { out.flush(); }
+
+void CsvStringWriter::begin(const std::vector<std::string> &headers) {
+  write_csv_headers(out, headers);
+}
+
+void CsvStringWriter::write(QueryResult &&batch) { write_csv_rows(out, batch); }
+
+std::string to_csv(const QueryResult &r) {
+  std::string out;
+  write_csv_headers(out, r.headers);
+  write_csv_rows(out, r);
+  return out;
 }
 
 std::string to_ascii(const QueryResult &r) {
   std::vector<size_t> widths(r.headers.size(), 0);
   for (size_t i = 0; i < r.headers.size(); ++i)
     widths[i] = r.headers[i].size();
-  for (const auto &row : r.rows) {
-    for (size_t i = 0; i < row.size(); ++i)
-      widths[i] = std::max(widths[i], row[i].size());
+  IntBuf buf;
+  auto row_width = [&](size_t row) {
+    return r.typed() ? r.columns.size() : r.rows[row].size();
+  };
+  for (size_t row = 0; row < r.row_count(); ++row) {
+    for (size_t i = 0; i < row_width(row); ++i)
+      widths[i] = std::max(widths[i], cell_text(r, row, i, buf).size());
   }
   auto line = [&]() {
     std::ostringstream s;
@@ -57,22 +207,23 @@ std::string to_ascii(const QueryResult &r) {
     }
     return s.str();
   };
-  auto fmt_row = [&](const std::vector<std::string> &cells) {
-    std::ostringstream s;
-    s << "|";
-    for (size_t i = 0; i < cells.size(); ++i) {
-      s << " " << std::left << std::setw(static_cast<int>(widths[i]))
-        << cells[i] << " |";
-    }
-    return s.str();
-  };
 
   std::ostringstream oss;
   oss << line() << "\n";
-  oss << fmt_row(r.headers) << "\n";
+  oss << "|";
+  for (size_t i = 0; i < r.headers.size(); ++i) {
+    oss << " " << std::left << std::setw(static_cast<int>(widths[i]))
+        << r.headers[i] << " |";
+  }
+  oss << "\n";
   oss << line() << "\n";
-  for (const auto &row : r.rows) {
-    oss << fmt_row(row) << "\n";
+  for (size_t row = 0; row < r.row_count(); ++row) {
+    oss << "|";
+    for (size_t i = 0; i < row_width(row); ++i) {
+      oss << " " << std::left << std::setw(static_cast<int>(widths[i]))
+          << cell_text(r, row, i, buf) << " |";
+    }
+    oss << "\n";
   }
   oss << line() << "\n";
   return oss.str();
@@ -0,0 +1,151 @@
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace db {
+
+ThreadPool::ThreadPool(size_t workers) {
+  threads.reserve(workers);
+  for (size_t i = 0; i < workers; ++i)
+    threads.emplace_back([this] { worker_loop(); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lk(mu);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lk(mu);
+    tasks.push_back(std::move(task));
+  }
+  cv.notify_one();
+}
+
+void ThreadPool::worker_loop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lk(mu);
+      cv.wait(lk, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty())
+        return;
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+static ParallelOptions g_options{
+    std::max<size_t>(1, std::thread::hardware_concurrency())};
+static std::unique_ptr<ThreadPool> g_pool;
+static std::mutex g_pool_mu;
+
+const ParallelOptions &parallel_options() { return g_options; }
+
+void set_parallel_options(const ParallelOptions &opts) {
+  std::lock_guard<std::mutex> lk(g_pool_mu);
+  g_options = opts;
+  g_options.threads = std::max<size_t>(1, g_options.threads);
+  g_options.morsel_rows = std::max<size_t>(1, g_options.morsel_rows);
+  g_pool.reset();
+}
+
+static ThreadPool *scan_pool() {
+  std::lock_guard<std::mutex> lk(g_pool_mu);
+  if (!g_pool && g_options.threads > 1)
+    g_pool = std::make_unique<ThreadPool>(g_options.threads - 1);
+  return g_pool.get();
+}
+
+bool use_parallel_scan(size_t rows) {
+  return g_options.threads > 1 && rows >= g_options.min_rows &&
+         rows > g_options.morsel_rows;
+}
+
+namespace {
+
+// Shared between the caller and its helpers. Helpers that get scheduled
+// after the caller has closed the job leave without touching fn, so the
+// caller only waits for helpers that actually joined.
+struct MorselJob {
+  std::atomic<size_t> next{0};
+  size_t n{0};
+  size_t grain{0};
+  const std::function<void(size_t, size_t, size_t)> *fn{nullptr};
+  std::mutex mu;
+  std::condition_variable cv;
+  size_t active{0};
+  bool closed{false};
+  std::exception_ptr error;
+
+  void work() {
+    while (true) {
+      size_t m = next.fetch_add(1);
+      size_t begin = m * grain;
+      if (begin >= n)
+        return;
+      try {
+        (*fn)(m, begin, std::min(n, begin + grain));
+      } catch (...) {
+        std::lock_guard<std::mutex> lk(mu);
+        if (!error)
+          error = std::current_exception();
+        next.store(n / grain + 1);
+      }
+    }
+  }
+};
+
+} // namespace
+
+static void run_job(size_t n, size_t grain,
+                    const std::function<void(size_t, size_t, size_t)> &fn) {
+  auto job = std::make_shared<MorselJob>();
+  job->n = n;
+  job->grain = grain;
+  job->fn = &fn;
+  size_t morsels = (n + grain - 1) / grain;
+  ThreadPool *pool = morsels > 1 ? scan_pool() : nullptr;
+  size_t helpers = pool ? std::min(pool->size(), morsels - 1) : 0;
+  for (size_t h = 0; h < helpers; ++h) {
+    pool->submit([job] {
+      {
+        std::lock_guard<std::mutex> lk(job->mu);
+        if (job->closed)
+          return;
+        ++job->active;
+      }
+      job->work();
+      std::lock_guard<std::mutex> lk(job->mu);
+      --job->active;
+      job->cv.notify_all();
+    });
+  }
+  job->work();
+  std::unique_lock<std::mutex> lk(job->mu);
+  job->closed = true;
+  job->cv.wait(lk, [&] { return job->active == 0; });
+  if (job->error)
+    std::rethrow_exception(job->error);
+}
+
+void parallel_morsels(size_t n,
+                      const std::function<void(size_t, size_t, size_t)> &fn) {
+  run_job(n, g_options.morsel_rows, fn);
+}
+
+void parallel_tasks(size_t n, const std::function<void(size_t)> &fn) {
+  run_job(n, 1, [&](size_t task, size_t, size_t) { fn(task); });
+}
+
+} // namespace db
@@ -1,7 +1,11 @@
 #include "parser.hpp"
 #include "tokenizer.hpp"
-#include <cctype>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
 #include <sstream>
+#include <unistd.h>
 
 namespace db {
 
@@ -12,29 +16,39 @@ static Type parse_type(const Token &t) {
     return Type::INT;
   if (t.text == "str")
     return Type::STR;
-  throw ParseError("Unknown type: " + t.text +
+  throw ParseError("Unknown type: " + std::string(t.text) +
                    " (types must be 'int' or 'str')");
 }
 
-static Value parse_literal(Token t) {
+// Literals met while parsing one statement. params, when set, receives the
+// parse-order ordinals of the '?' placeholders; otherwise '?' is an error.
+struct Literals {
+  std::vector<size_t> *params{nullptr};
+  size_t seen{0};
+};
+
+static Value parse_literal(const Token &t, Literals &lits) {
+  size_t ordinal = lits.seen++;
+  if (t.type == TokType::PARAM) {
+    if (!lits.params)
+      throw ParseError("Parameter '?' is only allowed in prepared statements");
+    lits.params->push_back(ordinal);
+    return Value::make_int(0);
+  }
   if (t.type == TokType::NUMBER) {
     long long v = 0;
-    try {
-      size_t pos = 0;
-      v = std::stoll(t.text, &pos, 10);
-      if (pos != t.text.size())
-        throw ParseError("Invalid integer literal: " + t.text);
-    } catch (...) {
-      throw ParseError("Invalid integer literal: " + t.text);
-    }
+    const char *end = t.text.data() + t.text.size();
+    auto res = std::from_chars(t.text.data(), end, v, 10);
+    if (res.ec != std::errc() || res.ptr != end)
+      throw ParseError("Invalid integer literal: " + std::string(t.text));
     return Value::make_int(v);
   } else if (t.type == TokType::STRING) {
-    return Value::make_str(t.text);
+    return Value::make_str(std::string(t.text));
   }
   throw ParseError("Expected literal (number or \"string\")");
 }
 
-static Condition::Op parse_op(Token t) {
+static Condition::Op parse_op(const Token &t) {
   switch (t.type) {
   case TokType::EQUAL:
     return Condition::Op::EQ;
@@ -54,48 +68,218 @@ static Condition::Op parse_op(Token t) {
   throw ParseError("Expected comparison operator (=, !=, <, >, <=, >=)");
 }
 
-static std::optional<Condition> parse_where(Tokenizer &tz) {
-  Token t = tz.peek();
-  if (t.type == TokType::IDENT && t.text == "WHERE") {
-    tz.next(); // WHERE
-    Token col = tz.next();
-    if (col.type != TokType::IDENT)
-      throw ParseError("Expected column name after WHERE");
-    Token op = tz.next();
-    auto cop = parse_op(op);
-    Token lit = tz.next();
-    Value v = parse_literal(lit);
-    return Condition{col.text, cop, v};
-  }
-  return std::nullopt;
+static void expect_keyword(Tokenizer &tz, Keyword kw) {
+  if (tz.next().kw != kw)
+    throw ParseError(std::string("Expected '") + keyword_name(kw) + "'");
 }
 
-static void expect_ident(Tokenizer &tz, const char *kw) {
-  Token t = tz.next();
-  if (t.type != TokType::IDENT || t.text != kw) {
-    throw ParseError(std::string("Expected '") + kw + "'");
-  }
+static bool accept_keyword(Tokenizer &tz, Keyword kw) {
+  if (tz.peek().kw != kw)
+    return false;
+  tz.next();
+  return true;
 }
 
 static std::string expect_ident_any(Tokenizer &tz) {
   Token t = tz.next();
   if (t.type != TokType::IDENT)
     throw ParseError("Expected identifier");
-  return t.text;
+  return std::string(t.text);
 }
 
-static void expect(Token t, TokType tt, const char *what) {
+static void expect(const Token &t, TokType tt, const char *what) {
   if (t.type != tt)
     throw ParseError(std::string("Expected ") + what);
 }
 
-Statement parse_statement(const std::string &stmt) {
+// WHERE expressions, loosest binding first:
+//   or   := and (OR and)*
+//   and  := not (AND not)*
+//   not  := NOT not | '(' or ')' | column test
+//   test := op literal | [NOT] IN '(' literal, ... ')'
+//         | [NOT] BETWEEN literal AND literal
+// Runs of AND or OR become one node with every operand, so conjuncts can
+// be reordered freely. Nesting is bounded so input cannot exhaust the
+// stack.
+constexpr size_t kMaxWhereDepth = 64;
+
+static Condition parse_or(Tokenizer &tz, Literals &lits, size_t depth);
+
+static Condition combine(CondKind kind, Condition a, Condition b) {
+  if (a.kind != kind) {
+    Condition node;
+    node.kind = kind;
+    node.children.push_back(std::move(a));
+    a = std::move(node);
+  }
+  if (b.kind == kind) {
+    for (auto &c : b.children)
+      a.children.push_back(std::move(c));
+  } else {
+    a.children.push_back(std::move(b));
+  }
+  return a;
+}
+
+static Condition negate(Condition c) {
+  Condition node;
+  node.kind = CondKind::NOT;
+  node.children.push_back(std::move(c));
+  return node;
+}
+
+static Condition parse_test(Tokenizer &tz, Literals &lits) {
+  Token col = tz.next();
+  if (col.type != TokType::IDENT)
+    throw ParseError("Expected column name in WHERE");
+  bool negated = accept_keyword(tz, Keyword::NOT);
+  Condition c;
+  c.column = std::string(col.text);
+  if (accept_keyword(tz, Keyword::IN)) {
+    c.kind = CondKind::IN;
+    expect(tz.next(), TokType::LPAREN, "'(' after IN");
+    while (true) {
+      c.values.push_back(parse_literal(tz.next(), lits));
+      if (tz.peek().type != TokType::COMMA)
+        break;
+      tz.next();
+    }
+    expect(tz.next(), TokType::RPAREN, "')' after IN list");
+  } else if (accept_keyword(tz, Keyword::BETWEEN)) {
+    Condition lo{c.column, CmpOp::GE, parse_literal(tz.next(), lits)};
+    expect_keyword(tz, Keyword::AND);
+    Condition hi{c.column, CmpOp::LE, parse_literal(tz.next(), lits)};
+    c = combine(CondKind::AND, std::move(lo), std::move(hi));
+  } else if (negated) {
+    throw ParseError("Expected IN or BETWEEN after NOT");
+  } else {
+    c.op = parse_op(tz.next());
+    c.literal = parse_literal(tz.next(), lits);
+  }
+  return negated ? negate(std::move(c)) : c;
+}
+
+static Condition parse_not(Tokenizer &tz, Literals &lits, size_t depth) {
+  if (depth > kMaxWhereDepth)
+    throw ParseError("WHERE clause is nested too deeply");
+  if (accept_keyword(tz, Keyword::NOT))
+    return negate(parse_not(tz, lits, depth + 1));
+  if (tz.peek().type == TokType::LPAREN) {
+    tz.next();
+    Condition c = parse_or(tz, lits, depth + 1);
+    expect(tz.next(), TokType::RPAREN, "')' in WHERE");
+    return c;
+  }
+  return parse_test(tz, lits);
+}
+
+static Condition parse_and(Tokenizer &tz, Literals &lits, size_t depth) {
+  Condition c = parse_not(tz, lits, depth);
+  while (accept_keyword(tz, Keyword::AND))
+    c = combine(CondKind::AND, std::move(c), parse_not(tz, lits, depth));
+  return c;
+}
+
+static Condition parse_or(Tokenizer &tz, Literals &lits, size_t depth) {
+  Condition c = parse_and(tz, lits, depth);
+  while (accept_keyword(tz, Keyword::OR))
+    c = combine(CondKind::OR, std::move(c), parse_and(tz, lits, depth));
+  return c;
+}
+
+static std::optional<Condition> parse_where(Tokenizer &tz, Literals &lits) {
+  if (!accept_keyword(tz, Keyword::WHERE))
+    return std::nullopt;
+  return parse_or(tz, lits, 0);
+}
+
+// The row count after LIMIT or OFFSET.
+static size_t parse_count(const Token &t, const char *clause) {
+  size_t v = 0;
+  const char *end = t.text.data() + t.text.size();
+  if (t.type == TokType::NUMBER) {
+    auto res = std::from_chars(t.text.data(), end, v, 10);
+    if (res.ec == std::errc() && res.ptr == end)
+      return v;
+  }
+  throw ParseError(std::string("Expected row count after ") + clause);
+}
+
+static Ordering parse_ordering(Tokenizer &tz) {
+  Ordering o;
+  if (accept_keyword(tz, Keyword::ORDER)) {
+    expect_keyword(tz, Keyword::BY);
+    o.column = expect_ident_any(tz);
+    if (tz.peek().type == TokType::COMMA)
+      throw ParseError("ORDER BY takes a single column");
+    if (accept_keyword(tz, Keyword::DESC))
+      o.descending = true;
+    else
+      accept_keyword(tz, Keyword::ASC);
+  }
+  if (accept_keyword(tz, Keyword::LIMIT)) {
+    o.limit = parse_count(tz.next(), "LIMIT");
+    if (accept_keyword(tz, Keyword::OFFSET))
+      o.offset = parse_count(tz.next(), "OFFSET");
+  }
+  return o;
+}
+
+// name '(' column ')', or COUNT(*); the name has already been read
+static Aggregate parse_aggregate(const Token &name, Tokenizer &tz) {
+  Aggregate agg{AggFunc::COUNT, {}};
+  if (name.text == "COUNT")
+    agg.func = AggFunc::COUNT;
+  else if (name.text == "SUM")
+    agg.func = AggFunc::SUM;
+  else if (name.text == "MIN")
+    agg.func = AggFunc::MIN;
+  else if (name.text == "MAX")
+    agg.func = AggFunc::MAX;
+  else if (name.text == "AVG")
+    agg.func = AggFunc::AVG;
+  else
+    throw ParseError("Unknown aggregate function: " + std::string(name.text) +
+                     " (expected COUNT, SUM, MIN, MAX or AVG)");
+  expect(tz.next(), TokType::LPAREN, "'('");
+  Token arg = tz.next();
+  if (arg.type == TokType::IDENT)
+    agg.column = std::string(arg.text);
+  else if (arg.type != TokType::STAR || agg.func != AggFunc::COUNT)
+    throw ParseError(std::string("Expected column name in ") +
+                     agg_func_name(agg.func) + "()");
+  expect(tz.next(), TokType::RPAREN, "')'");
+  return agg;
+}
+
+static Statement parse(std::string_view stmt, Literals &lits) {
   Tokenizer tz(stmt);
   Token t = tz.next();
   if (t.type != TokType::IDENT)
     throw ParseError("Expected statement keyword");
-  if (t.text == "CREATE") {
-    expect_ident(tz, "TABLE");
+  switch (t.kw) {
+  case Keyword::CREATE: {
+    if (accept_keyword(tz, Keyword::INDEX)) {
+      std::string idx = expect_ident_any(tz);
+      expect_keyword(tz, Keyword::ON);
+      std::string tbl = expect_ident_any(tz);
+      expect(tz.next(), TokType::LPAREN, "'('");
+      std::string col = expect_ident_any(tz);
+      expect(tz.next(), TokType::RPAREN, "')'");
+      IndexKind kind = IndexKind::HASH;
+      if (accept_keyword(tz, Keyword::USING)) {
+        Token method = tz.next();
+        if (method.kw == Keyword::BTREE)
+          kind = IndexKind::BTREE;
+        else if (method.kw != Keyword::HASH)
+          throw ParseError("Unknown index type: " + std::string(method.text) +
+                           " (expected HASH or BTREE)");
+      }
+      if (!tz.eof())
+        throw ParseError("Unexpected tokens after CREATE INDEX");
+      return StmtCreateIndex{idx, tbl, col, kind};
+    }
+    expect_keyword(tz, Keyword::TABLE);
     std::string tbl = expect_ident_any(tz);
     expect(tz.next(), TokType::LPAREN, "'('");
     std::vector<Column> cols;
@@ -117,8 +301,9 @@ Statement parse_statement(const std::string &stmt) {
     if (!tz.eof())
       throw ParseError("Unexpected tokens after CREATE TABLE");
     return StmtCreate{tbl, cols};
-  } else if (t.text == "INSERT") {
-    expect_ident(tz, "INTO");
+  }
+  case Keyword::INSERT: {
+    expect_keyword(tz, Keyword::INTO);
     std::string tbl = expect_ident_any(tz);
     expect(tz.next(), TokType::LPAREN, "'('");
     std::vector<std::string> cols;
@@ -135,7 +320,7 @@ Statement parse_statement(const std::string &stmt) {
       first = false;
       cols.push_back(expect_ident_any(tz));
     }
-    expect_ident(tz, "VALUES");
+    expect_keyword(tz, Keyword::VALUES);
     std::vector<std::vector<Value>> values;
     bool first_tuple = true;
     while (true) {
@@ -149,6 +334,7 @@ Statement parse_statement(const std::string &stmt) {
       first_tuple = false;
       expect(tz.next(), TokType::LPAREN, "'('");
       std::vector<Value> tup;
+      tup.reserve(cols.size());
       bool firstv = true;
       while (true) {
         Token nt = tz.peek();
@@ -160,7 +346,7 @@ Statement parse_statement(const std::string &stmt) {
           expect(tz.next(), TokType::COMMA, "','");
         }
         firstv = false;
-        tup.push_back(parse_literal(tz.next()));
+        tup.push_back(parse_literal(tz.next(), lits));
       }
       values.push_back(std::move(tup));
       Token next = tz.peek();
@@ -169,17 +355,19 @@ Statement parse_statement(const std::string &stmt) {
     }
     if (!tz.eof())
       throw ParseError("Unexpected tokens after INSERT");
-    return StmtInsert{tbl, cols, values};
-  } else if (t.text == "DELETE") {
-    expect_ident(tz, "FROM");
+    return StmtInsert{std::move(tbl), std::move(cols), std::move(values)};
+  }
+  case Keyword::DELETE: {
+    expect_keyword(tz, Keyword::FROM);
     std::string tbl = expect_ident_any(tz);
-    auto where = parse_where(tz);
+    auto where = parse_where(tz, lits);
     if (!tz.eof())
       throw ParseError("Unexpected tokens after DELETE");
     return StmtDelete{tbl, where};
-  } else if (t.text == "UPDATE") {
+  }
+  case Keyword::UPDATE: {
     std::string tbl = expect_ident_any(tz);
-    expect_ident(tz, "SET");
+    expect_keyword(tz, Keyword::SET);
     std::vector<std::pair<std::string, Value>> sets;
     bool first = true;
     while (true) {
@@ -193,76 +381,238 @@ Statement parse_statement(const std::string &stmt) {
       first = false;
       std::string col = expect_ident_any(tz);
       expect(tz.next(), TokType::EQUAL, "'='");
-      Value v = parse_literal(tz.next());
+      Value v = parse_literal(tz.next(), lits);
       sets.emplace_back(col, v);
       Token nxt = tz.peek();
       if (nxt.type != TokType::COMMA)
         break;
     }
-    auto where = parse_where(tz);
+    auto where = parse_where(tz, lits);
     if (!tz.eof())
       throw ParseError("Unexpected tokens after UPDATE");
     return StmtUpdate{tbl, sets, where};
-  } else if (t.text == "SELECT") {
+  }
+  case Keyword::SELECT: {
     std::vector<std::string> cols;
+    std::vector<Aggregate> aggs;
     bool star = false;
     Token a = tz.next();
     if (a.type == TokType::STAR) {
       star = true;
     } else if (a.type == TokType::IDENT) {
-      cols.push_back(a.text);
       while (true) {
-        Token c = tz.peek();
-        if (c.type == TokType::COMMA) {
-          tz.next();
-          cols.push_back(expect_ident_any(tz));
+        // a name followed by '(' calls an aggregate function
+        if (tz.peek().type == TokType::LPAREN) {
+          aggs.push_back(parse_aggregate(a, tz));
+          aggs.back().position = cols.size() + aggs.size() - 1;
         } else
+          cols.emplace_back(a.text);
+        if (tz.peek().type != TokType::COMMA)
           break;
+        tz.next();
+        a = tz.next();
+        if (a.type != TokType::IDENT)
+          throw ParseError("Expected column or aggregate after ','");
       }
     } else {
       throw ParseError("Expected '*' or column list after SELECT");
     }
-    expect_ident(tz, "FROM");
+    expect_keyword(tz, Keyword::FROM);
     std::string tbl = expect_ident_any(tz);
-    auto where = parse_where(tz);
+    std::optional<Join> join;
+    if (accept_keyword(tz, Keyword::JOIN)) {
+      join.emplace();
+      join->table = expect_ident_any(tz);
+      expect_keyword(tz, Keyword::ON);
+      join->left = expect_ident_any(tz);
+      expect(tz.next(), TokType::EQUAL, "'='");
+      join->right = expect_ident_any(tz);
+    }
+    auto where = parse_where(tz, lits);
+    std::string group_by;
+    if (accept_keyword(tz, Keyword::GROUP)) {
+      expect_keyword(tz, Keyword::BY);
+      group_by = expect_ident_any(tz);
+      if (tz.peek().type == TokType::COMMA)
+        throw ParseError("GROUP BY takes a single column");
+      if (star)
+        throw ParseError("SELECT * cannot be grouped");
+      for (const auto &c : cols) {
+        if (c != group_by)
+          throw ParseError("Column " + c + " must appear in GROUP BY");
+      }
+    } else if (!cols.empty() && !aggs.empty()) {
+      throw ParseError("Cannot mix columns and aggregates without GROUP BY");
+    }
+    Ordering order = parse_ordering(tz);
+    if (!order.column.empty() && (!aggs.empty() || !group_by.empty()))
+      throw ParseError("ORDER BY cannot be used with aggregates or GROUP BY");
+    if (join && (!aggs.empty() || !group_by.empty() || !order.column.empty()))
+      throw ParseError("JOIN cannot be used with aggregates, GROUP BY or "
+                       "ORDER BY");
     if (!tz.eof())
       throw ParseError("Unexpected tokens after SELECT");
-    return StmtSelect{tbl, cols, star, where};
-  } else {
-    throw ParseError("Unknown statement type: " + t.text +
+    return StmtSelect{tbl,
+                      cols,
+                      star,
+                      where,
+                      std::move(aggs),
+                      std::move(group_by),
+                      std::move(order),
+                      std::move(join)};
+  }
+  case Keyword::COPY: {
+    std::string tbl = expect_ident_any(tz);
+    expect_keyword(tz, Keyword::FROM);
+    Token path = tz.next();
+    expect(path, TokType::STRING, "file name string after FROM");
+    if (!tz.eof())
+      throw ParseError("Unexpected tokens after COPY");
+    return StmtCopy{std::move(tbl), std::string(path.text)};
+  }
+  case Keyword::SAVE: {
+    Token path = tz.next();
+    expect(path, TokType::STRING, "file name string after SAVE");
+    if (!tz.eof())
+      throw ParseError("Unexpected tokens after SAVE");
+    return StmtSave{std::string(path.text)};
+  }
+  case Keyword::CHECKPOINT: {
+    Token path = tz.next();
+    expect(path, TokType::STRING, "file name string after CHECKPOINT");
+    if (!tz.eof())
+      throw ParseError("Unexpected tokens after CHECKPOINT");
+    return StmtCheckpoint{std::string(path.text)};
+  }
+  case Keyword::VACUUM: {
+    StmtVacuum v;
+    if (!tz.eof())
+      v.table = expect_ident_any(tz);
+    if (!tz.eof())
+      throw ParseError("Unexpected tokens after VACUUM");
+    return v;
+  }
+  case Keyword::PREPARE: {
+    std::string name = expect_ident_any(tz);
+    expect_keyword(tz, Keyword::AS);
+    std::string_view body = tz.rest();
+    while (!body.empty() && is_space(body.front()))
+      body.remove_prefix(1);
+    // checked here so a bad body fails at PREPARE rather than EXECUTE
+    std::vector<size_t> params;
+    Statement inner = parse_statement(body, params);
+    if (std::holds_alternative<StmtPrepare>(inner) ||
+        std::holds_alternative<StmtExecute>(inner))
+      throw ParseError("PREPARE cannot wrap PREPARE or EXECUTE");
+    return StmtPrepare{std::move(name), std::string(body)};
+  }
+  case Keyword::EXECUTE: {
+    std::string name = expect_ident_any(tz);
+    std::vector<Value> params;
+    if (tz.peek().type == TokType::LPAREN) {
+      tz.next();
+      bool firstp = true;
+      while (tz.peek().type != TokType::RPAREN) {
+        if (!firstp)
+          expect(tz.next(), TokType::COMMA, "','");
+        firstp = false;
+        params.push_back(parse_literal(tz.next(), lits));
+      }
+      tz.next();
+    }
+    if (!tz.eof())
+      throw ParseError("Unexpected tokens after EXECUTE");
+    return StmtExecute{std::move(name), std::move(params)};
+  }
+  default:
+    throw ParseError("Unknown statement type: " + std::string(t.text) +
                      " (keywords must be uppercase)");
   }
 }
 
-std::vector<std::string> split_statements(const std::string &input) {
-  std::vector<std::string> out;
-  std::string cur;
-  bool in_string = false;
-  for (size_t i = 0; i < input.size(); ++i) {
-    char c = input[i];
+Statement parse_statement(std::string_view stmt) {
+  Literals lits;
+  return parse(stmt, lits);
+}
+
+Statement parse_statement(std::string_view stmt, std::vector<size_t> &params) {
+  Literals lits;
+  lits.params = &params;
+  return parse(stmt, lits);
+}
+
+void StatementSplitter::feed(std::string_view chunk,
+                             std::vector<std::string> &out) {
+  size_t start = 0;
+  for (size_t i = 0; i < chunk.size(); ++i) {
+    char c = chunk[i];
     if (c == '"') {
       in_string = !in_string;
-      cur.push_back(c);
     } else if (c == ';' && !in_string) {
       // end of stmt
-      // trim whitespace
-      size_t start = 0;
-      while (start < cur.size() &&
-             std::isspace(static_cast<unsigned char>(cur[start])))
-        ++start;
-      size_t end = cur.size();
-      while (end > start &&
-             std::isspace(static_cast<unsigned char>(cur[end - 1])))
-        --end;
-      if (end > start)
-        out.emplace_back(cur.substr(start, end - start));
+      cur.append(chunk.data() + start, i - start);
+      start = i + 1;
+      size_t b = 0;
+      while (b < cur.size() && is_space(cur[b]))
+        ++b;
+      size_t e = cur.size();
+      while (e > b && is_space(cur[e - 1]))
+        --e;
+      if (e > b)
+        out.emplace_back(cur, b, e - b);
       cur.clear();
-    } else {
-      cur.push_back(c);
     }
   }
+  cur.append(chunk.data() + start, chunk.size() - start);
+}
+
+std::vector<std::string> split_statements(const std::string &input) {
+  std::vector<std::string> out;
+  StatementSplitter splitter;
+  splitter.feed(input, out);
   // ignore trailing partial stmt without semicolon
   return out;
 }
 
+StatementReader::StatementReader(int fd, size_t chunk_size)
+    : fd(fd), buf(std::max<size_t>(1, chunk_size)) {}
+
+StatementReader::StatementReader(std::istream &in, size_t chunk_size)
+    : in(&in), buf(std::max<size_t>(1, chunk_size)) {}
+
+// Returns as soon as some input is available rather than waiting for a full
+// chunk, so statements typed into a pipe run right away. 0 means EOF.
+size_t StatementReader::fill() {
+  if (in) {
+    if (!in->read(buf.data(), 1))
+      return 0;
+    return 1 + static_cast<size_t>(in->readsome(buf.data() + 1,
+                                                buf.size() - 1));
+  }
+  while (true) {
+    ssize_t n = ::read(fd, buf.data(), buf.size());
+    if (n >= 0)
+      return static_cast<size_t>(n);
+    if (errno != EINTR)
+      throw DBError(std::string("Failed to read input: ") +
+                    std::strerror(errno));
+  }
+}
+
+bool StatementReader::next(std::string &stmt) {
+  while (ready_pos == ready.size()) {
+    if (done)
+      return false;
+    ready.clear();
+    ready_pos = 0;
+    size_t n = fill();
+    if (n == 0)
+      done = true;
+    else
+      splitter.feed(std::string_view(buf.data(), n), ready);
+  }
+  stmt = std::move(ready[ready_pos++]);
+  return true;
+}
+
 } // namespace db
@@ -0,0 +1,353 @@
+#include "predicate.hpp"
+#include <algorithm>
+#include <functional>
+#include <string_view>
+
+namespace db {
+
+// Default estimates in the spirit of System R's: an equality keeps a tenth
+// of the rows and a range a third. Costs are relative to one INT compare.
+constexpr double kEqSelectivity = 0.1;
+constexpr double kRangeSelectivity = 1.0 / 3;
+constexpr double kIntCompare = 1;
+constexpr double kStrCompare = 3;
+constexpr double kIntProbe = 2;
+constexpr double kStrProbe = 5;
+
+BoundCondition::BoundCondition(const Table &t, const ColumnCondition &c)
+    : kind(c.kind) {
+  switch (c.kind) {
+  case CondKind::CMP:
+    bind_leaf(t, c);
+    return;
+  case CondKind::IN:
+    bind_in(t, c);
+    return;
+  case CondKind::AND:
+  case CondKind::OR:
+  case CondKind::NOT:
+    break;
+  }
+  children.reserve(c.children.size());
+  for (const auto &child : c.children)
+    children.emplace_back(t, child);
+  order_children();
+}
+
+void BoundCondition::bind_leaf(const Table &t, const ColumnCondition &c) {
+  col = c.column;
+  const Value &lit = *c.literal;
+  if (t.col_at(col).type != lit.type)
+    throw TypeError("Type mismatch in comparison");
+  if (lit.type == Type::INT) {
+    ints = &std::get<IntColumn>(t.column_data(col));
+    int_lit = lit.i;
+    int_kernel = filter_kernel(c.op);
+    per_row = kIntCompare;
+  } else {
+    strs = &std::get<StrColumn>(t.column_data(col));
+    str_lit = lit.s;
+    per_row = kStrCompare;
+  }
+  switch (c.op) {
+  case CmpOp::EQ:
+    sel = kEqSelectivity;
+    bind<std::equal_to<>>();
+    break;
+  case CmpOp::NEQ:
+    sel = 1 - kEqSelectivity;
+    bind<std::not_equal_to<>>();
+    break;
+  case CmpOp::LT:
+    sel = kRangeSelectivity;
+    bind<std::less<>>();
+    break;
+  case CmpOp::GT:
+    sel = kRangeSelectivity;
+    bind<std::greater<>>();
+    break;
+  case CmpOp::LE:
+    sel = kRangeSelectivity;
+    bind<std::less_equal<>>();
+    break;
+  case CmpOp::GE:
+    sel = kRangeSelectivity;
+    bind<std::greater_equal<>>();
+    break;
+  }
+}
+
+void BoundCondition::bind_in(const Table &t, const ColumnCondition &c) {
+  col = c.column;
+  Type type = t.col_at(col).type;
+  for (const Value &v : *c.values) {
+    if (v.type != type)
+      throw TypeError("Type mismatch in IN list");
+  }
+  if (type == Type::INT) {
+    ints = &std::get<IntColumn>(t.column_data(col));
+    for (const Value &v : *c.values)
+      int_set.insert(v.i);
+    match_fn = &match_int_in;
+    select_fn = &select_int_in;
+    per_row = kIntProbe;
+  } else {
+    strs = &std::get<StrColumn>(t.column_data(col));
+    for (const Value &v : *c.values)
+      str_set.insert(v.s);
+    match_fn = &match_str_in;
+    select_fn = &select_str_in;
+    per_row = kStrProbe;
+  }
+  size_t n = type == Type::INT ? int_set.size() : str_set.size();
+  sel = std::min(1.0, kEqSelectivity * static_cast<double>(n));
+}
+
+// Orders the operands and derives this node's estimates from theirs. An
+// operand is only evaluated on the rows the ones before it left open, so
+// its cost counts in that proportion.
+void BoundCondition::order_children() {
+  if (kind == CondKind::NOT) {
+    sel = 1 - children[0].sel;
+    per_row = children[0].per_row;
+    return;
+  }
+  bool all = kind == CondKind::AND;
+  // AND wants rows rejected early, OR wants them accepted early
+  auto decided = [&](const BoundCondition &c) {
+    return all ? 1 - c.sel : c.sel;
+  };
+  std::stable_sort(children.begin(), children.end(),
+                   [&](const BoundCondition &a, const BoundCondition &b) {
+                     return decided(a) * b.per_row > decided(b) * a.per_row;
+                   });
+  double open = 1;
+  per_row = 0;
+  for (const auto &c : children) {
+    per_row += open * c.per_row;
+    open *= 1 - decided(c);
+  }
+  sel = all ? open : 1 - open;
+}
+
+bool BoundCondition::matches(size_t row) const {
+  switch (kind) {
+  case CondKind::CMP:
+  case CondKind::IN:
+    return match_fn(*this, row);
+  case CondKind::AND:
+    for (const auto &c : children) {
+      if (!c.matches(row))
+        return false;
+    }
+    return true;
+  case CondKind::OR:
+    for (const auto &c : children) {
+      if (c.matches(row))
+        return true;
+    }
+    return false;
+  case CondKind::NOT:
+    break;
+  }
+  return !children[0].matches(row);
+}
+
+// Remove from rows[from, end) the entries of [drop, drop_end); both ascend.
+static void erase_rows(std::vector<size_t> &rows, size_t from,
+                       const size_t *drop, const size_t *drop_end) {
+  size_t n = from;
+  for (size_t i = from; i < rows.size(); ++i) {
+    while (drop != drop_end && *drop < rows[i])
+      ++drop;
+    if (drop != drop_end && *drop == rows[i])
+      continue;
+    rows[n++] = rows[i];
+  }
+  rows.resize(n);
+}
+
+void BoundCondition::select(size_t begin, size_t end,
+                            std::vector<size_t> &out) const {
+  size_t from = out.size();
+  switch (kind) {
+  case CondKind::CMP:
+  case CondKind::IN:
+    select_fn(*this, begin, end, out);
+    return;
+  case CondKind::AND:
+    // the first operand scans; the rest only test its survivors
+    children[0].select(begin, end, out);
+    for (size_t k = 1; k < children.size() && out.size() > from; ++k)
+      children[k].refine(out, from);
+    return;
+  case CondKind::OR: {
+    children[0].select(begin, end, out);
+    std::vector<size_t> undecided(end - begin);
+    for (size_t i = 0; i < undecided.size(); ++i)
+      undecided[i] = begin + i;
+    erase_rows(undecided, 0, out.data() + from, out.data() + out.size());
+    select_any(out, from, std::move(undecided), 1);
+    return;
+  }
+  case CondKind::NOT:
+    break;
+  }
+  for (size_t row = begin; row < end; ++row)
+    out.push_back(row);
+  refine(out, from);
+}
+
+void BoundCondition::refine(std::vector<size_t> &rows, size_t from) const {
+  switch (kind) {
+  case CondKind::CMP:
+  case CondKind::IN: {
+    // write every candidate, advance only on a match
+    size_t n = from;
+    for (size_t i = from; i < rows.size(); ++i) {
+      size_t row = rows[i];
+      rows[n] = row;
+      n += match_fn(*this, row);
+    }
+    rows.resize(n);
+    return;
+  }
+  case CondKind::AND:
+    for (size_t k = 0; k < children.size() && rows.size() > from; ++k)
+      children[k].refine(rows, from);
+    return;
+  case CondKind::OR: {
+    std::vector<size_t> undecided(rows.begin() + from, rows.end());
+    rows.resize(from);
+    select_any(rows, from, std::move(undecided), 0);
+    return;
+  }
+  case CondKind::NOT:
+    break;
+  }
+  std::vector<size_t> hits(rows.begin() + from, rows.end());
+  children[0].refine(hits, 0);
+  erase_rows(rows, from, hits.data(), hits.data() + hits.size());
+}
+
+// OR from operand `first` on: each operand tests the undecided rows, and
+// the ones it accepts are merged into rows[from, end) and decided.
+void BoundCondition::select_any(std::vector<size_t> &rows, size_t from,
+                                std::vector<size_t> undecided,
+                                size_t first) const {
+  std::vector<size_t> hits;
+  for (size_t k = first; k < children.size() && !undecided.empty(); ++k) {
+    hits = undecided;
+    children[k].refine(hits, 0);
+    if (hits.empty())
+      continue;
+    erase_rows(undecided, 0, hits.data(), hits.data() + hits.size());
+    size_t mid = rows.size();
+    rows.insert(rows.end(), hits.begin(), hits.end());
+    std::inplace_merge(rows.begin() + static_cast<std::ptrdiff_t>(from),
+                       rows.begin() + static_cast<std::ptrdiff_t>(mid),
+                       rows.end());
+  }
+}
+
+template <typename Cmp> void BoundCondition::bind() {
+  if (ints) {
+    match_fn = &match_int<Cmp>;
+    select_fn = &select_int;
+  } else {
+    match_fn = &match_str<Cmp>;
+    select_fn = &select_str<Cmp>;
+  }
+}
+
+template <typename Cmp>
+bool BoundCondition::match_int(const BoundCondition &b, size_t row) {
+  return Cmp{}(b.ints->get(row), b.int_lit);
+}
+
+template <typename Cmp>
+bool BoundCondition::match_str(const BoundCondition &b, size_t row) {
+  return Cmp{}(b.strs->get(row), std::string_view(b.str_lit));
+}
+
+bool BoundCondition::match_int_in(const BoundCondition &b, size_t row) {
+  return b.int_set.count(b.ints->get(row)) != 0;
+}
+
+bool BoundCondition::match_str_in(const BoundCondition &b, size_t row) {
+  return b.str_set.count(b.strs->get(row)) != 0;
+}
+
+// INT scans run the vectorised kernel over each contiguous run of the
+// column (at most one storage chunk) and expand its bitmap into positions.
+void BoundCondition::select_int(const BoundCondition &b, size_t begin,
+                                size_t end, std::vector<size_t> &out) {
+  constexpr size_t kBlock = ColumnBuffer<int64_t>::kChunk;
+  uint64_t bits[kBlock / 64];
+  b.ints->buffer().runs(begin, end,
+                        [&](const int64_t *v, size_t n, size_t first) {
+                          b.int_kernel(v, n, b.int_lit, bits);
+                          append_selection(bits, n, first, out);
+                        });
+}
+
+// STR scans write every candidate position and advance the output cursor
+// only on a match, which keeps the loop free of branches and reallocation.
+template <typename Cmp>
+void BoundCondition::select_str(const BoundCondition &b, size_t begin,
+                                size_t end, std::vector<size_t> &out) {
+  size_t n = out.size();
+  out.resize(n + (end - begin));
+  size_t *dst = out.data();
+  const StrColumn &col = *b.strs;
+  const char *bytes = col.byte_data();
+  const std::string_view lit(b.str_lit);
+  Cmp cmp;
+  // offsets and lengths are chunked alike, so a run of one is a run of both
+  col.offset_buffer().runs(
+      begin, end, [&](const uint64_t *offs, size_t count, size_t first) {
+        const uint32_t *lens = &col.length_buffer()[first];
+        for (size_t i = 0; i < count; ++i) {
+          dst[n] = first + i;
+          n += cmp(std::string_view(bytes + offs[i], lens[i]), lit);
+        }
+      });
+  out.resize(n);
+}
+
+// IN scans probe the set with each value of a run, in the same branch-free
+// style.
+void BoundCondition::select_int_in(const BoundCondition &b, size_t begin,
+                                   size_t end, std::vector<size_t> &out) {
+  size_t n = out.size();
+  out.resize(n + (end - begin));
+  size_t *dst = out.data();
+  b.ints->buffer().runs(begin, end,
+                        [&](const int64_t *v, size_t count, size_t first) {
+                          for (size_t i = 0; i < count; ++i) {
+                            dst[n] = first + i;
+                            n += b.int_set.count(v[i]);
+                          }
+                        });
+  out.resize(n);
+}
+
+void BoundCondition::select_str_in(const BoundCondition &b, size_t begin,
+                                   size_t end, std::vector<size_t> &out) {
+  size_t n = out.size();
+  out.resize(n + (end - begin));
+  size_t *dst = out.data();
+  const StrColumn &col = *b.strs;
+  const char *bytes = col.byte_data();
+  col.offset_buffer().runs(
+      begin, end, [&](const uint64_t *offs, size_t count, size_t first) {
+        const uint32_t *lens = &col.length_buffer()[first];
+        for (size_t i = 0; i < count; ++i) {
+          dst[n] = first + i;
+          n += b.str_set.count(std::string_view(bytes + offs[i], lens[i]));
+        }
+      });
+  out.resize(n);
+}
+
+} // namespace db
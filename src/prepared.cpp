@@ -0,0 +1,262 @@
+#include "prepared.hpp"
+#include "parser.hpp"
+#include "wal.hpp"
+#include <exception>
+
+namespace db {
+
+// A condition's literals, operands in order, as the parser met them.
+static void condition_literals(Condition &c, std::vector<Value *> &out) {
+  switch (c.kind) {
+  case CondKind::CMP:
+    out.push_back(&c.literal);
+    return;
+  case CondKind::IN:
+    for (auto &v : c.values)
+      out.push_back(&v);
+    return;
+  case CondKind::AND:
+  case CondKind::OR:
+  case CondKind::NOT:
+    break;
+  }
+  for (auto &child : c.children)
+    condition_literals(child, out);
+}
+
+static void where_literal(std::optional<Condition> &where,
+                          std::vector<Value *> &out) {
+  if (where)
+    condition_literals(*where, out);
+}
+
+// The statement's literals in the order the parser met them.
+static std::vector<Value *> literals(Statement &stmt) {
+  std::vector<Value *> out;
+  if (auto *s = std::get_if<StmtInsert>(&stmt)) {
+    for (auto &tup : s->values)
+      for (auto &v : tup)
+        out.push_back(&v);
+  } else if (auto *s = std::get_if<StmtUpdate>(&stmt)) {
+    for (auto &set : s->sets)
+      out.push_back(&set.second);
+    where_literal(s->where, out);
+  } else if (auto *s = std::get_if<StmtDelete>(&stmt)) {
+    where_literal(s->where, out);
+  } else if (auto *s = std::get_if<StmtSelect>(&stmt)) {
+    where_literal(s->where, out);
+  }
+  return out;
+}
+
+PreparedStatement::PreparedStatement(Database &d, std::string_view sql)
+    : db(d) {
+  stmt = parse_statement(sql, ordinals);
+  if (std::holds_alternative<StmtPrepare>(stmt) ||
+      std::holds_alternative<StmtExecute>(stmt))
+    throw ParseError("Cannot prepare PREPARE or EXECUTE");
+  auto lits = literals(stmt);
+  slots.reserve(ordinals.size());
+  for (size_t ordinal : ordinals)
+    slots.push_back(lits[ordinal]);
+}
+
+void PreparedStatement::bind() {
+  if (auto *s = std::get_if<StmtInsert>(&stmt)) {
+    table = &db.table(s->table);
+    cols.clear();
+    for (const auto &c : s->columns)
+      cols.push_back(table->col_index(c));
+    rows.clear();
+    for (const auto &tup : s->values) {
+      if (tup.size() != s->columns.size())
+        throw DBError("INSERT values tuple length mismatch");
+      rows.emplace_back(table->get_columns().size(), nullptr);
+      for (size_t k = 0; k < tup.size(); ++k)
+        rows.back()[cols[k]] = &tup[k];
+    }
+  } else if (auto *s = std::get_if<StmtUpdate>(&stmt)) {
+    table = &db.table(s->table);
+    sets.clear();
+    for (const auto &set : s->sets)
+      sets.emplace_back(table->col_index(set.first), &set.second);
+    where = table->resolve(s->where);
+  } else if (auto *s = std::get_if<StmtDelete>(&stmt)) {
+    table = &db.table(s->table);
+    where = table->resolve(s->where);
+  } else if (auto *s = std::get_if<StmtSelect>(&stmt)) {
+    table = &db.table(s->table);
+    if (s->join) {
+      join_table = &db.table(s->join->table);
+      join = table->resolve_join(*join_table, *s->join, s->columns, s->star,
+                                 s->where);
+      order = table->resolve(s->order);
+      return;
+    }
+    if (!s->group_by.empty())
+      group = table->resolve_group(s->group_by, s->columns, s->aggregates);
+    else if (!s->aggregates.empty())
+      aggs = table->resolve(s->aggregates);
+    else
+      cols = table->build_projection(s->columns, s->star);
+    where = table->resolve(s->where);
+    order = table->resolve(s->order);
+  }
+}
+
+// The parameter standing in for literal, or literal if it is no
+// placeholder.
+const Value *PreparedStatement::arg(const Value *literal,
+                                    const Args &args) const {
+  for (size_t k = 0; k < slots.size(); ++k) {
+    if (slots[k] == literal)
+      return &args.params[k];
+  }
+  return literal;
+}
+
+void PreparedStatement::bind_args(ColumnCondition &c, Args &args) const {
+  c.literal = arg(c.literal, args);
+  if (c.values) {
+    // an IN list holding placeholders is copied with the parameters in
+    std::vector<Value> *list = nullptr;
+    for (size_t i = 0; i < c.values->size(); ++i) {
+      const Value *v = arg(&(*c.values)[i], args);
+      if (v == &(*c.values)[i])
+        continue;
+      if (!list)
+        list = &args.lists.emplace_back(*c.values);
+      (*list)[i] = *v;
+    }
+    if (list)
+      c.values = list;
+  }
+  for (auto &child : c.children)
+    bind_args(child, args);
+}
+
+void PreparedStatement::bind_args(JoinFilter &f, Args &args) const {
+  bind_args(f.test, args);
+  for (auto &child : f.children)
+    bind_args(child, args);
+}
+
+std::optional<ColumnCondition>
+PreparedStatement::bound_where(Args &args) const {
+  std::optional<ColumnCondition> c = where;
+  if (c)
+    bind_args(*c, args);
+  return c;
+}
+
+// stmt with the parameters in place of its placeholders, as the log
+// records it.
+Statement
+PreparedStatement::with_params(const std::vector<Value> &params) const {
+  Statement out = stmt;
+  auto lits = literals(out);
+  for (size_t k = 0; k < ordinals.size(); ++k)
+    *lits[ordinals[k]] = params[k];
+  return out;
+}
+
+bool PreparedStatement::execute(const std::vector<Value> &params,
+                                RowSink &sink) {
+  if (params.size() != slots.size())
+    throw DBError("Expected " + std::to_string(slots.size()) +
+                  " parameters, got " + std::to_string(params.size()));
+  // DDL, COPY, SAVE, CHECKPOINT and VACUUM have nothing to bind
+  if (std::holds_alternative<StmtCreate>(stmt) ||
+      std::holds_alternative<StmtCreateIndex>(stmt) ||
+      std::holds_alternative<StmtCopy>(stmt) ||
+      std::holds_alternative<StmtSave>(stmt) ||
+      std::holds_alternative<StmtCheckpoint>(stmt) ||
+      std::holds_alternative<StmtVacuum>(stmt))
+    return db::execute(db, stmt, sink);
+  std::call_once(bound, [this] { bind(); });
+
+  Args args{params};
+  WriteAheadLog *log = db.wal();
+  if (std::holds_alternative<StmtInsert>(stmt)) {
+    // a row of pointers per thread, reused so that an insert need not
+    // allocate
+    thread_local std::vector<const Value *> row;
+    uint64_t lsn;
+    // as in db::execute, rows before a failure are made durable too
+    std::exception_ptr failed;
+    {
+      Table::Batch batch(*table);
+      size_t before = table->slot_count();
+      try {
+        for (const auto &tuple : rows) {
+          row.assign(tuple.begin(), tuple.end());
+          for (const Value *&v : row) {
+            if (v)
+              v = arg(v, args);
+          }
+          table->insert_row(row);
+        }
+      } catch (...) {
+        failed = std::current_exception();
+      }
+      lsn = log_appended(db, *table, before);
+    }
+    make_durable(db, lsn);
+    if (failed)
+      std::rethrow_exception(failed);
+    return false;
+  }
+  if (std::holds_alternative<StmtUpdate>(stmt)) {
+    auto bound_sets = sets;
+    for (auto &set : bound_sets)
+      set.second = arg(set.second, args);
+    uint64_t lsn = 0;
+    {
+      Table::Batch batch(*table);
+      if (table->update_rows(bound_sets, bound_where(args)) > 0 && log)
+        lsn = log->log_update(std::get<StmtUpdate>(with_params(params)));
+    }
+    make_durable(db, lsn);
+    return false;
+  }
+  if (std::holds_alternative<StmtDelete>(stmt)) {
+    uint64_t lsn = 0;
+    {
+      Table::Batch batch(*table);
+      if (table->delete_rows(bound_where(args)) > 0 && log)
+        lsn = log->log_delete(std::get<StmtDelete>(with_params(params)));
+    }
+    make_durable(db, lsn);
+    return false;
+  }
+  if (join) {
+    JoinPlan plan = *join;
+    for (auto &w : plan.where) {
+      if (w)
+        bind_args(*w, args);
+    }
+    for (auto &f : plan.residual)
+      bind_args(f, args);
+    LimitSink limited(sink, order.limit, order.offset);
+    table->join_rows(*join_table, plan, limited);
+  } else if (group || !aggs.empty()) {
+    LimitSink limited(sink, order.limit, order.offset);
+    if (group)
+      table->group_rows(*group, bound_where(args), limited);
+    else
+      table->aggregate_rows(aggs, bound_where(args), limited);
+  } else {
+    table->scan_rows(cols, bound_where(args), sink, order);
+  }
+  return true;
+}
+
+std::optional<QueryResult>
+PreparedStatement::execute(const std::vector<Value> &params) {
+  ResultCollector collector;
+  if (!execute(params, collector))
+    return std::nullopt;
+  return std::move(collector.result);
+}
+
+} // namespace db
@@ -0,0 +1,262 @@
+#include "protocol.hpp"
+#include "byte_io.hpp"
+#include "errors.hpp"
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace db {
+
+size_t begin_frame(std::string &out) {
+  size_t at = out.size();
+  out.append(4, '\0');
+  return at;
+}
+
+void end_frame(std::string &out, size_t at) {
+  size_t size = out.size() - at - 4;
+  // the receiver would reject it, and u32 may not even hold its length
+  if (size > kMaxFrame)
+    throw DBError("Frame of " + std::to_string(size) + " bytes is too large");
+  uint32_t n = static_cast<uint32_t>(size);
+  std::memcpy(&out[at], &n, 4);
+}
+
+void append_frame(std::string &out, std::string_view payload) {
+  size_t at = begin_frame(out);
+  out.append(payload.data(), payload.size());
+  end_frame(out, at);
+}
+
+bool next_frame(std::string_view buf, size_t &pos, std::string_view &payload) {
+  if (buf.size() - pos < 4)
+    return false;
+  uint32_t n;
+  std::memcpy(&n, buf.data() + pos, 4);
+  if (n > kMaxFrame)
+    throw DBError("Frame of " + std::to_string(n) + " bytes is too large");
+  if (buf.size() - pos - 4 < n)
+    return false;
+  payload = buf.substr(pos + 4, n);
+  pos += 4 + n;
+  return true;
+}
+
+void BinaryResultWriter::begin(const std::vector<std::string> &headers) {
+  ByteWriter w;
+  w.u32(static_cast<uint32_t>(headers.size()));
+  for (const auto &h : headers)
+    w.str(h);
+  out += w.out;
+  ncols = headers.size();
+}
+
+void BinaryResultWriter::write(QueryResult &&batch) {
+  size_t n = batch.row_count();
+  if (n == 0)
+    return;
+  ByteWriter w;
+  w.out.swap(out);
+  w.u32(static_cast<uint32_t>(n));
+  for (size_t col = 0; col < ncols; ++col) {
+    if (batch.typed() && batch.columns[col].type == Type::INT) {
+      w.u8(static_cast<uint8_t>(Type::INT));
+      w.raw(batch.columns[col].ints.data(), n * sizeof(int64_t));
+      continue;
+    }
+    w.u8(static_cast<uint8_t>(Type::STR));
+    if (batch.typed()) {
+      for (std::string_view s : batch.columns[col].strs)
+        w.str(s);
+    } else {
+      for (size_t row = 0; row < n; ++row)
+        w.str(batch.rows[row][col]);
+    }
+  }
+  w.out.swap(out);
+}
+
+void BinaryResultWriter::end() {
+  ByteWriter w;
+  w.u32(0);
+  out += w.out;
+}
+
+QueryResult decode_binary_result(std::string_view body) {
+  ByteReader r(body, "Truncated binary result");
+  QueryResult res;
+  uint32_t ncols = r.u32();
+  for (uint32_t col = 0; col < ncols; ++col)
+    res.headers.emplace_back(r.str());
+  while (uint32_t n = r.u32()) {
+    size_t base = res.rows.size();
+    res.rows.resize(base + n, std::vector<std::string>(ncols));
+    for (uint32_t col = 0; col < ncols; ++col) {
+      bool is_int = r.u8() == static_cast<uint8_t>(Type::INT);
+      for (uint32_t row = 0; row < n; ++row) {
+        res.rows[base + row][col] =
+            is_int ? std::to_string(r.i64()) : std::string(r.str());
+      }
+    }
+  }
+  return res;
+}
+
+static DBError socket_error(const std::string &what,
+                            const std::string &address) {
+  return DBError(what + " " + address + ": " + std::strerror(errno));
+}
+
+static bool is_port(const std::string &address) {
+  return !address.empty() && address.size() <= 5 &&
+         address.find_first_not_of("0123456789") == std::string::npos;
+}
+
+// Fills in the socket address for `address`; returns its length.
+static socklen_t resolve(const std::string &address, sockaddr_storage &ss) {
+  std::memset(&ss, 0, sizeof(ss));
+  if (is_port(address)) {
+    unsigned long port = std::stoul(address);
+    if (port > 65535)
+      throw DBError("Invalid port: " + address);
+    auto *in = reinterpret_cast<sockaddr_in *>(&ss);
+    in->sin_family = AF_INET;
+    in->sin_port = htons(static_cast<uint16_t>(port));
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return sizeof(sockaddr_in);
+  }
+  auto *un = reinterpret_cast<sockaddr_un *>(&ss);
+  if (address.size() >= sizeof(un->sun_path))
+    throw DBError("Socket path too long: " + address);
+  un->sun_family = AF_UNIX;
+  std::memcpy(un->sun_path, address.c_str(), address.size() + 1);
+  return sizeof(sockaddr_un);
+}
+
+static int make_socket(const sockaddr_storage &ss, const std::string &address) {
+  int fd = ::socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    throw socket_error("Cannot create socket for", address);
+  if (ss.ss_family == AF_INET) {
+    // responses are written whole; don't hold small ones back
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+int listen_on(const std::string &address) {
+  sockaddr_storage ss;
+  socklen_t len = resolve(address, ss);
+  int fd = make_socket(ss, address);
+  if (ss.ss_family == AF_INET) {
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  } else {
+    // a socket file left by an earlier server would make bind fail
+    ::unlink(address.c_str());
+  }
+  if (::bind(fd, reinterpret_cast<sockaddr *>(&ss), len) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0) {
+    DBError err = socket_error("Cannot listen on", address);
+    ::close(fd);
+    throw err;
+  }
+  return fd;
+}
+
+int connect_to(const std::string &address) {
+  sockaddr_storage ss;
+  socklen_t len = resolve(address, ss);
+  int fd = make_socket(ss, address);
+  int r;
+  do {
+    r = ::connect(fd, reinterpret_cast<sockaddr *>(&ss), len);
+  } while (r != 0 && errno == EINTR);
+  if (r != 0) {
+    DBError err = socket_error("Cannot connect to", address);
+    ::close(fd);
+    throw err;
+  }
+  return fd;
+}
+
+Client::Client(const std::string &address) : fd(connect_to(address)) {}
+
+Client::~Client() {
+  if (fd >= 0)
+    ::close(fd);
+}
+
+void Client::send(std::string_view sql, ResultFormat format) {
+  size_t at = begin_frame(out);
+  out.push_back(static_cast<char>(format));
+  out.append(sql.data(), sql.size());
+  try {
+    end_frame(out, at);
+  } catch (const DBError &) {
+    out.resize(at);
+    throw;
+  }
+  if (out.size() >= (1 << 16))
+    flush();
+}
+
+void Client::flush() {
+  size_t done = 0;
+  while (done < out.size()) {
+    ssize_t w = ::send(fd, out.data() + done, out.size() - done, MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      throw DBError(std::string("Cannot send request: ") +
+                    std::strerror(errno));
+    }
+    done += static_cast<size_t>(w);
+  }
+  out.clear();
+}
+
+std::string_view Client::next_payload() {
+  std::string_view payload;
+  while (!next_frame(in, in_pos, payload)) {
+    // keep only the unread tail before reading more
+    in.erase(0, in_pos);
+    in_pos = 0;
+    char buf[1 << 16];
+    ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw DBError("Connection closed by server");
+    in.append(buf, static_cast<size_t>(n));
+  }
+  if (payload.empty())
+    throw DBError("Empty response");
+  return payload;
+}
+
+Response Client::receive() {
+  flush();
+  Response r;
+  while (true) {
+    std::string_view payload = next_payload();
+    r.status = static_cast<ResponseStatus>(payload[0]);
+    if (r.status == ResponseStatus::ERROR)
+      r.body.clear();
+    r.body.append(payload.substr(1));
+    if (r.status != ResponseStatus::MORE)
+      return r;
+  }
+}
+
+Response Client::query(std::string_view sql, ResultFormat format) {
+  send(sql, format);
+  return receive();
+}
+
+} // namespace db
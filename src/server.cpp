@@ -0,0 +1,436 @@
+#include "server.hpp"
+#include "parser.hpp"
+#include "protocol.hpp"
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace db {
+
+namespace {
+
+// epoll keys besides connection ids
+constexpr uint64_t kListenKey = 0;
+constexpr uint64_t kWakeKey = 1;
+
+// The statement without a trailing ';', which the parser does not expect.
+std::string_view trim_statement(std::string_view sql) {
+  while (!sql.empty() &&
+         (sql.back() == ';' ||
+          std::isspace(static_cast<unsigned char>(sql.back()))))
+    sql.remove_suffix(1);
+  return sql;
+}
+
+// Results are sent in frames of about this size; the frame being written
+// is closed as MORE once it passes it.
+constexpr size_t kResponseChunk = size_t{1} << 20;
+
+// Passes a result on to an encoder writing into out, and hands out over
+// through flush() each time the frame at `at` fills up, which starts the
+// next frame.
+class FramedSink : public RowSink {
+public:
+  FramedSink(RowSink &encoder, std::string &out, size_t &at,
+             const std::function<void()> &flush)
+      : encoder(encoder), out(out), at(at), flush(flush) {}
+  void begin(const std::vector<std::string> &headers) override {
+    encoder.begin(headers);
+  }
+  void write(QueryResult &&batch) override {
+    encoder.write(std::move(batch));
+    if (out.size() - at - 5 < kResponseChunk)
+      return;
+    out[at + 4] = static_cast<char>(ResponseStatus::MORE);
+    end_frame(out, at);
+    flush();
+    at = begin_frame(out);
+    out.push_back(static_cast<char>(ResponseStatus::OK));
+  }
+  void end() override { encoder.end(); }
+
+private:
+  RowSink &encoder;
+  std::string &out;
+  size_t &at;
+  const std::function<void()> &flush;
+};
+
+// Executes one request for a connection with PREPARE names `names` and
+// appends its response to out. Results are encoded into out as the scan
+// produces them, so no copy of the rows is collected; a large one is
+// split into frames, and flush() is called with out ending at each.
+void respond(Database &db, PreparedNames &names, std::string_view payload,
+             std::string &out, const std::function<void()> &flush) {
+  size_t at = begin_frame(out);
+  out.push_back(static_cast<char>(ResponseStatus::OK));
+  try {
+    if (payload.empty())
+      throw DBError("Empty request");
+    auto format = static_cast<ResultFormat>(payload[0]);
+    if (format != ResultFormat::CSV && format != ResultFormat::BINARY)
+      throw DBError("Unknown result format");
+    Statement stmt = parse_statement(trim_statement(payload.substr(1)));
+    bool rows;
+    if (format == ResultFormat::BINARY) {
+      BinaryResultWriter encoder(out);
+      FramedSink sink(encoder, out, at, flush);
+      rows = execute(db, stmt, sink, &names);
+    } else {
+      CsvStringWriter encoder(out);
+      FramedSink sink(encoder, out, at, flush);
+      rows = execute(db, stmt, sink, &names);
+    }
+    if (rows)
+      out[at + 4] = static_cast<char>(ResponseStatus::ROWS);
+  } catch (const std::exception &e) {
+    // drop whatever part of a result is still here; parts already sent
+    // are voided by the error
+    out.resize(at + 4);
+    out.push_back(static_cast<char>(ResponseStatus::ERROR));
+    out += e.what();
+  }
+  end_frame(out, at);
+}
+
+} // namespace
+
+struct Server::Connection {
+  uint64_t id{0};
+  int fd{-1};
+  // its PREPARE names; shared with a running batch, which may outlive it
+  std::shared_ptr<PreparedNames> names{std::make_shared<PreparedNames>()};
+  // shared with its running batch
+  std::shared_ptr<Backlog> backlog{std::make_shared<Backlog>()};
+  // received bytes not yet handed to a worker
+  std::string in;
+  // responses not yet written, from out_pos on
+  std::string out;
+  size_t out_pos{0};
+  // a worker is executing this connection's requests
+  bool busy{false};
+  // the peer sent everything it will send (or broke the protocol)
+  bool eof{false};
+  // epoll interest, or no registration at all
+  uint32_t events{0};
+  bool registered{false};
+
+  size_t pending_output() const { return out.size() - out_pos; }
+};
+
+Server::Server(Database &d, const std::string &addr, ServerOptions o)
+    : db(d), opts(std::move(o)), address(addr) {
+  listen_fd = listen_on(address);
+  sockaddr_storage ss;
+  socklen_t len = sizeof(ss);
+  if (::getsockname(listen_fd, reinterpret_cast<sockaddr *>(&ss), &len) == 0 &&
+      ss.ss_family == AF_INET)
+    tcp_port = ntohs(reinterpret_cast<sockaddr_in *>(&ss)->sin_port);
+  // accept_all() drains the backlog until accept4 would block
+  ::fcntl(listen_fd, F_SETFL, ::fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+  epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+  wake_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (epoll_fd < 0 || wake_fd < 0) {
+    std::string err = std::strerror(errno);
+    for (int fd : {listen_fd, epoll_fd, wake_fd}) {
+      if (fd >= 0)
+        ::close(fd);
+    }
+    throw DBError("Cannot start server: " + err);
+  }
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.u64 = kListenKey;
+  ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+  ev.data.u64 = kWakeKey;
+  ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+  next_id = kWakeKey + 1;
+  workers = std::make_unique<ThreadPool>(std::max<size_t>(1, opts.workers));
+}
+
+Server::~Server() {
+  // finish running batches before the state they report to goes away;
+  // those waiting for output to drain give up, as the loop has stopped
+  for (auto &entry : conns)
+    report_backlog(*entry.second, true);
+  workers.reset();
+  for (auto &entry : conns)
+    ::close(entry.second->fd);
+  for (int fd : {listen_fd, epoll_fd, wake_fd}) {
+    if (fd >= 0)
+      ::close(fd);
+  }
+  if (tcp_port == 0)
+    ::unlink(address.c_str());
+}
+
+void Server::stop() {
+  // only async-signal-safe calls here
+  stopping.store(true);
+  uint64_t one = 1;
+  ssize_t r = ::write(wake_fd, &one, sizeof(one));
+  (void)r;
+}
+
+void Server::run() {
+  epoll_event events[64];
+  while (true) {
+    int n = ::epoll_wait(epoll_fd, events, 64, opts.tick ? 100 : -1);
+    if (n < 0 && errno != EINTR)
+      throw DBError(std::string("epoll_wait: ") + std::strerror(errno));
+    for (int k = 0; k < n; ++k) {
+      uint64_t key = events[k].data.u64;
+      if (key == kListenKey)
+        accept_all();
+      else if (key == kWakeKey)
+        on_wake();
+      else
+        on_ready(key, events[k].events);
+    }
+    if (opts.tick)
+      opts.tick();
+    if (stopping.load())
+      return;
+  }
+}
+
+void Server::accept_all() {
+  while (true) {
+    int fd = ::accept4(listen_fd, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return; // EAGAIN, or a connection that went away before we got it
+    uint64_t id = next_id++;
+    auto c = std::make_unique<Connection>();
+    c->id = id;
+    c->fd = fd;
+    c->events = EPOLLIN;
+    c->registered = true;
+    epoll_event ev{};
+    ev.events = c->events;
+    ev.data.u64 = id;
+    if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      ::close(fd);
+      continue;
+    }
+    conns.emplace(id, std::move(c));
+  }
+}
+
+void Server::on_ready(uint64_t id, uint32_t events) {
+  auto it = conns.find(id);
+  if (it == conns.end())
+    return;
+  Connection &c = *it->second;
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+    read_input(c);
+  if (events & EPOLLOUT)
+    write_output(c);
+  dispatch(c);
+  settle(c);
+}
+
+void Server::on_wake() {
+  uint64_t count;
+  while (::read(wake_fd, &count, sizeof(count)) > 0) {
+  }
+  std::vector<Completion> batch;
+  {
+    std::lock_guard<std::mutex> lk(done_mu);
+    batch.swap(done);
+  }
+  for (auto &d : batch) {
+    auto it = conns.find(d.id);
+    if (it == conns.end())
+      continue; // closed while its batch ran
+    Connection &c = *it->second;
+    c.busy = d.partial;
+    if (c.out.empty())
+      c.out.swap(d.out);
+    else
+      c.out += d.out;
+    write_output(c);
+    dispatch(c);
+    settle(c);
+  }
+}
+
+void Server::read_input(Connection &c) {
+  char buf[1 << 16];
+  while (!c.eof) {
+    ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      c.in.append(buf, static_cast<size_t>(n));
+      // leave the rest in the socket until the backlog is worked off
+      if (c.in.size() > kMaxFrame)
+        return;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    c.eof = true;
+  }
+}
+
+void Server::write_output(Connection &c) {
+  while (c.pending_output() > 0) {
+    ssize_t w = ::send(c.fd, c.out.data() + c.out_pos, c.pending_output(),
+                       MSG_NOSIGNAL);
+    if (w > 0) {
+      c.out_pos += static_cast<size_t>(w);
+      continue;
+    }
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    // the peer is gone; nothing more will be read or written
+    c.eof = true;
+    c.in.clear();
+    c.out.clear();
+    c.out_pos = 0;
+    report_backlog(c, true);
+    return;
+  }
+  if (c.out_pos == c.out.size()) {
+    c.out.clear();
+    c.out_pos = 0;
+  }
+  report_backlog(c);
+}
+
+void Server::report_backlog(Connection &c, bool closed) {
+  if (!c.busy)
+    return;
+  Backlog &b = *c.backlog;
+  std::lock_guard<std::mutex> lk(b.mu);
+  b.unsent = c.pending_output();
+  b.closed = b.closed || closed;
+  b.cv.notify_all();
+}
+
+void Server::complete(Completion &&d) {
+  std::lock_guard<std::mutex> lk(done_mu);
+  done.push_back(std::move(d));
+  uint64_t one = 1;
+  ssize_t r = ::write(wake_fd, &one, sizeof(one));
+  (void)r;
+}
+
+void Server::dispatch(Connection &c) {
+  if (c.busy || c.pending_output() > opts.max_pending_output)
+    return;
+  // hand over every complete frame received so far
+  size_t pos = 0;
+  std::string_view payload;
+  std::string error;
+  try {
+    while (next_frame(c.in, pos, payload)) {
+    }
+  } catch (const DBError &e) {
+    error = e.what();
+  }
+  if (pos == 0 && error.empty())
+    return;
+  std::string batch = c.in.substr(0, pos);
+  c.in.erase(0, pos);
+  if (!error.empty()) {
+    // the stream cannot be resynchronised: answer, then hang up
+    c.eof = true;
+    c.in.clear();
+  }
+  c.busy = true;
+  workers->submit([this, id = c.id, names = c.names, backlog = c.backlog,
+                   batch = std::move(batch), error = std::move(error)] {
+    std::string out;
+    bool stalled = false;
+    // hands over a result's finished frames, then waits while the
+    // connection is behind; stops the result if it will not be sent, or
+    // not soon enough
+    std::function<void()> flush = [&] {
+      if (stalled)
+        throw DBError("Client is not reading its results");
+      std::unique_lock<std::mutex> lk(backlog->mu);
+      if (!backlog->closed) {
+        backlog->unsent += out.size();
+        lk.unlock();
+        complete({id, std::move(out), true});
+        out.clear();
+        lk.lock();
+      }
+      // the loop notifies whenever it writes, so each wait is a period
+      // without progress
+      while (!backlog->closed && backlog->unsent > opts.max_pending_output) {
+        size_t unsent = backlog->unsent;
+        backlog->cv.wait_for(lk, opts.output_timeout, [&] {
+          return backlog->closed || backlog->unsent != unsent;
+        });
+        if (!backlog->closed && backlog->unsent == unsent) {
+          stalled = true;
+          throw DBError("Client is not reading its results");
+        }
+      }
+      if (backlog->closed)
+        throw DBError("Connection closed");
+    };
+    size_t pos = 0;
+    std::string_view payload;
+    while (next_frame(batch, pos, payload))
+      respond(db, *names, payload, out, flush);
+    if (!error.empty()) {
+      std::string msg(1, static_cast<char>(ResponseStatus::ERROR));
+      append_frame(out, msg + error);
+    }
+    complete({id, std::move(out)});
+  });
+}
+
+void Server::settle(Connection &c) {
+  // dispatch() has taken every complete frame unless c is busy; a partial
+  // one left at end of input is dropped
+  if (c.eof && !c.busy && c.pending_output() == 0) {
+    close_connection(c.id);
+    return;
+  }
+  uint32_t want = 0;
+  if (!c.eof && c.in.size() <= kMaxFrame &&
+      c.pending_output() <= opts.max_pending_output)
+    want |= EPOLLIN;
+  if (c.pending_output() > 0)
+    want |= EPOLLOUT;
+  if (c.registered && want == c.events)
+    return;
+  // a hung-up socket reports EPOLLHUP whatever the interest, so one with
+  // nothing to do leaves the set until its batch completes
+  if (want == 0 && c.eof) {
+    if (c.registered)
+      ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+    c.registered = false;
+    return;
+  }
+  epoll_event ev{};
+  ev.events = want;
+  ev.data.u64 = c.id;
+  ::epoll_ctl(epoll_fd, c.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c.fd,
+              &ev);
+  c.events = want;
+  c.registered = true;
+}
+
+void Server::close_connection(uint64_t id) {
+  auto it = conns.find(id);
+  if (it->second->registered)
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->second->fd, nullptr);
+  ::close(it->second->fd);
+  conns.erase(it);
+}
+
+} // namespace db
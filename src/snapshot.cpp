@@ -0,0 +1,338 @@
+#include "snapshot.hpp"
+#include "byte_io.hpp"
+#include "checksum.hpp"
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace db {
+
+// Layout (all integers little-endian):
+//   Header                                          at offset 0
+//   column buffers, each aligned to kAlign
+//   catalog                                         at header.catalog_offset
+// The catalog lists, per table: name, row count, columns (name, type and
+// the buffers holding it) and indexes (name, column, kind). A buffer is
+// recorded as {offset, bytes, crc}.
+namespace {
+
+constexpr char kMagic[8] = {'I', 'M', 'D', 'B', 'S', 'N', 'A', 'P'};
+// 2: the header records the last write-ahead log entry the snapshot holds
+constexpr uint32_t kVersion = 2;
+constexpr uint64_t kAlign = 64;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_crc; // over the header with this field zeroed
+  uint64_t catalog_offset;
+  uint64_t catalog_size;
+  uint32_t catalog_crc;
+  uint32_t reserved;
+  uint64_t wal_lsn;
+};
+
+struct Buffer {
+  uint64_t offset;
+  uint64_t bytes;
+  uint32_t crc;
+};
+
+uint32_t header_crc(Header h) {
+  h.header_crc = 0;
+  return crc32c(&h, sizeof(h));
+}
+
+void check_host() {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+  throw DBError("Snapshots are only supported on little-endian hosts");
+#endif
+}
+
+void write_buffer(ByteWriter &cat, const Buffer &b) {
+  cat.u64(b.offset);
+  cat.u64(b.bytes);
+  cat.u32(b.crc);
+}
+
+Buffer read_buffer(ByteReader &cat) {
+  Buffer b;
+  b.offset = cat.u64();
+  b.bytes = cat.u64();
+  b.crc = cat.u32();
+  return b;
+}
+
+// Sequential file writer that keeps track of its offset.
+class FileWriter {
+public:
+  explicit FileWriter(const std::string &path) : path(path) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+      fail();
+  }
+  ~FileWriter() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  uint64_t offset() const { return pos; }
+
+  void write(const void *data, size_t n) {
+    const char *p = static_cast<const char *>(data);
+    while (n > 0) {
+      ssize_t w = ::write(fd, p, n);
+      if (w < 0) {
+        if (errno == EINTR)
+          continue;
+        fail();
+      }
+      p += w;
+      n -= static_cast<size_t>(w);
+      pos += static_cast<uint64_t>(w);
+    }
+  }
+
+  void pad_to(uint64_t align) {
+    static const char zeros[kAlign] = {};
+    write(zeros, (align - pos % align) % align);
+  }
+
+  Buffer buffer(const void *data, size_t n) {
+    pad_to(kAlign);
+    Buffer b{pos, n, crc32c(data, n)};
+    write(data, n);
+    return b;
+  }
+
+  // one buffer written from the column's storage chunks in turn
+  template <typename T> Buffer buffer(const ColumnBuffer<T> &values) {
+    pad_to(kAlign);
+    Buffer b{pos, values.size() * sizeof(T), 0};
+    values.runs(0, values.size(), [&](const T *v, size_t n, size_t) {
+      b.crc = crc32c(v, n * sizeof(T), b.crc);
+      write(v, n * sizeof(T));
+    });
+    return b;
+  }
+
+  void rewrite(uint64_t at, const void *data, size_t n) {
+    if (::pwrite(fd, data, n, static_cast<off_t>(at)) !=
+        static_cast<ssize_t>(n))
+      fail();
+  }
+
+  void sync_and_close() {
+    if (::fsync(fd) != 0)
+      fail();
+    int f = fd;
+    fd = -1;
+    if (::close(f) != 0)
+      fail();
+  }
+
+private:
+  std::string path;
+  int fd{-1};
+  uint64_t pos{0};
+
+  [[noreturn]] void fail() {
+    throw DBError("Cannot write " + path + ": " + std::strerror(errno));
+  }
+};
+
+} // namespace
+
+static void write_table(FileWriter &file, ByteWriter &cat, const Table &t) {
+  cat.str(t.get_name());
+  cat.u64(t.row_count());
+  cat.u32(static_cast<uint32_t>(t.get_columns().size()));
+  // deleted rows are left out: write a compacted copy of each column
+  std::vector<size_t> dead = t.deleted_rows();
+  for (size_t c = 0; c < t.get_columns().size(); ++c) {
+    const Column &col = t.col_at(c);
+    cat.str(col.name);
+    cat.u8(static_cast<uint8_t>(col.type));
+    ColumnData compacted;
+    const ColumnData *d = &t.column_data(c);
+    if (!dead.empty()) {
+      compacted = *d;
+      std::visit([&](auto &values) { values.erase_rows(dead); }, compacted);
+      d = &compacted;
+    }
+    if (const auto *ic = std::get_if<IntColumn>(d)) {
+      write_buffer(cat, file.buffer(ic->buffer()));
+      continue;
+    }
+    const StrColumn *sc = &std::get<StrColumn>(*d);
+    // overwritten strings leave dead bytes; write a packed copy instead
+    StrColumn packed;
+    if (!sc->packed()) {
+      packed.append(*sc);
+      sc = &packed;
+    }
+    write_buffer(cat, file.buffer(sc->offset_buffer()));
+    write_buffer(cat, file.buffer(sc->length_buffer()));
+    write_buffer(cat, file.buffer(sc->byte_data(), sc->byte_count()));
+  }
+  cat.u32(static_cast<uint32_t>(t.get_indexes().size()));
+  for (const auto &ix : t.get_indexes()) {
+    cat.str(ix->get_name());
+    cat.u32(static_cast<uint32_t>(ix->get_column()));
+    cat.u8(static_cast<uint8_t>(ix->kind()));
+  }
+}
+
+void save_snapshot(const Database &db, const std::string &path,
+                   uint64_t wal_lsn) {
+  check_host();
+  std::vector<const Table *> tables = db.get_tables();
+  std::sort(tables.begin(), tables.end(), [](const Table *a, const Table *b) {
+    return a->get_name() < b->get_name();
+  });
+
+  std::string tmp = path + ".tmp";
+  try {
+    FileWriter file(tmp);
+    Header h{};
+    file.write(&h, sizeof(h)); // placeholder until the catalog is known
+    ByteWriter cat;
+    cat.u32(static_cast<uint32_t>(tables.size()));
+    for (const Table *t : tables)
+      write_table(file, cat, *t);
+    file.pad_to(8);
+
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.wal_lsn = wal_lsn;
+    h.catalog_offset = file.offset();
+    h.catalog_size = cat.out.size();
+    h.catalog_crc = crc32c(cat.out.data(), cat.out.size());
+    h.header_crc = header_crc(h);
+    file.write(cat.out.data(), cat.out.size());
+    file.rewrite(0, &h, sizeof(h));
+    file.sync_and_close();
+  } catch (...) {
+    ::unlink(tmp.c_str());
+    throw;
+  }
+  if (::rename(tmp.c_str(), path.c_str()) != 0) {
+    int err = errno;
+    ::unlink(tmp.c_str());
+    throw DBError("Cannot write " + path + ": " + std::strerror(err));
+  }
+  // the rename is only durable once the directory is; a checkpoint must
+  // not drop log records before then
+  sync_parent_dir(path);
+}
+
+namespace {
+
+// Resolves catalog buffers against the mapping.
+struct Mapping {
+  std::shared_ptr<const MappedFile> file;
+  bool verify;
+
+  const char *bytes(const Buffer &b, uint64_t expected) const {
+    if (b.bytes != expected || b.offset % kAlign != 0 ||
+        b.offset > file->size() || b.bytes > file->size() - b.offset)
+      throw DBError("Corrupt snapshot: bad column buffer");
+    const char *p = file->data() + b.offset;
+    if (verify && crc32c(p, b.bytes) != b.crc)
+      throw DBError("Corrupt snapshot: column checksum mismatch");
+    return p;
+  }
+  template <typename T> const T *array(const Buffer &b, uint64_t n) const {
+    if (n > file->size() / sizeof(T))
+      throw DBError("Corrupt snapshot: bad column buffer");
+    return reinterpret_cast<const T *>(bytes(b, n * sizeof(T)));
+  }
+};
+
+} // namespace
+
+static void read_table(Database &db, ByteReader &cat, const Mapping &map) {
+  std::string name(cat.str());
+  uint64_t rows = cat.u64();
+  uint32_t ncols = cat.u32();
+  std::vector<Column> cols;
+  std::vector<ColumnData> data;
+  for (uint32_t c = 0; c < ncols; ++c) {
+    std::string col_name(cat.str());
+    uint8_t type = cat.u8();
+    if (type == static_cast<uint8_t>(Type::INT)) {
+      IntColumn ic;
+      ic.borrow(map.array<int64_t>(read_buffer(cat), rows), rows, map.file);
+      cols.push_back({std::move(col_name), Type::INT});
+      data.emplace_back(std::move(ic));
+    } else if (type == static_cast<uint8_t>(Type::STR)) {
+      const auto *offs = map.array<uint64_t>(read_buffer(cat), rows);
+      const auto *lens = map.array<uint32_t>(read_buffer(cat), rows);
+      Buffer bytes = read_buffer(cat);
+      const char *p = map.bytes(bytes, bytes.bytes);
+      // a string reaching past the bytes would be read out of the mapping;
+      // checked with the checksums, as it reads 12 bytes per row
+      for (uint64_t row = 0; map.verify && row < rows; ++row) {
+        if (offs[row] > bytes.bytes || lens[row] > bytes.bytes - offs[row])
+          throw DBError("Corrupt snapshot: string out of bounds");
+      }
+      StrColumn sc;
+      sc.borrow(offs, lens, rows, p, bytes.bytes, map.file);
+      cols.push_back({std::move(col_name), Type::STR});
+      data.emplace_back(std::move(sc));
+    } else {
+      throw DBError("Corrupt snapshot: unknown column type");
+    }
+  }
+  db.create_table(name, cols);
+  Table &t = db.table(name);
+  t.restore(std::move(data), rows);
+  uint32_t nindexes = cat.u32();
+  for (uint32_t k = 0; k < nindexes; ++k) {
+    std::string ix_name(cat.str());
+    uint32_t col = cat.u32();
+    uint8_t kind = cat.u8();
+    if (col >= ncols || kind > static_cast<uint8_t>(IndexKind::BTREE))
+      throw DBError("Corrupt snapshot: bad index " + ix_name);
+    db.create_index(ix_name, name, cols[col].name,
+                    static_cast<IndexKind>(kind));
+  }
+}
+
+uint64_t load_snapshot(Database &db, const std::string &path,
+                       bool verify_data) {
+  check_host();
+  auto file = std::make_shared<const MappedFile>(path);
+  Header h;
+  if (file->size() < sizeof(h))
+    throw DBError("Not a snapshot: " + path);
+  std::memcpy(&h, file->data(), sizeof(h));
+  if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0)
+    throw DBError("Not a snapshot: " + path);
+  if (h.header_crc != header_crc(h))
+    throw DBError("Corrupt snapshot: header checksum mismatch");
+  if (h.version != kVersion)
+    throw DBError("Unsupported snapshot version " +
+                  std::to_string(h.version));
+  if (h.catalog_offset > file->size() ||
+      h.catalog_size > file->size() - h.catalog_offset)
+    throw DBError("Corrupt snapshot: truncated file");
+  const char *catalog = file->data() + h.catalog_offset;
+  if (crc32c(catalog, h.catalog_size) != h.catalog_crc)
+    throw DBError("Corrupt snapshot: catalog checksum mismatch");
+
+  ByteReader cat(std::string_view(catalog, h.catalog_size),
+                 "Corrupt snapshot: truncated catalog");
+  Mapping map{file, verify_data};
+  uint32_t ntables = cat.u32();
+  for (uint32_t k = 0; k < ntables; ++k)
+    read_table(db, cat, map);
+  if (!cat.done())
+    throw DBError("Corrupt snapshot: trailing catalog bytes");
+  return h.wal_lsn;
+}
+
+} // namespace db
@@ -0,0 +1,126 @@
+#include "storage.hpp"
+#include "errors.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace db {
+
+void StrColumn::append(const StrColumn &other) {
+  if (other.dead_bytes) {
+    for (size_t row = 0; row < other.size(); ++row)
+      push_back(other.get(row));
+    return;
+  }
+  // packed buffer: copy it whole and shift the offsets
+  uint64_t base = bytes.size();
+  bytes.append(other.bytes);
+  lengths.append(other.lengths);
+  other.offsets.runs(0, other.size(),
+                     [&](const uint64_t *p, size_t count, size_t) {
+                       for (size_t i = 0; i < count; ++i)
+                         offsets.push_back(base + p[i]);
+                     });
+}
+
+void StrColumn::borrow(const uint64_t *offs, const uint32_t *lens, size_t n,
+                       const char *data, size_t nbytes,
+                       const std::shared_ptr<const void> &keep) {
+  offsets.borrow(offs, n, keep);
+  lengths.borrow(lens, n, keep);
+  bytes.borrow(data, nbytes, keep);
+  dead_bytes = 0;
+}
+
+StrColumn StrColumn::view() const {
+  StrColumn v;
+  v.offsets = offsets.view();
+  v.lengths = lengths.view();
+  v.bytes = bytes.view();
+  v.dead_bytes = dead_bytes;
+  return v;
+}
+
+void StrColumn::push_back(std::string_view s) {
+  if (s.size() > std::numeric_limits<uint32_t>::max())
+    throw DBError("String value too long");
+  offsets.push_back(bytes.append(s));
+  lengths.push_back(static_cast<uint32_t>(s.size()));
+}
+
+void StrColumn::set(size_t row, std::string_view s) {
+  if (s.size() > std::numeric_limits<uint32_t>::max())
+    throw DBError("String value too long");
+  if (s.size() <= lengths[row] && bytes.writable()) {
+    // fits in the old slot: overwrite in place
+    dead_bytes += lengths[row] - s.size();
+    std::copy(s.begin(), s.end(), bytes.mutable_data() + offsets[row]);
+  } else {
+    // appending keeps the old bytes intact for views of the column
+    dead_bytes += lengths[row];
+    offsets.set(row, bytes.append(s));
+  }
+  lengths.set(row, static_cast<uint32_t>(s.size()));
+  maybe_compact();
+}
+
+void StrColumn::erase_rows(const std::vector<size_t> &sorted_rows) {
+  if (sorted_rows.empty())
+    return;
+  for (size_t row : sorted_rows)
+    dead_bytes += lengths[row];
+  offsets.erase(sorted_rows);
+  lengths.erase(sorted_rows);
+  maybe_compact();
+}
+
+void StrColumn::maybe_compact() {
+  if (dead_bytes < 4096 || dead_bytes * 2 < bytes.size())
+    return;
+  pack();
+}
+
+void StrColumn::shrink_to_fit() {
+  if (dead_bytes)
+    pack();
+  offsets.shrink_to_fit();
+  lengths.shrink_to_fit();
+  bytes.shrink_to_fit();
+}
+
+void StrColumn::pack() {
+  std::vector<char> packed;
+  packed.reserve(bytes.size() - dead_bytes);
+  ColumnBuffer<uint64_t> o;
+  for (size_t row = 0; row < size(); ++row) {
+    const char *p = bytes.data() + offsets[row];
+    o.push_back(packed.size());
+    packed.insert(packed.end(), p, p + lengths[row]);
+  }
+  offsets = std::move(o);
+  bytes.assign(std::move(packed));
+  dead_bytes = 0;
+}
+
+std::vector<size_t> RowBitmap::positions() const {
+  std::vector<size_t> out;
+  out.reserve(ones);
+  words.runs(0, words.size(), [&](const uint64_t *p, size_t n, size_t first) {
+    for (size_t i = 0; i < n; ++i) {
+      for (uint64_t w = p[i]; w; w &= w - 1)
+        out.push_back(((first + i) << 6) +
+                      static_cast<size_t>(__builtin_ctzll(w)));
+    }
+  });
+  return out;
+}
+
+void RowBitmap::remove_set(std::vector<size_t> &rows, size_t from) const {
+  if (!ones)
+    return;
+  rows.erase(std::remove_if(rows.begin() + static_cast<ptrdiff_t>(from),
+                            rows.end(),
+                            [&](size_t row) { return test(row); }),
+             rows.end());
+}
+
+} // namespace db
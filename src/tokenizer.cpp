@@ -1,46 +1,249 @@
 #include "tokenizer.hpp"
-#include <cctype>
 
 namespace db {
 
-Tokenizer::Tokenizer(const std::string &s) : input(s), i(0) {}
+// Dispatch on the first letter so at most a couple of candidates are
+// compared per identifier.
+Keyword keyword_of(std::string_view w) {
+  if (w.empty())
+    return Keyword::NONE;
+  switch (w[0]) {
+  case 'A':
+    if (w == "AND")
+      return Keyword::AND;
+    if (w == "AS")
+      return Keyword::AS;
+    if (w == "ASC")
+      return Keyword::ASC;
+    break;
+  case 'B':
+    if (w == "BETWEEN")
+      return Keyword::BETWEEN;
+    if (w == "BTREE")
+      return Keyword::BTREE;
+    if (w == "BY")
+      return Keyword::BY;
+    break;
+  case 'C':
+    if (w == "CREATE")
+      return Keyword::CREATE;
+    if (w == "COPY")
+      return Keyword::COPY;
+    if (w == "CHECKPOINT")
+      return Keyword::CHECKPOINT;
+    break;
+  case 'D':
+    if (w == "DELETE")
+      return Keyword::DELETE;
+    if (w == "DESC")
+      return Keyword::DESC;
+    break;
+  case 'E':
+    if (w == "EXECUTE")
+      return Keyword::EXECUTE;
+    break;
+  case 'F':
+    if (w == "FROM")
+      return Keyword::FROM;
+    break;
+  case 'G':
+    if (w == "GROUP")
+      return Keyword::GROUP;
+    break;
+  case 'H':
+    if (w == "HASH")
+      return Keyword::HASH;
+    break;
+  case 'I':
+    if (w == "IN")
+      return Keyword::IN;
+    if (w == "INTO")
+      return Keyword::INTO;
+    if (w == "INSERT")
+      return Keyword::INSERT;
+    if (w == "INDEX")
+      return Keyword::INDEX;
+    break;
+  case 'J':
+    if (w == "JOIN")
+      return Keyword::JOIN;
+    break;
+  case 'L':
+    if (w == "LIMIT")
+      return Keyword::LIMIT;
+    break;
+  case 'N':
+    if (w == "NOT")
+      return Keyword::NOT;
+    break;
+  case 'O':
+    if (w == "ON")
+      return Keyword::ON;
+    if (w == "OR")
+      return Keyword::OR;
+    if (w == "ORDER")
+      return Keyword::ORDER;
+    if (w == "OFFSET")
+      return Keyword::OFFSET;
+    break;
+  case 'P':
+    if (w == "PREPARE")
+      return Keyword::PREPARE;
+    break;
+  case 'S':
+    if (w == "SELECT")
+      return Keyword::SELECT;
+    if (w == "SET")
+      return Keyword::SET;
+    if (w == "SAVE")
+      return Keyword::SAVE;
+    break;
+  case 'T':
+    if (w == "TABLE")
+      return Keyword::TABLE;
+    break;
+  case 'U':
+    if (w == "UPDATE")
+      return Keyword::UPDATE;
+    if (w == "USING")
+      return Keyword::USING;
+    break;
+  case 'V':
+    if (w == "VALUES")
+      return Keyword::VALUES;
+    if (w == "VACUUM")
+      return Keyword::VACUUM;
+    break;
+  case 'W':
+    if (w == "WHERE")
+      return Keyword::WHERE;
+    break;
+  default:
+    break;
+  }
+  return Keyword::NONE;
+}
+
+const char *keyword_name(Keyword kw) {
+  switch (kw) {
+  case Keyword::NONE:
+    break;
+  case Keyword::AND:
+    return "AND";
+  case Keyword::AS:
+    return "AS";
+  case Keyword::ASC:
+    return "ASC";
+  case Keyword::BETWEEN:
+    return "BETWEEN";
+  case Keyword::BTREE:
+    return "BTREE";
+  case Keyword::BY:
+    return "BY";
+  case Keyword::CHECKPOINT:
+    return "CHECKPOINT";
+  case Keyword::COPY:
+    return "COPY";
+  case Keyword::CREATE:
+    return "CREATE";
+  case Keyword::DELETE:
+    return "DELETE";
+  case Keyword::DESC:
+    return "DESC";
+  case Keyword::EXECUTE:
+    return "EXECUTE";
+  case Keyword::FROM:
+    return "FROM";
+  case Keyword::GROUP:
+    return "GROUP";
+  case Keyword::HASH:
+    return "HASH";
+  case Keyword::IN:
+    return "IN";
+  case Keyword::INDEX:
+    return "INDEX";
+  case Keyword::INSERT:
+    return "INSERT";
+  case Keyword::INTO:
+    return "INTO";
+  case Keyword::JOIN:
+    return "JOIN";
+  case Keyword::LIMIT:
+    return "LIMIT";
+  case Keyword::NOT:
+    return "NOT";
+  case Keyword::OFFSET:
+    return "OFFSET";
+  case Keyword::ON:
+    return "ON";
+  case Keyword::OR:
+    return "OR";
+  case Keyword::ORDER:
+    return "ORDER";
+  case Keyword::PREPARE:
+    return "PREPARE";
+  case Keyword::SAVE:
+    return "SAVE";
+  case Keyword::SELECT:
+    return "SELECT";
+  case Keyword::SET:
+    return "SET";
+  case Keyword::TABLE:
+    return "TABLE";
+  case Keyword::UPDATE:
+    return "UPDATE";
+  case Keyword::USING:
+    return "USING";
+  case Keyword::VACUUM:
+    return "VACUUM";
+  case Keyword::VALUES:
+    return "VALUES";
+  case Keyword::WHERE:
+    return "WHERE";
+  }
+  return "";
+}
+
+// ASCII character classes, like is_space(); cheaper than the locale-aware
+// <cctype> calls on the per-character path.
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+static inline bool is_alpha(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+Tokenizer::Tokenizer(std::string_view s) : input(s), i(0) {}
 
 void Tokenizer::skip_ws() {
-  while (i < input.size() && std::isspace(static_cast<unsigned char>(input[i])))
+  while (i < input.size() && is_space(input[i]))
     ++i;
 }
 
 Token Tokenizer::scan_string() {
   // assume input[i] == '"'
   ++i; // skip opening quote
-  std::string out;
-  while (i < input.size()) {
-    char c = input[i++];
-    if (c == '"')
-      break;
-    out.push_back(c);
-  }
-  return Token{TokType::STRING, out};
+  size_t start = i;
+  while (i < input.size() && input[i] != '"')
+    ++i;
+  std::string_view body = input.substr(start, i - start);
+  if (i < input.size())
+    ++i; // skip closing quote
+  return Token{TokType::STRING, body};
 }
 
 Token Tokenizer::scan_ident_or_number() {
   size_t start = i;
-  if (input[i] == '-' || std::isdigit(static_cast<unsigned char>(input[i]))) {
+  if (input[i] == '-' || is_digit(input[i])) {
     // number
     bool is_num = true;
     if (input[i] == '-')
       ++i;
-    if (i >= input.size() ||
-        !std::isdigit(static_cast<unsigned char>(input[i]))) {
+    if (i >= input.size() || !is_digit(input[i])) {
       // '-' not followed by digit -> treat as ident
       is_num = false;
     } else {
-      while (i < input.size() &&
-             std::isdigit(static_cast<unsigned char>(input[i])))
+      while (i < input.size() && is_digit(input[i]))
         ++i;
-      if (i < input.size() &&
-          (std::isalpha(static_cast<unsigned char>(input[i])) ||
-           input[i] == '_')) {
+      if (i < input.size() && (is_alpha(input[i]) || input[i] == '_')) {
         // something like 123abc -> ident
         is_num = false;
       }
@@ -53,28 +256,39 @@ Token Tokenizer::scan_ident_or_number() {
   // ident: letters, digits, underscore
   while (i < input.size()) {
     char c = input[i];
-    if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.') {
+    if (is_alpha(c) || is_digit(c) || c == '_' || c == '.') {
       ++i;
     } else
       break;
   }
-  return Token{TokType::IDENT, input.substr(start, i - start)};
+  std::string_view word = input.substr(start, i - start);
+  return Token{TokType::IDENT, word, keyword_of(word)};
 }
 
-Token Tokenizer::peek() const {
-  Tokenizer tmp = *this;
-  return tmp.next();
+const Token &Tokenizer::peek() {
+  if (!has_ahead) {
+    ahead = scan();
+    has_ahead = true;
+  }
+  return ahead;
 }
 
 Token Tokenizer::next() {
+  if (has_ahead) {
+    has_ahead = false;
+    return ahead;
+  }
+  return scan();
+}
+
+Token Tokenizer::scan() {
   skip_ws();
   if (i >= input.size())
     return Token{TokType::END, ""};
   char c = input[i];
   if (c == '"')
     return scan_string();
-  if (std::isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '-' ||
-      std::isdigit(static_cast<unsigned char>(c))) {
+  if (is_alpha(c) || c == '_' || c == '-' || is_digit(c)) {
     return scan_ident_or_number();
   }
   ++i;
@@ -91,6 +305,8 @@ Token Tokenizer::next() {
     return Token{TokType::SEMICOLON, ";"};
   case '=':
     return Token{TokType::EQUAL, "="};
+  case '?':
+    return Token{TokType::PARAM, "?"};
   case '!':
     if (i < input.size() && input[i] == '=') {
       ++i;
@@ -113,12 +329,7 @@ Token Tokenizer::next() {
     break;
   }
   // unknown symbol
-  return Token{TokType::SYMBOL, std::string(1, c)};
-}
-
-bool Tokenizer::eof() const {
-  Token t = peek();
-  return t.type == TokType::END;
+  return Token{TokType::SYMBOL, input.substr(i - 1, 1)};
 }
 
 } // namespace db
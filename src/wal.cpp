@@ -0,0 +1,529 @@
+#include "wal.hpp"
+#include "byte_io.hpp"
+#include "checksum.hpp"
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace db {
+
+namespace {
+
+enum class Record : uint8_t {
+  CREATE_TABLE = 1,
+  CREATE_INDEX,
+  ROWS,
+  UPDATE,
+  DELETE
+};
+
+constexpr size_t kFrameHeader = 16;
+
+[[noreturn]] void fail(const std::string &path) {
+  throw DBError("Write-ahead log " + path + ": " + std::strerror(errno));
+}
+
+void put_value(ByteWriter &w, const Value &v) {
+  w.u8(static_cast<uint8_t>(v.type));
+  if (v.type == Type::INT)
+    w.i64(v.i);
+  else
+    w.str(v.s);
+}
+
+Value get_value(ByteReader &r) {
+  uint8_t type = r.u8();
+  if (type == static_cast<uint8_t>(Type::INT))
+    return Value::make_int(r.i64());
+  if (type == static_cast<uint8_t>(Type::STR))
+    return Value::make_str(std::string(r.str()));
+  throw DBError("Corrupt write-ahead log: bad value type");
+}
+
+// Deepest condition a log record may hold; the parser allows less.
+constexpr size_t kMaxConditionDepth = 256;
+
+void put_condition(ByteWriter &w, const Condition &c) {
+  w.u8(static_cast<uint8_t>(c.kind));
+  switch (c.kind) {
+  case CondKind::CMP:
+    w.str(c.column);
+    w.u8(static_cast<uint8_t>(c.op));
+    put_value(w, c.literal);
+    return;
+  case CondKind::IN:
+    w.str(c.column);
+    w.u32(static_cast<uint32_t>(c.values.size()));
+    for (const auto &v : c.values)
+      put_value(w, v);
+    return;
+  case CondKind::AND:
+  case CondKind::OR:
+  case CondKind::NOT:
+    break;
+  }
+  w.u32(static_cast<uint32_t>(c.children.size()));
+  for (const auto &child : c.children)
+    put_condition(w, child);
+}
+
+Condition get_comparison(ByteReader &r) {
+  Condition c;
+  c.column = std::string(r.str());
+  uint8_t op = r.u8();
+  if (op > static_cast<uint8_t>(CmpOp::GE))
+    throw DBError("Corrupt write-ahead log: bad operator");
+  c.op = static_cast<CmpOp>(op);
+  c.literal = get_value(r);
+  return c;
+}
+
+Condition get_condition(ByteReader &r, size_t depth) {
+  if (depth > kMaxConditionDepth)
+    throw DBError("Corrupt write-ahead log: condition nested too deeply");
+  uint8_t kind = r.u8();
+  if (kind > static_cast<uint8_t>(CondKind::NOT))
+    throw DBError("Corrupt write-ahead log: bad condition");
+  if (kind == static_cast<uint8_t>(CondKind::CMP))
+    return get_comparison(r);
+  Condition c;
+  c.kind = static_cast<CondKind>(kind);
+  if (c.kind == CondKind::IN)
+    c.column = std::string(r.str());
+  // a count past the record's end runs out of input below
+  uint32_t n = r.u32();
+  if (n == 0 || (c.kind == CondKind::NOT && n != 1))
+    throw DBError("Corrupt write-ahead log: bad condition");
+  for (uint32_t k = 0; k < n; ++k) {
+    if (c.kind == CondKind::IN)
+      c.values.push_back(get_value(r));
+    else
+      c.children.push_back(get_condition(r, depth + 1));
+  }
+  return c;
+}
+
+// A WHERE is logged as a flag: 0 for none, 1 for a single comparison (the
+// only form earlier logs hold), 2 for a condition tree.
+void put_where(ByteWriter &w, const std::optional<Condition> &where) {
+  if (!where) {
+    w.u8(0);
+  } else if (where->kind == CondKind::CMP) {
+    w.u8(1);
+    w.str(where->column);
+    w.u8(static_cast<uint8_t>(where->op));
+    put_value(w, where->literal);
+  } else {
+    w.u8(2);
+    put_condition(w, *where);
+  }
+}
+
+std::optional<Condition> get_where(ByteReader &r) {
+  switch (r.u8()) {
+  case 0:
+    return std::nullopt;
+  case 1:
+    return get_comparison(r);
+  case 2:
+    return get_condition(r, 0);
+  default:
+    break;
+  }
+  throw DBError("Corrupt write-ahead log: bad condition");
+}
+
+// Calls fn(lsn, payload) for each intact frame in [p, p + n) and returns
+// the offset just past the last one.
+template <typename F> size_t scan_frames(const char *p, size_t n, F &&fn) {
+  size_t off = 0;
+  uint64_t prev = 0;
+  while (n - off >= kFrameHeader) {
+    uint32_t size, crc;
+    uint64_t lsn;
+    std::memcpy(&size, p + off, 4);
+    std::memcpy(&crc, p + off + 4, 4);
+    std::memcpy(&lsn, p + off + 8, 8);
+    if (size > n - off - kFrameHeader || lsn <= prev)
+      break;
+    const char *payload = p + off + kFrameHeader;
+    if (crc32c(payload, size) != crc)
+      break;
+    fn(lsn, std::string_view(payload, size));
+    prev = lsn;
+    off += kFrameHeader + size;
+  }
+  return off;
+}
+
+void apply(Database &db, std::string_view payload) {
+  ByteReader r(payload, "Corrupt write-ahead log: truncated record");
+  auto kind = static_cast<Record>(r.u8());
+  switch (kind) {
+  case Record::CREATE_TABLE: {
+    std::string name(r.str());
+    std::vector<Column> cols(r.u32());
+    for (auto &c : cols) {
+      c.name = std::string(r.str());
+      c.type = r.u8() == static_cast<uint8_t>(Type::INT) ? Type::INT
+                                                         : Type::STR;
+    }
+    db.create_table(name, cols);
+    return;
+  }
+  case Record::CREATE_INDEX: {
+    StmtCreateIndex s;
+    s.name = std::string(r.str());
+    s.table = std::string(r.str());
+    s.column = std::string(r.str());
+    s.kind = r.u8() == static_cast<uint8_t>(IndexKind::BTREE)
+                 ? IndexKind::BTREE
+                 : IndexKind::HASH;
+    db.create_index(s.name, s.table, s.column, s.kind);
+    return;
+  }
+  case Record::ROWS: {
+    Table &t = db.table(std::string(r.str()));
+    uint64_t rows = r.u64();
+    std::vector<ColumnData> block;
+    for (const auto &col : t.get_columns()) {
+      if (col.type == Type::INT) {
+        IntColumn ic;
+        for (uint64_t k = 0; k < rows; ++k)
+          ic.push_back(r.i64());
+        block.emplace_back(std::move(ic));
+      } else {
+        StrColumn sc;
+        for (uint64_t k = 0; k < rows; ++k)
+          sc.push_back(r.str());
+        block.emplace_back(std::move(sc));
+      }
+    }
+    t.append(block);
+    return;
+  }
+  case Record::UPDATE: {
+    StmtUpdate s;
+    s.table = std::string(r.str());
+    s.sets.resize(r.u32());
+    for (auto &set : s.sets) {
+      set.first = std::string(r.str());
+      set.second = get_value(r);
+    }
+    s.where = get_where(r);
+    db.table(s.table).update_where(s.sets, s.where);
+    return;
+  }
+  case Record::DELETE: {
+    StmtDelete s;
+    s.table = std::string(r.str());
+    s.where = get_where(r);
+    db.table(s.table).delete_where(s.where);
+    return;
+  }
+  }
+  throw DBError("Corrupt write-ahead log: unknown record kind");
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(std::string p, WalOptions o)
+    : path(std::move(p)), opts(o) {
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    fail(path);
+  size_t good = 0;
+  {
+    MappedFile file(path, true);
+    good = scan_frames(file.data(), file.size(),
+                       [&](uint64_t lsn, std::string_view) { last = lsn; });
+    // drop a torn tail so new records follow the last intact one
+    if (good != file.size() &&
+        ::ftruncate(fd, static_cast<off_t>(good)) != 0) {
+      ::close(fd);
+      fail(path);
+    }
+  }
+  if (::lseek(fd, static_cast<off_t>(good), SEEK_SET) < 0) {
+    ::close(fd);
+    fail(path);
+  }
+  durable = last;
+  size = good;
+  flusher = std::thread([this] { flush_loop(); });
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  {
+    std::lock_guard<std::mutex> lk(mu);
+    stopping = true;
+  }
+  cv.notify_all();
+  flusher.join();
+  try {
+    flush();
+  } catch (const DBError &) {
+    // nothing left to report to
+  }
+  ::close(fd);
+}
+
+size_t WriteAheadLog::replay(Database &db, uint64_t after) {
+  MappedFile file(path, true);
+  size_t applied = 0;
+  scan_frames(file.data(), file.size(),
+              [&](uint64_t lsn, std::string_view payload) {
+                if (lsn > after) {
+                  apply(db, payload);
+                  ++applied;
+                }
+              });
+  std::lock_guard<std::mutex> lk(mu);
+  last = std::max(last, after);
+  durable = std::max(durable, after);
+  return applied;
+}
+
+uint64_t WriteAheadLog::append(const std::string &payload) {
+  bool full;
+  uint64_t lsn;
+  {
+    std::lock_guard<std::mutex> lk(mu);
+    if (!error.empty())
+      throw DBError(error);
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    uint32_t crc = crc32c(payload.data(), payload.size());
+    lsn = ++last;
+    pending.append(reinterpret_cast<const char *>(&size), 4);
+    pending.append(reinterpret_cast<const char *>(&crc), 4);
+    pending.append(reinterpret_cast<const char *>(&lsn), 8);
+    pending += payload;
+    full = ++pending_records >= opts.group_size;
+  }
+  if (full)
+    flush();
+  return lsn;
+}
+
+void WriteAheadLog::flush() {
+  std::lock_guard<std::mutex> io(io_mu);
+  flush_locked();
+}
+
+void WriteAheadLog::flush_locked() {
+  std::string batch;
+  size_t records;
+  uint64_t upto;
+  {
+    std::lock_guard<std::mutex> lk(mu);
+    if (!error.empty())
+      throw DBError(error);
+    if (pending.empty())
+      return;
+    batch.swap(pending);
+    records = pending_records;
+    pending_records = 0;
+    upto = last;
+    syncing = true;
+  }
+  try {
+    const char *p = batch.data();
+    size_t n = batch.size();
+    while (n > 0) {
+      ssize_t w = ::write(fd, p, n);
+      if (w < 0) {
+        if (errno == EINTR)
+          continue;
+        fail(path);
+      }
+      p += w;
+      n -= static_cast<size_t>(w);
+    }
+    if (::fdatasync(fd) != 0)
+      fail(path);
+  } catch (const DBError &e) {
+    // cut off whatever part of the batch reached the file and keep the
+    // batch ahead of the records appended since
+    if (::ftruncate(fd, static_cast<off_t>(size)) == 0)
+      ::lseek(fd, static_cast<off_t>(size), SEEK_SET);
+    std::lock_guard<std::mutex> lk(mu);
+    error = e.what();
+    pending.insert(0, batch);
+    pending_records += records;
+    syncing = false;
+    synced.notify_all();
+    throw;
+  }
+  size += batch.size();
+  std::lock_guard<std::mutex> lk(mu);
+  durable = upto;
+  syncing = false;
+  synced.notify_all();
+}
+
+void WriteAheadLog::commit(uint64_t lsn) {
+  if (opts.async_commit)
+    return;
+  std::unique_lock<std::mutex> lk(mu);
+  while (durable < lsn) {
+    if (!error.empty())
+      throw DBError(error);
+    if (syncing) {
+      synced.wait(lk);
+      continue;
+    }
+    // lead the next group, which takes every record appended so far
+    lk.unlock();
+    flush();
+    lk.lock();
+  }
+}
+
+WalMark WriteAheadLog::mark() {
+  std::lock_guard<std::mutex> io(io_mu);
+  flush_locked();
+  std::lock_guard<std::mutex> lk(mu);
+  return WalMark{durable, size};
+}
+
+void WriteAheadLog::truncate_to(const WalMark &m) {
+  std::lock_guard<std::mutex> io(io_mu);
+  if (m.offset > size)
+    throw DBError("Write-ahead log " + path + ": mark past the end");
+  std::string tail(size - m.offset, '\0');
+  if (!tail.empty() &&
+      ::pread(fd, tail.data(), tail.size(), static_cast<off_t>(m.offset)) !=
+          static_cast<ssize_t>(tail.size()))
+    fail(path);
+  std::string tmp = path + ".tmp";
+  int nfd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (nfd < 0)
+    fail(tmp);
+  const char *p = tail.data();
+  size_t n = tail.size();
+  while (n > 0) {
+    ssize_t w = ::write(nfd, p, n);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0) {
+      ::close(nfd);
+      ::unlink(tmp.c_str());
+      fail(tmp);
+    }
+    p += w;
+    n -= static_cast<size_t>(w);
+  }
+  if (::fsync(nfd) != 0 || ::rename(tmp.c_str(), path.c_str()) != 0) {
+    ::close(nfd);
+    ::unlink(tmp.c_str());
+    fail(path);
+  }
+  ::close(fd);
+  fd = nfd;
+  size = tail.size();
+  // until the directory is synced a crash could bring the old log back,
+  // losing whatever is appended to the new one
+  sync_parent_dir(path);
+}
+
+void WriteAheadLog::flush_loop() {
+  std::unique_lock<std::mutex> lk(mu);
+  while (!stopping) {
+    cv.wait_for(lk, opts.group_interval);
+    if (stopping || pending.empty() || !error.empty())
+      continue;
+    lk.unlock();
+    try {
+      flush();
+    } catch (const DBError &) {
+      // the failure is kept; the next append or flush reports it
+    }
+    lk.lock();
+  }
+}
+
+uint64_t WriteAheadLog::last_lsn() const {
+  std::lock_guard<std::mutex> lk(mu);
+  return last;
+}
+
+uint64_t WriteAheadLog::durable_lsn() const {
+  std::lock_guard<std::mutex> lk(mu);
+  return durable;
+}
+
+uint64_t WriteAheadLog::log_create_table(const std::string &name,
+                                         const std::vector<Column> &cols) {
+  ByteWriter w;
+  w.u8(static_cast<uint8_t>(Record::CREATE_TABLE));
+  w.str(name);
+  w.u32(static_cast<uint32_t>(cols.size()));
+  for (const auto &c : cols) {
+    w.str(c.name);
+    w.u8(static_cast<uint8_t>(c.type));
+  }
+  return append(w.out);
+}
+
+uint64_t WriteAheadLog::log_create_index(const StmtCreateIndex &s) {
+  ByteWriter w;
+  w.u8(static_cast<uint8_t>(Record::CREATE_INDEX));
+  w.str(s.name);
+  w.str(s.table);
+  w.str(s.column);
+  w.u8(static_cast<uint8_t>(s.kind));
+  return append(w.out);
+}
+
+uint64_t WriteAheadLog::log_rows(const Table &t, size_t begin, size_t end) {
+  // bulk loads are split so every record stays well under the frame limit
+  constexpr size_t kRowsPerRecord = 1 << 14;
+  uint64_t lsn = 0;
+  for (size_t lo = begin; lo < end; lo += kRowsPerRecord) {
+    size_t hi = std::min(end, lo + kRowsPerRecord);
+    ByteWriter w;
+    w.u8(static_cast<uint8_t>(Record::ROWS));
+    w.str(t.get_name());
+    w.u64(hi - lo);
+    // column by column, matching the table's layout
+    for (size_t c = 0; c < t.get_columns().size(); ++c) {
+      if (const auto *ic = std::get_if<IntColumn>(&t.column_data(c))) {
+        ic->buffer().runs(lo, hi, [&](const int64_t *v, size_t n, size_t) {
+          w.raw(v, n * sizeof(int64_t));
+        });
+      } else {
+        const auto &sc = std::get<StrColumn>(t.column_data(c));
+        for (size_t row = lo; row < hi; ++row)
+          w.str(sc.get(row));
+      }
+    }
+    lsn = append(w.out);
+  }
+  return lsn;
+}
+
+uint64_t WriteAheadLog::log_update(const StmtUpdate &s) {
+  ByteWriter w;
+  w.u8(static_cast<uint8_t>(Record::UPDATE));
+  w.str(s.table);
+  w.u32(static_cast<uint32_t>(s.sets.size()));
+  for (const auto &set : s.sets) {
+    w.str(set.first);
+    put_value(w, set.second);
+  }
+  put_where(w, s.where);
+  return append(w.out);
+}
+
+uint64_t WriteAheadLog::log_delete(const StmtDelete &s) {
+  ByteWriter w;
+  w.u8(static_cast<uint8_t>(Record::DELETE));
+  w.str(s.table);
+  put_where(w, s.where);
+  return append(w.out);
+}
+
+} // namespace db
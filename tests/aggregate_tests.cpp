@@ -0,0 +1,204 @@
+#include "aggregate.hpp"
+#include "group.hpp"
+#include "parallel.hpp"
+#include "parser.hpp"
+#include "test_util.hpp"
+#include <catch2/catch.hpp>
+#include <limits>
+
+using namespace db;
+
+namespace {
+// rows k = 0..n-1 with v = k % 100 - 50 and name "n<k % 37>"
+void fill(Database &db, size_t n) {
+  make_table(db, "t", n,
+             {int_column("k", [](int64_t k) { return k; }),
+              int_column("v", [](int64_t k) { return k % 100 - 50; }),
+              str_column("name", [](int64_t k) {
+                return "n" + std::to_string(k % 37);
+              })});
+}
+} // namespace
+
+TEST_CASE("INT aggregate kernels", "[aggregate]") {
+  std::vector<int64_t> values;
+  for (int64_t k = 0; k < 1000; ++k)
+    values.push_back((k * 7919) % 1013 - 500);
+  values[17] = std::numeric_limits<int64_t>::max();
+  values[900] = std::numeric_limits<int64_t>::min();
+
+  IntAggregate dense;
+  aggregate_ints(values.data(), values.size(), dense);
+  IntAggregate ref;
+  uint64_t sum = 0;
+  for (int64_t v : values) {
+    sum += static_cast<uint64_t>(v);
+    ref.min = std::min(ref.min, v);
+    ref.max = std::max(ref.max, v);
+  }
+  CHECK(dense.count == 1000);
+  CHECK(dense.sum == static_cast<int64_t>(sum));
+  CHECK(dense.min == ref.min);
+  CHECK(dense.max == ref.max);
+
+  // every third position of a run starting at 5000
+  std::vector<size_t> rows;
+  for (size_t i = 0; i < values.size(); i += 3)
+    rows.push_back(5000 + i);
+  IntAggregate sel;
+  aggregate_ints(values.data(), 5000, rows.data(), rows.size(), sel);
+  CHECK(sel.count == static_cast<int64_t>(rows.size()));
+  CHECK(sel.min == std::numeric_limits<int64_t>::min());
+
+  IntAggregate halves;
+  IntAggregate second;
+  aggregate_ints(values.data(), 400, halves);
+  aggregate_ints(values.data() + 400, 600, second);
+  halves.merge(second);
+  CHECK(halves.sum == dense.sum);
+  CHECK(halves.min == dense.min);
+  CHECK(halves.max == dense.max);
+}
+
+TEST_CASE("Aggregates in SELECT", "[aggregate]") {
+  Database db;
+  fill(db, 10000);
+
+  auto r = run(db, "SELECT COUNT(*), SUM(v), MIN(v), MAX(v), AVG(k) FROM t");
+  REQUIRE(r.headers == std::vector<std::string>{"COUNT(*)", "SUM(v)",
+                                                "MIN(v)", "MAX(v)", "AVG(k)"});
+  REQUIRE(r.row_count() == 1);
+  CHECK(r.cell(0, 0) == "10000");
+  CHECK(r.cell(0, 1) == "-5000");
+  CHECK(r.cell(0, 2) == "-50");
+  CHECK(r.cell(0, 3) == "49");
+  CHECK(r.cell(0, 4) == "4999");
+  CHECK(r.columns[1].type == Type::INT);
+
+  SECTION("Over the rows the WHERE keeps") {
+    auto w = run(db, "SELECT COUNT(v), SUM(v), MIN(k) FROM t WHERE v > 40");
+    CHECK(w.cell(0, 0) == "900");
+    CHECK(w.cell(0, 1) == std::to_string(100 * (41 + 49) * 9 / 2));
+    CHECK(w.cell(0, 2) == "91");
+
+    auto s = run(db, "SELECT COUNT(*), MIN(name), MAX(name) FROM t "
+                     "WHERE name != \"n0\"");
+    CHECK(s.cell(0, 0) == std::to_string(10000 - 271));
+    CHECK(s.cell(0, 1) == "n1");
+    CHECK(s.cell(0, 2) == "n9");
+    CHECK(s.columns[1].type == Type::STR);
+  }
+
+  SECTION("No matching rows") {
+    auto e = run(db, "SELECT COUNT(*), SUM(v), MIN(v), AVG(v) FROM t "
+                     "WHERE k < 0");
+    CHECK(e.cell(0, 0) == "0");
+    CHECK(e.cell(0, 1) == "0");
+    CHECK(e.cell(0, 2) == "");
+    CHECK(e.cell(0, 3) == "");
+  }
+
+  SECTION("Errors") {
+    REQUIRE_THROWS_AS(run(db, "SELECT SUM(name) FROM t"), TypeError);
+    REQUIRE_THROWS_AS(run(db, "SELECT AVG(nope) FROM t"), DBError);
+  }
+}
+
+TEST_CASE("Group tables", "[aggregate]") {
+  GroupTable<int64_t> a(1, 0);
+  GroupTable<int64_t> b(1, 0);
+  // enough keys to grow the slot array many times
+  for (int64_t k = 0; k < 100000; ++k) {
+    auto &t = k % 2 ? a : b;
+    t.int_at(t.add_row(k % 30000, group_hash(k % 30000)), 0).add(k);
+  }
+  REQUIRE(a.size() == 15000);
+  REQUIRE(b.size() == 15000);
+  a.merge(b);
+  REQUIRE(a.size() == 30000);
+  for (size_t g = 0; g < a.size(); ++g) {
+    int64_t k = a.key(g);
+    // k, k + 30000, k + 60000 and, below 10000, k + 90000
+    int64_t n = k < 10000 ? 4 : 3;
+    REQUIRE(a.rows(g) == n);
+    REQUIRE(a.int_at(g, 0).sum == n * k + 30000 * n * (n - 1) / 2);
+  }
+
+  // STR keys only view their bytes
+  std::string text = "abcabc";
+  GroupTable<std::string_view> s(0, 0);
+  std::string_view first(text.data(), 3);
+  std::string_view second(text.data() + 3, 3);
+  size_t g = s.add_row(first, group_hash(first));
+  REQUIRE(s.add_row(second, group_hash(second)) == g);
+  REQUIRE(s.key(g).data() == text.data());
+  REQUIRE(s.rows(g) == 2);
+}
+
+namespace {
+// result rows as text, sorted, since groups come in no particular order
+std::vector<std::string> sorted_rows(const QueryResult &r) {
+  std::vector<std::string> out;
+  for (size_t row = 0; row < r.row_count(); ++row) {
+    std::string line;
+    for (size_t c = 0; c < r.headers.size(); ++c)
+      line += (c ? "," : "") + r.cell(row, c);
+    out.push_back(line);
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+} // namespace
+
+TEST_CASE("GROUP BY", "[aggregate]") {
+  Database db;
+  fill(db, 10000);
+
+  auto r = run(db, "SELECT COUNT(*), v, SUM(k), MIN(name) FROM t GROUP BY v");
+  REQUIRE(r.headers ==
+          std::vector<std::string>{"COUNT(*)", "v", "SUM(k)", "MIN(name)"});
+  REQUIRE(r.row_count() == 100);
+  CHECK(r.columns[1].type == Type::INT);
+  for (size_t row = 0; row < r.row_count(); ++row) {
+    int64_t v = r.columns[1].ints[row];
+    // k = v + 50 + 100 j for j in [0, 100)
+    CHECK(r.columns[0].ints[row] == 100);
+    CHECK(r.columns[2].ints[row] == 100 * (v + 50) + 100 * 4950);
+  }
+
+  SECTION("STR keys") {
+    auto s = run(db, "SELECT name, COUNT(k), MAX(k) FROM t WHERE k < 74 "
+                     "GROUP BY name");
+    REQUIRE(s.row_count() == 37);
+    CHECK(s.columns[0].type == Type::STR);
+    auto rows = sorted_rows(s);
+    CHECK(rows[0] == "n0,2,37");
+    CHECK(rows[1] == "n1,2,38");
+  }
+
+  SECTION("Without aggregates, one row per distinct key") {
+    run(db, "CREATE INDEX t_k ON t (k)");
+    auto d = run(db, "SELECT name FROM t WHERE k = 40 GROUP BY name");
+    REQUIRE(d.row_count() == 1);
+    CHECK(d.cell(0, 0) == "n3");
+  }
+
+  SECTION("Parallel partitioned aggregation matches the serial one") {
+    run(db, "DELETE FROM t WHERE k = 7");
+    const std::string sql = "SELECT k, COUNT(*), SUM(v), MAX(name) FROM t "
+                            "WHERE v != 0 GROUP BY k";
+    auto serial = sorted_rows(run(db, sql));
+    REQUIRE(serial.size() == 10000 - 100 - 1);
+    ScopedParallelOptions scoped({4, 0, 1000});
+    CHECK(sorted_rows(run(db, sql)) == serial);
+    auto by_name = sorted_rows(
+        run(db, "SELECT name, SUM(v), COUNT(*) FROM t GROUP BY name"));
+    REQUIRE(by_name.size() == 37);
+    CHECK(by_name[0] == "n0,-105,271");
+  }
+
+  SECTION("Unknown key column") {
+    REQUIRE_THROWS_AS(run(db, "SELECT COUNT(*) FROM t GROUP BY nope"),
+                      DBError);
+  }
+}
@@ -0,0 +1,121 @@
+#include "checkpoint.hpp"
+#include "parser.hpp"
+#include "snapshot.hpp"
+#include "test_util.hpp"
+#include "wal.hpp"
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <fstream>
+
+using namespace db;
+
+namespace {
+void insert_range(Database &db, int from, int to) {
+  for (int i = from; i < to; ++i)
+    run(db, "INSERT INTO t (id, name) VALUES (" + std::to_string(i) +
+                ", \"n" + std::to_string(i) + "\")");
+}
+} // namespace
+
+TEST_CASE("Checkpoint runs while the parent keeps writing",
+          "[checkpoint]") {
+  TempPath log_path("ckpt_wal");
+  TempPath snap_path("ckpt_snap");
+  std::string expected;
+  {
+    WriteAheadLog wal(log_path.path);
+    Database db;
+    db.attach_wal(&wal);
+    run(db, "CREATE TABLE t (id int, name str)");
+    insert_range(db, 0, 2000);
+    run(db, "CHECKPOINT \"" + snap_path.path + "\"");
+    REQUIRE(db.checkpointer().running());
+    // rows written during the checkpoint stay in the log
+    insert_range(db, 2000, 2500);
+    run(db, "DELETE FROM t WHERE id < 10");
+    auto r = db.checkpointer().poll(true);
+    REQUIRE(r.has_value());
+    REQUIRE(r->ok);
+    REQUIRE(r->error.empty());
+    REQUIRE(r->wal_lsn > 0);
+    REQUIRE(r->seconds >= 0);
+    REQUIRE_FALSE(db.checkpointer().running());
+    REQUIRE_FALSE(db.checkpointer().poll().has_value());
+    expected = dump(db, "t");
+  }
+
+  // the snapshot holds the first 2000 rows only
+  {
+    Database db;
+    uint64_t lsn = load_snapshot(db, snap_path.path);
+    REQUIRE(lsn > 0);
+    REQUIRE(db.table("t").row_count() == 2000);
+  }
+
+  // snapshot plus the remaining log is the parent's state
+  Database db;
+  uint64_t lsn = load_snapshot(db, snap_path.path);
+  WriteAheadLog wal(log_path.path);
+  wal.replay(db, lsn);
+  REQUIRE(dump(db, "t") == expected);
+}
+
+TEST_CASE("Checkpoint truncates the log", "[checkpoint]") {
+  TempPath log_path("ckpt_trunc_wal");
+  TempPath snap_path("ckpt_trunc_snap");
+  WriteAheadLog wal(log_path.path);
+  Database db;
+  db.attach_wal(&wal);
+  run(db, "CREATE TABLE t (id int, name str)");
+  insert_range(db, 0, 1000);
+  wal.flush();
+  size_t before = file_size(log_path.path);
+  REQUIRE(before > 0);
+
+  db.checkpointer().start(db, snap_path.path);
+  auto r = db.checkpointer().poll(true);
+  REQUIRE(r.has_value());
+  REQUIRE(r->ok);
+  REQUIRE(file_size(log_path.path) == 0);
+
+  // the log keeps working after the truncation
+  insert_range(db, 1000, 1010);
+  wal.flush();
+  REQUIRE(file_size(log_path.path) > 0);
+  std::string expected = dump(db, "t");
+
+  Database copy;
+  uint64_t lsn = load_snapshot(copy, snap_path.path);
+  WriteAheadLog reopened(log_path.path);
+  reopened.replay(copy, lsn);
+  REQUIRE(dump(copy, "t") == expected);
+}
+
+TEST_CASE("Checkpoint errors", "[checkpoint]") {
+  TempPath snap_path("ckpt_err");
+  Database db;
+  run(db, "CREATE TABLE t (id int, name str)");
+  insert_range(db, 0, 10);
+
+  SECTION("one at a time") {
+    db.checkpointer().start(db, snap_path.path);
+    REQUIRE_THROWS_AS(db.checkpointer().start(db, snap_path.path), DBError);
+    auto r = db.checkpointer().poll(true);
+    REQUIRE(r.has_value());
+    REQUIRE(r->ok);
+    REQUIRE(r->wal_lsn == 0);
+  }
+
+  SECTION("failure is reported, not thrown") {
+    run(db, "CHECKPOINT \"/nonexistent_dir/snap\"");
+    auto r = db.checkpointer().poll(true);
+    REQUIRE(r.has_value());
+    REQUIRE_FALSE(r->ok);
+    REQUIRE_FALSE(r->error.empty());
+  }
+
+  SECTION("parse") {
+    REQUIRE_THROWS_AS(parse_statement("CHECKPOINT"), ParseError);
+    REQUIRE_THROWS_AS(parse_statement("CHECKPOINT \"a\" x"), ParseError);
+  }
+}
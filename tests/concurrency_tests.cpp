@@ -0,0 +1,188 @@
+#include "parser.hpp"
+#include "prepared.hpp"
+#include "test_util.hpp"
+#include "wal.hpp"
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <thread>
+
+using namespace db;
+
+// Assertions stay on the test thread (Catch2 is not thread-safe); workers
+// record failures in atomics.
+
+TEST_CASE("Concurrent writers and readers", "[concurrency]") {
+  Database db;
+  run(db, "CREATE TABLE shared (w int, k int, tag str)");
+  run(db, "CREATE INDEX by_w ON shared (w)");
+  // rewritten and compacted throughout, so its storage keeps moving
+  run(db, "CREATE TABLE churn (name str)");
+  const std::string kName = "a name long enough to live on the heap";
+  constexpr int kWriters = 4;
+  constexpr int kStatements = 200;
+  std::atomic<bool> done{false};
+  std::atomic<int> torn{0};
+  std::atomic<int> garbled{0};
+  std::atomic<int> errors{0};
+
+  std::vector<std::thread> threads;
+  for (int w = 0; w < kWriters; ++w) {
+    threads.emplace_back([&, w] {
+      try {
+        std::string own = "own" + std::to_string(w);
+        run(db, "CREATE TABLE " + own + " (k int)");
+        std::string ws = std::to_string(w);
+        // the end of each row: its tag and closing parenthesis
+        std::string tag = ", \"tag" + ws + "\")";
+        for (int k = 0; k < kStatements; ++k) {
+          std::string ks = std::to_string(k);
+          // two rows per statement, so readers can spot half of one
+          run(db, "INSERT INTO shared (w, k, tag) VALUES (" + ws + ", " + ks +
+                      tag + ", (" + ws + ", " + ks + tag);
+          run(db, "INSERT INTO " + own + " (k) VALUES (" + ks + ")");
+          if (k % 10 == 0)
+            run(db, "UPDATE shared SET k = -1 WHERE w = " + ws);
+        }
+      } catch (...) {
+        ++errors;
+      }
+    });
+  }
+  threads.emplace_back([&] {
+    try {
+      for (int k = 0; k < kStatements; ++k) {
+        run(db, "INSERT INTO churn (name) VALUES (\"" + kName + "\")");
+        run(db, "DELETE FROM churn WHERE name = \"" + kName + "\"");
+      }
+    } catch (...) {
+      ++errors;
+    }
+  });
+  // results are read after the query returns, while writers go on
+  threads.emplace_back([&] {
+    auto count = db.prepare("SELECT k, tag FROM shared WHERE w = ?");
+    while (!done.load()) {
+      for (int w = 0; w < kWriters; ++w) {
+        auto r = count->execute({Value::make_int(w)});
+        if (r->row_count() % 2 != 0)
+          ++torn;
+        for (size_t i = 0; i < r->row_count(); ++i) {
+          if (r->cell(i, 1) != "tag" + std::to_string(w))
+            ++garbled;
+        }
+      }
+      auto names = execute(db, parse_statement("SELECT name FROM churn"));
+      for (size_t i = 0; i < names->row_count(); ++i) {
+        if (names->cell(i, 0) != kName)
+          ++garbled;
+      }
+    }
+  });
+  for (int w = 0; w <= kWriters; ++w)
+    threads[static_cast<size_t>(w)].join();
+  done = true;
+  threads.back().join();
+
+  REQUIRE(errors.load() == 0);
+  REQUIRE(torn.load() == 0);
+  REQUIRE(garbled.load() == 0);
+  REQUIRE(db.table("shared").row_count() == 2 * kWriters * kStatements);
+  for (int w = 0; w < kWriters; ++w)
+    REQUIRE(db.table("own" + std::to_string(w)).row_count() == kStatements);
+}
+
+TEST_CASE("Concurrent DDL", "[concurrency]") {
+  Database db;
+  constexpr int kThreads = 4;
+  std::atomic<int> created{0};
+  std::atomic<int> rejected{0};
+  std::atomic<int> lookups_failed{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&] {
+      for (int k = 0; k < 50; ++k) {
+        // every thread races for the same names
+        try {
+          db.create_table("t" + std::to_string(k), {{"x", Type::INT}});
+          ++created;
+        } catch (const DBError &) {
+          ++rejected;
+        }
+        try {
+          db.table("t" + std::to_string(k));
+        } catch (const DBError &) {
+          ++lookups_failed;
+        }
+        try {
+          db.create_index("ix" + std::to_string(k), "t" + std::to_string(k),
+                          "x", IndexKind::HASH);
+        } catch (const DBError &) {
+        }
+      }
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  REQUIRE(created.load() == 50);
+  REQUIRE(rejected.load() == 50 * (kThreads - 1));
+  REQUIRE(lookups_failed.load() == 0);
+  REQUIRE(db.get_tables().size() == 50);
+  for (const Table *t : db.get_tables())
+    REQUIRE(t->get_indexes().size() == 1);
+}
+
+TEST_CASE("The log keeps concurrent writers in order", "[concurrency]") {
+  std::string path = std::string(P_tmpdir) + "/inmemdb_concurrent_wal_" +
+                     std::to_string(reinterpret_cast<uintptr_t>(&path));
+  std::string expected;
+  {
+    WriteAheadLog log(path);
+    Database db;
+    db.attach_wal(&log);
+    run(db, "CREATE TABLE t (id int, v int)");
+    run(db, "INSERT INTO t (id, v) VALUES (1, 0), (2, 0)");
+    std::vector<std::thread> threads;
+    for (int w = 0; w < 4; ++w) {
+      threads.emplace_back([&, w] {
+        // the final values depend on the order the updates were applied
+        for (int k = 0; k < 100; ++k) {
+          run(db, "UPDATE t SET v = " + std::to_string(w * 1000 + k) +
+                      " WHERE id = " + std::to_string(1 + k % 2));
+          if (k % 25 == 0)
+            run(db, "DELETE FROM t WHERE v = " + std::to_string(w));
+        }
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+    expected = dump(db, "t");
+  }
+  Database db;
+  WriteAheadLog log(path);
+  log.replay(db, 0);
+  REQUIRE(dump(db, "t") == expected);
+  std::remove(path.c_str());
+}
+
+TEST_CASE("A shared prepared statement runs from many threads",
+          "[concurrency]") {
+  Database db;
+  run(db, "CREATE TABLE t (id int, name str)");
+  auto insert = db.prepare("INSERT INTO t (id, name) VALUES (?, ?)");
+  std::vector<std::thread> threads;
+  for (int w = 0; w < 4; ++w) {
+    threads.emplace_back([&, w] {
+      for (int k = 0; k < 100; ++k)
+        insert->execute({Value::make_int(w),
+                         Value::make_str("n" + std::to_string(w))});
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  // each row got the parameters of a single execution
+  auto r = *execute(db, parse_statement("SELECT * FROM t WHERE id = 2"));
+  REQUIRE(r.row_count() == 100);
+  for (size_t row = 0; row < r.row_count(); ++row)
+    REQUIRE(r.cell(row, 1) == "n2");
+}
@@ -0,0 +1,92 @@
+#include "copy.hpp"
+#include "parallel.hpp"
+#include "parser.hpp"
+#include "test_util.hpp"
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <fstream>
+
+using namespace db;
+
+namespace {
+// A temporary file holding contents.
+struct TempFile : TempPath {
+  explicit TempFile(const std::string &contents) : TempPath("copy") {
+    std::ofstream(path, std::ios::binary) << contents;
+  }
+};
+} // namespace
+
+TEST_CASE("COPY FROM CSV", "[copy]") {
+  Database db;
+  execute(db, parse_statement("CREATE TABLE t (id int, name str, n int)"));
+  Table &t = db.table("t");
+
+  SECTION("Quoted fields, reordered and missing columns") {
+    TempFile f("name,id\r\n"
+               "plain,1\r\n"
+               "\"a,b\",2\n"
+               "\"say \"\"hi\"\"\",3\n"
+               "\n"
+               "\"two\nlines\",-4\n"
+               ",5");
+    execute(db, parse_statement("COPY t FROM \"" + f.path + "\""));
+    REQUIRE(t.row_count() == 5);
+    REQUIRE(t.cell(0, 1).s == "plain");
+    REQUIRE(t.cell(1, 1).s == "a,b");
+    REQUIRE(t.cell(2, 1).s == "say \"hi\"");
+    REQUIRE(t.cell(3, 1).s == "two\nlines");
+    REQUIRE(t.cell(3, 0).i == -4);
+    REQUIRE(t.cell(4, 1).s.empty());
+    REQUIRE(t.cell(4, 2).i == 0);
+  }
+
+  SECTION("Chunked parallel load matches the CSV output") {
+    ParallelOptions saved = parallel_options();
+    set_parallel_options({4, 0, 10});
+    std::string csv = "id,name,n\n";
+    for (int i = 0; i < 2000; ++i)
+      csv += std::to_string(i) + ",\"r;" + std::to_string(i) + "\n,\"," +
+             std::to_string(i * 7) + "\n";
+    TempFile f(csv);
+    execute(db, parse_statement("CREATE INDEX ix ON t (id)"));
+    // tiny chunks put boundaries inside quoted fields
+    REQUIRE(copy_from_csv(t, f.path, 37) == 2000);
+    set_parallel_options(saved);
+
+    auto res = execute(db, parse_statement("SELECT * FROM t"));
+    REQUIRE(to_csv(*res) == csv);
+    auto hit = execute(db, parse_statement("SELECT n FROM t WHERE id = 1234"));
+    REQUIRE(hit->row_count() == 1);
+    REQUIRE(hit->cell(0, 0) == "8638");
+  }
+
+  SECTION("An empty line is a row of a single STR column") {
+    execute(db, parse_statement("CREATE TABLE s (v str)"));
+    execute(db, parse_statement("INSERT INTO s (v) VALUES (\"a\"), (\"\"), "
+                                "(\"b\"), (\"\")"));
+    std::string csv = to_csv(*execute(db, parse_statement("SELECT v FROM s")));
+    REQUIRE(csv == "v\na\n\nb\n\n");
+    TempFile f(csv);
+    execute(db, parse_statement("CREATE TABLE copied (v str)"));
+    REQUIRE(copy_from_csv(db.table("copied"), f.path) == 4);
+    REQUIRE(to_csv(*execute(db, parse_statement("SELECT v FROM copied"))) ==
+            csv);
+  }
+
+  SECTION("Errors leave the table untouched") {
+    TempFile bad_int("id,name\n1,a\nx,b\n");
+    REQUIRE_THROWS_WITH(copy_from_csv(t, bad_int.path),
+                        Catch::Contains("line 3"));
+    TempFile short_row("id,name\n1\n");
+    REQUIRE_THROWS_AS(copy_from_csv(t, short_row.path), DBError);
+    TempFile long_row("id\n1,a\n");
+    REQUIRE_THROWS_AS(copy_from_csv(t, long_row.path), DBError);
+    TempFile unknown("id,age\n1,2\n");
+    REQUIRE_THROWS_AS(copy_from_csv(t, unknown.path), DBError);
+    TempFile open_quote("name\n\"abc\n");
+    REQUIRE_THROWS_AS(copy_from_csv(t, open_quote.path), DBError);
+    REQUIRE_THROWS_AS(copy_from_csv(t, "/nonexistent/file.csv"), DBError);
+    REQUIRE(t.row_count() == 0);
+  }
+}
@@ -1,4 +1,5 @@
 #include "database.hpp"
+#include "predicate.hpp"
 #include <catch2/catch.hpp>
 
 using namespace db;
@@ -37,21 +38,21 @@ TEST_CASE("Table row operations", "[database]") {
     table.insert_row({Value::make_str("alice"), Value::make_int(30)});
 
     auto result = table.select_where({}, true, std::nullopt);
-    REQUIRE(result.rows.size() == 1);
-    REQUIRE(result.rows[0][0] == "alice");
-    REQUIRE(result.rows[0][1] == "30");
+    REQUIRE(result.row_count() == 1);
+    REQUIRE(result.cell(0, 0) == "alice");
+    REQUIRE(result.cell(0, 1) == "30");
   }
 
   SECTION("Insert with default values") {
     // Clear the table first
     auto result1 = table.select_where({}, true, std::nullopt);
-    size_t initial_count = result1.rows.size();
+    size_t initial_count = result1.row_count();
 
     table.insert_row({Value::make_str("bob"), std::nullopt});
 
     auto result2 = table.select_where({}, true, std::nullopt);
-    REQUIRE(result2.rows.size() == initial_count + 1);
-    REQUIRE(result2.rows[initial_count][1] == "0"); // default int value
+    REQUIRE(result2.row_count() == initial_count + 1);
+    REQUIRE(result2.cell(initial_count, 1) == "0"); // default int value
   }
 
   SECTION("Type mismatch error") {
@@ -80,20 +81,34 @@ TEST_CASE("Table selection operations", "[database]") {
   SECTION("Select all columns") {
     auto result = table.select_where({}, true, std::nullopt);
     REQUIRE(result.headers.size() == 3);
-    REQUIRE(result.rows.size() == 3);
+    REQUIRE(result.row_count() == 3);
   }
 
   SECTION("Select specific columns") {
     auto result = table.select_where({"name", "age"}, false, std::nullopt);
     REQUIRE(result.headers.size() == 2);
-    REQUIRE(result.rows.size() == 3);
+    REQUIRE(result.row_count() == 3);
   }
 
   SECTION("WHERE conditions") {
     Condition cond{"age", Condition::Op::GT, Value::make_int(30)};
     auto result = table.select_where({}, true, cond);
-    REQUIRE(result.rows.size() == 1);
-    REQUIRE(result.rows[0][0] == "carol");
+    REQUIRE(result.row_count() == 1);
+    REQUIRE(result.cell(0, 0) == "carol");
+  }
+
+  SECTION("Results outlive later writes") {
+    auto result = table.select_where({"name", "city"}, false, std::nullopt);
+    auto copy = result;
+    // enough rows to move the string storage several times
+    for (int i = 0; i < 2000; ++i)
+      table.insert_row({Value::make_str("name" + std::to_string(i)),
+                        Value::make_int(i), Value::make_str("somewhere")});
+    table.delete_where(std::nullopt);
+    REQUIRE(result.cell(0, 0) == "alice");
+    REQUIRE(result.cell(2, 1) == "Chicago");
+    result = QueryResult();
+    REQUIRE(copy.cell(1, 0) == "bob");
   }
 }
 
@@ -113,7 +128,7 @@ TEST_CASE("Table update and delete operations", "[database]") {
     REQUIRE(updated == 1);
 
     auto result = table.select_where({}, true, cond);
-    REQUIRE(result.rows[0][1] == "31");
+    REQUIRE(result.cell(0, 1) == "31");
   }
 
   SECTION("Delete operations") {
@@ -122,7 +137,7 @@ TEST_CASE("Table update and delete operations", "[database]") {
     REQUIRE(deleted == 1);
 
     auto result = table.select_where({}, true, std::nullopt);
-    REQUIRE(result.rows.size() == 1);
+    REQUIRE(result.row_count() == 1);
   }
 }
 
@@ -147,3 +162,137 @@ TEST_CASE("Value operations", "[database]") {
     REQUIRE_THROWS_AS(int_val.compare(str_val), TypeError);
   }
 }
+
+TEST_CASE("Columnar storage", "[database]") {
+  SECTION("String column overwrite and compaction") {
+    StrColumn col;
+    col.push_back("alice");
+    col.push_back("bob");
+    col.set(1, "a much longer replacement value");
+    col.set(0, "al");
+    REQUIRE(col.get(0) == "al");
+    REQUIRE(col.get(1) == "a much longer replacement value");
+    for (int k = 0; k < 1000; ++k)
+      col.set(0, std::string(static_cast<size_t>(k % 50), 'x'));
+    REQUIRE(col.get(0) == std::string(49, 'x'));
+    REQUIRE(col.get(1) == "a much longer replacement value");
+  }
+
+  SECTION("Deleting rows keeps columns aligned") {
+    Database db;
+    db.create_table("t", {{"id", Type::INT}, {"name", Type::STR}});
+    auto &table = db.table("t");
+    for (int k = 0; k < 10; ++k)
+      table.insert_row(
+          {Value::make_int(k), Value::make_str("n" + std::to_string(k))});
+    Condition high{"id", Condition::Op::GT, Value::make_int(4)};
+    REQUIRE(table.delete_where(high) == 5);
+    REQUIRE(table.row_count() == 5);
+    auto result = table.select_where({"name", "id"}, false, std::nullopt);
+    REQUIRE(result.row_count() == 5);
+    REQUIRE(result.cell(4, 0) == "n4");
+    REQUIRE(result.cell(4, 1) == "4");
+  }
+
+  SECTION("Failed insert leaves no partial row") {
+    Database db;
+    db.create_table("t", {{"id", Type::INT}, {"name", Type::STR}});
+    auto &table = db.table("t");
+    REQUIRE_THROWS_AS(
+        table.insert_row({Value::make_int(1), Value::make_int(2)}), TypeError);
+    REQUIRE(table.row_count() == 0);
+  }
+}
+
+TEST_CASE("Bound conditions", "[database]") {
+  Database db;
+  db.create_table("t", {{"id", Type::INT}, {"name", Type::STR}});
+  auto &table = db.table("t");
+
+  SECTION("Type errors are caught when binding") {
+    Condition cond{"id", Condition::Op::EQ, Value::make_str("x")};
+    REQUIRE_THROWS_AS(BoundCondition(table, cond), TypeError);
+    REQUIRE_THROWS_AS(table.select_where({}, true, cond), TypeError);
+  }
+
+  SECTION("Every operator on both column types") {
+    const char *names[] = {"a", "b", "c", "d"};
+    for (int k = 0; k < 4; ++k)
+      table.insert_row({Value::make_int(k), Value::make_str(names[k])});
+    auto rows = [&](Condition c) {
+      std::vector<size_t> out;
+      BoundCondition(table, c).select(0, table.row_count(), out);
+      return out;
+    };
+    using Op = Condition::Op;
+    auto lit = Value::make_int(2);
+    REQUIRE(rows({"id", Op::EQ, lit}) == std::vector<size_t>{2});
+    REQUIRE(rows({"id", Op::NEQ, lit}) == std::vector<size_t>{0, 1, 3});
+    REQUIRE(rows({"id", Op::LT, lit}) == std::vector<size_t>{0, 1});
+    REQUIRE(rows({"id", Op::GT, lit}) == std::vector<size_t>{3});
+    REQUIRE(rows({"id", Op::LE, lit}) == std::vector<size_t>{0, 1, 2});
+    REQUIRE(rows({"id", Op::GE, lit}) == std::vector<size_t>{2, 3});
+    auto s = Value::make_str("b");
+    REQUIRE(rows({"name", Op::EQ, s}) == std::vector<size_t>{1});
+    REQUIRE(rows({"name", Op::GT, s}) == std::vector<size_t>{2, 3});
+    REQUIRE(BoundCondition(table, {"name", Op::LE, s}).matches(0));
+  }
+}
+
+TEST_CASE("Deleted rows are marked until compaction", "[database]") {
+  Database db;
+  db.create_table("t", {{"id", Type::INT}, {"name", Type::STR}});
+  db.create_index("by_id", "t", "id", IndexKind::HASH);
+  auto &table = db.table("t");
+  for (int k = 0; k < 1000; ++k)
+    table.insert_row(
+        {Value::make_int(k), Value::make_str("n" + std::to_string(k))});
+  using Op = Condition::Op;
+  auto count = [&](std::optional<Condition> c) {
+    return table.select_where({}, true, c).row_count();
+  };
+
+  REQUIRE(table.delete_where(Condition{"id", Op::LT, Value::make_int(10)}) ==
+          10);
+  // marked in place: positions and index entries stay put
+  REQUIRE(table.row_count() == 990);
+  REQUIRE(table.slot_count() == 1000);
+  REQUIRE(table.is_deleted(5));
+  REQUIRE_FALSE(table.is_deleted(10));
+  REQUIRE(count(Condition{"id", Op::EQ, Value::make_int(5)}) == 0);
+  REQUIRE(count(Condition{"name", Op::EQ, Value::make_str("n5")}) == 0);
+  REQUIRE(count(std::nullopt) == 990);
+  REQUIRE(table.update_where({{"name", Value::make_str("x")}},
+                             Condition{"id", Op::LT, Value::make_int(10)}) ==
+          0);
+  REQUIRE(table.delete_where(Condition{"id", Op::LT, Value::make_int(10)}) ==
+          0);
+  table.insert_row({Value::make_int(5), Value::make_str("again")});
+  auto hit =
+      table.select_where({"name"}, false, Condition{"id", Op::EQ,
+                                                    Value::make_int(5)});
+  REQUIRE(hit.row_count() == 1);
+  REQUIRE(hit.cell(0, 0) == "again");
+
+  SECTION("Compaction once a quarter of the rows are deleted") {
+    REQUIRE(table.delete_where(
+                Condition{"id", Op::LT, Value::make_int(300)}) == 291);
+    REQUIRE(table.row_count() == 700);
+    REQUIRE(table.slot_count() == 700);
+    REQUIRE_FALSE(table.is_deleted(0));
+    auto rows = table.select_where({"id"}, false, std::nullopt);
+    REQUIRE(rows.cell(0, 0) == "300");
+    REQUIRE(rows.cell(699, 0) == "999");
+    REQUIRE(count(Condition{"id", Op::EQ, Value::make_int(500)}) == 1);
+  }
+
+  SECTION("Vacuum") {
+    std::string before = to_csv(table.select_where({}, true, std::nullopt));
+    REQUIRE(table.vacuum() == 10);
+    REQUIRE(table.slot_count() == 991);
+    REQUIRE(table.deleted_rows().empty());
+    REQUIRE(to_csv(table.select_where({}, true, std::nullopt)) == before);
+    REQUIRE(count(Condition{"id", Op::EQ, Value::make_int(5)}) == 1);
+    REQUIRE(table.vacuum() == 0);
+  }
+}
@@ -0,0 +1,57 @@
+#include "filter.hpp"
+#include <catch2/catch.hpp>
+#include <limits>
+
+using namespace db;
+
+static bool reference(CmpOp op, int64_t v, int64_t lit) {
+  switch (op) {
+  case CmpOp::EQ:
+    return v == lit;
+  case CmpOp::NEQ:
+    return v != lit;
+  case CmpOp::LT:
+    return v < lit;
+  case CmpOp::GT:
+    return v > lit;
+  case CmpOp::LE:
+    return v <= lit;
+  case CmpOp::GE:
+    return v >= lit;
+  }
+  return false;
+}
+
+TEST_CASE("INT filter kernels agree with scalar comparisons", "[filter]") {
+  const int64_t big = std::numeric_limits<int64_t>::max();
+  const int64_t small = std::numeric_limits<int64_t>::min();
+  std::vector<int64_t> values;
+  for (int64_t k = 0; k < 203; ++k)
+    values.push_back((k * 7919) % 13 - 6);
+  values[5] = big;
+  values[70] = small;
+
+  for (SimdLevel level :
+       {SimdLevel::SCALAR, SimdLevel::SSE42, SimdLevel::AVX2}) {
+    if (!simd_level_supported(level))
+      continue;
+    for (CmpOp op : {CmpOp::EQ, CmpOp::NEQ, CmpOp::LT, CmpOp::GT, CmpOp::LE,
+                     CmpOp::GE}) {
+      for (int64_t lit : {int64_t{0}, int64_t{-6}, big, small}) {
+        // odd lengths exercise the scalar tail after the vector loop
+        for (size_t n : {size_t{0}, size_t{1}, size_t{64}, size_t{203}}) {
+          std::vector<uint64_t> bits((n + 63) / 64 + 1, ~uint64_t{0});
+          filter_kernel(op, level)(values.data(), n, lit, bits.data());
+          std::vector<size_t> got;
+          append_selection(bits.data(), n, 100, got);
+          std::vector<size_t> want;
+          for (size_t i = 0; i < n; ++i) {
+            if (reference(op, values[i], lit))
+              want.push_back(100 + i);
+          }
+          REQUIRE(got == want);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,206 @@
+#include "database.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <catch2/catch.hpp>
+
+using namespace db;
+
+static std::vector<size_t> sorted_eq(const Index &ix, const Value &key) {
+  std::vector<size_t> out;
+  ix.lookup(CmpOp::EQ, key, out);
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+TEST_CASE("Hash index lookups", "[index]") {
+  SECTION("INT keys with duplicates") {
+    ColumnData col = IntColumn{};
+    auto &ints = std::get<IntColumn>(col);
+    for (int64_t v : {5, 7, 5, 9})
+      ints.push_back(v);
+    HashIndex ix("ix", 0);
+    ix.rebuild(col, ints.size());
+    REQUIRE(sorted_eq(ix, Value::make_int(5)) == std::vector<size_t>{0, 2});
+    REQUIRE(sorted_eq(ix, Value::make_int(8)).empty());
+
+    ix.erase(col, 2);
+    REQUIRE(sorted_eq(ix, Value::make_int(5)) == std::vector<size_t>{0});
+  }
+
+  SECTION("STR keys") {
+    ColumnData col = StrColumn{};
+    auto &strs = std::get<StrColumn>(col);
+    strs.push_back("alice");
+    strs.push_back("bob");
+    HashIndex ix("ix", 0);
+    ix.rebuild(col, strs.size());
+    REQUIRE(sorted_eq(ix, Value::make_str("bob")) == std::vector<size_t>{1});
+  }
+
+  SECTION("Erasing rows of a key many rows share") {
+    ColumnData col = StrColumn{};
+    auto &strs = std::get<StrColumn>(col);
+    for (size_t row = 0; row < 1000; ++row)
+      strs.push_back(row % 10 ? "common" : "rare");
+    HashIndex ix("ix", 0);
+    ix.rebuild(col, strs.size());
+    std::vector<size_t> common;
+    for (size_t row = 0; row < 1000; ++row) {
+      if (row % 10 && row % 3 == 0)
+        ix.erase(col, row);
+      else if (row % 10)
+        common.push_back(row);
+    }
+    REQUIRE(sorted_eq(ix, Value::make_str("common")) == common);
+    REQUIRE(sorted_eq(ix, Value::make_str("rare")).size() == 100);
+    // erasing under a key the row is not indexed by changes nothing
+    ix.erase(col, 3);
+    REQUIRE(sorted_eq(ix, Value::make_str("common")) == common);
+
+    for (size_t row = 0; row < 1000; row += 10)
+      ix.erase(col, row);
+    REQUIRE(sorted_eq(ix, Value::make_str("rare")).empty());
+    ix.insert(col, 0);
+    REQUIRE(sorted_eq(ix, Value::make_str("rare")) == std::vector<size_t>{0});
+  }
+}
+
+TEST_CASE("Indexes follow table mutations", "[index]") {
+  Database db;
+  execute(db, parse_statement("CREATE TABLE t (id int, name str)"));
+  execute(db, parse_statement("INSERT INTO t (id, name) VALUES (1, \"a\"), "
+                              "(2, \"b\"), (3, \"c\"), (2, \"d\")"));
+  execute(db, parse_statement("CREATE INDEX t_id ON t (id)"));
+  execute(db, parse_statement("CREATE INDEX t_name ON t (name)"));
+
+  auto select = [&](const std::string &sql) {
+    return *execute(db, parse_statement(sql));
+  };
+
+  SECTION("Equality lookups keep table order") {
+    auto r = select("SELECT name FROM t WHERE id = 2");
+    REQUIRE(r.row_count() == 2);
+    REQUIRE(r.cell(0, 0) == "b");
+    REQUIRE(r.cell(1, 0) == "d");
+  }
+
+  SECTION("Inserted rows are indexed") {
+    execute(db, parse_statement("INSERT INTO t (id, name) VALUES (4, \"e\")"));
+    REQUIRE(select("SELECT name FROM t WHERE id = 4").row_count() == 1);
+  }
+
+  SECTION("Updates move index entries") {
+    execute(db, parse_statement("UPDATE t SET id = 9 WHERE name = \"b\""));
+    REQUIRE(select("SELECT name FROM t WHERE id = 2").row_count() == 1);
+    auto r = select("SELECT name FROM t WHERE id = 9");
+    REQUIRE(r.row_count() == 1);
+    REQUIRE(r.cell(0, 0) == "b");
+  }
+
+  SECTION("Deletes renumber index entries") {
+    execute(db, parse_statement("DELETE FROM t WHERE id = 1"));
+    auto r = select("SELECT name FROM t WHERE name = \"c\"");
+    REQUIRE(r.row_count() == 1);
+    REQUIRE(r.cell(0, 0) == "c");
+    REQUIRE(select("SELECT id FROM t WHERE id = 1").row_count() == 0);
+  }
+
+  SECTION("Type errors are still reported") {
+    REQUIRE_THROWS_AS(select("SELECT * FROM t WHERE id = \"x\""), TypeError);
+  }
+
+  SECTION("Duplicate and invalid indexes") {
+    REQUIRE_THROWS_AS(
+        execute(db, parse_statement("CREATE INDEX t_id ON t (name)")),
+        DBError);
+    REQUIRE_THROWS_AS(
+        execute(db, parse_statement("CREATE INDEX t_x ON t (missing)")),
+        DBError);
+  }
+}
+
+TEST_CASE("B+tree matches a sorted reference", "[index]") {
+  BPlusTree<int64_t> tree;
+  std::vector<std::pair<int64_t, size_t>> ref;
+  uint64_t seed = 42;
+  auto rnd = [&]() {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return seed >> 33;
+  };
+  for (size_t row = 0; row < 5000; ++row) {
+    int64_t key = static_cast<int64_t>(rnd() % 500);
+    tree.insert(key, row);
+    ref.emplace_back(key, row);
+  }
+  // erase most entries in random order to force merges and borrows
+  for (size_t k = 0; k < 4000; ++k) {
+    size_t victim = rnd() % ref.size();
+    REQUIRE(tree.erase(ref[victim].first, ref[victim].second));
+    ref.erase(ref.begin() + static_cast<std::ptrdiff_t>(victim));
+  }
+  REQUIRE_FALSE(tree.erase(1000, 0));
+  std::sort(ref.begin(), ref.end());
+  REQUIRE(tree.size() == ref.size());
+
+  int64_t lo = 100, hi = 300;
+  std::vector<std::pair<int64_t, size_t>> got;
+  tree.scan({&lo, false}, {&hi, true},
+            [&](int64_t key, size_t row) { got.emplace_back(key, row); });
+  std::vector<std::pair<int64_t, size_t>> want;
+  for (const auto &e : ref) {
+    if (e.first > lo && e.first <= hi)
+      want.push_back(e);
+  }
+  REQUIRE(got == want);
+
+  got.clear();
+  tree.scan({nullptr, false}, {nullptr, false},
+            [&](int64_t key, size_t row) { got.emplace_back(key, row); });
+  REQUIRE(got == ref);
+}
+
+TEST_CASE("Ordered index range queries", "[index]") {
+  Database db;
+  execute(db, parse_statement("CREATE TABLE t (id int, name str)"));
+  for (int k = 0; k < 200; ++k) {
+    execute(db, parse_statement("INSERT INTO t (id, name) VALUES (" +
+                                std::to_string(k % 50) + ", \"n" +
+                                std::to_string(k) + "\")"));
+  }
+  execute(db, parse_statement("CREATE INDEX t_id ON t (id) USING BTREE"));
+  execute(db, parse_statement("CREATE INDEX t_name ON t (name) USING BTREE"));
+
+  auto count = [&](const std::string &sql) {
+    return execute(db, parse_statement(sql))->row_count();
+  };
+
+  SECTION("Range operators") {
+    REQUIRE(count("SELECT * FROM t WHERE id < 10") == 40);
+    REQUIRE(count("SELECT * FROM t WHERE id <= 10") == 44);
+    REQUIRE(count("SELECT * FROM t WHERE id > 45") == 16);
+    REQUIRE(count("SELECT * FROM t WHERE id >= 45") == 20);
+    REQUIRE(count("SELECT * FROM t WHERE id = 7") == 4);
+    REQUIRE(count("SELECT * FROM t WHERE name < \"n10\"") == 2);
+  }
+
+  SECTION("Results keep table order") {
+    auto r = *execute(db, parse_statement("SELECT name FROM t WHERE id < 2"));
+    REQUIRE(r.row_count() == 8);
+    REQUIRE(r.cell(0, 0) == "n0");
+    REQUIRE(r.cell(1, 0) == "n1");
+    REQUIRE(r.cell(2, 0) == "n50");
+  }
+
+  SECTION("Mutations through the index") {
+    execute(db, parse_statement("UPDATE t SET id = 100 WHERE id >= 40"));
+    REQUIRE(count("SELECT * FROM t WHERE id > 99") == 40);
+    execute(db, parse_statement("DELETE FROM t WHERE id > 99"));
+    REQUIRE(count("SELECT * FROM t") == 160);
+    REQUIRE(count("SELECT * FROM t WHERE id >= 39") == 4);
+  }
+
+  SECTION("Unknown index type") {
+    REQUIRE_THROWS_AS(
+        parse_statement("CREATE INDEX ix ON t (id) USING BITMAP"), ParseError);
+  }
+}
@@ -27,9 +27,9 @@ TEST_CASE("Complete SQL workflow", "[integration]") {
 
     auto &result = *select_result;
     REQUIRE(result.headers.size() == 2);
-    REQUIRE(result.rows.size() == 1);
-    REQUIRE(result.rows[0][0] == "alice");
-    REQUIRE(result.rows[0][1] == "30");
+    REQUIRE(result.row_count() == 1);
+    REQUIRE(result.cell(0, 0) == "alice");
+    REQUIRE(result.cell(0, 1) == "30");
   }
 
   SECTION("Multiple operations") {
@@ -53,9 +53,9 @@ TEST_CASE("Complete SQL workflow", "[integration]") {
     REQUIRE(select_result.has_value());
 
     auto &result = *select_result;
-    REQUIRE(result.rows.size() == 2);
-    REQUIRE(result.rows[0][1] == "alice");
-    REQUIRE(result.rows[1][1] == "bob");
+    REQUIRE(result.row_count() == 2);
+    REQUIRE(result.cell(0, 1) == "alice");
+    REQUIRE(result.cell(1, 1) == "bob");
   }
 
   SECTION("UPDATE and DELETE workflow") {
@@ -82,8 +82,8 @@ TEST_CASE("Complete SQL workflow", "[integration]") {
     REQUIRE(select_result.has_value());
 
     auto &result = *select_result;
-    REQUIRE(result.rows.size() == 1);
-    REQUIRE(result.rows[0][2] == "900");
+    REQUIRE(result.row_count() == 1);
+    REQUIRE(result.cell(0, 2) == "900");
 
     // Delete product
     auto delete_stmt =
@@ -96,7 +96,7 @@ TEST_CASE("Complete SQL workflow", "[integration]") {
     REQUIRE(final_result.has_value());
 
     auto &final = *final_result;
-    REQUIRE(final.rows.empty());
+    REQUIRE(final.row_count() == 0);
   }
 }
 
@@ -151,6 +151,42 @@ TEST_CASE("Multi-statement execution", "[integration]") {
     REQUIRE(final_result.has_value());
 
     auto &result = *final_result;
-    REQUIRE(result.rows.size() == 2);
+    REQUIRE(result.row_count() == 2);
   }
 }
+
+TEST_CASE("Streaming SELECT execution", "[integration]") {
+  // counts the batches it receives without keeping any rows
+  struct CountingSink : RowSink {
+    std::vector<std::string> headers;
+    size_t batches = 0;
+    size_t rows = 0;
+    bool ended = false;
+    void begin(const std::vector<std::string> &h) override { headers = h; }
+    void write(QueryResult &&batch) override {
+      ++batches;
+      rows += batch.row_count();
+    }
+    void end() override { ended = true; }
+  };
+
+  Database db;
+  execute(db, parse_statement("CREATE TABLE t (id int, name str)"));
+  std::string insert = "INSERT INTO t (id, name) VALUES (0, \"x\")";
+  for (int k = 1; k < 5000; ++k)
+    insert += ", (" + std::to_string(k) + ", \"x\")";
+  execute(db, parse_statement(insert));
+
+  CountingSink sink;
+  REQUIRE(execute(db, parse_statement("SELECT id FROM t WHERE id >= 100"),
+                  sink));
+  REQUIRE(sink.headers == std::vector<std::string>{"id"});
+  REQUIRE(sink.rows == 4900);
+  REQUIRE(sink.batches > 1);
+  REQUIRE(sink.ended);
+
+  CountingSink unused;
+  REQUIRE_FALSE(execute(db, parse_statement("DELETE FROM t WHERE id < 10"),
+                        unused));
+  REQUIRE(unused.batches == 0);
+}
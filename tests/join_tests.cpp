@@ -0,0 +1,220 @@
+#include "parallel.hpp"
+#include "parser.hpp"
+#include "test_util.hpp"
+#include <catch2/catch.hpp>
+#include <functional>
+
+using namespace db;
+
+namespace {
+const int64_t kOrders = 5000;
+const int64_t kCustomers = 400;
+
+int64_t cust_of(int64_t id) { return id % 300; }
+int64_t amount_of(int64_t id) { return id * 7919 % 1000; }
+std::string region_of(int64_t cid) { return "r" + std::to_string(cid % 5); }
+
+// the customer rows: cid = 0..kCustomers-1, then a second row for each
+// multiple of 50
+std::vector<int64_t> customer_ids() {
+  std::vector<int64_t> out;
+  for (int64_t c = 0; c < kCustomers; ++c)
+    out.push_back(c);
+  for (int64_t c = 0; c < kCustomers; c += 50)
+    out.push_back(c);
+  return out;
+}
+
+std::string name_of(size_t row) {
+  return "c" + std::to_string(customer_ids()[row]) + "_" + std::to_string(row);
+}
+
+// orders(id, cust, amount) and customers(cid, name, region)
+void fill(Database &db) {
+  make_table(db, "orders", kOrders,
+             {int_column("id", [](int64_t id) { return id; }),
+              int_column("cust", cust_of), int_column("amount", amount_of)});
+  auto ids = customer_ids();
+  make_table(db, "customers", ids.size(),
+             {int_column("cid", [&](int64_t row) { return ids[row]; }),
+              str_column("name",
+                         [](int64_t row) {
+                           return name_of(static_cast<size_t>(row));
+                         }),
+              str_column("region", [&](int64_t row) {
+                return region_of(ids[row]);
+              })});
+}
+
+using Pairs = std::vector<std::pair<int64_t, std::string>>;
+
+// the (order id, customer name) rows of a result, sorted
+Pairs pairs(const QueryResult &r, size_t id_col = 0, size_t name_col = 1) {
+  Pairs out;
+  for (size_t i = 0; i < r.row_count(); ++i)
+    out.emplace_back(r.columns[id_col].ints[i], r.cell(i, name_col));
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+// the joined pairs that keep, by nested loops
+Pairs expected(const std::function<bool(int64_t, int64_t)> &keep) {
+  Pairs out;
+  auto ids = customer_ids();
+  for (int64_t id = 0; id < kOrders; ++id) {
+    for (size_t row = 0; row < ids.size(); ++row) {
+      if (cust_of(id) == ids[row] && keep(id, ids[row]))
+        out.emplace_back(id, name_of(row));
+    }
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+const char *const kJoin =
+    "SELECT orders.id, customers.name FROM orders JOIN customers ON "
+    "orders.cust = customers.cid";
+
+struct Case {
+  const char *where;
+  std::function<bool(int64_t, int64_t)> keep;
+};
+
+const Case kCases[] = {
+    {"", [](int64_t, int64_t) { return true; }},
+    {" WHERE orders.amount < 300",
+     [](int64_t id, int64_t) { return amount_of(id) < 300; }},
+    {" WHERE amount < 300 AND region = \"r1\" AND cid > 20",
+     [](int64_t id, int64_t cid) {
+       return amount_of(id) < 300 && region_of(cid) == "r1" && cid > 20;
+     }},
+    {" WHERE customers.cid IN (0, 50, 7) AND orders.id >= 600",
+     [](int64_t id, int64_t cid) {
+       return (cid == 0 || cid == 50 || cid == 7) && id >= 600;
+     }},
+    {" WHERE orders.amount < 100 OR customers.region = \"r2\"",
+     [](int64_t id, int64_t cid) {
+       return amount_of(id) < 100 || region_of(cid) == "r2";
+     }},
+    {" WHERE id < 2000 AND NOT (amount > 500 AND region != \"r0\")",
+     [](int64_t id, int64_t cid) {
+       return id < 2000 && !(amount_of(id) > 500 && region_of(cid) != "r0");
+     }},
+    {" WHERE orders.id = -1", [](int64_t, int64_t) { return false; }},
+};
+
+// Counts the batches it is given and wants no more after the first.
+struct FirstBatch : RowSink {
+  size_t writes{0};
+  void begin(const std::vector<std::string> &) override {}
+  void write(QueryResult &&) override { ++writes; }
+  bool done() const override { return writes > 0; }
+};
+} // namespace
+
+TEST_CASE("Hash joins", "[join]") {
+  Database db;
+  fill(db);
+
+  SECTION("Match nested loops, whichever side builds") {
+    for (const auto &c : kCases) {
+      INFO(c.where);
+      auto want = expected(c.keep);
+      CHECK(pairs(run(db, kJoin + std::string(c.where))) == want);
+      auto flipped = run(db, "SELECT customers.name, orders.id FROM customers "
+                             "JOIN orders ON customers.cid = orders.cust" +
+                                 std::string(c.where));
+      CHECK(pairs(flipped, 1, 0) == want);
+    }
+  }
+
+  SECTION("Headers") {
+    auto r = run(db, "SELECT id, customers.name FROM orders JOIN customers "
+                     "ON cust = cid LIMIT 1");
+    CHECK(r.headers == std::vector<std::string>{"id", "customers.name"});
+    auto star = run(db, "SELECT * FROM orders JOIN customers ON orders.cust "
+                        "= customers.cid WHERE orders.id = 7");
+    CHECK(star.headers ==
+          std::vector<std::string>{"orders.id", "orders.cust", "orders.amount",
+                                   "customers.cid", "customers.name",
+                                   "customers.region"});
+    REQUIRE(star.row_count() == 1);
+    CHECK(star.cell(0, 3) == "7");
+    CHECK(star.cell(0, 5) == "r2");
+  }
+
+  SECTION("STR keys") {
+    run(db, "CREATE TABLE regions (code str, label str)");
+    run(db, "INSERT INTO regions (code, label) VALUES (\"r0\", \"north\"), "
+            "(\"r1\", \"south\"), (\"r1\", \"sud\"), (\"r9\", \"none\")");
+    auto r = run(db, "SELECT customers.cid, regions.label FROM customers "
+                     "JOIN regions ON customers.region = regions.code WHERE "
+                     "customers.cid < 10");
+    Pairs got = pairs(r);
+    // cid 0 has two customer rows
+    CHECK(got == Pairs{{0, "north"}, {0, "north"}, {1, "south"}, {1, "sud"},
+                       {5, "north"}, {6, "south"}, {6, "sud"}});
+  }
+
+  SECTION("Parallel probes keep probe order") {
+    ScopedParallelOptions scoped({4, 0, 256});
+    auto r = run(db, "SELECT orders.id FROM orders JOIN customers ON "
+                     "orders.cust = customers.cid WHERE customers.cid = 1");
+    CHECK(std::is_sorted(r.columns[0].ints.begin(), r.columns[0].ints.end()));
+    CHECK(r.row_count() == static_cast<size_t>(kOrders / 300 + 1));
+  }
+
+  SECTION("LIMIT and OFFSET") {
+    size_t total = expected([](int64_t, int64_t) { return true; }).size();
+    CHECK(run(db, std::string(kJoin) + " LIMIT 10").row_count() == 10);
+    CHECK(run(db, std::string(kJoin) + " LIMIT 10 OFFSET " +
+                      std::to_string(total - 3))
+              .row_count() == 3);
+    CHECK(run(db, std::string(kJoin) + " LIMIT 0").row_count() == 0);
+  }
+
+  SECTION("A sink that is done stops the probe") {
+    const Table &orders = db.table("orders");
+    const Table &customers = db.table("customers");
+    JoinPlan plan = orders.resolve_join(customers, {"customers", "cust", "cid"},
+                                        {}, true, std::nullopt);
+    FirstBatch serial;
+    orders.join_rows(customers, plan, serial);
+    CHECK(serial.writes == 1);
+
+    ScopedParallelOptions scoped({4, 0, 256});
+    FirstBatch parallel;
+    orders.join_rows(customers, plan, parallel);
+    CHECK(parallel.writes == 1);
+    // which is how a LIMIT ends it
+    ResultCollector all;
+    LimitSink ten(all, 10, 0);
+    CHECK_FALSE(ten.done());
+    orders.join_rows(customers, plan, ten);
+    CHECK(ten.done());
+    CHECK(all.result.row_count() == 10);
+  }
+
+  SECTION("Errors") {
+    run(db, "CREATE TABLE x (k int, v int)");
+    run(db, "CREATE TABLE y (k int, w str)");
+    run(db, "INSERT INTO x (k, v) VALUES (1, 2)");
+    run(db, "INSERT INTO y (k, w) VALUES (1, \"a\")");
+    REQUIRE_THROWS_AS(run(db, "SELECT v FROM x JOIN y ON k = y.k"), DBError);
+    REQUIRE_THROWS_AS(run(db, "SELECT v FROM x JOIN y ON x.k = y.nope"),
+                      DBError);
+    REQUIRE_THROWS_AS(run(db, "SELECT z.v FROM x JOIN y ON x.k = y.k"),
+                      DBError);
+    REQUIRE_THROWS_AS(run(db, "SELECT v FROM x JOIN y ON x.k = x.v"), DBError);
+    REQUIRE_THROWS_AS(run(db, "SELECT v FROM x JOIN x ON x.k = x.v"), DBError);
+    REQUIRE_THROWS_AS(run(db, "SELECT v FROM x JOIN nope ON x.k = nope.k"),
+                      DBError);
+    REQUIRE_THROWS_AS(run(db, "SELECT v FROM x JOIN y ON x.k = y.w"),
+                      TypeError);
+    REQUIRE_THROWS_AS(
+        run(db, "SELECT v FROM x JOIN y ON x.k = y.k WHERE y.w = 1"),
+        TypeError);
+    REQUIRE_THROWS_AS(
+        run(db, "SELECT v FROM x JOIN y ON x.k = y.k WHERE k = 1"), DBError);
+  }
+}
@@ -2,28 +2,76 @@
 #include "database.hpp"
 #include "output.hpp"
 #include "parser.hpp"
+#include "test_util.hpp"
 #include "tokenizer.hpp"
 #include <catch2/catch.hpp>
+#include <cstdio>
+#include <fstream>
 
 using namespace db;
 
 // Test utilities
-Database create_test_db() {
-  Database db;
-  db.create_table("people", {{"name", Type::STR}, {"age", Type::INT}});
+// (databases are not movable, so they come back on the heap)
+std::unique_ptr<Database> create_test_db() {
+  auto db = std::make_unique<Database>();
+  db->create_table("people", {{"name", Type::STR}, {"age", Type::INT}});
   return db;
 }
 
-Database create_complex_db() {
-  Database db;
-  db.create_table(
+std::unique_ptr<Database> create_complex_db() {
+  auto db = std::make_unique<Database>();
+  db->create_table(
       "users", {{"id", Type::INT}, {"name", Type::STR}, {"email", Type::STR}});
-  db.create_table(
+  db->create_table(
       "orders",
       {{"id", Type::INT}, {"user_id", Type::INT}, {"amount", Type::INT}});
   return db;
 }
 
+QueryResult run(Database &db, const std::string &sql) {
+  auto r = execute(db, parse_statement(sql));
+  return r ? std::move(*r) : QueryResult();
+}
+
+std::string dump(Database &db, const std::string &table) {
+  return to_csv(run(db, "SELECT * FROM " + table));
+}
+
+size_t file_size(const std::string &path) {
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  return static_cast<size_t>(in.tellg());
+}
+
+void make_table(Database &db, const std::string &table, size_t n,
+                const std::vector<GenColumn> &cols) {
+  std::vector<Column> defs;
+  std::vector<ColumnData> block;
+  for (const auto &c : cols) {
+    defs.push_back(c.def);
+    if (c.def.type == Type::INT)
+      block.emplace_back(IntColumn());
+    else
+      block.emplace_back(StrColumn());
+  }
+  db.create_table(table, defs);
+  for (size_t row = 0; row < n; ++row) {
+    auto k = static_cast<int64_t>(row);
+    for (size_t i = 0; i < cols.size(); ++i) {
+      if (cols[i].int_of)
+        std::get<IntColumn>(block[i]).push_back(cols[i].int_of(k));
+      else
+        std::get<StrColumn>(block[i]).push_back(cols[i].str_of(k));
+    }
+  }
+  db.table(table).append(block);
+}
+
+TempPath::TempPath(const char *tag)
+    : path(std::string(P_tmpdir) + "/inmemdb_" + tag + "_" +
+           std::to_string(reinterpret_cast<uintptr_t>(this))) {}
+
+TempPath::~TempPath() { std::remove(path.c_str()); }
+
 // Include all test files
 // Note: Catch2 will automatically discover and run all TEST_CASE macros
 // from the included headers, so we don't need to explicitly include them here.
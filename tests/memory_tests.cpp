@@ -0,0 +1,158 @@
+#include "parser.hpp"
+#include "prepared.hpp"
+#include "snapshot.hpp"
+#include "test_util.hpp"
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace db;
+
+// Every heap allocation of the test program goes through these, so tests
+// can count the ones made on their own thread.
+namespace {
+thread_local size_t allocations = 0;
+
+void *counted_alloc(size_t n, size_t align) {
+  ++allocations;
+  n = n ? n : 1;
+  void *p = align ? std::aligned_alloc(align, (n + align - 1) / align * align)
+                  : std::malloc(n);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+} // namespace
+
+void *operator new(size_t n) { return counted_alloc(n, 0); }
+void *operator new[](size_t n) { return counted_alloc(n, 0); }
+void *operator new(size_t n, std::align_val_t a) {
+  return counted_alloc(n, static_cast<size_t>(a));
+}
+void *operator new[](size_t n, std::align_val_t a) {
+  return counted_alloc(n, static_cast<size_t>(a));
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+// heap allocations per call of f, over n calls
+template <typename F> double allocations_per_call(size_t n, F &&f) {
+  size_t before = allocations;
+  for (size_t k = 0; k < n; ++k)
+    f(k);
+  return static_cast<double>(allocations - before) / static_cast<double>(n);
+}
+
+std::string long_name(size_t k) {
+  return "a name too long to be stored inline " + std::to_string(k);
+}
+} // namespace
+
+TEST_CASE("Inserts allocate almost nothing per row", "[memory]") {
+  Database db;
+  run(db, "CREATE TABLE t (id int, name str, n int)");
+  run(db, "CREATE INDEX t_id ON t (id)");
+  run(db, "CREATE INDEX t_name ON t (name)");
+  run(db, "CREATE INDEX t_n ON t (n) USING BTREE");
+  constexpr size_t kRows = 20000;
+  std::vector<std::vector<Value>> params;
+  for (size_t k = 0; k < 2 * kRows; ++k)
+    params.push_back({Value::make_int(static_cast<long long>(k)),
+                      Value::make_str(long_name(k))});
+
+  // the name index's keys are the one allocation a row may still need,
+  // for names too long to store inline
+  auto ins = db.prepare("INSERT INTO t (id, name, n) VALUES (?, ?, 1)");
+  for (size_t k = 0; k < 100; ++k)
+    ins->execute(params[k]);
+  double prepared = allocations_per_call(
+      kRows, [&](size_t k) { ins->execute(params[100 + k]); });
+  CHECK(prepared < 0.1);
+
+  std::string sql = "INSERT INTO t (id, name) VALUES ";
+  for (size_t k = 0; k < 1000; ++k)
+    sql += (k ? ", (" : "(") + std::to_string(k) + ", \"" + long_name(k) +
+           "\")";
+  Statement stmt = parse_statement(sql);
+  execute(db, stmt);
+  double multi = allocations_per_call(10, [&](size_t) { execute(db, stmt); });
+  CHECK(multi / 1000 < 0.1);
+  REQUIRE(db.table("t").row_count() == kRows + 100 + 11 * 1000);
+}
+
+TEST_CASE("Memory usage by kind", "[memory]") {
+  Database db;
+  run(db, "CREATE TABLE t (id int, name str)");
+  REQUIRE(db.table("t").memory_usage().heap() == 0);
+
+  constexpr size_t kRows = 10000;
+  auto ins = db.prepare("INSERT INTO t (id, name) VALUES (?, ?)");
+  size_t name_bytes = 0;
+  for (size_t k = 0; k < kRows; ++k) {
+    name_bytes += long_name(k).size();
+    ins->execute({Value::make_int(static_cast<long long>(k)),
+                  Value::make_str(long_name(k))});
+  }
+  MemoryUsage m = db.table("t").memory_usage();
+  // ids, then string offsets and lengths
+  CHECK(m.columns >= kRows * (8 + 8 + 4));
+  CHECK(m.strings >= name_bytes);
+  CHECK(m.strings < 2 * name_bytes);
+  CHECK(m.indexes == 0);
+  CHECK(m.mapped == 0);
+
+  run(db, "CREATE INDEX t_id ON t (id)");
+  run(db, "CREATE INDEX t_name ON t (name) USING BTREE");
+  MemoryUsage indexed = db.table("t").memory_usage();
+  CHECK(indexed.indexes >= kRows * 2 * sizeof(size_t));
+  CHECK(indexed.columns == m.columns);
+
+  // compaction gives the space of deleted rows back
+  run(db, "DELETE FROM t WHERE id >= 100");
+  MemoryUsage small = db.table("t").memory_usage();
+  CHECK(small.columns < m.columns / 10);
+  CHECK(small.strings < m.strings / 10);
+  CHECK(small.indexes < indexed.indexes / 10);
+
+  auto all = db.memory_usage();
+  REQUIRE(all.size() == 1);
+  CHECK(all[0].first == "t");
+  CHECK(all[0].second.heap() == small.heap());
+}
+
+TEST_CASE("Memory usage of a loaded snapshot", "[memory]") {
+  std::string path = std::string(P_tmpdir) + "/inmemdb_memory_" +
+                     std::to_string(reinterpret_cast<uintptr_t>(&path));
+  {
+    Database db;
+    run(db, "CREATE TABLE t (id int, name str)");
+    for (size_t k = 0; k < 5000; ++k)
+      run(db, "INSERT INTO t (id, name) VALUES (" + std::to_string(k) +
+                  ", \"" + long_name(k) + "\")");
+    save_snapshot(db, path);
+  }
+  Database db;
+  load_snapshot(db, path);
+  std::remove(path.c_str());
+  // the columns are served from the file until they are written
+  MemoryUsage m = db.table("t").memory_usage();
+  CHECK(m.mapped >= 5000 * (8 + 8 + 4));
+  CHECK(m.heap() < 5000);
+
+  run(db, "UPDATE t SET id = 0 WHERE id = 1");
+  MemoryUsage written = db.table("t").memory_usage();
+  CHECK(written.columns >= 8 * 4096);
+  CHECK(written.mapped < m.mapped);
+}
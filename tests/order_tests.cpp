@@ -0,0 +1,148 @@
+#include "order.hpp"
+#include "parallel.hpp"
+#include "parser.hpp"
+#include "test_util.hpp"
+#include <catch2/catch.hpp>
+#include <functional>
+
+using namespace db;
+
+namespace {
+int64_t v_of(size_t k) { return static_cast<int64_t>(k * 7919 % 1000); }
+
+// rows k = 0..n-1 with v = v_of(k) and name "n<k % 37>"
+void fill(Database &db, size_t n) {
+  make_table(db, "t", n,
+             {int_column("k", [](int64_t k) { return k; }),
+              int_column("v", [](int64_t k) {
+                return v_of(static_cast<size_t>(k));
+              }),
+              str_column("name", [](int64_t k) {
+                return "n" + std::to_string(k % 37);
+              })});
+}
+
+// the k column of a result
+std::vector<int64_t> keys(const QueryResult &r) { return r.columns[0].ints; }
+
+// k of the rows with k < n that keep, sorted by v then k, descending on v
+// when asked
+std::vector<int64_t> expected(size_t n, bool descending,
+                              const std::function<bool(size_t)> &keep) {
+  std::vector<int64_t> out;
+  for (size_t k = 0; k < n; ++k) {
+    if (keep(k))
+      out.push_back(static_cast<int64_t>(k));
+  }
+  std::stable_sort(out.begin(), out.end(), [&](int64_t a, int64_t b) {
+    return descending ? v_of(a) > v_of(b) : v_of(a) < v_of(b);
+  });
+  return out;
+}
+
+std::vector<int64_t> slice(const std::vector<int64_t> &v, size_t from,
+                           size_t count) {
+  from = std::min(from, v.size());
+  count = std::min(count, v.size() - from);
+  return std::vector<int64_t>(v.begin() + from, v.begin() + from + count);
+}
+} // namespace
+
+TEST_CASE("Top-k heaps and parallel sort", "[order]") {
+  std::vector<int64_t> values;
+  for (int64_t i = 0; i < 10007; ++i)
+    values.push_back((i * 7919) % 3001 - 1500);
+  std::vector<int64_t> sorted = values;
+  std::sort(sorted.begin(), sorted.end());
+
+  SECTION("TopK keeps the k least, merged across heaps") {
+    TopK<int64_t, std::less<int64_t>> a(10, std::less<int64_t>());
+    TopK<int64_t, std::less<int64_t>> b(10, std::less<int64_t>());
+    for (size_t i = 0; i < values.size(); ++i)
+      (i % 2 ? a : b).push(values[i]);
+    a.merge(b);
+    REQUIRE(a.take_sorted() == slice(sorted, 0, 10));
+
+    TopK<int64_t, std::less<int64_t>> none(0, std::less<int64_t>());
+    none.push(1);
+    REQUIRE(none.take_sorted().empty());
+  }
+
+  SECTION("parallel_sort matches std::sort") {
+    std::vector<int64_t> serial = values;
+    parallel_sort(serial, std::less<int64_t>());
+    REQUIRE(serial == sorted);
+
+    for (size_t threads : {2, 3, 4}) {
+      ScopedParallelOptions scoped({threads, 0, 1000});
+      std::vector<int64_t> v = values;
+      parallel_sort(v, std::greater<int64_t>());
+      REQUIRE(std::is_sorted(v.begin(), v.end(), std::greater<int64_t>()));
+      REQUIRE(std::is_permutation(v.begin(), v.end(), sorted.begin()));
+    }
+  }
+}
+
+TEST_CASE("ORDER BY and LIMIT", "[order]") {
+  Database db;
+  const size_t n = 10000;
+  fill(db, n);
+  auto all = [](size_t) { return true; };
+  auto asc = expected(n, false, all);
+  auto desc = expected(n, true, all);
+
+  SECTION("Full sorts, ties in row order") {
+    auto r = run(db, "SELECT k, v FROM t ORDER BY v");
+    REQUIRE(r.headers == std::vector<std::string>{"k", "v"});
+    CHECK(keys(r) == asc);
+    CHECK(keys(run(db, "SELECT k FROM t ORDER BY v ASC")) == asc);
+    CHECK(keys(run(db, "SELECT k FROM t ORDER BY v DESC")) == desc);
+
+    auto s = run(db, "SELECT name FROM t ORDER BY name DESC LIMIT 3");
+    CHECK(s.cell(0, 0) == "n9");
+    CHECK(s.cell(2, 0) == "n9");
+  }
+
+  SECTION("ORDER BY with LIMIT and OFFSET") {
+    CHECK(keys(run(db, "SELECT k FROM t ORDER BY v LIMIT 25")) ==
+          slice(asc, 0, 25));
+    CHECK(keys(run(db, "SELECT k FROM t ORDER BY v DESC LIMIT 10 "
+                       "OFFSET 37")) == slice(desc, 37, 10));
+    CHECK(keys(run(db, "SELECT k FROM t ORDER BY v LIMIT 5 OFFSET 9998")) ==
+          slice(asc, 9998, 5));
+    CHECK(run(db, "SELECT k FROM t ORDER BY v LIMIT 0").row_count() == 0);
+    CHECK(keys(run(db, "SELECT k FROM t WHERE name = \"n3\" ORDER BY v "
+                       "LIMIT 7")) ==
+          slice(expected(n, false, [](size_t k) { return k % 37 == 3; }), 0,
+                7));
+  }
+
+  SECTION("Bare LIMIT keeps row order") {
+    CHECK(keys(run(db, "SELECT k FROM t LIMIT 3")) ==
+          std::vector<int64_t>{0, 1, 2});
+    CHECK(keys(run(db, "SELECT k FROM t LIMIT 2 OFFSET 5000")) ==
+          std::vector<int64_t>{5000, 5001});
+    std::vector<int64_t> low;
+    for (size_t k = 0; k < n; ++k) {
+      if (v_of(k) < 3)
+        low.push_back(static_cast<int64_t>(k));
+    }
+    CHECK(keys(run(db, "SELECT k FROM t WHERE v < 3 LIMIT 2 OFFSET 1")) ==
+          slice(low, 1, 2));
+    CHECK(run(db, "SELECT k FROM t LIMIT 5 OFFSET 10000").row_count() == 0);
+    CHECK(run(db, "SELECT * FROM t LIMIT 0").row_count() == 0);
+  }
+
+  SECTION("LIMIT after aggregates and GROUP BY") {
+    CHECK(run(db, "SELECT COUNT(*) FROM t LIMIT 1").cell(0, 0) == "10000");
+    CHECK(run(db, "SELECT COUNT(*) FROM t LIMIT 0").row_count() == 0);
+    CHECK(run(db, "SELECT name, COUNT(*) FROM t GROUP BY name LIMIT 5")
+              .row_count() == 5);
+    CHECK(run(db, "SELECT name FROM t GROUP BY name LIMIT 10 OFFSET 30")
+              .row_count() == 7);
+  }
+
+  SECTION("Unknown ORDER BY column") {
+    REQUIRE_THROWS_AS(run(db, "SELECT k FROM t ORDER BY nope"), DBError);
+  }
+}
@@ -1,5 +1,6 @@
 #include "output.hpp"
 #include <catch2/catch.hpp>
+#include <sstream>
 
 using namespace db;
 
@@ -84,3 +85,75 @@ TEST_CASE("QueryResult structure", "[output]") {
     REQUIRE(result.rows.empty());
   }
 }
+
+TEST_CASE("Streaming row sinks", "[output]") {
+  SECTION("CSV writer matches to_csv") {
+    QueryResult result;
+    result.headers = {"name", "note"};
+    result.rows = {{"alice", "a, b"}, {"bob", "c"}};
+
+    std::ostringstream oss;
+    CsvWriter writer(oss);
+    writer.begin(result.headers);
+    QueryResult first;
+    first.rows = {result.rows[0]};
+    writer.write(std::move(first));
+    QueryResult second;
+    second.rows = {result.rows[1]};
+    writer.write(std::move(second));
+    writer.end();
+    REQUIRE(oss.str() == to_csv(result));
+  }
+
+  SECTION("Collector concatenates batches") {
+    ResultCollector collector;
+    collector.begin({"id"});
+    QueryResult a;
+    a.rows = {{"1"}, {"2"}};
+    collector.write(std::move(a));
+    QueryResult b;
+    b.rows = {{"3"}};
+    collector.write(std::move(b));
+    collector.end();
+    REQUIRE(collector.result.headers == std::vector<std::string>{"id"});
+    REQUIRE(collector.result.rows.size() == 3);
+    REQUIRE(collector.result.rows[2][0] == "3");
+  }
+
+  SECTION("Collector copies strings out of batches") {
+    std::string storage = "alicebob";
+    ResultCollector collector;
+    collector.begin({"name"});
+    for (size_t from : {0, 5}) {
+      QueryResult batch;
+      batch.columns.resize(1);
+      batch.columns[0].strs = {
+          std::string_view(storage).substr(from, from == 0 ? 5 : 3)};
+      collector.write(std::move(batch));
+    }
+    storage.assign(storage.size(), '?');
+    REQUIRE(collector.result.cell(0, 0) == "alice");
+    REQUIRE(collector.result.cell(1, 0) == "bob");
+  }
+}
+
+TEST_CASE("Typed result columns", "[output]") {
+  std::string storage = "alicebob, jr";
+  QueryResult result;
+  result.headers = {"name", "age"};
+  result.columns.resize(2);
+  result.columns[0].type = Type::STR;
+  result.columns[0].strs = {std::string_view(storage).substr(0, 5),
+                            std::string_view(storage).substr(5)};
+  result.columns[1].type = Type::INT;
+  result.columns[1].ints = {30, -9223372036854775807LL - 1};
+
+  REQUIRE(result.row_count() == 2);
+  REQUIRE(result.cell(0, 0) == "alice");
+  REQUIRE(result.cell(1, 1) == "-9223372036854775808");
+  REQUIRE(to_csv(result) ==
+          "name,age\nalice,30\n\"bob, jr\",-9223372036854775808\n");
+  std::string ascii = to_ascii(result);
+  REQUIRE(ascii.find("| alice   | 30                   |") !=
+          std::string::npos);
+}
@@ -0,0 +1,68 @@
+#include "database.hpp"
+#include "parallel.hpp"
+#include "test_util.hpp"
+#include <atomic>
+#include <catch2/catch.hpp>
+
+using namespace db;
+
+TEST_CASE("Thread pool and morsels", "[parallel]") {
+  ScopedParallelOptions scoped({4, 0, 10});
+
+  SECTION("Every morsel runs exactly once") {
+    // assertions stay on the test thread; Catch2 is not thread-safe
+    std::vector<std::atomic<int>> hits(1005);
+    std::atomic<bool> aligned{true};
+    parallel_morsels(hits.size(), [&](size_t m, size_t begin, size_t end) {
+      if (begin != m * 10)
+        aligned = false;
+      for (size_t i = begin; i < end; ++i)
+        hits[i]++;
+    });
+    REQUIRE(aligned.load());
+    for (auto &h : hits)
+      REQUIRE(h.load() == 1);
+  }
+
+  SECTION("Exceptions reach the caller") {
+    REQUIRE_THROWS_AS(parallel_morsels(1000,
+                                       [](size_t m, size_t, size_t) {
+                                         if (m == 57)
+                                           throw DBError("boom");
+                                       }),
+                      DBError);
+  }
+
+  SECTION("Submitted tasks run") {
+    std::atomic<int> n{0};
+    {
+      ThreadPool pool(3);
+      for (int k = 0; k < 100; ++k)
+        pool.submit([&] { n++; });
+    }
+    REQUIRE(n.load() == 100);
+  }
+}
+
+TEST_CASE("Parallel scans match serial scans", "[parallel]") {
+  Database db;
+  db.create_table("t", {{"id", Type::INT}, {"name", Type::STR}});
+  auto &table = db.table("t");
+  for (int k = 0; k < 5000; ++k)
+    table.insert_row(
+        {Value::make_int(k % 97), Value::make_str("n" + std::to_string(k))});
+  Condition cond{"id", Condition::Op::LT, Value::make_int(10)};
+
+  auto serial = table.select_where({"name"}, false, cond);
+  auto serial_all = table.select_where({}, true, std::nullopt);
+  ScopedParallelOptions scoped({4, 0, 64});
+  auto par = table.select_where({"name"}, false, cond);
+  REQUIRE(to_csv(par) == to_csv(serial));
+  REQUIRE(to_csv(table.select_where({}, true, std::nullopt)) ==
+          to_csv(serial_all));
+
+  REQUIRE(table.update_where({{"name", Value::make_str("low")}}, cond) ==
+          serial.row_count());
+  REQUIRE(table.delete_where(cond) == serial.row_count());
+  REQUIRE(table.row_count() == 5000 - serial.row_count());
+}
@@ -1,5 +1,7 @@
 #include "parser.hpp"
 #include <catch2/catch.hpp>
+#include <sstream>
+#include <unistd.h>
 
 using namespace db;
 
@@ -20,6 +22,47 @@ TEST_CASE("Statement splitting", "[parser]") {
   }
 }
 
+TEST_CASE("Streaming statement reader", "[parser]") {
+  const std::string script =
+      "CREATE TABLE t (s str);\n"
+      "INSERT INTO t VALUES (\"a;b\"); ;\n"
+      "  SELECT * FROM t ;\n"
+      "SELECT s FROM";
+
+  SECTION("Matches split_statements for any chunk size") {
+    for (size_t chunk : {1, 2, 3, 7, 64, 1 << 16}) {
+      std::istringstream in(script);
+      StatementReader reader(in, chunk);
+      std::vector<std::string> got;
+      std::string stmt;
+      while (reader.next(stmt))
+        got.push_back(stmt);
+      REQUIRE(got == split_statements(script));
+    }
+  }
+
+  SECTION("Yields a statement before the input ends") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    StatementReader reader(fds[0]);
+    std::string first = "SELECT * FROM t; SELECT";
+    REQUIRE(write(fds[1], first.data(), first.size()) ==
+            static_cast<ssize_t>(first.size()));
+    std::string stmt;
+    REQUIRE(reader.next(stmt));
+    REQUIRE(stmt == "SELECT * FROM t");
+
+    std::string rest = " s FROM t;";
+    REQUIRE(write(fds[1], rest.data(), rest.size()) ==
+            static_cast<ssize_t>(rest.size()));
+    close(fds[1]);
+    REQUIRE(reader.next(stmt));
+    REQUIRE(stmt == "SELECT s FROM t");
+    REQUIRE_FALSE(reader.next(stmt));
+    close(fds[0]);
+  }
+}
+
 TEST_CASE("SQL statement parsing", "[parser]") {
   SECTION("CREATE TABLE") {
     auto stmt = parse_statement("CREATE TABLE people (name str, age int)");
@@ -32,6 +75,18 @@ TEST_CASE("SQL statement parsing", "[parser]") {
     REQUIRE(create_stmt.columns[0].type == Type::STR);
   }
 
+  SECTION("CREATE INDEX") {
+    auto stmt = parse_statement("CREATE INDEX people_age ON people (age)");
+    REQUIRE(std::holds_alternative<StmtCreateIndex>(stmt));
+
+    auto index_stmt = std::get<StmtCreateIndex>(stmt);
+    REQUIRE(index_stmt.name == "people_age");
+    REQUIRE(index_stmt.table == "people");
+    REQUIRE(index_stmt.column == "age");
+    REQUIRE_THROWS_AS(parse_statement("CREATE INDEX ix ON people age"),
+                      ParseError);
+  }
+
   SECTION("INSERT") {
     auto stmt = parse_statement(
         "INSERT INTO people (name, age) VALUES (\"alice\", 30)");
@@ -93,6 +148,191 @@ TEST_CASE("WHERE conditions", "[parser]") {
     REQUIRE(select.where->literal.type == Type::STR);
     REQUIRE(select.where->literal.s == "alice");
   }
+
+  SECTION("AND binds tighter than OR, runs are flattened") {
+    auto w = *std::get<StmtSelect>(
+                  parse_statement("SELECT * FROM t WHERE a = 1 OR b = 2 AND "
+                                  "c = 3 AND (d = 4 AND e = 5) OR f = 6"))
+                  .where;
+    REQUIRE(w.kind == CondKind::OR);
+    REQUIRE(w.children.size() == 3);
+    const Condition &conj = w.children[1];
+    REQUIRE(conj.kind == CondKind::AND);
+    REQUIRE(conj.children.size() == 4);
+    REQUIRE(conj.children[3].column == "e");
+    REQUIRE(w.children[2].literal.i == 6);
+  }
+
+  SECTION("NOT, IN and BETWEEN") {
+    auto w = *std::get<StmtSelect>(
+                  parse_statement("SELECT * FROM t WHERE NOT (a IN (1, 2, 3)) "
+                                  "AND b NOT BETWEEN 5 AND 9 AND c NOT IN "
+                                  "(\"x\")"))
+                  .where;
+    REQUIRE(w.kind == CondKind::AND);
+    REQUIRE(w.children.size() == 3);
+    const Condition &in = w.children[0].children[0];
+    REQUIRE(w.children[0].kind == CondKind::NOT);
+    REQUIRE(in.kind == CondKind::IN);
+    REQUIRE(in.values.size() == 3);
+    const Condition &range = w.children[1].children[0];
+    REQUIRE(range.kind == CondKind::AND);
+    REQUIRE(range.children[0].op == Condition::Op::GE);
+    REQUIRE(range.children[1].op == Condition::Op::LE);
+    REQUIRE(range.children[1].literal.i == 9);
+    REQUIRE(w.children[2].children[0].values[0].s == "x");
+  }
+
+  SECTION("Malformed expressions") {
+    for (const char *bad :
+         {"SELECT * FROM t WHERE a = 1 AND", "SELECT * FROM t WHERE (a = 1",
+          "SELECT * FROM t WHERE a IN ()", "SELECT * FROM t WHERE a IN 1",
+          "SELECT * FROM t WHERE a BETWEEN 1 OR 2",
+          "SELECT * FROM t WHERE a NOT = 1", "SELECT * FROM t WHERE NOT",
+          "SELECT * FROM t WHERE a = 1 b = 2"})
+      REQUIRE_THROWS_AS(parse_statement(bad), ParseError);
+    std::string deep = "SELECT * FROM t WHERE " + std::string(100, '(') +
+                       "a = 1" + std::string(100, ')');
+    REQUIRE_THROWS_AS(parse_statement(deep), ParseError);
+  }
+}
+
+TEST_CASE("Aggregate SELECT lists", "[parser]") {
+  auto sel = std::get<StmtSelect>(
+      parse_statement("SELECT COUNT(*), SUM(v) FROM t WHERE v > 1"));
+  REQUIRE(sel.aggregates.size() == 2);
+  REQUIRE(sel.aggregates[1].func == AggFunc::SUM);
+  REQUIRE(sel.aggregates[1].column == "v");
+  REQUIRE(sel.aggregates[1].position == 1);
+  REQUIRE(sel.columns.empty());
+
+  REQUIRE_THROWS_AS(parse_statement("SELECT k, COUNT(*) FROM t"), ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT SUM(*) FROM t"), ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT MEDIAN(k) FROM t"), ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT COUNT(k FROM t"), ParseError);
+}
+
+TEST_CASE("GROUP BY clauses", "[parser]") {
+  auto s = std::get<StmtSelect>(
+      parse_statement("SELECT SUM(v), k FROM t WHERE v > 1 GROUP BY k"));
+  REQUIRE(s.group_by == "k");
+  REQUIRE(s.columns == std::vector<std::string>{"k"});
+  REQUIRE(s.aggregates.at(0).position == 0);
+
+  REQUIRE_THROWS_AS(parse_statement("SELECT k, v FROM t GROUP BY k"),
+                    ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT * FROM t GROUP BY k"),
+                    ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT k FROM t GROUP BY k, v"),
+                    ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT k FROM t GROUP k"), ParseError);
+}
+
+TEST_CASE("ORDER BY, LIMIT and OFFSET", "[parser]") {
+  auto sel = std::get<StmtSelect>(
+      parse_statement("SELECT a FROM t WHERE a > 1 ORDER BY b DESC LIMIT 10 "
+                      "OFFSET 20"));
+  REQUIRE(sel.where);
+  REQUIRE(sel.order.column == "b");
+  REQUIRE(sel.order.descending);
+  REQUIRE(sel.order.limit == std::optional<size_t>(10));
+  REQUIRE(sel.order.offset == 20);
+
+  auto bare = std::get<StmtSelect>(parse_statement("SELECT * FROM t LIMIT 0"));
+  REQUIRE(bare.order.column.empty());
+  REQUIRE(bare.order.limit == std::optional<size_t>(0));
+  auto plain = std::get<StmtSelect>(parse_statement("SELECT * FROM t"));
+  REQUIRE_FALSE(plain.order.limit);
+
+  REQUIRE_THROWS_AS(parse_statement("SELECT k FROM t ORDER BY k, v"),
+                    ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT k FROM t ORDER k"), ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT k FROM t LIMIT -1"), ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT k FROM t LIMIT \"1\""),
+                    ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT k FROM t LIMIT ?"), ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT k FROM t OFFSET 1"), ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT k FROM t LIMIT 1 ORDER BY k"),
+                    ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT COUNT(*) FROM t ORDER BY k"),
+                    ParseError);
+  REQUIRE_THROWS_AS(
+      parse_statement("SELECT name FROM t GROUP BY name ORDER BY name"),
+      ParseError);
+}
+
+TEST_CASE("JOIN", "[parser]") {
+  auto sel = std::get<StmtSelect>(
+      parse_statement("SELECT a.x, b.y FROM a JOIN b ON a.k = b.k WHERE "
+                      "a.x > 1 LIMIT 5"));
+  REQUIRE(sel.table == "a");
+  REQUIRE(sel.columns == std::vector<std::string>{"a.x", "b.y"});
+  REQUIRE(sel.join);
+  REQUIRE(sel.join->table == "b");
+  REQUIRE(sel.join->left == "a.k");
+  REQUIRE(sel.join->right == "b.k");
+  REQUIRE(sel.where);
+  REQUIRE(sel.order.limit == std::optional<size_t>(5));
+  REQUIRE_FALSE(std::get<StmtSelect>(parse_statement("SELECT * FROM a")).join);
+
+  REQUIRE_THROWS_AS(parse_statement("SELECT * FROM a JOIN b"), ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT * FROM a JOIN b ON a.k"),
+                    ParseError);
+  REQUIRE_THROWS_AS(parse_statement("SELECT * FROM a JOIN b ON a.k < b.k"),
+                    ParseError);
+  REQUIRE_THROWS_AS(
+      parse_statement("SELECT COUNT(*) FROM a JOIN b ON a.k = b.k"),
+      ParseError);
+  REQUIRE_THROWS_AS(
+      parse_statement("SELECT a.x FROM a JOIN b ON a.k = b.k ORDER BY a.x"),
+      ParseError);
+}
+
+TEST_CASE("COPY FROM and SAVE", "[parser]") {
+  auto copy = std::get<StmtCopy>(parse_statement("COPY t FROM \"in.csv\""));
+  REQUIRE(copy.table == "t");
+  REQUIRE(copy.path == "in.csv");
+  REQUIRE_THROWS_AS(parse_statement("COPY t FROM in.csv"), ParseError);
+
+  REQUIRE(std::get<StmtSave>(parse_statement("SAVE \"db.snap\"")).path ==
+          "db.snap");
+}
+
+TEST_CASE("VACUUM", "[parser]") {
+  REQUIRE(std::get<StmtVacuum>(parse_statement("VACUUM")).table.empty());
+  REQUIRE(std::get<StmtVacuum>(parse_statement("VACUUM t")).table == "t");
+  REQUIRE_THROWS_AS(parse_statement("VACUUM t u"), ParseError);
+}
+
+TEST_CASE("PREPARE and EXECUTE", "[parser]") {
+  SECTION("Placeholders") {
+    std::vector<size_t> params;
+    auto stmt = parse_statement(
+        "UPDATE t SET a = ?, b = 1 WHERE id = ?", params);
+    REQUIRE(std::holds_alternative<StmtUpdate>(stmt));
+    REQUIRE(params == std::vector<size_t>{0, 2});
+    REQUIRE_THROWS_AS(parse_statement("SELECT * FROM t WHERE id = ?"),
+                      ParseError);
+  }
+
+  SECTION("PREPARE keeps the statement text") {
+    auto stmt = parse_statement("PREPARE q AS SELECT * FROM t WHERE id = ?");
+    auto prep = std::get<StmtPrepare>(stmt);
+    REQUIRE(prep.name == "q");
+    REQUIRE(prep.sql == "SELECT * FROM t WHERE id = ?");
+    REQUIRE_THROWS_AS(parse_statement("PREPARE q AS SELECT * FROM"),
+                      ParseError);
+    REQUIRE_THROWS_AS(parse_statement("PREPARE q AS EXECUTE p"), ParseError);
+  }
+
+  SECTION("EXECUTE with parameters") {
+    auto exec = std::get<StmtExecute>(parse_statement("EXECUTE q (1, \"x\")"));
+    REQUIRE(exec.name == "q");
+    REQUIRE(exec.params.size() == 2);
+    REQUIRE(exec.params[1].s == "x");
+    REQUIRE(std::get<StmtExecute>(parse_statement("EXECUTE q")).params.empty());
+    REQUIRE_THROWS_AS(parse_statement("EXECUTE q (?)"), ParseError);
+  }
 }
 
 TEST_CASE("Parser error handling", "[parser]") {
@@ -102,6 +342,12 @@ TEST_CASE("Parser error handling", "[parser]") {
     REQUIRE_THROWS_AS(parse_statement("select * FROM people"), ParseError);
   }
 
+  SECTION("Out of range integers") {
+    REQUIRE_THROWS_AS(
+        parse_statement("SELECT * FROM t WHERE id = 99999999999999999999"),
+        ParseError);
+  }
+
   SECTION("Malformed statements") {
     REQUIRE_THROWS_AS(parse_statement("CREATE TABLE test (id int"), ParseError);
     REQUIRE_THROWS_AS(parse_statement("SELECT * FROM"), ParseError);
@@ -0,0 +1,111 @@
+#include "parser.hpp"
+#include "prepared.hpp"
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <thread>
+
+using namespace db;
+
+TEST_CASE("Prepared statements", "[prepared]") {
+  Database db;
+  execute(db, parse_statement("CREATE TABLE people (id int, name str)"));
+
+  SECTION("Parameters fill placeholders per execution") {
+    auto ins = db.prepare("INSERT INTO people (name, id) VALUES (?, ?)");
+    REQUIRE(ins->param_count() == 2);
+    for (int i = 0; i < 10; ++i)
+      ins->execute({Value::make_str("p" + std::to_string(i)),
+                    Value::make_int(i)});
+
+    auto sel = db.prepare("SELECT name FROM people WHERE id >= ?");
+    auto res = sel->execute({Value::make_int(7)});
+    REQUIRE(res.has_value());
+    REQUIRE(res->row_count() == 3);
+    REQUIRE(res->cell(0, 0) == "p7");
+
+    auto upd = db.prepare("UPDATE people SET name = ? WHERE id = ?");
+    upd->execute({Value::make_str("seven"), Value::make_int(7)});
+    auto del = db.prepare("DELETE FROM people WHERE id < ?");
+    del->execute({Value::make_int(5)});
+
+    // same results as the unprepared path
+    auto plain = execute(db, parse_statement("SELECT * FROM people"));
+    auto prepared = db.prepare("SELECT * FROM people")->execute();
+    REQUIRE(plain->row_count() == 5);
+    REQUIRE(prepared->row_count() == 5);
+    for (size_t r = 0; r < 5; ++r) {
+      REQUIRE(prepared->cell(r, 0) == plain->cell(r, 0));
+      REQUIRE(prepared->cell(r, 1) == plain->cell(r, 1));
+    }
+    REQUIRE(plain->cell(2, 1) == "seven");
+  }
+
+  SECTION("Plans are cached by statement text") {
+    auto a = db.prepare("SELECT * FROM people WHERE id = ?");
+    auto b = db.prepare("SELECT * FROM people WHERE id = ?");
+    REQUIRE(a == b);
+    REQUIRE(db.prepare("SELECT * FROM people WHERE id > ?") != a);
+  }
+
+  SECTION("Indexes created after binding are used") {
+    auto sel = db.prepare("SELECT id FROM people WHERE name = ?");
+    auto ins = db.prepare("INSERT INTO people (id, name) VALUES (?, ?)");
+    ins->execute({Value::make_int(1), Value::make_str("a")});
+    REQUIRE(sel->execute({Value::make_str("a")})->row_count() == 1);
+    db.create_index("ix_name", "people", "name", IndexKind::HASH);
+    ins->execute({Value::make_int(2), Value::make_str("a")});
+    REQUIRE(sel->execute({Value::make_str("a")})->row_count() == 2);
+  }
+
+  SECTION("Errors") {
+    auto sel = db.prepare("SELECT * FROM people WHERE id = ?");
+    REQUIRE_THROWS_AS(sel->execute(), DBError);
+    REQUIRE_THROWS_AS(sel->execute({Value::make_str("x")}), TypeError);
+    REQUIRE_THROWS_AS(db.prepare("SELECT * FROM"), ParseError);
+    // unknown tables are reported on execution, which may come later
+    auto later = db.prepare("SELECT * FROM pets");
+    REQUIRE_THROWS_AS(later->execute(), DBError);
+    execute(db, parse_statement("CREATE TABLE pets (name str)"));
+    REQUIRE(later->execute()->row_count() == 0);
+  }
+
+  SECTION("PREPARE and EXECUTE statements") {
+    execute(db, parse_statement("PREPARE add AS INSERT INTO people (id, name) "
+                                "VALUES (?, ?)"));
+    execute(db, parse_statement("EXECUTE add (1, \"ann\")"));
+    execute(db, parse_statement("EXECUTE add (2, \"bo\")"));
+    execute(db, parse_statement("PREPARE get AS SELECT name FROM people "
+                                "WHERE id = ?"));
+    auto res = execute(db, parse_statement("EXECUTE get (2)"));
+    REQUIRE(res.has_value());
+    REQUIRE(res->row_count() == 1);
+    REQUIRE(res->cell(0, 0) == "bo");
+    REQUIRE_THROWS_AS(execute(db, parse_statement("EXECUTE nope")), DBError);
+  }
+
+  SECTION("Threads run one plan with their own parameters") {
+    auto ins = db.prepare("INSERT INTO people (id, name) VALUES (?, ?)");
+    for (int i = 0; i < 100; ++i)
+      ins->execute(
+          {Value::make_int(i), Value::make_str("p" + std::to_string(i))});
+    auto sel = db.prepare("SELECT name FROM people WHERE id IN (?, 1000) OR "
+                          "id = ?");
+    // assertions stay on the test thread; Catch2 is not thread-safe
+    std::atomic<int> wrong{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&, t] {
+        for (int i = 0; i < 500; ++i) {
+          int a = (t * 37 + i) % 99;
+          auto r = sel->execute({Value::make_int(a), Value::make_int(a + 1)});
+          if (r->row_count() != 2 || r->cell(0, 0) != "p" + std::to_string(a) ||
+              r->cell(1, 0) != "p" + std::to_string(a + 1))
+            ++wrong;
+        }
+      });
+    }
+    for (auto &th : threads)
+      th.join();
+    REQUIRE(wrong.load() == 0);
+  }
+}
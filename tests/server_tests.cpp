@@ -0,0 +1,261 @@
+#include "parser.hpp"
+#include "protocol.hpp"
+#include "server.hpp"
+#include "test_util.hpp"
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace db;
+
+namespace {
+// A Server on a temporary Unix socket, run on its own thread.
+struct TestServer {
+  Database db;
+  std::string address;
+  Server server;
+  std::thread loop;
+
+  explicit TestServer(ServerOptions opts = options())
+      : address(std::string(P_tmpdir) + "/inmemdb_server_" +
+                std::to_string(reinterpret_cast<uintptr_t>(this))),
+        server(db, address, std::move(opts)), loop([this] { server.run(); }) {}
+  ~TestServer() {
+    server.stop();
+    loop.join();
+  }
+
+  static ServerOptions options() {
+    ServerOptions opts;
+    opts.workers = 2;
+    return opts;
+  }
+};
+
+std::string local_csv(Database &db, const std::string &sql) {
+  return to_csv(*execute(db, parse_statement(sql)));
+}
+} // namespace
+
+TEST_CASE("Pipelined requests are answered in order", "[server]") {
+  TestServer s;
+  Client c(s.address);
+  c.send("CREATE TABLE t (id int, name str);");
+  for (int i = 0; i < 100; ++i)
+    c.send("INSERT INTO t (id, name) VALUES (" + std::to_string(i) +
+           ", \"n" + std::to_string(i) + "\")");
+  for (int i = 0; i < 100; ++i)
+    c.send("SELECT name FROM t WHERE id = " + std::to_string(i));
+
+  for (int i = 0; i < 101; ++i) {
+    Response r = c.receive();
+    REQUIRE(r.status == ResponseStatus::OK);
+    REQUIRE(r.body.empty());
+  }
+  for (int i = 0; i < 100; ++i) {
+    Response r = c.receive();
+    REQUIRE(r.status == ResponseStatus::ROWS);
+    REQUIRE(r.body == local_csv(s.db, "SELECT name FROM t WHERE id = " +
+                                          std::to_string(i)));
+  }
+}
+
+TEST_CASE("Binary results decode to the same rows", "[server]") {
+  TestServer s;
+  Client c(s.address);
+  c.query("CREATE TABLE t (id int, name str)");
+  c.query("INSERT INTO t (id, name) VALUES (1, \"a\"), (2, \"b,c\"), "
+          "(3, \"\")");
+  Response r = c.query("SELECT * FROM t", ResultFormat::BINARY);
+  REQUIRE(r.status == ResponseStatus::ROWS);
+  QueryResult rows = decode_binary_result(r.body);
+  REQUIRE(to_csv(rows) == local_csv(s.db, "SELECT * FROM t"));
+
+  r = c.query("SELECT * FROM t WHERE id > 5", ResultFormat::BINARY);
+  REQUIRE(r.status == ResponseStatus::ROWS);
+  rows = decode_binary_result(r.body);
+  REQUIRE(rows.headers.size() == 2);
+  REQUIRE(rows.row_count() == 0);
+}
+
+TEST_CASE("Results larger than a frame are split over several",
+          "[server]") {
+  TestServer s;
+  constexpr size_t kRows = 70000;
+  make_table(s.db, "t", kRows,
+             {int_column("k", [](int64_t k) { return k; }),
+              str_column("pad", [](int64_t k) {
+                return std::string(1000, static_cast<char>('a' + k % 26));
+              })});
+  Client c(s.address);
+  Response r = c.query("SELECT * FROM t", ResultFormat::BINARY);
+  REQUIRE(r.status == ResponseStatus::ROWS);
+  REQUIRE(r.body.size() > kMaxFrame);
+  QueryResult rows = decode_binary_result(r.body);
+  REQUIRE(rows.row_count() == kRows);
+  REQUIRE(rows.rows[kRows - 1][0] == std::to_string(kRows - 1));
+  REQUIRE(rows.rows[kRows - 1][1] ==
+          std::string(1000, static_cast<char>('a' + (kRows - 1) % 26)));
+
+  // a client leaving mid-result stops it without holding up the server
+  {
+    Client gone(s.address);
+    gone.send("SELECT * FROM t");
+    gone.flush();
+  }
+  r = c.query("SELECT k FROM t WHERE k = 3");
+  REQUIRE(r.status == ResponseStatus::ROWS);
+  REQUIRE(r.body == "k\n3\n");
+
+  // a single frame that large is refused rather than mislabelled
+  std::string out;
+  size_t at = begin_frame(out);
+  out.resize(out.size() + kMaxFrame + 1);
+  REQUIRE_THROWS_AS(end_frame(out, at), DBError);
+}
+
+TEST_CASE("A client that stops reading does not hold a worker",
+          "[server]") {
+  // one worker, which a stalled result would otherwise keep for good
+  ServerOptions opts = TestServer::options();
+  opts.workers = 1;
+  opts.max_pending_output = size_t{1} << 20;
+  opts.output_timeout = std::chrono::milliseconds(100);
+  TestServer s(opts);
+  make_table(s.db, "t", 20000,
+             {int_column("k", [](int64_t k) { return k; }),
+              str_column("pad",
+                         [](int64_t) { return std::string(1000, 'p'); })});
+  Client stuck(s.address);
+  stuck.send("SELECT * FROM t");
+  stuck.send("SELECT * FROM t");
+  stuck.flush();
+
+  Client other(s.address);
+  for (int i = 0; i < 3; ++i) {
+    Response r = other.query("SELECT k FROM t WHERE k = 7");
+    REQUIRE(r.status == ResponseStatus::ROWS);
+    REQUIRE(r.body == "k\n7\n");
+  }
+  // the stalled results end in errors once the client reads again
+  Response r = stuck.receive();
+  REQUIRE(r.status == ResponseStatus::ERROR);
+  REQUIRE_THAT(r.body, Catch::Contains("not reading"));
+  REQUIRE(stuck.receive().status == ResponseStatus::ERROR);
+  REQUIRE(stuck.query("SELECT k FROM t WHERE k = 7").body == "k\n7\n");
+}
+
+TEST_CASE("Errors are reported without closing the connection",
+          "[server]") {
+  TestServer s;
+  Client c(s.address);
+  c.send("SELEKT 1");
+  c.send("SELECT * FROM missing");
+  c.send("CREATE TABLE t (x int)");
+  Response r = c.receive();
+  REQUIRE(r.status == ResponseStatus::ERROR);
+  REQUIRE_FALSE(r.body.empty());
+  REQUIRE(c.receive().status == ResponseStatus::ERROR);
+  REQUIRE(c.receive().status == ResponseStatus::OK);
+}
+
+TEST_CASE("A malformed frame closes the connection", "[server]") {
+  TestServer s;
+  int fd = connect_to(s.address);
+  uint32_t huge = 0xffffffff;
+  REQUIRE(::send(fd, &huge, sizeof(huge), MSG_NOSIGNAL) == sizeof(huge));
+  // one error response, then end of stream
+  std::string in;
+  char buf[256];
+  ssize_t n;
+  while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0)
+    in.append(buf, static_cast<size_t>(n));
+  ::close(fd);
+  size_t pos = 0;
+  std::string_view payload;
+  REQUIRE(next_frame(in, pos, payload));
+  REQUIRE(payload[0] == static_cast<char>(ResponseStatus::ERROR));
+  REQUIRE(pos == in.size());
+
+  // the server carries on
+  Client c(s.address);
+  REQUIRE(c.query("CREATE TABLE t (x int)").status == ResponseStatus::OK);
+}
+
+TEST_CASE("Concurrent clients", "[server]") {
+  TestServer s;
+  Client(s.address).query("CREATE TABLE t (c int, k int)");
+  constexpr int kClients = 4;
+  constexpr int kRows = 200;
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (int w = 0; w < kClients; ++w) {
+    threads.emplace_back([&, w] {
+      try {
+        Client c(s.address);
+        for (int k = 0; k < kRows; ++k)
+          c.send("INSERT INTO t (c, k) VALUES (" + std::to_string(w) + ", " +
+                 std::to_string(k) + ")");
+        for (int k = 0; k < kRows; ++k) {
+          if (c.receive().status != ResponseStatus::OK)
+            ++failures;
+        }
+        Response r = c.query("SELECT k FROM t WHERE c = " + std::to_string(w),
+                             ResultFormat::BINARY);
+        if (decode_binary_result(r.body).row_count() != kRows)
+          ++failures;
+      } catch (const DBError &) {
+        ++failures;
+      }
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  REQUIRE(failures.load() == 0);
+  REQUIRE(s.db.table("t").row_count() == kClients * kRows);
+}
+
+TEST_CASE("PREPARE names belong to their connection", "[server]") {
+  TestServer s;
+  Client a(s.address);
+  Client b(s.address);
+  a.query("CREATE TABLE t (id int, name str)");
+  a.query("INSERT INTO t (id, name) VALUES (1, \"one\"), (2, \"two\")");
+  REQUIRE(a.query("PREPARE q AS SELECT name FROM t WHERE id = ?").status ==
+          ResponseStatus::OK);
+  REQUIRE(b.query("PREPARE q AS DELETE FROM t WHERE id = ?").status ==
+          ResponseStatus::OK);
+
+  Response r = a.query("EXECUTE q (1)");
+  REQUIRE(r.status == ResponseStatus::ROWS);
+  REQUIRE(r.body == "name\none\n");
+  REQUIRE(b.query("EXECUTE q (2)").status == ResponseStatus::OK);
+  r = a.query("EXECUTE q (2)");
+  REQUIRE(r.status == ResponseStatus::ROWS);
+  REQUIRE(r.body == "name\n");
+  REQUIRE(Client(s.address).query("EXECUTE q (1)").status ==
+          ResponseStatus::ERROR);
+  REQUIRE(s.db.table("t").row_count() == 1);
+}
+
+TEST_CASE("Serving on a TCP port", "[server]") {
+  // port 0 lets the kernel pick a free one
+  Database db;
+  Server server(db, "0", TestServer::options());
+  REQUIRE(server.port() > 0);
+  std::thread loop([&] { server.run(); });
+  {
+    Client c(std::to_string(server.port()));
+    REQUIRE(c.query("CREATE TABLE t (x int)").status == ResponseStatus::OK);
+    REQUIRE(c.query("INSERT INTO t (x) VALUES (7)").status ==
+            ResponseStatus::OK);
+    REQUIRE(c.query("SELECT x FROM t").body ==
+            local_csv(db, "SELECT x FROM t"));
+  }
+  server.stop();
+  loop.join();
+}
@@ -0,0 +1,122 @@
+#include "checksum.hpp"
+#include "parser.hpp"
+#include "snapshot.hpp"
+#include "test_util.hpp"
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+using namespace db;
+
+namespace {
+std::string read_all(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+void write_all(const std::string &path, const std::string &data) {
+  std::ofstream(path, std::ios::binary) << data;
+}
+} // namespace
+
+TEST_CASE("CRC-32C", "[snapshot]") {
+  REQUIRE(crc32c("123456789", 9) == 0xE3069283u);
+  // continuing a checksum equals checksumming the concatenation
+  REQUIRE(crc32c("56789", 5, crc32c("1234", 4)) == 0xE3069283u);
+  REQUIRE(crc32c("", 0) == 0);
+}
+
+TEST_CASE("Snapshot save and load", "[snapshot]") {
+  TempPath snap("snap");
+  Database db;
+  run(db, "CREATE TABLE people (id int, name str)");
+  run(db, "CREATE TABLE empty (x int)");
+  run(db, "CREATE INDEX ix_id ON people (id) USING BTREE");
+  run(db, "CREATE INDEX ix_name ON people (name)");
+  for (int i = 0; i < 500; ++i)
+    run(db, "INSERT INTO people (id, name) VALUES (" + std::to_string(i) +
+                ", \"person " + std::to_string(i) + "\")");
+  // leaves dead bytes behind, so the saved column must be repacked
+  run(db, "UPDATE people SET name = \"a much longer replacement name\" "
+          "WHERE id < 100");
+  // a fifth of the rows: marked deleted, too few to compact the table
+  run(db, "DELETE FROM people WHERE id >= 400");
+  run(db, "SAVE \"" + snap.path + "\"");
+
+  Database loaded;
+  load_snapshot(loaded, snap.path, true);
+  REQUIRE(loaded.table("empty").row_count() == 0);
+  const Table &t = loaded.table("people");
+  REQUIRE(t.row_count() == 400);
+  REQUIRE(t.has_index("ix_id"));
+  REQUIRE(t.has_index("ix_name"));
+  auto before = to_csv(*execute(db, parse_statement("SELECT * FROM people")));
+  auto after =
+      to_csv(*execute(loaded, parse_statement("SELECT * FROM people")));
+  REQUIRE(before == after);
+  auto hit = execute(loaded,
+                     parse_statement("SELECT id FROM people WHERE name = "
+                                     "\"person 250\""));
+  REQUIRE(hit->row_count() == 1);
+  REQUIRE(hit->cell(0, 0) == "250");
+
+  SECTION("Mapped columns are copied on write") {
+    std::string bytes = read_all(snap.path);
+    run(loaded, "UPDATE people SET name = \"changed\" WHERE id = 5");
+    run(loaded, "INSERT INTO people (id, name) VALUES (1000, \"new\")");
+    run(loaded, "DELETE FROM people WHERE id < 3");
+    REQUIRE(read_all(snap.path) == bytes);
+    REQUIRE(loaded.table("people").row_count() == 398);
+    auto res = execute(loaded, parse_statement(
+                                   "SELECT name FROM people WHERE id = 5"));
+    REQUIRE(res->cell(0, 0) == "changed");
+
+    Database again;
+    load_snapshot(again, snap.path);
+    REQUIRE(again.table("people").row_count() == 400);
+  }
+
+  SECTION("Corruption is detected") {
+    std::string good = read_all(snap.path);
+    Database other;
+
+    std::string bad = good;
+    bad[0] = 'X';
+    write_all(snap.path, bad);
+    REQUIRE_THROWS_WITH(load_snapshot(other, snap.path),
+                        Catch::Contains("Not a snapshot"));
+
+    // the catalog sits at the end of the file
+    bad = good;
+    bad[bad.size() - 3] ^= 0x40;
+    write_all(snap.path, bad);
+    REQUIRE_THROWS_WITH(load_snapshot(other, snap.path),
+                        Catch::Contains("catalog checksum"));
+
+    // column data starts after the 48-byte header, at the first alignment
+    bad = good;
+    bad[64] ^= 0x01;
+    write_all(snap.path, bad);
+    REQUIRE_THROWS_WITH(load_snapshot(other, snap.path, true),
+                        Catch::Contains("column checksum"));
+
+    write_all(snap.path, good.substr(0, good.size() / 2));
+    REQUIRE_THROWS_AS(load_snapshot(other, snap.path), DBError);
+    REQUIRE_THROWS_AS(load_snapshot(other, "/nonexistent/snap"), DBError);
+
+    // string bounds are checked with the column data, and trusted without
+    Database one;
+    run(one, "CREATE TABLE w (s str)");
+    run(one, "INSERT INTO w (s) VALUES (\"abc\")");
+    save_snapshot(one, snap.path);
+    bad = read_all(snap.path);
+    // the offsets take the first aligned block, the lengths the second
+    REQUIRE(bad[128] == 3);
+    bad[128] = 0x7f;
+    write_all(snap.path, bad);
+    REQUIRE_THROWS_AS(load_snapshot(other, snap.path, true), DBError);
+    Database trusting;
+    REQUIRE_NOTHROW(load_snapshot(trusting, snap.path));
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "database.hpp"
+#include "parallel.hpp"
+#include <functional>
+#include <memory>
+#include <string>
+
+// Helpers shared by the test files; defined in main.cpp.
+
+std::unique_ptr<db::Database> create_test_db();
+std::unique_ptr<db::Database> create_complex_db();
+
+// Runs one statement; an empty result if it produces none.
+db::QueryResult run(db::Database &db, const std::string &sql);
+// SELECT * FROM table, as CSV.
+std::string dump(db::Database &db, const std::string &table);
+size_t file_size(const std::string &path);
+
+// A column of a generated table: its definition and the value it holds in
+// row k.
+struct GenColumn {
+  db::Column def;
+  std::function<int64_t(int64_t)> int_of;
+  std::function<std::string(int64_t)> str_of;
+};
+inline GenColumn int_column(std::string name,
+                            std::function<int64_t(int64_t)> f) {
+  return {{std::move(name), db::Type::INT}, std::move(f), {}};
+}
+inline GenColumn str_column(std::string name,
+                            std::function<std::string(int64_t)> f) {
+  return {{std::move(name), db::Type::STR}, {}, std::move(f)};
+}
+// Creates table with these columns and appends rows k = 0..n-1 as one
+// block.
+void make_table(db::Database &db, const std::string &table, size_t n,
+                const std::vector<GenColumn> &cols);
+
+// A path under the temp directory, removed when the test ends.
+struct TempPath {
+  std::string path;
+  explicit TempPath(const char *tag);
+  ~TempPath();
+};
+
+// Parallel options for the duration of a test, e.g. to force parallel
+// scans on small inputs.
+struct ScopedParallelOptions {
+  db::ParallelOptions saved = db::parallel_options();
+  explicit ScopedParallelOptions(const db::ParallelOptions &opts) {
+    db::set_parallel_options(opts);
+  }
+  ~ScopedParallelOptions() { db::set_parallel_options(saved); }
+};
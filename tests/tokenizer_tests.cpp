@@ -58,3 +58,38 @@ TEST_CASE("Tokenizer basic functionality", "[tokenizer]") {
     REQUIRE(tz.next().type == TokType::GE);
   }
 }
+
+TEST_CASE("Tokenizer keywords and lookahead", "[tokenizer]") {
+  SECTION("Keywords are recognised case-sensitively") {
+    Tokenizer tz("SELECT select WHERE wherever");
+    REQUIRE(tz.next().kw == Keyword::SELECT);
+    Token lower = tz.next();
+    REQUIRE(lower.type == TokType::IDENT);
+    REQUIRE(lower.kw == Keyword::NONE);
+    REQUIRE(tz.next().kw == Keyword::WHERE);
+    REQUIRE(tz.next().kw == Keyword::NONE);
+    REQUIRE(keyword_of("VALUES") == Keyword::VALUES);
+    REQUIRE(std::string(keyword_name(Keyword::VALUES)) == "VALUES");
+  }
+
+  SECTION("Peek does not consume") {
+    Tokenizer tz("a \"b c\"");
+    REQUIRE(tz.peek().text == "a");
+    REQUIRE(tz.peek().text == "a");
+    REQUIRE(tz.next().text == "a");
+    Token s = tz.next();
+    REQUIRE(s.type == TokType::STRING);
+    REQUIRE(s.text == "b c");
+    REQUIRE(tz.eof());
+    REQUIRE(tz.next().type == TokType::END);
+  }
+
+  SECTION("Tokens view the input") {
+    std::string input = "name \"value\"";
+    Tokenizer tz(input);
+    Token ident = tz.next();
+    Token str = tz.next();
+    REQUIRE(ident.text.data() == input.data());
+    REQUIRE(str.text.data() == input.data() + 6);
+  }
+}
@@ -0,0 +1,210 @@
+#include "parser.hpp"
+#include "prepared.hpp"
+#include "snapshot.hpp"
+#include "test_util.hpp"
+#include "wal.hpp"
+#include <catch2/catch.hpp>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sys/resource.h>
+#include <thread>
+
+using namespace db;
+
+namespace {
+// Caps the size of files the process writes; a write past the cap fails
+// with EFBIG instead of raising SIGXFSZ.
+struct FileSizeLimit {
+  rlimit saved{};
+  void (*handler)(int);
+  explicit FileSizeLimit(rlim_t bytes) {
+    ::getrlimit(RLIMIT_FSIZE, &saved);
+    handler = std::signal(SIGXFSZ, SIG_IGN);
+    rlimit cap = saved;
+    cap.rlim_cur = bytes;
+    ::setrlimit(RLIMIT_FSIZE, &cap);
+  }
+  ~FileSizeLimit() {
+    ::setrlimit(RLIMIT_FSIZE, &saved);
+    std::signal(SIGXFSZ, handler);
+  }
+};
+} // namespace
+
+TEST_CASE("Write-ahead log replay", "[wal]") {
+  TempPath log_path("wal");
+  std::string expected;
+  {
+    WriteAheadLog log(log_path.path, {1000, std::chrono::milliseconds(5)});
+    Database db;
+    db.attach_wal(&log);
+    run(db, "CREATE TABLE t (id int, name str)");
+    run(db, "CREATE INDEX ix ON t (id) USING BTREE");
+    run(db, "INSERT INTO t (id, name) VALUES (1, \"a\"), (2, \"b\"), "
+            "(3, \"c\")");
+    // the first tuple is applied before the second fails; both the table
+    // and the log keep it
+    REQUIRE_THROWS_AS(
+        run(db, "INSERT INTO t (id, name) VALUES (4, \"d\"), (\"x\", 5)"),
+        TypeError);
+    auto ins = db.prepare("INSERT INTO t (name, id) VALUES (?, ?)");
+    ins->execute({Value::make_str("e"), Value::make_int(5)});
+    run(db, "UPDATE t SET name = \"B\" WHERE id = 2");
+    run(db, "DELETE FROM t WHERE id = 1");
+    run(db, "DELETE FROM t WHERE id = 99");
+    expected = dump(db, "t");
+    REQUIRE(log.last_lsn() == 7);
+  }
+
+  Database again;
+  WriteAheadLog log(log_path.path);
+  REQUIRE(log.replay(again, 0) == 7);
+  REQUIRE(dump(again, "t") == expected);
+  REQUIRE(again.table("t").has_index("ix"));
+  REQUIRE(log.last_lsn() == 7);
+
+  SECTION("Replay starts after the snapshot") {
+    TempPath snap("walsnap");
+    again.attach_wal(&log);
+    run(again, "SAVE \"" + snap.path + "\"");
+    run(again, "INSERT INTO t (id, name) VALUES (6, \"f\")");
+    log.flush();
+    Database restored;
+    uint64_t lsn = load_snapshot(restored, snap.path);
+    REQUIRE(lsn == 7);
+    WriteAheadLog reopened(log_path.path);
+    REQUIRE(reopened.replay(restored, lsn) == 1);
+    REQUIRE(dump(restored, "t") == dump(again, "t"));
+  }
+
+  SECTION("A torn tail is cut off") {
+    size_t intact = file_size(log_path.path);
+    {
+      std::ofstream out(log_path.path, std::ios::binary | std::ios::app);
+      out << std::string(11, '\x7f');
+    }
+    Database db;
+    WriteAheadLog reopened(log_path.path);
+    REQUIRE(file_size(log_path.path) == intact);
+    REQUIRE(reopened.replay(db, 0) == 7);
+    db.attach_wal(&reopened);
+    run(db, "INSERT INTO t (id, name) VALUES (7, \"g\")");
+    reopened.flush();
+    REQUIRE(reopened.last_lsn() == 8);
+    Database check;
+    WriteAheadLog(log_path.path).replay(check, 0);
+    REQUIRE(check.table("t").row_count() == 5);
+  }
+}
+
+TEST_CASE("Write-ahead log replays compound WHERE clauses", "[wal]") {
+  TempPath log_path("walwhere");
+  std::string expected;
+  {
+    WriteAheadLog log(log_path.path);
+    Database db;
+    db.attach_wal(&log);
+    run(db, "CREATE TABLE t (id int, name str)");
+    for (int k = 0; k < 20; ++k)
+      run(db, "INSERT INTO t (id, name) VALUES (" + std::to_string(k) +
+                  ", \"n" + std::to_string(k % 3) + "\")");
+    run(db, "UPDATE t SET name = \"x\" WHERE id BETWEEN 3 AND 6 OR "
+            "NOT (name IN (\"n0\", \"n1\"))");
+    run(db, "DELETE FROM t WHERE name = \"x\" AND id NOT IN (4, 17)");
+    expected = dump(db, "t");
+  }
+  Database again;
+  WriteAheadLog(log_path.path).replay(again, 0);
+  REQUIRE(dump(again, "t") == expected);
+  REQUIRE(again.table("t").row_count() == 20 - 7);
+}
+
+TEST_CASE("Write-ahead log group commit", "[wal]") {
+  TempPath log_path("walgroup");
+
+  SECTION("A statement returns once its records are durable") {
+    // neither a full group nor the flusher would sync them meanwhile
+    WriteAheadLog log(log_path.path, {1000, std::chrono::milliseconds(60000)});
+    Database db;
+    db.attach_wal(&log);
+    run(db, "CREATE TABLE t (x int)");
+    REQUIRE(log.durable_lsn() == 1);
+    run(db, "INSERT INTO t (x) VALUES (1), (2)");
+    REQUIRE(log.durable_lsn() == 2);
+    auto update = db.prepare("UPDATE t SET x = ? WHERE x = 1");
+    update->execute({Value::make_int(3)});
+    REQUIRE(log.durable_lsn() == 3);
+    run(db, "DELETE FROM t WHERE x = 99");
+    REQUIRE(log.last_lsn() == 3);
+    // the rows a failing INSERT applied before the error too
+    REQUIRE_THROWS_AS(run(db, "INSERT INTO t (x) VALUES (5), (\"x\")"),
+                      TypeError);
+    REQUIRE(log.durable_lsn() == 4);
+
+    // concurrent writers all come back durable
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 4; ++w) {
+      writers.emplace_back([&] {
+        for (int k = 0; k < 20; ++k) {
+          uint64_t before = log.last_lsn();
+          run(db, "INSERT INTO t (x) VALUES (" + std::to_string(k) + ")");
+          CHECK(log.durable_lsn() > before);
+        }
+      });
+    }
+    for (auto &t : writers)
+      t.join();
+    REQUIRE(log.durable_lsn() == 4 + 4 * 20);
+  }
+
+  SECTION("A full group is made durable at once") {
+    WriteAheadLog log(log_path.path,
+                      {3, std::chrono::milliseconds(60000), true});
+    Database db;
+    db.attach_wal(&log);
+    run(db, "CREATE TABLE t (x int)");
+    run(db, "INSERT INTO t (x) VALUES (1)");
+    REQUIRE(log.durable_lsn() == 0);
+    run(db, "INSERT INTO t (x) VALUES (2)");
+    REQUIRE(log.durable_lsn() == 3);
+  }
+
+  SECTION("The flusher syncs a partial group") {
+    WriteAheadLog log(log_path.path,
+                      {1000, std::chrono::milliseconds(1), true});
+    Database db;
+    db.attach_wal(&log);
+    run(db, "CREATE TABLE t (x int)");
+    for (int i = 0; i < 200 && log.durable_lsn() < 1; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    REQUIRE(log.durable_lsn() == 1);
+  }
+
+  SECTION("A failed write is cut off and fails the log for good") {
+    WriteAheadLog log(log_path.path,
+                      {1000, std::chrono::milliseconds(60000), true});
+    Database db;
+    db.attach_wal(&log);
+    run(db, "CREATE TABLE t (x int, s str)");
+    log.flush();
+    size_t good = file_size(log_path.path);
+    run(db, "INSERT INTO t (x, s) VALUES (1, \"" + std::string(8192, 'a') +
+                "\")");
+    {
+      // only part of the record fits
+      FileSizeLimit limit(good + 100);
+      REQUIRE_THROWS_AS(log.flush(), DBError);
+    }
+    CHECK(file_size(log_path.path) == good);
+    CHECK(log.durable_lsn() == 1);
+    REQUIRE_THROWS_AS(log.flush(), DBError);
+    REQUIRE_THROWS_AS(run(db, "INSERT INTO t (x, s) VALUES (2, \"b\")"),
+                      DBError);
+
+    Database again;
+    WriteAheadLog(log_path.path).replay(again, 0);
+    CHECK(again.table("t").row_count() == 0);
+  }
+}
@@ -0,0 +1,173 @@
+#include "parser.hpp"
+#include "predicate.hpp"
+#include "prepared.hpp"
+#include "test_util.hpp"
+#include <catch2/catch.hpp>
+#include <functional>
+
+using namespace db;
+
+namespace {
+int64_t a_of(int64_t k) { return k % 50; }
+int64_t b_of(int64_t k) { return k * 7919 % 1000; }
+std::string s_of(int64_t k) { return "s" + std::to_string(k % 13); }
+
+// rows k = 0..n-1 with a = a_of(k), b = b_of(k) and s = s_of(k)
+void fill(Database &db, int64_t n) {
+  make_table(db, "t", static_cast<size_t>(n),
+             {int_column("k", [](int64_t k) { return k; }),
+              int_column("a", a_of), int_column("b", b_of),
+              str_column("s", s_of)});
+}
+
+// the k column of a result, which has no columns when it has no rows
+std::vector<int64_t> keys(const QueryResult &r) {
+  return r.columns.empty() ? std::vector<int64_t>() : r.columns[0].ints;
+}
+
+struct Case {
+  const char *where;
+  std::function<bool(int64_t, int64_t, int64_t, const std::string &)> keep;
+};
+
+const Case kCases[] = {
+    {"a = 3 AND b < 500",
+     [](auto a, auto b, auto, auto &) { return a == 3 && b < 500; }},
+    {"a = 3 OR b < 100 OR s = \"s4\"",
+     [](auto a, auto b, auto, auto &s) { return a == 3 || b < 100 || s == "s4"; }},
+    {"NOT (a > 10) AND NOT s = \"s1\"",
+     [](auto a, auto, auto, auto &s) { return a <= 10 && s != "s1"; }},
+    {"a IN (1, 7, 7, 49) AND b BETWEEN 100 AND 600",
+     [](auto a, auto b, auto, auto &) {
+       return (a == 1 || a == 7 || a == 49) && b >= 100 && b <= 600;
+     }},
+    {"s IN (\"s2\", \"s11\", \"nope\") OR a NOT BETWEEN 5 AND 45",
+     [](auto a, auto, auto, auto &s) {
+       return s == "s2" || s == "s11" || a < 5 || a > 45;
+     }},
+    {"(a < 5 OR a > 44) AND (s = \"s0\" OR b >= 900) AND k NOT IN (13, 26)",
+     [](auto a, auto b, auto k, auto &s) {
+       return (a < 5 || a > 44) && (s == "s0" || b >= 900) && k != 13 &&
+              k != 26;
+     }},
+    {"NOT (a = 1 OR NOT (b < 200))",
+     [](auto a, auto b, auto, auto &) { return a != 1 && b < 200; }},
+    {"a = 1 AND a = 2", [](auto, auto, auto, auto &) { return false; }},
+};
+
+std::vector<int64_t> expected(int64_t n, const Case &c,
+                              const std::function<bool(int64_t)> &live) {
+  std::vector<int64_t> out;
+  for (int64_t k = 0; k < n; ++k) {
+    if (live(k) && c.keep(a_of(k), b_of(k), k, s_of(k)))
+      out.push_back(k);
+  }
+  return out;
+}
+} // namespace
+
+TEST_CASE("Compound WHERE clauses", "[where]") {
+  Database db;
+  const int64_t n = 6000;
+  fill(db, n);
+  auto all = [](int64_t) { return true; };
+
+  SECTION("Serial scans") {
+    for (const Case &c : kCases) {
+      INFO(c.where);
+      auto r = run(db, std::string("SELECT k FROM t WHERE ") + c.where);
+      CHECK(keys(r) == expected(n, c, all));
+    }
+  }
+
+  SECTION("Indexes answer comparisons, IN lists and AND operands") {
+    run(db, "CREATE INDEX t_a ON t (a)");
+    run(db, "CREATE INDEX t_b ON t (b) USING BTREE");
+    run(db, "DELETE FROM t WHERE k = 1");
+    auto live = [](int64_t k) { return k != 1; };
+    for (const Case &c : kCases) {
+      INFO(c.where);
+      auto r = run(db, std::string("SELECT k FROM t WHERE ") + c.where);
+      CHECK(keys(r) == expected(n, c, live));
+    }
+  }
+
+  SECTION("Aggregates, GROUP BY, UPDATE and DELETE") {
+    const Case &c = kCases[3];
+    auto rows = expected(n, c, all);
+    auto count = run(db, std::string("SELECT COUNT(*) FROM t WHERE ") +
+                             c.where);
+    CHECK(count.cell(0, 0) == std::to_string(rows.size()));
+    auto groups = run(db, std::string("SELECT a, COUNT(*) FROM t WHERE ") +
+                              c.where + " GROUP BY a");
+    CHECK(groups.row_count() == 3);
+
+    run(db, std::string("UPDATE t SET s = \"hit\" WHERE ") + c.where);
+    CHECK(keys(run(db, "SELECT k FROM t WHERE s = \"hit\"")) == rows);
+    run(db, "DELETE FROM t WHERE s = \"hit\" OR k >= 10");
+    auto kept = std::count_if(rows.begin(), rows.end(),
+                              [](int64_t k) { return k < 10; });
+    CHECK(run(db, "SELECT COUNT(*) FROM t").cell(0, 0) ==
+          std::to_string(10 - kept));
+  }
+
+  SECTION("Prepared placeholders in IN lists and BETWEEN") {
+    auto plan = db.prepare("SELECT k FROM t WHERE a IN (?, ?) AND b BETWEEN "
+                           "? AND ? LIMIT 3");
+    REQUIRE(plan->param_count() == 4);
+    auto r = plan->execute({Value::make_int(1), Value::make_int(7),
+                            Value::make_int(100), Value::make_int(600)});
+    auto rows = expected(n, kCases[3], all);
+    CHECK(keys(*r) == std::vector<int64_t>(rows.begin(), rows.begin() + 3));
+    r = plan->execute({Value::make_int(1), Value::make_int(1),
+                       Value::make_int(600), Value::make_int(100)});
+    CHECK(r->row_count() == 0);
+  }
+
+  SECTION("Type errors") {
+    REQUIRE_THROWS_AS(run(db, "SELECT k FROM t WHERE a IN (1, \"x\")"),
+                      TypeError);
+    REQUIRE_THROWS_AS(
+        run(db, "SELECT k FROM t WHERE a = 1 OR s BETWEEN 1 AND 2"),
+        TypeError);
+    REQUIRE_THROWS_AS(run(db, "SELECT k FROM t WHERE a = 1 AND nope = 2"),
+                      DBError);
+  }
+}
+
+TEST_CASE("Conjuncts are ordered by cost and selectivity", "[where]") {
+  Database db;
+  fill(db, 10);
+  const Table &t = db.table("t");
+  auto bind = [&](const std::string &where) {
+    return *std::get<StmtSelect>(
+                parse_statement("SELECT k FROM t WHERE " + where))
+                .where;
+  };
+
+  auto eq = bind("a = 1");
+  auto range = bind("b < 1");
+  BoundCondition beq(t, eq);
+  BoundCondition brange(t, range);
+  CHECK(beq.selectivity() < brange.selectivity());
+
+  // the equality runs first, so the range is only paid for on its rows
+  auto both = bind("b < 1 AND a = 1");
+  BoundCondition band(t, both);
+  CHECK(band.selectivity() == Approx(beq.selectivity() *
+                                     brange.selectivity()));
+  CHECK(band.cost() == Approx(beq.cost() + beq.selectivity() *
+                                               brange.cost()));
+
+  // OR tries the likelier operand first and skips the rows it accepts
+  auto either = bind("a = 1 OR b < 1");
+  BoundCondition bor(t, either);
+  CHECK(bor.cost() == Approx(brange.cost() + (1 - brange.selectivity()) *
+                                                 beq.cost()));
+
+  // a STR comparison costs more than an INT one of equal selectivity
+  BoundCondition bstr(t, bind("s = \"s1\""));
+  CHECK(bstr.cost() > beq.cost());
+  BoundCondition bmix(t, bind("s = \"s1\" AND a = 1"));
+  CHECK(bmix.cost() == Approx(beq.cost() + beq.selectivity() * bstr.cost()));
+}